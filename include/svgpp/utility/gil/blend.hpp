@@ -9,6 +9,7 @@
 
 #include <svgpp/definitions.hpp>
 #include <svgpp/utility/gil/common.hpp>
+#include <svgpp/utility/gil/simd.hpp>
 #include <boost/gil/channel_algorithm.hpp>
 #include <boost/gil/color_base_algorithm.hpp>
 
@@ -103,6 +104,81 @@ struct blend_alpha_fn<gil::bits8>
   }
 };
 
+// Formulas of the whole row kernels, same as above but with rounded products
+template<class BlendModeTag>
+struct blend_formulas;
+
+struct blend_alpha_formula
+{
+  template<class Ops>
+  static typename Ops::vec alpha(typename Ops::vec alpha_a, typename Ops::vec alpha_b)
+  {
+    return Ops::sub(Ops::set1(255), Ops::mul255(Ops::sub(Ops::set1(255), alpha_a), Ops::sub(Ops::set1(255), alpha_b)));
+  }
+};
+
+template<>
+struct blend_formulas<tag::value::normal>: blend_alpha_formula
+{
+  template<class Ops>
+  static typename Ops::vec color(typename Ops::vec channel_a, typename Ops::vec channel_b, 
+    typename Ops::vec alpha_a, typename Ops::vec alpha_b)
+  {
+    return Ops::add(Ops::mul255(Ops::sub(Ops::set1(255), alpha_a), channel_b), channel_a);
+  }
+};
+
+template<>
+struct blend_formulas<tag::value::multiply>: blend_alpha_formula
+{
+  template<class Ops>
+  static typename Ops::vec color(typename Ops::vec channel_a, typename Ops::vec channel_b, 
+    typename Ops::vec alpha_a, typename Ops::vec alpha_b)
+  {
+    return Ops::add(Ops::add(
+      Ops::mul255(Ops::sub(Ops::set1(255), alpha_a), channel_b), 
+      Ops::mul255(Ops::sub(Ops::set1(255), alpha_b), channel_a)), 
+      Ops::mul255(channel_a, channel_b));
+  }
+};
+
+template<>
+struct blend_formulas<tag::value::screen>: blend_alpha_formula
+{
+  template<class Ops>
+  static typename Ops::vec color(typename Ops::vec channel_a, typename Ops::vec channel_b, 
+    typename Ops::vec alpha_a, typename Ops::vec alpha_b)
+  {
+    return Ops::sub(Ops::add(channel_a, channel_b), Ops::mul255(channel_a, channel_b));
+  }
+};
+
+template<>
+struct blend_formulas<tag::value::darken>: blend_alpha_formula
+{
+  template<class Ops>
+  static typename Ops::vec color(typename Ops::vec channel_a, typename Ops::vec channel_b, 
+    typename Ops::vec alpha_a, typename Ops::vec alpha_b)
+  {
+    return Ops::min(
+      Ops::add(Ops::mul255(Ops::sub(Ops::set1(255), alpha_a), channel_b), channel_a),
+      Ops::add(Ops::mul255(Ops::sub(Ops::set1(255), alpha_b), channel_a), channel_b));
+  }
+};
+
+template<>
+struct blend_formulas<tag::value::lighten>: blend_alpha_formula
+{
+  template<class Ops>
+  static typename Ops::vec color(typename Ops::vec channel_a, typename Ops::vec channel_b, 
+    typename Ops::vec alpha_a, typename Ops::vec alpha_b)
+  {
+    return Ops::max(
+      Ops::add(Ops::mul255(Ops::sub(Ops::set1(255), alpha_a), channel_b), channel_a),
+      Ops::add(Ops::mul255(Ops::sub(Ops::set1(255), alpha_b), channel_a), channel_b));
+  }
+};
+
 } // namespace gil_detail 
 
 namespace gil_utility 
@@ -144,4 +220,14 @@ struct blend_pixel
   }
 };
 
+template<class View1, class View2, class DstView, class BlendModeTag>
+blend_pixel<BlendModeTag> transform_pixels(View1 const & src1, View2 const & src2, DstView const & dst, 
+  blend_pixel<BlendModeTag> fn)
+{
+  gil_detail::transform_pixels_rgba8(src1, src2, dst, 
+    gil_detail::color_alpha_kernel<gil_detail::blend_formulas<BlendModeTag> >(), fn,
+    typename gil_detail::is_rgba8_like_views<View1, View2, DstView>::type());
+  return fn;
+}
+
 }}
@@ -7,53 +7,290 @@
 
 #pragma once
 
+#include <svgpp/utility/gil/simd.hpp>
+#include <algorithm>
 #include <cmath>
+#include <limits>
+#include <boost/cstdint.hpp>
 #include <boost/gil/color_base_algorithm.hpp>
 #include <boost/gil/rgba.hpp>
 #include <boost/multi_array.hpp>
 
-namespace svgpp { namespace gil_utility {
+namespace svgpp { namespace gil_detail {
 
+typedef boost::int32_t color_matrix_fixed_t;
+
+inline int color_matrix_fixed_to_channel(color_matrix_fixed_t v)
+{
+  return v < 0 ? 0 : std::min<color_matrix_fixed_t>(v >> 16, 255);
+}
+
+// Matrix transform of 8 bit channels in 16.16 fixed point. Rows produce Outputs channels from
+// Inputs channels, last column is offset. Shapes are:
+//   <4, 4> - red, green, blue, alpha from red, green, blue, alpha;
+//   <3, 3> - red, green, blue from red, green, blue, alpha is copied;
+//   <3, 1> - alpha from red, green, blue, other channels are zero.
+template<int Inputs, int Outputs>
+class color_matrix_kernel
+{
+public:
+  typedef color_matrix_fixed_t matrix_t[Outputs][Inputs + 1];
+
+  static int input_channel(int j) { return j; }
+  static int output_channel(int i) { return Outputs == 1 ? 3 : i; }
+  // Channel copied from source or -1
+  static int kept_channel() { return Inputs == 3 && Outputs == 3 ? 3 : -1; }
+
+  // 'positions' are offsets of red, green, blue and alpha in pixel
+  color_matrix_kernel(matrix_t const & matrix, int const (&positions)[4])
+    : kept_(kept_channel() < 0 ? -1 : positions[kept_channel()])
+  {
+    for(int j = 0; j < Inputs; ++j)
+      input_[j] = positions[input_channel(j)];
+    for(int i = 0; i < Outputs; ++i)
+    {
+      output_[i] = positions[output_channel(i)];
+      std::copy(matrix[i], matrix[i] + Inputs + 1, matrix_[i]);
+    }
+  }
+
+  template<class Ops>
+  typename Ops::vec apply(typename Ops::vec p) const
+  {
+    typedef typename Ops::vec vec;
+    vec in[Inputs];
+    for(int j = 0; j < Inputs; ++j)
+      in[j] = Ops::get_channel32(p, input_[j]);
+    vec result = kept_ < 0 
+      ? Ops::set1_32(0) 
+      : Ops::and_(p, Ops::set1_32(static_cast<boost::int32_t>(boost::uint32_t(0xff) << (kept_ * 8))));
+    for(int i = 0; i < Outputs; ++i)
+    {
+      vec sum = Ops::set1_32(matrix_[i][Inputs]);
+      for(int j = 0; j < Inputs; ++j)
+        sum = Ops::add32(sum, Ops::mullo32(in[j], Ops::set1_32(matrix_[i][j])));
+      result = Ops::or_(result, Ops::put_channel32(Ops::fixed_to_channel32(sum), output_[i]));
+    }
+    return result;
+  }
+
+  void apply_scalar(boost::uint8_t const * src, boost::uint8_t * dst) const
+  {
+    boost::uint8_t result[4] = { 0, 0, 0, 0 };
+    if (kept_ >= 0)
+      result[kept_] = src[kept_];
+    for(int i = 0; i < Outputs; ++i)
+    {
+      color_matrix_fixed_t sum = matrix_[i][Inputs];
+      for(int j = 0; j < Inputs; ++j)
+        sum += matrix_[i][j] * src[input_[j]];
+      result[output_[i]] = static_cast<boost::uint8_t>(color_matrix_fixed_to_channel(sum));
+    }
+    std::copy(result, result + 4, dst);
+  }
+
+private:
+  int input_[Inputs], output_[Outputs], kept_;
+  matrix_t matrix_;
+};
+
+template<class Color, class Value>
+void set_channel_by_index(Color & color, int index, Value value)
+{
+  namespace gil = boost::gil;
+  switch(index)
+  {
+  case 0: gil::get_color(color, gil::red_t()) = value; break;
+  case 1: gil::get_color(color, gil::green_t()) = value; break;
+  case 2: gil::get_color(color, gil::blue_t()) = value; break;
+  default: gil::get_color(color, gil::alpha_t()) = value; break;
+  }
+}
+
+template<class Color, class Scalar, int Inputs, int Outputs>
+class color_matrix_transform_base
+{
+public:
+  typedef color_matrix_kernel<Inputs, Outputs> kernel_type;
+  typedef typename boost::gil::channel_type<Color>::type channel_t;
+
+  Color operator()(Color const & color) const 
+  {
+    namespace gil = boost::gil;
+    Color result;
+    gil::static_fill(result, channel_t());
+    if (kernel_type::kept_channel() >= 0)
+      set_channel_by_index(result, kernel_type::kept_channel(), gil::get_color(color, gil::alpha_t()));
+    channel_t const in[4] = {
+      gil::get_color(color, gil::red_t()),
+      gil::get_color(color, gil::green_t()),
+      gil::get_color(color, gil::blue_t()),
+      gil::get_color(color, gil::alpha_t()) };
+    for(int i = 0; i < Outputs; ++i)
+    {
+      if (fixed_point_)
+      {
+        color_matrix_fixed_t sum = fixed_[i][Inputs];
+        for(int j = 0; j < Inputs; ++j)
+          sum += fixed_[i][j] * static_cast<int>(in[kernel_type::input_channel(j)]);
+        set_channel_by_index(result, kernel_type::output_channel(i), 
+          static_cast<channel_t>(color_matrix_fixed_to_channel(sum)));
+      }
+      else
+      {
+        Scalar const max_value = gil::channel_traits<channel_t>::max_value();
+        Scalar sum = matrix_[i][Inputs] * max_value;
+        for(int j = 0; j < Inputs; ++j)
+          sum += matrix_[i][j] * static_cast<Scalar>(in[kernel_type::input_channel(j)]);
+        if (std::numeric_limits<channel_t>::is_integer)
+          sum = std::floor(sum + Scalar(0.5));
+        set_channel_by_index(result, kernel_type::output_channel(i), 
+          static_cast<channel_t>(std::min(max_value, std::max(Scalar(0), sum))));
+      }
+    }
+    return result;
+  }
+
+  // Fixed point is used for 8 bit channels unless coefficients are too large for 32 bit sums
+  bool fixed_point() const { return fixed_point_; }
+
+  kernel_type kernel(int const (&positions)[4]) const { return kernel_type(fixed_, positions); }
+
+protected:
+  // 'matrix' is indexed as matrix[i][j], it has Outputs rows and Inputs + 1 or Inputs columns,
+  // offsets in the last column are in 0..1 range
+  template<class Matrix>
+  void assign(Matrix const & matrix, bool with_offset)
+  {
+    static Scalar const max_coefficient = 16;
+    fixed_point_ = boost::is_same<channel_t, boost::gil::bits8>::value;
+    for(int i = 0; i < Outputs; ++i)
+      for(int j = 0; j <= Inputs; ++j)
+      {
+        matrix_[i][j] = j < Inputs || with_offset ? static_cast<Scalar>(matrix[i][j]) : Scalar(0);
+        if (std::abs(matrix_[i][j]) > max_coefficient)
+          fixed_point_ = false;
+        fixed_[i][j] = static_cast<color_matrix_fixed_t>(std::floor(
+          (j < Inputs ? matrix_[i][j] : matrix_[i][j] * 255) * 65536 + Scalar(0.5)));
+      }
+    // Rounding of the result
+    for(int i = 0; i < Outputs; ++i)
+      fixed_[i][Inputs] += 1 << 15;
+  }
+
+private:
+  Scalar matrix_[Outputs][Inputs + 1];
+  typename kernel_type::matrix_t fixed_;
+  bool fixed_point_;
+};
+
+template<class SrcView, class DstView, class Transform>
+void transform_pixels_color_matrix(SrcView const & src, DstView const & dst, Transform const & fn, boost::mpl::true_)
+{
+  if (!fn.fixed_point())
+  {
+    boost::gil::transform_pixels(src, dst, fn);
+    return;
+  }
+  int positions[4];
+  rgba8_channel_positions<typename DstView::value_type>(positions);
+  typename Transform::kernel_type const kernel = fn.kernel(positions);
+  for(std::ptrdiff_t y = 0; y < dst.height(); ++y)
+    transform_row_rgba8(kernel,
+      reinterpret_cast<boost::uint8_t const *>(&*src.row_begin(y)),
+      reinterpret_cast<boost::uint8_t *>(&*dst.row_begin(y)),
+      dst.width());
+}
+
+template<class SrcView, class DstView, class Transform>
+void transform_pixels_color_matrix(SrcView const & src, DstView const & dst, Transform const & fn, boost::mpl::false_)
+{
+  boost::gil::transform_pixels(src, dst, fn);
+}
+
+} // namespace gil_detail
+
+namespace gil_utility {
+
+// General 4x5 matrix. 3x3 matrix is also accepted, color_matrix_3x3_transform handles it faster
 template<class Color, class Scalar = double>
-class color_matrix_transform
+class color_matrix_transform: public gil_detail::color_matrix_transform_base<Color, Scalar, 4, 4>
 {
 public:
   typedef boost::multi_array<Scalar, 2> matrix_t;
 
   color_matrix_transform(matrix_t const & matrix)
-    : matrix_(matrix)
   {
     if (matrix.shape()[0] == 3 && matrix.shape()[1] == 3)
     {
-      // TODO make specialization for 3x3 matrix
-      matrix_.resize(boost::extents[4][5]);
-      matrix_[3][3] = 1;
+      matrix_t m(boost::extents[4][5]);
+      for(int i = 0; i < 3; ++i)
+        for(int j = 0; j < 3; ++j)
+          m[i][j] = matrix[i][j];
+      m[3][3] = 1;
+      this->assign(m, true);
     }
     else
+    {
       BOOST_ASSERT(matrix.shape()[0] == 4 && matrix.shape()[1] == 5);
+      this->assign(matrix, true);
+    }
   }
+};
 
-  Color operator()(const Color & color) const 
+// 3x3 matrix for saturate and hueRotate, alpha is left unchanged
+template<class Color, class Scalar = double>
+class color_matrix_3x3_transform: public gil_detail::color_matrix_transform_base<Color, Scalar, 3, 3>
+{
+public:
+  typedef boost::multi_array<Scalar, 2> matrix_t;
+
+  color_matrix_3x3_transform(matrix_t const & matrix)
   {
-    // TODO integer optimization
-    namespace gil = boost::gil;
-    Color result;
-    typename gil::color_element_type<Color, gil::red_t>::type 
-      r = gil::get_color(color, gil::red_t()),
-      g = gil::get_color(color, gil::green_t()),
-      b = gil::get_color(color, gil::blue_t()),
-      a = gil::get_color(color, gil::alpha_t());
-    gil::get_color(result, gil::red_t())    = matrix_[0][0] * r + matrix_[0][1] * g + matrix_[0][2] * b + matrix_[0][3] * a + matrix_[0][4];
-    gil::get_color(result, gil::green_t())  = matrix_[1][0] * r + matrix_[1][1] * g + matrix_[1][2] * b + matrix_[1][3] * a + matrix_[1][4];
-    gil::get_color(result, gil::blue_t())   = matrix_[2][0] * r + matrix_[2][1] * g + matrix_[2][2] * b + matrix_[2][3] * a + matrix_[2][4];
-    gil::get_color(result, gil::alpha_t())  = matrix_[3][0] * r + matrix_[3][1] * g + matrix_[3][2] * b + matrix_[3][3] * a + matrix_[3][4];
-    return result;
+    BOOST_ASSERT(matrix.shape()[0] == 3 && matrix.shape()[1] == 3);
+    this->assign(matrix, false);
   }
+};
 
-private:
-  matrix_t matrix_;
+// feColorMatrix type="luminanceToAlpha"
+template<class Color, class Scalar = double>
+class luminance_to_alpha_transform: public gil_detail::color_matrix_transform_base<Color, Scalar, 3, 1>
+{
+public:
+  luminance_to_alpha_transform()
+  {
+    Scalar const m[1][3] = { { Scalar(0.2125), Scalar(0.7154), Scalar(0.0721) } };
+    this->assign(m, false);
+  }
 };
 
+template<class SrcView, class DstView, class Color, class Scalar>
+color_matrix_transform<Color, Scalar> transform_pixels(SrcView const & src, DstView const & dst, 
+  color_matrix_transform<Color, Scalar> fn)
+{
+  gil_detail::transform_pixels_color_matrix(src, dst, fn, 
+    typename gil_detail::is_rgba8_like_view_pair<SrcView, DstView>::type());
+  return fn;
+}
+
+template<class SrcView, class DstView, class Color, class Scalar>
+color_matrix_3x3_transform<Color, Scalar> transform_pixels(SrcView const & src, DstView const & dst, 
+  color_matrix_3x3_transform<Color, Scalar> fn)
+{
+  gil_detail::transform_pixels_color_matrix(src, dst, fn, 
+    typename gil_detail::is_rgba8_like_view_pair<SrcView, DstView>::type());
+  return fn;
+}
+
+template<class SrcView, class DstView, class Color, class Scalar>
+luminance_to_alpha_transform<Color, Scalar> transform_pixels(SrcView const & src, DstView const & dst, 
+  luminance_to_alpha_transform<Color, Scalar> fn)
+{
+  gil_detail::transform_pixels_color_matrix(src, dst, fn, 
+    typename gil_detail::is_rgba8_like_view_pair<SrcView, DstView>::type());
+  return fn;
+}
+
 // A saturate operation is equivalent to the following matrix operation:
 // | R' |     |0.213+0.787s  0.715-0.715s  0.072-0.072s 0  0 |   | R |
 // | G' |     |0.213-0.213s  0.715+0.285s  0.072-0.072s 0  0 |   | G |
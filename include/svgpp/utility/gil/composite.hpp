@@ -9,6 +9,7 @@
 
 #include <svgpp/definitions.hpp>
 #include <svgpp/utility/gil/common.hpp>
+#include <svgpp/utility/gil/simd.hpp>
 #include <boost/gil/channel_algorithm.hpp>
 #include <boost/gil/color_base_algorithm.hpp>
 
@@ -91,7 +92,7 @@ struct composite_channel_fn<tag::value::out, gil::bits8>
 {
   gil::bits8 operator()(int channel_a, int channel_b, int alpha_a, int alpha_b) const
   {
-    return channel_a * alpha_a * (255 - alpha_b) / 65535;
+    return channel_a * (255 - alpha_b) / 255;
   }
 };
 
@@ -111,7 +112,7 @@ struct composite_channel_fn<tag::value::atop, gil::bits8>
 {
   gil::bits8 operator()(int channel_a, int channel_b, int alpha_a, int alpha_b) const
   {
-    return (channel_a * alpha_a + channel_b * (255 - alpha_a)) * alpha_b / 65535;
+    return clamp_channel_bits8((channel_a * alpha_b + channel_b * (255 - alpha_a)) / 255);
   }
 };
 
@@ -131,7 +132,7 @@ struct composite_channel_fn<tag::value::xor_, gil::bits8>
 {
   gil::bits8 operator()(int channel_a, int channel_b, int alpha_a, int alpha_b) const
   {
-    return clamp_channel_bits8((channel_a * alpha_a * (255 - alpha_b) + channel_b * alpha_b * (255 - alpha_a)) / 65535);
+    return clamp_channel_bits8((channel_a * (255 - alpha_b) + channel_b * (255 - alpha_a)) / 255);
   }
 };
 
@@ -141,7 +142,7 @@ struct composite_alpha_fn<tag::value::xor_, gil::bits8>
 {
   gil::bits8 operator()(int alpha_a, int alpha_b) const
   {
-    return clamp_channel_bits8((alpha_a + alpha_b - 2 * alpha_a * alpha_b) / 255);
+    return clamp_channel_bits8(alpha_a + alpha_b - 2 * alpha_a * alpha_b / 255);
   }
 };
 
@@ -163,6 +164,98 @@ private:
   int k1_, k2_, k3_, k4_;
 };
 
+// Formulas of the whole row kernels, same as above but with rounded products
+template<class CompositeModeTag>
+struct composite_formulas;
+
+template<>
+struct composite_formulas<tag::value::over>
+{
+  template<class Ops>
+  static typename Ops::vec color(typename Ops::vec channel_a, typename Ops::vec channel_b, 
+    typename Ops::vec alpha_a, typename Ops::vec alpha_b)
+  {
+    return Ops::add(channel_a, Ops::mul255(channel_b, Ops::sub(Ops::set1(255), alpha_a)));
+  }
+
+  template<class Ops>
+  static typename Ops::vec alpha(typename Ops::vec alpha_a, typename Ops::vec alpha_b)
+  {
+    return Ops::sub(Ops::add(alpha_a, alpha_b), Ops::mul255(alpha_a, alpha_b));
+  }
+};
+
+template<>
+struct composite_formulas<tag::value::in>
+{
+  template<class Ops>
+  static typename Ops::vec color(typename Ops::vec channel_a, typename Ops::vec channel_b, 
+    typename Ops::vec alpha_a, typename Ops::vec alpha_b)
+  {
+    return Ops::mul255(channel_a, alpha_b);
+  }
+
+  template<class Ops>
+  static typename Ops::vec alpha(typename Ops::vec alpha_a, typename Ops::vec alpha_b)
+  {
+    return Ops::mul255(alpha_a, alpha_b);
+  }
+};
+
+template<>
+struct composite_formulas<tag::value::out>
+{
+  template<class Ops>
+  static typename Ops::vec color(typename Ops::vec channel_a, typename Ops::vec channel_b, 
+    typename Ops::vec alpha_a, typename Ops::vec alpha_b)
+  {
+    return Ops::mul255(channel_a, Ops::sub(Ops::set1(255), alpha_b));
+  }
+
+  template<class Ops>
+  static typename Ops::vec alpha(typename Ops::vec alpha_a, typename Ops::vec alpha_b)
+  {
+    return Ops::mul255(alpha_a, Ops::sub(Ops::set1(255), alpha_b));
+  }
+};
+
+template<>
+struct composite_formulas<tag::value::atop>
+{
+  template<class Ops>
+  static typename Ops::vec color(typename Ops::vec channel_a, typename Ops::vec channel_b, 
+    typename Ops::vec alpha_a, typename Ops::vec alpha_b)
+  {
+    return Ops::add(Ops::mul255(channel_a, alpha_b), Ops::mul255(channel_b, Ops::sub(Ops::set1(255), alpha_a)));
+  }
+
+  template<class Ops>
+  static typename Ops::vec alpha(typename Ops::vec alpha_a, typename Ops::vec alpha_b)
+  {
+    return alpha_b;
+  }
+};
+
+template<>
+struct composite_formulas<tag::value::xor_>
+{
+  template<class Ops>
+  static typename Ops::vec color(typename Ops::vec channel_a, typename Ops::vec channel_b, 
+    typename Ops::vec alpha_a, typename Ops::vec alpha_b)
+  {
+    return Ops::add(
+      Ops::mul255(channel_a, Ops::sub(Ops::set1(255), alpha_b)), 
+      Ops::mul255(channel_b, Ops::sub(Ops::set1(255), alpha_a)));
+  }
+
+  template<class Ops>
+  static typename Ops::vec alpha(typename Ops::vec alpha_a, typename Ops::vec alpha_b)
+  {
+    typename Ops::vec const product = Ops::mul255(alpha_a, alpha_b);
+    return Ops::sub(Ops::sub(Ops::add(alpha_a, alpha_b), product), product);
+  }
+};
+
 } // namespace gil_detail 
 
 namespace gil_utility 
@@ -213,8 +306,11 @@ struct composite_pixel_arithmetic
     , g_(k1, k2, k3, k4)
     , b_(k1, k2, k3, k4)
     , a_(k1, k2, k3, k4)
+    , kernel_(k1, k2, k3, k4)
   {}
 
+  gil_detail::arithmetic_kernel const & kernel() const { return kernel_; }
+
   Color operator()(const Color & pixa, const Color & pixb) const 
   {
     Color result;
@@ -230,6 +326,26 @@ private:
   gil_detail::composite_arithmetic_channel_fn<typename gil::color_element_type<Color, gil::green_t>::type> g_;
   gil_detail::composite_arithmetic_channel_fn<typename gil::color_element_type<Color, gil::blue_t >::type> b_;
   gil_detail::composite_arithmetic_channel_fn<typename gil::color_element_type<Color, gil::alpha_t>::type> a_;
+  gil_detail::arithmetic_kernel kernel_;
 };
 
+template<class View1, class View2, class DstView, class CompositeModeTag>
+composite_pixel<CompositeModeTag> transform_pixels(View1 const & src1, View2 const & src2, DstView const & dst, 
+  composite_pixel<CompositeModeTag> fn)
+{
+  gil_detail::transform_pixels_rgba8(src1, src2, dst, 
+    gil_detail::color_alpha_kernel<gil_detail::composite_formulas<CompositeModeTag> >(), fn,
+    typename gil_detail::is_rgba8_like_views<View1, View2, DstView>::type());
+  return fn;
+}
+
+template<class View1, class View2, class DstView, class Color>
+composite_pixel_arithmetic<Color> transform_pixels(View1 const & src1, View2 const & src2, DstView const & dst, 
+  composite_pixel_arithmetic<Color> fn)
+{
+  gil_detail::transform_pixels_rgba8(src1, src2, dst, fn.kernel(), fn,
+    typename gil_detail::is_rgba8_like_views<View1, View2, DstView>::type());
+  return fn;
+}
+
 }}
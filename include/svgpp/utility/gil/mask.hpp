@@ -7,11 +7,14 @@
 
 #pragma once
 
+#include <svgpp/utility/gil/simd.hpp>
 #include <boost/cstdint.hpp>
 #include <boost/gil/channel_algorithm.hpp>
 #include <boost/gil/gray.hpp>
 #include <boost/gil/rgb.hpp>
 #include <boost/gil/rgba.hpp>
+#include <boost/mpl/int.hpp>
+#include <boost/mpl/or.hpp>
 
 namespace svgpp 
 { 
@@ -56,6 +59,199 @@ inline typename boost::gil::channel_traits<GrayChannel>::value_type rgb_to_lumin
                               typename boost::gil::channel_traits<GrayChannel>::value_type>()(red,green,blue);
 }
 
+// Mask value is luminance of mask pixel multiplied by its alpha, computed exactly as
+// rgba_to_mask_color_converter does for 8 bit channels
+struct luminance_mask_value
+{
+  // 'positions' are offsets of red, green, blue and alpha in mask pixel
+  explicit luminance_mask_value(int const (&positions)[4])
+  {
+    std::copy(positions, positions + 4, positions_);
+  }
+
+  template<class Ops>
+  typename Ops::vec get(typename Ops::vec mask) const
+  {
+    typename Ops::vec const luminance = Ops::shift_right32(Ops::add32(Ops::add32(
+      Ops::mul16_32(Ops::get_channel32(mask, positions_[0]), Ops::set1_32(red_weight)),
+      Ops::mul16_32(Ops::get_channel32(mask, positions_[1]), Ops::set1_32(green_weight))),
+      Ops::mul16_32(Ops::get_channel32(mask, positions_[2]), Ops::set1_32(blue_weight))), 14);
+    return Ops::mul255(luminance, Ops::get_channel32(mask, positions_[3]));
+  }
+
+  int get_scalar(boost::uint8_t const * mask) const
+  {
+    int const luminance = (mask[positions_[0]] * red_weight + mask[positions_[1]] * green_weight 
+      + mask[positions_[2]] * blue_weight) >> 14;
+    return scalar_ops::mul255(luminance, mask[positions_[3]]);
+  }
+
+private:
+  static const int red_weight = static_cast<int>(0.2125 * (1 << 14));
+  static const int green_weight = static_cast<int>(0.7154 * (1 << 14));
+  static const int blue_weight = static_cast<int>(0.0721 * (1 << 14));
+
+  int positions_[4];
+};
+
+// Mask value is single channel of mask pixel
+struct channel_mask_value
+{
+  explicit channel_mask_value(int position)
+    : position_(position)
+  {}
+
+  template<class Ops>
+  typename Ops::vec get(typename Ops::vec mask) const
+  {
+    return Ops::get_channel32(mask, position_);
+  }
+
+  int get_scalar(boost::uint8_t const * mask) const
+  {
+    return mask[position_];
+  }
+
+private:
+  int position_;
+};
+
+// Mask pixels of 1 byte are loaded to separate lanes, of 4 bytes - as whole pixels
+template<class Ops, int MaskBytes>
+struct mask_loader
+{
+  static typename Ops::vec load(boost::uint8_t const * mask) { return Ops::load(mask); }
+};
+
+template<class Ops>
+struct mask_loader<Ops, 1>
+{
+  static typename Ops::vec load(boost::uint8_t const * mask) { return Ops::load_bytes32(mask); }
+};
+
+template<class Ops>
+typename Ops::vec multiply_alpha32(typename Ops::vec target, typename Ops::vec mask_value, int alpha_position)
+{
+  typename Ops::vec const alpha = Ops::mul255(Ops::get_channel32(target, alpha_position), mask_value);
+  return Ops::or_(
+    Ops::and_(target, Ops::set1_32(~static_cast<boost::int32_t>(boost::uint32_t(0xff) << (alpha_position * 8)))),
+    Ops::put_channel32(alpha, alpha_position));
+}
+
+// Multiplies alpha of 'count' 4 byte target pixels by mask values in one pass
+template<int MaskBytes, class MaskValue>
+void apply_mask_row_rgba8(MaskValue const & mask_value, int alpha_position, 
+  boost::uint8_t * target, boost::uint8_t const * mask, std::ptrdiff_t count)
+{
+#if defined(SVGPP_GIL_AVX2)
+  for(; count >= 8; count -= 8, target += 32, mask += 8 * MaskBytes)
+    avx2_ops::store(target, multiply_alpha32<avx2_ops>(avx2_ops::load(target), 
+      mask_value.template get<avx2_ops>(mask_loader<avx2_ops, MaskBytes>::load(mask)), alpha_position));
+#endif
+#if defined(SVGPP_GIL_SSE2)
+  for(; count >= 4; count -= 4, target += 16, mask += 4 * MaskBytes)
+    sse2_ops::store(target, multiply_alpha32<sse2_ops>(sse2_ops::load(target), 
+      mask_value.template get<sse2_ops>(mask_loader<sse2_ops, MaskBytes>::load(mask)), alpha_position));
+#endif
+  for(; count > 0; --count, target += 4, mask += MaskBytes)
+    target[alpha_position] = static_cast<boost::uint8_t>(
+      scalar_ops::mul255(target[alpha_position], mask_value.get_scalar(mask)));
+}
+
+template<class DstView, class MaskView, class MaskValue>
+void apply_mask_rgba8(DstView const & dst, MaskView const & mask, MaskValue const & mask_value)
+{
+  BOOST_ASSERT(dst.dimensions() == mask.dimensions());
+  int positions[4];
+  rgba8_channel_positions<typename DstView::value_type>(positions);
+  for(std::ptrdiff_t y = 0; y < dst.height(); ++y)
+    apply_mask_row_rgba8<boost::gil::num_channels<MaskView>::value>(mask_value, positions[3],
+      reinterpret_cast<boost::uint8_t *>(&*dst.row_begin(y)),
+      reinterpret_cast<boost::uint8_t const *>(&*mask.row_begin(y)),
+      dst.width());
+}
+
+// Row kernels are used for interleaved 8 bit target with 4 channels and 8 bit mask 
+// with 'MaskChannels' channels
+template<class DstView, class MaskView, int MaskChannels>
+struct is_rgba8_mask_views: boost::mpl::and_<
+  boost::is_pointer<typename DstView::x_iterator>,
+  boost::is_pointer<typename MaskView::x_iterator>,
+  boost::mpl::bool_<boost::gil::num_channels<DstView>::value == 4 
+    && boost::gil::num_channels<MaskView>::value == MaskChannels>,
+  boost::is_same<typename boost::gil::channel_type<DstView>::type, boost::gil::bits8>,
+  boost::is_same<typename boost::gil::channel_type<MaskView>::type, boost::gil::bits8>
+>
+{};
+
+template<class Pixel>
+typename boost::gil::channel_type<Pixel>::type mask_pixel_alpha(Pixel const & p, boost::mpl::int_<1>)
+{
+  return boost::gil::semantic_at_c<0>(p);
+}
+
+template<class Pixel>
+typename boost::gil::channel_type<Pixel>::type mask_pixel_alpha(Pixel const & p, boost::mpl::int_<4>)
+{
+  return boost::gil::get_color(p, boost::gil::alpha_t());
+}
+
+template<class DstView, class MaskView>
+void apply_alpha_mask(DstView const & dst, MaskView const & mask, boost::mpl::false_)
+{
+  using namespace boost::gil;
+  BOOST_ASSERT(dst.dimensions() == mask.dimensions());
+  typename MaskView::iterator m = mask.begin();
+  for(typename DstView::iterator o = dst.begin(); o != dst.end(); ++o, ++m)
+    get_color(*o, alpha_t()) = channel_multiply(get_color(*o, alpha_t()), 
+      channel_convert<typename color_element_type<typename DstView::value_type, alpha_t>::type>(
+        mask_pixel_alpha(*m, boost::mpl::int_<num_channels<MaskView>::value>())));
+}
+
+template<class Pixel>
+int mask_alpha_position(boost::mpl::int_<1>)
+{
+  return 0;
+}
+
+template<class Pixel>
+int mask_alpha_position(boost::mpl::int_<4>)
+{
+  int positions[4];
+  rgba8_channel_positions<Pixel>(positions);
+  return positions[3];
+}
+
+template<class DstView, class MaskView>
+void apply_alpha_mask(DstView const & dst, MaskView const & mask, boost::mpl::true_)
+{
+  apply_mask_rgba8(dst, mask, channel_mask_value(mask_alpha_position<typename MaskView::value_type>(
+    boost::mpl::int_<boost::gil::num_channels<MaskView>::value>())));
+}
+
+template<class DstView, class MaskView>
+void apply_luminance_mask(DstView const & dst, MaskView const & mask, boost::mpl::false_)
+{
+  using namespace boost::gil;
+  typedef typename color_element_type<typename MaskView::value_type, alpha_t>::type mask_channel_t;
+  BOOST_ASSERT(dst.dimensions() == mask.dimensions());
+  typename MaskView::iterator m = mask.begin();
+  for(typename DstView::iterator o = dst.begin(); o != dst.end(); ++o, ++m)
+    get_color(*o, alpha_t()) = channel_multiply(get_color(*o, alpha_t()), 
+      channel_convert<typename color_element_type<typename DstView::value_type, alpha_t>::type>(
+        channel_multiply(
+          rgb_to_luminance<mask_channel_t>(get_color(*m, red_t()), get_color(*m, green_t()), get_color(*m, blue_t())),
+          get_color(*m, alpha_t()))));
+}
+
+template<class DstView, class MaskView>
+void apply_luminance_mask(DstView const & dst, MaskView const & mask, boost::mpl::true_)
+{
+  int positions[4];
+  rgba8_channel_positions<typename MaskView::value_type>(positions);
+  apply_mask_rgba8(dst, mask, luminance_mask_value(positions));
+}
+
 }   // namespace gil_detail
 
 namespace gil_utility 
@@ -98,4 +294,25 @@ struct rgba_to_mask_color_converter
   }
 };
 
+// Multiplies alpha of 'dst' by luminance of 'mask' multiplied by its alpha, as 'mask' property does.
+// Same as applying rgba_to_mask_color_converter to 'mask', but interleaved 8 bit views are processed 
+// in one SIMD pass without intermediate gray image
+template<class DstView, class MaskView>
+void apply_luminance_mask(DstView const & dst, MaskView const & mask)
+{
+  gil_detail::apply_luminance_mask(dst, mask, 
+    typename gil_detail::is_rgba8_mask_views<DstView, MaskView, 4>::type());
+}
+
+// Multiplies alpha of 'dst' by value of gray 'mask' or by alpha of RGBA 'mask'
+template<class DstView, class MaskView>
+void apply_alpha_mask(DstView const & dst, MaskView const & mask)
+{
+  gil_detail::apply_alpha_mask(dst, mask, 
+    typename boost::mpl::or_<
+      gil_detail::is_rgba8_mask_views<DstView, MaskView, 1>,
+      gil_detail::is_rgba8_mask_views<DstView, MaskView, 4>
+    >::type());
+}
+
 }}
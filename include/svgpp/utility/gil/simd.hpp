@@ -0,0 +1,488 @@
+// Copyright Oleg Maximenko 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+// See http://github.com/svgpp/svgpp for library home page.
+
+#pragma once
+
+#include <svgpp/utility/gil/common.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/gil/algorithm.hpp>
+#include <boost/gil/metafunctions.hpp>
+#include <boost/mpl/and.hpp>
+#include <boost/mpl/bool.hpp>
+#include <boost/type_traits/is_pointer.hpp>
+#include <boost/type_traits/is_same.hpp>
+#include <boost/type_traits/remove_const.hpp>
+#include <algorithm>
+#include <cstring>
+
+// Define SVGPP_GIL_NO_SIMD to use scalar code only
+#if !defined(SVGPP_GIL_NO_SIMD)
+# if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#   define SVGPP_GIL_SSE2
+#   include <emmintrin.h>
+# endif
+# if defined(__SSE4_1__)
+#   include <smmintrin.h>
+# endif
+# if defined(__AVX2__)
+#   define SVGPP_GIL_AVX2
+#   include <immintrin.h>
+# endif
+#endif
+
+namespace svgpp
+{
+
+namespace gil_detail
+{
+
+namespace gil = boost::gil;
+
+// Pixel kernels are written once against these operation sets. Values are non-negative
+// 8 bit channels widened to 16 bit lanes, results are clamped to 0..255 when packed back.
+// mul255(a, b) = (a * b + 127) / 255, i.e. product of two channels, rounded. It also works for
+// 32 bit lanes holding 0..255 values. Operations with '32' suffix work on 32 bit lanes holding
+// whole pixels or single values
+struct scalar_ops
+{
+  typedef int vec;
+
+  static vec set1(int v) { return v; }
+  static vec add(vec a, vec b) { return a + b; }
+  static vec sub(vec a, vec b) { return a - b; }
+  static vec min(vec a, vec b) { return std::min(a, b); }
+  static vec max(vec a, vec b) { return std::max(a, b); }
+  static vec mul255(vec a, vec b) { return (a * b + 127) / 255; }
+
+  // k1 * a * b / 255 + k2 * a + k3 * b + k4 with coefficients already scaled
+  static vec arithmetic(vec a, vec b, float k1, float k2, float k3, float k4)
+  {
+    float const r = k1 * float(a * b) + k2 * float(a) + k3 * float(b) + k4 + 0.5f;
+    // Truncation differs from floor only for negative values that are clamped anyway
+    return r > 255.f ? 255 : r < 0.f ? 0 : static_cast<int>(r);
+  }
+};
+
+#if defined(SVGPP_GIL_SSE2)
+struct sse2_ops
+{
+  typedef __m128i vec;
+
+  static vec set1(int v) { return _mm_set1_epi16(static_cast<short>(v)); }
+  static vec add(vec a, vec b) { return _mm_add_epi16(a, b); }
+  static vec sub(vec a, vec b) { return _mm_sub_epi16(a, b); }
+  static vec min(vec a, vec b) { return _mm_min_epi16(a, b); }
+  static vec max(vec a, vec b) { return _mm_max_epi16(a, b); }
+
+  static vec mul255(vec a, vec b)
+  {
+    // t / 255 == (t * 0x8081) >> 23 for any 16 bit t
+    vec const t = _mm_add_epi16(_mm_mullo_epi16(a, b), _mm_set1_epi16(127));
+    return _mm_srli_epi16(_mm_mulhi_epu16(t, _mm_set1_epi16(short(0x8081))), 7);
+  }
+
+  static vec arithmetic(vec a, vec b, float k1, float k2, float k3, float k4)
+  {
+    vec const zero = _mm_setzero_si128();
+    return _mm_packs_epi32(
+      arithmetic_half(_mm_unpacklo_epi16(a, zero), _mm_unpacklo_epi16(b, zero), k1, k2, k3, k4),
+      arithmetic_half(_mm_unpackhi_epi16(a, zero), _mm_unpackhi_epi16(b, zero), k1, k2, k3, k4));
+  }
+
+  template<int AlphaIndex>
+  static vec broadcast_alpha(vec v)
+  {
+    return _mm_shufflehi_epi16(_mm_shufflelo_epi16(v,
+      _MM_SHUFFLE(AlphaIndex, AlphaIndex, AlphaIndex, AlphaIndex)),
+      _MM_SHUFFLE(AlphaIndex, AlphaIndex, AlphaIndex, AlphaIndex));
+  }
+
+  template<int AlphaIndex>
+  static vec select_alpha(vec color, vec alpha)
+  {
+    vec const mask = _mm_set_epi16(
+      AlphaIndex == 3 ? -1 : 0, AlphaIndex == 2 ? -1 : 0, AlphaIndex == 1 ? -1 : 0, AlphaIndex == 0 ? -1 : 0,
+      AlphaIndex == 3 ? -1 : 0, AlphaIndex == 2 ? -1 : 0, AlphaIndex == 1 ? -1 : 0, AlphaIndex == 0 ? -1 : 0);
+    return _mm_or_si128(_mm_and_si128(mask, alpha), _mm_andnot_si128(mask, color));
+  }
+
+  // Processes 4 pixels
+  template<int AlphaIndex, class Kernel>
+  static void step(Kernel const & kernel, boost::uint8_t const * a, boost::uint8_t const * b, boost::uint8_t * dst)
+  {
+    vec const zero = _mm_setzero_si128();
+    vec const pa = _mm_loadu_si128(reinterpret_cast<vec const *>(a));
+    vec const pb = _mm_loadu_si128(reinterpret_cast<vec const *>(b));
+    vec const lo = kernel.template apply<sse2_ops, AlphaIndex>(_mm_unpacklo_epi8(pa, zero), _mm_unpacklo_epi8(pb, zero));
+    vec const hi = kernel.template apply<sse2_ops, AlphaIndex>(_mm_unpackhi_epi8(pa, zero), _mm_unpackhi_epi8(pb, zero));
+    _mm_storeu_si128(reinterpret_cast<vec *>(dst), _mm_packus_epi16(lo, hi));
+  }
+
+  static vec load(boost::uint8_t const * p) { return _mm_loadu_si128(reinterpret_cast<vec const *>(p)); }
+  static void store(boost::uint8_t * p, vec v) { _mm_storeu_si128(reinterpret_cast<vec *>(p), v); }
+  static vec and_(vec a, vec b) { return _mm_and_si128(a, b); }
+  static vec or_(vec a, vec b) { return _mm_or_si128(a, b); }
+  static vec set1_32(boost::int32_t v) { return _mm_set1_epi32(v); }
+  static vec add32(vec a, vec b) { return _mm_add_epi32(a, b); }
+  static vec sub32(vec a, vec b) { return _mm_sub_epi32(a, b); }
+
+  static vec mullo32(vec a, vec b)
+  {
+#if defined(__SSE4_1__)
+    return _mm_mullo_epi32(a, b);
+#else
+    // Low halves of 64 bit products are the same for signed and unsigned values
+    vec const even = _mm_mul_epu32(a, b);
+    vec const odd = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+    return _mm_unpacklo_epi32(
+      _mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+#endif
+  }
+
+  // Channel at byte 'position' of pixel as 0..255 value and back
+  static vec get_channel32(vec p, int position)
+  {
+    return _mm_and_si128(_mm_srl_epi32(p, _mm_cvtsi32_si128(position * 8)), _mm_set1_epi32(0xff));
+  }
+
+  static vec put_channel32(vec v, int position) { return _mm_sll_epi32(v, _mm_cvtsi32_si128(position * 8)); }
+  static vec shift_right32(vec v, int bits) { return _mm_srl_epi32(v, _mm_cvtsi32_si128(bits)); }
+
+  // Product of lanes holding values less than 32768
+  static vec mul16_32(vec a, vec b) { return _mm_madd_epi16(a, b); }
+
+  // (v * scale + 2^31) >> 32 for unsigned lanes, i.e. product with 0.32 fixed point value, rounded
+  static vec mul_fixed32(vec v, boost::uint32_t scale)
+  {
+    vec const s = _mm_set1_epi32(static_cast<int>(scale));
+    vec const half = _mm_set_epi32(0, static_cast<int>(0x80000000u), 0, static_cast<int>(0x80000000u));
+    vec const even = _mm_srli_epi64(_mm_add_epi64(_mm_mul_epu32(v, s), half), 32);
+    vec const odd = _mm_srli_epi64(_mm_add_epi64(_mm_mul_epu32(_mm_srli_epi64(v, 32), s), half), 32);
+    return _mm_or_si128(even, _mm_slli_epi64(odd, 32));
+  }
+
+  // Minimum of lanes holding values less than 2^31
+  static vec min32(vec a, vec b)
+  {
+    vec const greater = _mm_cmpgt_epi32(a, b);
+    return _mm_or_si128(_mm_and_si128(greater, b), _mm_andnot_si128(greater, a));
+  }
+
+  // Loads 4 16 bit values to separate lanes
+  static vec load_words32(boost::uint16_t const * p)
+  {
+    return _mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<vec const *>(p)), _mm_setzero_si128());
+  }
+
+  // Stores lanes holding 0..65535 values as 4 16 bit values
+  static void store_words32(boost::uint16_t * p, vec v)
+  {
+    // Biased to signed range, as SSE2 has signed saturating pack only
+    vec const packed = _mm_packs_epi32(_mm_sub_epi32(v, _mm_set1_epi32(32768)), _mm_setzero_si128());
+    _mm_storel_epi64(reinterpret_cast<vec *>(p), _mm_add_epi16(packed, _mm_set1_epi16(short(-32768))));
+  }
+
+  // Loads 4 bytes to separate lanes
+  static vec load_bytes32(boost::uint8_t const * p)
+  {
+    boost::int32_t bytes;
+    std::memcpy(&bytes, p, 4);
+    vec const zero = _mm_setzero_si128();
+    return _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero), zero);
+  }
+
+  // 16.16 fixed point value truncated and clamped to 0..255
+  static vec fixed_to_channel32(vec v)
+  {
+    v = _mm_srli_epi32(_mm_andnot_si128(_mm_srai_epi32(v, 31), v), 16);
+    vec const over = _mm_cmpgt_epi32(v, _mm_set1_epi32(255));
+    return _mm_or_si128(_mm_andnot_si128(over, v), _mm_and_si128(over, _mm_set1_epi32(255)));
+  }
+
+private:
+  static __m128i arithmetic_half(__m128i a, __m128i b, float k1, float k2, float k3, float k4)
+  {
+    __m128 const fa = _mm_cvtepi32_ps(a), fb = _mm_cvtepi32_ps(b);
+    __m128 r = _mm_mul_ps(_mm_set1_ps(k1), _mm_mul_ps(fa, fb));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(k2), fa));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(k3), fb));
+    r = _mm_add_ps(r, _mm_set1_ps(k4));
+    r = _mm_add_ps(r, _mm_set1_ps(0.5f));
+    // Clamped to 0..255 before conversion, so that large values don't overflow 16 bit lanes
+    r = _mm_min_ps(_mm_max_ps(r, _mm_setzero_ps()), _mm_set1_ps(255.f));
+    return _mm_cvttps_epi32(r);
+  }
+};
+#endif
+
+#if defined(SVGPP_GIL_AVX2)
+struct avx2_ops
+{
+  typedef __m256i vec;
+
+  static vec set1(int v) { return _mm256_set1_epi16(static_cast<short>(v)); }
+  static vec add(vec a, vec b) { return _mm256_add_epi16(a, b); }
+  static vec sub(vec a, vec b) { return _mm256_sub_epi16(a, b); }
+  static vec min(vec a, vec b) { return _mm256_min_epi16(a, b); }
+  static vec max(vec a, vec b) { return _mm256_max_epi16(a, b); }
+
+  static vec mul255(vec a, vec b)
+  {
+    vec const t = _mm256_add_epi16(_mm256_mullo_epi16(a, b), _mm256_set1_epi16(127));
+    return _mm256_srli_epi16(_mm256_mulhi_epu16(t, _mm256_set1_epi16(short(0x8081))), 7);
+  }
+
+  static vec arithmetic(vec a, vec b, float k1, float k2, float k3, float k4)
+  {
+    vec const zero = _mm256_setzero_si256();
+    return _mm256_packs_epi32(
+      arithmetic_half(_mm256_unpacklo_epi16(a, zero), _mm256_unpacklo_epi16(b, zero), k1, k2, k3, k4),
+      arithmetic_half(_mm256_unpackhi_epi16(a, zero), _mm256_unpackhi_epi16(b, zero), k1, k2, k3, k4));
+  }
+
+  template<int AlphaIndex>
+  static vec broadcast_alpha(vec v)
+  {
+    return _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(v,
+      _MM_SHUFFLE(AlphaIndex, AlphaIndex, AlphaIndex, AlphaIndex)),
+      _MM_SHUFFLE(AlphaIndex, AlphaIndex, AlphaIndex, AlphaIndex));
+  }
+
+  template<int AlphaIndex>
+  static vec select_alpha(vec color, vec alpha)
+  {
+    return _mm256_blend_epi16(color, alpha, (1 << AlphaIndex) | (1 << (AlphaIndex + 4)));
+  }
+
+  // Processes 8 pixels. Unpacking and packing work inside of 128 bit lanes, so pixel order is preserved
+  template<int AlphaIndex, class Kernel>
+  static void step(Kernel const & kernel, boost::uint8_t const * a, boost::uint8_t const * b, boost::uint8_t * dst)
+  {
+    vec const zero = _mm256_setzero_si256();
+    vec const pa = _mm256_loadu_si256(reinterpret_cast<vec const *>(a));
+    vec const pb = _mm256_loadu_si256(reinterpret_cast<vec const *>(b));
+    vec const lo = kernel.template apply<avx2_ops, AlphaIndex>(_mm256_unpacklo_epi8(pa, zero), _mm256_unpacklo_epi8(pb, zero));
+    vec const hi = kernel.template apply<avx2_ops, AlphaIndex>(_mm256_unpackhi_epi8(pa, zero), _mm256_unpackhi_epi8(pb, zero));
+    _mm256_storeu_si256(reinterpret_cast<vec *>(dst), _mm256_packus_epi16(lo, hi));
+  }
+
+  static vec load(boost::uint8_t const * p) { return _mm256_loadu_si256(reinterpret_cast<vec const *>(p)); }
+  static void store(boost::uint8_t * p, vec v) { _mm256_storeu_si256(reinterpret_cast<vec *>(p), v); }
+  static vec and_(vec a, vec b) { return _mm256_and_si256(a, b); }
+  static vec or_(vec a, vec b) { return _mm256_or_si256(a, b); }
+  static vec set1_32(boost::int32_t v) { return _mm256_set1_epi32(v); }
+  static vec add32(vec a, vec b) { return _mm256_add_epi32(a, b); }
+  static vec mullo32(vec a, vec b) { return _mm256_mullo_epi32(a, b); }
+
+  static vec get_channel32(vec p, int position)
+  {
+    return _mm256_and_si256(_mm256_srl_epi32(p, _mm_cvtsi32_si128(position * 8)), _mm256_set1_epi32(0xff));
+  }
+
+  static vec put_channel32(vec v, int position) { return _mm256_sll_epi32(v, _mm_cvtsi32_si128(position * 8)); }
+  static vec shift_right32(vec v, int bits) { return _mm256_srl_epi32(v, _mm_cvtsi32_si128(bits)); }
+  static vec mul16_32(vec a, vec b) { return _mm256_madd_epi16(a, b); }
+
+  // Loads 8 bytes to separate lanes
+  static vec load_bytes32(boost::uint8_t const * p)
+  {
+    return _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<__m128i const *>(p)));
+  }
+
+  static vec fixed_to_channel32(vec v)
+  {
+    return _mm256_min_epi32(_mm256_srli_epi32(_mm256_max_epi32(v, _mm256_setzero_si256()), 16), _mm256_set1_epi32(255));
+  }
+
+private:
+  static __m256i arithmetic_half(__m256i a, __m256i b, float k1, float k2, float k3, float k4)
+  {
+    __m256 const fa = _mm256_cvtepi32_ps(a), fb = _mm256_cvtepi32_ps(b);
+    __m256 r = _mm256_mul_ps(_mm256_set1_ps(k1), _mm256_mul_ps(fa, fb));
+    r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_set1_ps(k2), fa));
+    r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_set1_ps(k3), fb));
+    r = _mm256_add_ps(r, _mm256_set1_ps(k4));
+    r = _mm256_add_ps(r, _mm256_set1_ps(0.5f));
+    r = _mm256_min_ps(_mm256_max_ps(r, _mm256_setzero_ps()), _mm256_set1_ps(255.f));
+    return _mm256_cvttps_epi32(r);
+  }
+};
+#endif
+
+// Kernel with separate formulas for color channels and alpha
+template<class Formulas>
+struct color_alpha_kernel
+{
+  template<class Ops, int AlphaIndex>
+  typename Ops::vec apply(typename Ops::vec a, typename Ops::vec b) const
+  {
+    typename Ops::vec const alpha_a = Ops::template broadcast_alpha<AlphaIndex>(a);
+    typename Ops::vec const alpha_b = Ops::template broadcast_alpha<AlphaIndex>(b);
+    return Ops::template select_alpha<AlphaIndex>(
+      Formulas::template color<Ops>(a, b, alpha_a, alpha_b),
+      Formulas::template alpha<Ops>(alpha_a, alpha_b));
+  }
+
+  template<int AlphaIndex>
+  void apply_scalar(boost::uint8_t const * a, boost::uint8_t const * b, boost::uint8_t * dst) const
+  {
+    int const alpha_a = a[AlphaIndex], alpha_b = b[AlphaIndex];
+    for(int c = 0; c < 4; ++c)
+      dst[c] = clamp_channel_bits8(c == AlphaIndex
+        ? Formulas::template alpha<scalar_ops>(alpha_a, alpha_b)
+        : Formulas::template color<scalar_ops>(a[c], b[c], alpha_a, alpha_b));
+  }
+};
+
+// Same formula for all channels
+struct arithmetic_kernel
+{
+  // Coefficients are scaled so that the formula works on 0..255 values
+  template<class Coefficient>
+  arithmetic_kernel(Coefficient k1, Coefficient k2, Coefficient k3, Coefficient k4)
+    : k1_(static_cast<float>(k1 / 255.0)), k2_(static_cast<float>(k2))
+    , k3_(static_cast<float>(k3)), k4_(static_cast<float>(k4 * 255.0))
+  {}
+
+  template<class Ops, int AlphaIndex>
+  typename Ops::vec apply(typename Ops::vec a, typename Ops::vec b) const
+  {
+    return Ops::arithmetic(a, b, k1_, k2_, k3_, k4_);
+  }
+
+  template<int AlphaIndex>
+  void apply_scalar(boost::uint8_t const * a, boost::uint8_t const * b, boost::uint8_t * dst) const
+  {
+    for(int c = 0; c < 4; ++c)
+      dst[c] = static_cast<boost::uint8_t>(scalar_ops::arithmetic(a[c], b[c], k1_, k2_, k3_, k4_));
+  }
+
+private:
+  float k1_, k2_, k3_, k4_;
+};
+
+// Processes row of 'count' interleaved 8 bit 4 channel pixels, widest available instruction set
+// is used for the most of the row and scalar code for the rest
+template<int AlphaIndex, class Kernel>
+void transform_row_rgba8(Kernel const & kernel, boost::uint8_t const * a, boost::uint8_t const * b, boost::uint8_t * dst,
+  std::ptrdiff_t count)
+{
+#if defined(SVGPP_GIL_AVX2)
+  for(; count >= 8; count -= 8, a += 32, b += 32, dst += 32)
+    avx2_ops::step<AlphaIndex>(kernel, a, b, dst);
+#endif
+#if defined(SVGPP_GIL_SSE2)
+  for(; count >= 4; count -= 4, a += 16, b += 16, dst += 16)
+    sse2_ops::step<AlphaIndex>(kernel, a, b, dst);
+#endif
+  for(; count > 0; --count, a += 4, b += 4, dst += 4)
+    kernel.template apply_scalar<AlphaIndex>(a, b, dst);
+}
+
+// Same for kernels with one source, 'Kernel::apply' gets and returns whole pixels in 32 bit lanes
+template<class Kernel>
+void transform_row_rgba8(Kernel const & kernel, boost::uint8_t const * src, boost::uint8_t * dst, std::ptrdiff_t count)
+{
+#if defined(SVGPP_GIL_AVX2)
+  for(; count >= 8; count -= 8, src += 32, dst += 32)
+    avx2_ops::store(dst, kernel.template apply<avx2_ops>(avx2_ops::load(src)));
+#endif
+#if defined(SVGPP_GIL_SSE2)
+  for(; count >= 4; count -= 4, src += 16, dst += 16)
+    sse2_ops::store(dst, kernel.template apply<sse2_ops>(sse2_ops::load(src)));
+#endif
+  for(; count > 0; --count, src += 4, dst += 4)
+    kernel.apply_scalar(src, dst);
+}
+
+// Whole row kernels are used for views of the same interleaved 8 bit pixels with 4 channels
+template<class View1, class View2, class DstView>
+struct is_rgba8_like_views: boost::mpl::and_<
+  boost::mpl::and_<
+    boost::is_pointer<typename View1::x_iterator>,
+    boost::is_pointer<typename View2::x_iterator>,
+    boost::is_pointer<typename DstView::x_iterator>
+  >,
+  boost::is_same<typename boost::remove_const<typename View1::value_type>::type, typename DstView::value_type>,
+  boost::is_same<typename boost::remove_const<typename View2::value_type>::type, typename DstView::value_type>,
+  boost::mpl::bool_<gil::num_channels<DstView>::value == 4>,
+  boost::is_same<typename gil::channel_type<DstView>::type, gil::bits8>
+>
+{};
+
+template<class SrcView, class DstView>
+struct is_rgba8_like_view_pair: is_rgba8_like_views<SrcView, SrcView, DstView>
+{};
+
+// Position of red, green, blue and alpha in memory depends on the layout channel mapping,
+// not on the color space
+template<class Pixel>
+void rgba8_channel_positions(int (&positions)[4])
+{
+  Pixel probe(0, 0, 0, 0);
+  gil::get_color(probe, gil::red_t()) = 1;
+  gil::get_color(probe, gil::green_t()) = 2;
+  gil::get_color(probe, gil::blue_t()) = 3;
+  gil::get_color(probe, gil::alpha_t()) = 4;
+  boost::uint8_t const * bytes = reinterpret_cast<boost::uint8_t const *>(&probe);
+  for(int i = 0; i < 4; ++i)
+    positions[bytes[i] - 1] = i;
+}
+
+template<int AlphaIndex, class View1, class View2, class DstView, class Kernel>
+void transform_rows_rgba8(View1 const & src1, View2 const & src2, DstView const & dst, Kernel const & kernel)
+{
+  for(std::ptrdiff_t y = 0; y < dst.height(); ++y)
+    transform_row_rgba8<AlphaIndex>(kernel,
+      reinterpret_cast<boost::uint8_t const *>(&*src1.row_begin(y)),
+      reinterpret_cast<boost::uint8_t const *>(&*src2.row_begin(y)),
+      reinterpret_cast<boost::uint8_t *>(&*dst.row_begin(y)),
+      dst.width());
+}
+
+template<class View1, class View2, class DstView, class Kernel, class PixelFunction>
+void transform_pixels_rgba8(View1 const & src1, View2 const & src2, DstView const & dst,
+  Kernel const & kernel, PixelFunction const &, boost::mpl::true_)
+{
+  int positions[4];
+  rgba8_channel_positions<typename DstView::value_type>(positions);
+  switch(positions[3])
+  {
+  case 0: transform_rows_rgba8<0>(src1, src2, dst, kernel); break;
+  case 1: transform_rows_rgba8<1>(src1, src2, dst, kernel); break;
+  case 2: transform_rows_rgba8<2>(src1, src2, dst, kernel); break;
+  default: transform_rows_rgba8<3>(src1, src2, dst, kernel); break;
+  }
+}
+
+template<class View1, class View2, class DstView, class Kernel, class PixelFunction>
+void transform_pixels_rgba8(View1 const & src1, View2 const & src2, DstView const & dst,
+  Kernel const &, PixelFunction const & fn, boost::mpl::false_)
+{
+  gil::transform_pixels(src1, src2, dst, fn);
+}
+
+} // namespace gil_detail
+
+namespace gil_utility
+{
+
+// Drop-in replacements for boost::gil::transform_pixels. Overloads for blend_pixel, composite_pixel,
+// composite_pixel_arithmetic and color matrix transforms process whole rows with SIMD
+template<class SrcView, class DstView, class PixelFunction>
+PixelFunction transform_pixels(SrcView const & src, DstView const & dst, PixelFunction fn)
+{
+  return boost::gil::transform_pixels(src, dst, fn);
+}
+
+template<class View1, class View2, class DstView, class PixelFunction>
+PixelFunction transform_pixels(View1 const & src1, View2 const & src2, DstView const & dst, PixelFunction fn)
+{
+  return boost::gil::transform_pixels(src1, src2, dst, fn);
+}
+
+}}
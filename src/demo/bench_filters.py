@@ -0,0 +1,57 @@
+import argparse
+import os
+import subprocess
+import tempfile
+import time
+from string import Template
+
+parser = argparse.ArgumentParser(description='Measure render time of filter primitives on large images.')
+parser.add_argument('--executable', dest='executable', required=True,
+                   help='path to demo app executable')
+parser.add_argument('--width', dest='width', type=int, default=3840,
+                   help='image width')
+parser.add_argument('--height', dest='height', type=int, default=2160,
+                   help='image height')
+parser.add_argument('--std-deviations', dest='std_deviations', default='1,2,5,10,20,50',
+                   help='comma separated list of feGaussianBlur stdDeviation values')
+parser.add_argument('--threads', dest='threads', default='1',
+                   help='comma separated list of thread counts passed to the executable')
+parser.add_argument('--repeat', dest='repeat', type=int, default=3,
+                   help='number of runs, the best time is reported')
+
+args = parser.parse_args()
+
+svg_template = Template('''<svg xmlns="http://www.w3.org/2000/svg" width="$width" height="$height">
+  <filter id="blur" filterUnits="userSpaceOnUse" x="0" y="0" width="$width" height="$height">
+    <feGaussianBlur stdDeviation="$std_deviation"/>
+  </filter>
+  <g filter="url(#blur)">
+    <rect width="$width" height="$height" fill="#204080"/>
+    <circle cx="$cx" cy="$cy" r="$r" fill="#f0c020" fill-opacity="0.7"/>
+    <rect x="$cx" y="$cy" width="$r" height="$r" fill="#10a060"/>
+  </g>
+</svg>
+''')
+
+def best_time(command):
+  best = None
+  for i in range(args.repeat):
+    start = time.time()
+    subprocess.check_call(command)
+    elapsed = time.time() - start
+    if best is None or elapsed < best:
+      best = elapsed
+  return best
+
+work_dir = tempfile.mkdtemp()
+out_image_name = os.path.join(work_dir, 'out.png')
+thread_counts = [int(t) for t in args.threads.split(',')]
+
+print('stdDeviation ' + ' '.join('%10s' % ('%d thr, s' % t) for t in thread_counts))
+for std_deviation in args.std_deviations.split(','):
+  svg_file = os.path.join(work_dir, 'blur_%s.svg' % std_deviation)
+  with open(svg_file, 'w') as f:
+    f.write(svg_template.substitute(width=args.width, height=args.height, std_deviation=std_deviation,
+      cx=args.width // 3, cy=args.height // 3, r=args.height // 4))
+  times = [best_time([args.executable, '--threads=%d' % t, svg_file, out_image_name]) for t in thread_counts]
+  print('%12s ' % std_deviation + ' '.join('%10.3f' % t for t in times))
@@ -2,6 +2,7 @@
 
 #if defined(RENDERER_AGG)
 #include <agg_alpha_mask_u8.h>
+#include <agg_bounding_rect.h>
 #include <agg_conv_curve.h>
 #include <agg_path_storage.h>
 #include <agg_pixfmt_amask_adaptor.h>
@@ -40,7 +41,7 @@ void ClipBuffer::intersectClipRect(transform_t const & transform, number_t x, nu
 #if defined(RENDERER_AGG)
   typedef agg::renderer_scanline_aa_solid<renderer_base_t> renderer_t;
 
-  agg::rendering_buffer rbuf(&buffer_[0], width, height, width);
+  agg::rendering_buffer rbuf(&buffer_[0], width_, height_, width_);
   pixfmt_t pixfmt(rbuf);
   renderer_base_t renderer_base(pixfmt);
   agg::scanline_p8 scanline;
@@ -113,13 +114,17 @@ namespace
     ElementBase(
       XMLDocument & xml_document,
 #if defined(RENDERER_AGG)
-      agg::rendering_buffer & rbuf, 
+      agg::rendering_buffer * rbuf, 
+      BoundingBox * bounds,
+      PathCache * path_cache,
 #endif
       transform_t const & transform
       )
       : xml_document_(xml_document)
 #if defined(RENDERER_AGG)
       , rbuf_(rbuf)
+      , bounds_(bounds)
+      , path_cache_(path_cache)
       , transform_(transform)
 #endif
       , display_(true)
@@ -134,6 +139,8 @@ namespace
       : xml_document_(parent.xml_document_)
 #if defined(RENDERER_AGG)
       , rbuf_(parent.rbuf_)
+      , bounds_(parent.bounds_)
+      , path_cache_(parent.path_cache_)
       , transform_(parent.transform_)
 #endif
       , display_(parent.display_)
@@ -172,7 +179,9 @@ namespace
   protected:
     XMLDocument & xml_document_;
 #if defined(RENDERER_AGG)
-    agg::rendering_buffer & rbuf_;
+    agg::rendering_buffer * rbuf_; // Shapes are rasterized to it if set
+    BoundingBox * bounds_; // Shape bounds in pixels are added to it if set
+    PathCache * path_cache_; // May be NULL
 #endif
     transform_t transform_;
     bool display_;
@@ -186,8 +195,11 @@ namespace
 #endif
   {
   public:
-    Path(ElementBase const & parent)
+    Path(ElementBase const & parent, XMLElement const & element)
       : ElementBase(parent)
+#if defined(RENDERER_AGG)
+      , element_(element)
+#endif
     {}
 
 #if defined(RENDERER_AGG)
@@ -225,28 +237,60 @@ namespace
 
     void path_exit()
     {}
+
+    // Marker positions are only kept in cached geometry, that may be shared with the renderer
+    void marker(svgpp::marker_vertex v, number_t x, number_t y, number_t directionality, unsigned marker_index)
+    {
+      if (marker_index >= markers_.size())
+        markers_.resize(marker_index + 1);
+      MarkerPos & m = markers_[marker_index];
+      m.v = v;
+      m.x = x;
+      m.y = y;
+      m.directionality = directionality;
+    }
+
+    using ElementBase::set;
+
+    template<class Range>
+    void set(svgpp::tag::attribute::d, Range const & path_data);
 #endif
 
     void on_exit_element()
     {
 #if defined(RENDERER_AGG)
-      if (display_ && path_storage_.total_vertices() > 0)
+      // Orientations of cached geometry are already arranged
+      agg::path_storage const & geometry = geometry_ ? geometry_->path_storage_ : path_storage_;
+      if (display_ && geometry.total_vertices() > 0)
       {
-        typedef agg::conv_curve<agg::path_storage> curved_t;
+        typedef agg::conv_curve<ConstPathSource> curved_t;
         typedef agg::conv_transform<curved_t> curved_transformed_t;
 
-        curved_t curved(path_storage_);
-
-        path_storage_.arrange_orientations_all_paths(agg::path_flags_ccw);
-  
+        if (!geometry_)
+          path_storage_.arrange_orientations_all_paths(agg::path_flags_ccw);
+        ConstPathSource path(geometry);
+        curved_t curved(path);
         curved_transformed_t curved_transformed(curved, transform_);
-        agg::rasterizer_scanline_aa<> rasterizer;
-        agg::scanline_p8 scanline;
-        pixfmt_t pixfmt(rbuf_);
-        renderer_base_t renderer_base(pixfmt);
-        rasterizer.filling_rule(nonzero_clip_rule_ ? agg::fill_non_zero : agg::fill_even_odd);
-        rasterizer.add_path(curved_transformed);
-        agg::render_scanlines_aa_solid(rasterizer, scanline, renderer_base, agg::gray8(0));
+        if (bounds_)
+        {
+          double min_x, min_y, max_x, max_y;
+          if (agg::bounding_rect_single(curved_transformed, 0, &min_x, &min_y, &max_x, &max_y))
+          {
+            bounds_->add(min_x, min_y);
+            bounds_->add(max_x, max_y);
+          }
+        }
+        if (rbuf_)
+        {
+          agg::rasterizer_scanline_aa<> rasterizer;
+          agg::scanline_p8 scanline;
+          pixfmt_t pixfmt(*rbuf_);
+          renderer_base_t renderer_base(pixfmt);
+          rasterizer.clip_box(0, 0, pixfmt.width(), pixfmt.height());
+          rasterizer.filling_rule(nonzero_clip_rule_ ? agg::fill_non_zero : agg::fill_even_odd);
+          rasterizer.add_path(curved_transformed);
+          agg::render_scanlines_aa_solid(rasterizer, scanline, renderer_base, agg::gray8(0));
+        }
       }
 #elif defined(RENDERER_GDIPLUS)
 
@@ -255,7 +299,10 @@ namespace
 
   private:
 #if defined(RENDERER_AGG)
+    XMLElement const element_;
     agg::path_storage path_storage_;
+    std::vector<MarkerPos> markers_;
+    PathCache::geometry_ptr_t geometry_; // Cached geometry, used instead of path_storage_ if set
 #endif
   };
 
@@ -304,7 +351,7 @@ namespace
   template<class ElementTag>
   struct context_factories::apply<ElementBase, ElementTag>
   {
-    typedef svgpp::factory::context::on_stack<Path> type;
+    typedef svgpp::factory::context::on_stack_with_xml_element<Path> type;
   };
 
   length_factory_t length_factory_instance;
@@ -330,9 +377,41 @@ namespace
 		svgpp::processed_attributes<processed_attributes>,
     svgpp::path_policy<path_policy>,
     svgpp::transform_events_policy<svgpp::policy::transform_events::forward_to_method<ElementBase> >,
+#if defined(RENDERER_AGG)
+    svgpp::passthrough_attributes<boost::mpl::set1<svgpp::tag::attribute::d> >, // Parsed by Path
+#endif
     svgpp::length_policy<length_policy_t>
   > document_traversal;
 
+#if defined(RENDERER_AGG)
+  template<class Range>
+  void Path::set(svgpp::tag::attribute::d, Range const & path_data)
+  {
+    if (path_cache_)
+      if ((geometry_ = path_cache_->find(element_)))
+        return;
+    typedef svgpp::attribute_dispatcher<
+        svgpp::tag::element::path,
+        Path,
+        svgpp::processed_attributes<boost::mpl::set1<svgpp::tag::attribute::d> >,
+        svgpp::length_policy<length_policy_t>,
+        svgpp::path_policy<path_policy>,
+        svgpp::markers_policy<svgpp::policy::markers::calculate_always>
+      > path_data_loader;
+    if (path_data_loader(*this).load_attribute_value(svgpp::tag::attribute::d(), path_data, svgpp::tag::source::attribute())
+      && path_cache_)
+    {
+      // Same layout as geometry cached by the renderer, that may find it later
+      boost::shared_ptr<PathGeometry> geometry(new PathGeometry);
+      geometry->path_storage_ = path_storage_;
+      geometry->path_storage_.arrange_orientations_all_paths(agg::path_flags_ccw);
+      geometry->markers_.swap(markers_);
+      path_cache_->insert(element_, geometry);
+      geometry_ = geometry;
+    }
+  }
+#endif
+
   void Use::on_exit_element()
   {
     if (!display_)
@@ -357,7 +436,8 @@ namespace
   }
 }
 
-void ClipBuffer::intersectClipPath(XMLDocument & xml_document, svg_string_t const & id, transform_t const & transform)
+void ClipBuffer::intersectClipPath(XMLDocument & xml_document, svg_string_t const & id, transform_t const & transform,
+  PathCache * path_cache)
 {
   if (XMLElement node = xml_document.findElementById(id))
   {
@@ -366,7 +446,7 @@ void ClipBuffer::intersectClipPath(XMLDocument & xml_document, svg_string_t cons
 #if defined(RENDERER_AGG)
       std::vector<unsigned char> clip_path_buffer(width_ * height_, 0xff);
       agg::rendering_buffer clip_path_rbuf(&clip_path_buffer[0], width_, height_, width_);
-      ElementBase root_context(xml_document, clip_path_rbuf, transform);
+      ElementBase root_context(xml_document, &clip_path_rbuf, NULL, path_cache, transform);
       document_traversal::load_expected_element(node, root_context, svgpp::tag::element::clipPath());
 
       typedef agg::amask_no_clip_gray8 alpha_mask_t;
@@ -386,3 +466,31 @@ void ClipBuffer::intersectClipPath(XMLDocument & xml_document, svg_string_t cons
   }
 }
 
+
+BoundingBox clipPathBounds(XMLDocument & xml_document, svg_string_t const & id, transform_t const & transform,
+  PathCache * path_cache)
+{
+#if defined(RENDERER_AGG)
+  if (XMLElement node = xml_document.findElementById(id))
+  {
+    try
+    {
+      BoundingBox bounds;
+      ElementBase root_context(xml_document, NULL, &bounds, path_cache, transform);
+      document_traversal::load_expected_element(node, root_context, svgpp::tag::element::clipPath());
+      // Antialiased edges reach the neighbour pixels
+      if (!bounds.empty())
+      {
+        bounds.add(bounds.minX_ - 1, bounds.minY_ - 1);
+        bounds.add(bounds.maxX_ + 1, bounds.maxY_ + 1);
+      }
+      return bounds;
+    } 
+    catch (std::exception const &)
+    {
+      // Error is reported when clip path is applied
+    }
+  }
+#endif
+  return BoundingBox::unbounded();
+}
@@ -3,6 +3,7 @@
 #include <vector>
 #include <boost/gil/gil_all.hpp>
 #include "common.hpp"
+#include "path_cache.hpp"
 
 class ClipBuffer
 {
@@ -13,9 +14,15 @@ public:
   boost::gil::gray8c_view_t gilView() const;
 
   void intersectClipRect(transform_t const & transform, number_t x, number_t y, number_t width, number_t height);
-  void intersectClipPath(XMLDocument & xml_document, svg_string_t const & id, transform_t const & transform);
+  // Geometry of clip path shapes is shared through 'path_cache' between calls if it is set
+  void intersectClipPath(XMLDocument & xml_document, svg_string_t const & id, transform_t const & transform,
+    PathCache * path_cache = NULL);
 
 private:
   std::vector<unsigned char> buffer_;
   const int width_, height_;
-};
\ No newline at end of file
+};
+
+// Bounds in pixels of the area that 'clipPath' element leaves visible. Unbounded if it can't be computed
+BoundingBox clipPathBounds(XMLDocument & xml_document, svg_string_t const & id, transform_t const & transform,
+  PathCache * path_cache = NULL);
\ No newline at end of file
@@ -40,6 +40,8 @@
 #endif
 #include <boost/function.hpp>
 #include <boost/tuple/tuple.hpp>
+#include <algorithm>
+#include <limits>
 #include <map>
 
 #if defined(RENDERER_AGG)
@@ -48,6 +50,7 @@ typedef agg::trans_affine transform_t;
 typedef agg::rgba8 color_t;
 
 inline color_t BlackColor() { return color_t(0, 0, 0); }
+inline color_t WhiteColor() { return color_t(255, 255, 255); }
 inline color_t TransparentBlackColor() { return color_t(0, 0, 0, 0); }
 inline color_t TransparentWhiteColor() { return color_t(255, 255, 255, 0); }
 
@@ -67,6 +70,7 @@ typedef Gdiplus::Matrix transform_t;
 typedef Gdiplus::Color color_t;
 
 inline color_t BlackColor() { return color_t(0, 0, 0); }
+inline color_t WhiteColor() { return color_t(255, 255, 255); }
 inline color_t TransparentBlackColor() { return color_t(0, 0, 0, 0); }
 inline color_t TransparentWhiteColor() { return color_t(0, 255, 255, 255); }
 
@@ -86,6 +90,7 @@ typedef SkMatrix transform_t;
 typedef SkColor color_t;
 
 inline color_t BlackColor() { return SK_ColorBLACK; }
+inline color_t WhiteColor() { return SK_ColorWHITE; }
 inline color_t TransparentBlackColor() { return SK_ColorTRANSPARENT; }
 inline color_t TransparentWhiteColor() { return 0x00FFFFFF; }
 
@@ -106,6 +111,104 @@ typedef svgpp::factory::length::unitless<number_t, number_t> length_factory_t;
 typedef boost::tuple<double, double, double, double> bounding_box_t;
 typedef boost::function<bounding_box_t()> get_bounding_box_func_t;
 
+// Axis-aligned bounds of added points, empty until the first point is added
+struct BoundingBox
+{
+  BoundingBox()
+    : minX_(1), minY_(1), maxX_(0), maxY_(0)
+  {}
+
+  bool empty() const
+  { return minX_ > maxX_ || minY_ > maxY_; }
+
+  void add(number_t x, number_t y)
+  {
+    if (empty())
+    {
+      minX_ = maxX_ = x;
+      minY_ = maxY_ = y;
+    }
+    else
+    {
+      minX_ = std::min(minX_, x);
+      minY_ = std::min(minY_, y);
+      maxX_ = std::max(maxX_, x);
+      maxY_ = std::max(maxY_, y);
+    }
+  }
+
+  void add(BoundingBox const & box)
+  {
+    if (!box.empty())
+    {
+      add(box.minX_, box.minY_);
+      add(box.maxX_, box.maxY_);
+    }
+  }
+
+  // Leaves the area common with 'box', result is empty if they don't overlap
+  void intersect(BoundingBox const & box)
+  {
+    minX_ = std::max(minX_, box.minX_);
+    minY_ = std::max(minY_, box.minY_);
+    maxX_ = std::min(maxX_, box.maxX_);
+    maxY_ = std::min(maxY_, box.maxY_);
+  }
+
+  bool intersects(BoundingBox const & box) const
+  { 
+    return !empty() && !box.empty() 
+      && minX_ <= box.maxX_ && box.minX_ <= maxX_ && minY_ <= box.maxY_ && box.minY_ <= maxY_; 
+  }
+
+  static BoundingBox unbounded()
+  {
+    BoundingBox box;
+    box.minX_ = box.minY_ = -std::numeric_limits<number_t>::max();
+    box.maxX_ = box.maxY_ = std::numeric_limits<number_t>::max();
+    return box;
+  }
+
+  number_t minX_, minY_, maxX_, maxY_;
+};
+
+inline void TransformPoint(transform_t const & transform, number_t & x, number_t & y)
+{
+#if defined(RENDERER_AGG)
+  transform.transform(&x, &y);
+#elif defined(RENDERER_GDIPLUS)
+  Gdiplus::PointF point(x, y);
+  transform.TransformPoints(&point);
+  x = point.X;
+  y = point.Y;
+#elif defined(RENDERER_SKIA)
+  SkPoint point;
+  transform.mapXY(x, y, &point);
+  x = point.fX;
+  y = point.fY;
+#endif
+}
+
+// Bounds of box corners mapped by 'transform'
+inline BoundingBox TransformBox(transform_t const & transform, BoundingBox const & box)
+{
+  BoundingBox result;
+  if (box.empty())
+    return result;
+  number_t const max = std::numeric_limits<number_t>::max();
+  if (box.minX_ == -max || box.minY_ == -max || box.maxX_ == max || box.maxY_ == max)
+    return BoundingBox::unbounded(); // Corners would overflow
+  number_t const corners[4][2] = {
+    { box.minX_, box.minY_ }, { box.maxX_, box.minY_ }, { box.minX_, box.maxY_ }, { box.maxX_, box.maxY_ } };
+  for(int i = 0; i < 4; ++i)
+  {
+    number_t x = corners[i][0], y = corners[i][1];
+    TransformPoint(transform, x, y);
+    result.add(x, y);
+  }
+  return result;
+}
+
 #if defined(RENDERER_GDIPLUS)
 inline void AssignMatrix(Gdiplus::Matrix & dest, Gdiplus::Matrix const & src)
 {
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "common.hpp"
+#include "gradient.hpp"
+
+#include <map>
+#include <vector>
+#include <boost/optional.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/variant.hpp>
+
+#if defined(RENDERER_AGG)
+#include <agg_math_stroke.h>
+#include <agg_path_storage.h>
+
+typedef boost::variant<svgpp::tag::value::none, color_t, Gradient> EffectivePaint;
+
+// Style of the path resolved to values needed for rasterization
+struct PathPaint
+{
+  EffectivePaint fill_, stroke_;
+  number_t fill_opacity_, stroke_opacity_;
+  bool nonzero_fill_rule_;
+  number_t stroke_width_;
+  agg::line_cap_e line_cap_;
+  agg::line_join_e line_join_;
+  number_t miterlimit_;
+  std::vector<number_t> stroke_dasharray_;
+  number_t stroke_dashoffset_;
+};
+
+// Drawing commands produced by document traversal, that may be rasterized later any number of times
+// at different scale or crop. Masks, clip paths and filters are kept as references to the XML document
+struct DisplayList
+{
+  // Clip state is a chain of intersected areas shared by commands of nested elements
+  struct Clip
+  {
+    boost::shared_ptr<Clip const> parent_;
+    transform_t transform_;
+    boost::optional<svg_string_t> clip_path_fragment_; // Rectangle is used if not set
+    number_t x_, y_, width_, height_; // Zero if clip path is set
+  };
+  typedef boost::shared_ptr<Clip const> clip_ptr_t;
+
+  struct DrawPath
+  {
+    boost::shared_ptr<agg::path_storage const> geometry_; // In user space, subpath orientations arranged
+    transform_t transform_; // User space to canvas pixels
+    PathPaint paint_;
+    BoundingBox bounds_; // Geometry without stroke in canvas pixels
+    BoundingBox visible_bounds_; // Area of canvas pixels not clipped out by viewports and clip paths
+    bool filtered_; // Inside of filtered element, small features aren't culled as filters may enlarge them
+  };
+
+  // Following commands draw to a new transparent layer until matching PopLayer
+  struct PushLayer
+  {};
+
+  // Composes layer with effects into the layer below
+  struct PopLayer
+  {
+    number_t opacity_;
+    clip_ptr_t clip_;
+    boost::optional<svg_string_t> mask_fragment_, filter_;
+    transform_t transform_;
+    length_factory_t length_factory_;
+    BoundingBox bounding_box_; // Bounds of layer content in canvas pixels, used by filters
+  };
+
+  typedef boost::variant<DrawPath, PushLayer, PopLayer> command_t;
+
+  // Commands drawn by the element with 'id' attribute and its content, so that the element may be
+  // recorded again alone after it is changed, see updateDisplayListSubtree()
+  struct Subtree
+  {
+    size_t begin_, end_;
+    std::vector<unsigned> path_; // Indices of elements from the topmost 'svg' element, in document order
+    bool refreshable_; // False if id isn't unique or element is inside of a filtered element
+  };
+  typedef std::map<svg_string_t, Subtree> subtrees_t;
+
+  DisplayList()
+    : width_(0)
+    , height_(0)
+  {}
+
+  std::vector<command_t> commands_;
+  subtrees_t subtrees_;
+  int width_, height_; // Canvas size at scale 1
+};
+#endif
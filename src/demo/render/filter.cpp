@@ -2,24 +2,39 @@
 #define BOOST_MPL_LIMIT_SET_SIZE 40
 
 #include "filter.hpp"
+#include "thread_pool.hpp"
 
 #include <svgpp/document_traversal.hpp>
 #include <svgpp/utility/gil/blend.hpp>
 #include <svgpp/utility/gil/composite.hpp>
 #include <svgpp/utility/gil/color_matrix.hpp>
-#include <svgpp/utility/gil/mask.hpp>
+#include <svgpp/utility/gil/simd.hpp>
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
 #include <boost/gil/gil_all.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/mpl/empty_sequence.hpp>
+#include <boost/mpl/fold.hpp>
+#include <boost/mpl/if.hpp>
+#include <boost/mpl/insert.hpp>
 #include <boost/mpl/set.hpp>
+#include <boost/mpl/vector.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/variant.hpp>
 #include <boost/math/constants/constants.hpp>
+#include <boost/type_traits/is_same.hpp>
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <limits>
+#include <numeric>
 
 namespace mpl = boost::mpl;
 namespace gil = boost::gil;
 
 struct ElementWithRegion
 {
-  double x_, y_, width_, height_;
+  boost::optional<double> x_, y_, width_, height_;
 };
 
 struct FilterInput
@@ -29,12 +44,17 @@ struct FilterInput
 
   FilterInput()
     : source_(fiNotSet)
+    , step_(-1)
   {}
 
   source source_;
   svg_string_t reference_;
+  int step_; // Index of referenced primitive, resolved on compilation
 };
 
+// How pixels outside of the input image are obtained
+enum EdgeMode { emDuplicate, emWrap, emNone };
+
 struct FilterElementBase: ElementWithRegion
 {
   svg_string_t result_;
@@ -122,17 +142,126 @@ struct feColorMatrix: FilterElementBase
   boost::optional<std::vector<double> > values_;
 };
 
+struct feMorphology: FilterElementBase
+{
+  enum Operator { opErode, opDilate };
+
+  feMorphology()
+    : operator_(opErode)
+    , radiusX_(0), radiusY_(0)
+  {}
+
+  FilterInput input_;
+  Operator operator_;
+  double radiusX_, radiusY_;
+};
+
+struct feGaussianBlur: FilterElementBase
+{
+  feGaussianBlur()
+    : stdDeviationX_(0), stdDeviationY_(0)
+    , edgeMode_(emNone)
+  {}
+
+  FilterInput input_;
+  double stdDeviationX_, stdDeviationY_;
+  EdgeMode edgeMode_;
+};
+
+struct feConvolveMatrix: FilterElementBase
+{
+  feConvolveMatrix()
+    : orderX_(3), orderY_(3)
+    , bias_(0)
+    , edgeMode_(emDuplicate)
+    , preserveAlpha_(false)
+  {}
+
+  FilterInput input_;
+  double orderX_, orderY_;
+  std::vector<double> kernelMatrix_;
+  boost::optional<double> divisor_;
+  double bias_;
+  boost::optional<int> targetX_, targetY_;
+  EdgeMode edgeMode_;
+  bool preserveAlpha_;
+};
+
+struct feTurbulence: FilterElementBase
+{
+  feTurbulence()
+    : baseFrequencyX_(0), baseFrequencyY_(0)
+    , numOctaves_(1)
+    , seed_(0)
+    , stitchTiles_(false)
+    , fractalNoise_(false)
+  {}
+
+  double baseFrequencyX_, baseFrequencyY_;
+  int numOctaves_;
+  double seed_;
+  bool stitchTiles_;
+  bool fractalNoise_;
+  boost::shared_ptr<TurbulenceLattice const> lattice_; // Shared by primitives with the same seed, set on compilation
+};
+
+struct LightSource
+{
+  enum Type { lsNone, lsDistant, lsPoint, lsSpot };
+
+  LightSource()
+    : type_(lsNone)
+    , azimuth_(0), elevation_(0)
+    , x_(0), y_(0), z_(0)
+    , pointsAtX_(0), pointsAtY_(0), pointsAtZ_(0)
+    , specularExponent_(1)
+  {}
+
+  Type type_;
+  double azimuth_, elevation_;
+  double x_, y_, z_;
+  double pointsAtX_, pointsAtY_, pointsAtZ_;
+  double specularExponent_;
+  boost::optional<double> limitingConeAngle_;
+};
+
+// feDiffuseLighting and feSpecularLighting
+struct feLighting: FilterElementBase
+{
+  feLighting()
+    : specular_(false)
+    , lighting_color_(WhiteColor())
+    , surfaceScale_(1)
+    , diffuseConstant_(1)
+    , specularConstant_(1)
+    , specularExponent_(1)
+  {}
+
+  FilterInput input_;
+  bool specular_;
+  color_t lighting_color_;
+  double surfaceScale_;
+  double diffuseConstant_;
+  double specularConstant_, specularExponent_;
+  LightSource light_;
+};
 
 typedef boost::variant<feBlend, feComponentTransfer, feOffset, feComposite, feMerge, feFlood, 
-  feColorMatrix> FilterElement;
+  feColorMatrix, feGaussianBlur, feMorphology, feConvolveMatrix, feTurbulence, feLighting> FilterElement;
 
 class ElementWithRegionContext
 {
 public:
-  ElementWithRegionContext(ElementWithRegion & data)
+  ElementWithRegionContext(ElementWithRegion & data, length_factory_t const & length_factory)
     : data_(data)
+    , length_factory_(length_factory)
   {}
 
+  length_factory_t const & length_factory() const
+  {
+    return length_factory_;
+  }
+
   void set(svgpp::tag::attribute::x, double val)  { data_.x_ = val; }
   void set(svgpp::tag::attribute::y, double val)  { data_.y_ = val; }
   void set(svgpp::tag::attribute::width, double val)  { data_.width_ = val; }
@@ -140,6 +269,7 @@ public:
 
 protected:
   ElementWithRegion & data_;
+  length_factory_t const & length_factory_;
 };
 
 template<class InAttributeTag>
@@ -179,8 +309,8 @@ protected:
 class FilterElementBaseContext: public ElementWithRegionContext
 {
 public:
-  FilterElementBaseContext(FilterElementBase & data)
-    : ElementWithRegionContext(data)
+  FilterElementBaseContext(FilterElementBase & data, length_factory_t const & length_factory)
+    : ElementWithRegionContext(data, length_factory)
     , data_(data)
   {}
 
@@ -196,11 +326,16 @@ protected:
   FilterElementBase & data_;
 };
 
+struct afterFilterUnitsTag {};
+
 class FilterContext: public ElementWithRegionContext
 {
 public:
-  FilterContext()
-    : ElementWithRegionContext(region_)
+  FilterContext(length_factory_t const & referenced_length_factory)
+    : ElementWithRegionContext(region_, filter_length_factory_)
+    , filterUnitsUseObjectBoundingBox_(true)
+    , primitiveUnitsUseObjectBoundingBox_(false)
+    , referenced_length_factory_(referenced_length_factory)
   {}
 
   void on_enter_element(svgpp::tag::element::filter) const 
@@ -221,6 +356,44 @@ public:
     filterUnitsUseObjectBoundingBox_ = true;
   }
 
+  void set(svgpp::tag::attribute::primitiveUnits, svgpp::tag::value::userSpaceOnUse)
+  {
+    primitiveUnitsUseObjectBoundingBox_ = false;
+  }
+
+  void set(svgpp::tag::attribute::primitiveUnits, svgpp::tag::value::objectBoundingBox)
+  {
+    primitiveUnitsUseObjectBoundingBox_ = true;
+  }
+
+  bool notify(afterFilterUnitsTag)
+  {
+    // Lengths in objectBoundingBox units are fractions of the bounding box, 
+    // so percentages are calculated relative to 1x1 viewport
+    filter_length_factory_ = referenced_length_factory_;
+    if (filterUnitsUseObjectBoundingBox_)
+      filter_length_factory_.set_viewport_size(1.0, 1.0);
+    primitive_length_factory_ = referenced_length_factory_;
+    if (primitiveUnitsUseObjectBoundingBox_)
+      primitive_length_factory_.set_viewport_size(1.0, 1.0);
+
+    // Default filter region, attributes that follow may override it
+    region_.x_ = filter_length_factory_.create_length(
+      -10, svgpp::tag::length_units::percent(), svgpp::tag::length_dimension::width());
+    region_.y_ = filter_length_factory_.create_length(
+      -10, svgpp::tag::length_units::percent(), svgpp::tag::length_dimension::height());
+    region_.width_ = filter_length_factory_.create_length(
+      120, svgpp::tag::length_units::percent(), svgpp::tag::length_dimension::width());
+    region_.height_ = filter_length_factory_.create_length(
+      120, svgpp::tag::length_units::percent(), svgpp::tag::length_dimension::height());
+    return true;
+  }
+
+  length_factory_t const & primitiveLengthFactory() const
+  {
+    return primitive_length_factory_;
+  }
+
   void addElement(FilterElement const & el)
   {
     elements_.push_back(el);
@@ -228,7 +401,13 @@ public:
 
   ElementWithRegion region_;
   bool filterUnitsUseObjectBoundingBox_;
+  bool primitiveUnitsUseObjectBoundingBox_;
   std::vector<FilterElement> elements_;
+
+private:
+  length_factory_t const & referenced_length_factory_;
+  length_factory_t filter_length_factory_;
+  length_factory_t primitive_length_factory_;
 };
 
 class feBlendContext: 
@@ -246,7 +425,7 @@ class feBlendContext:
 
 public:
   feBlendContext(FilterContext & parent)
-    : FilterElementBaseContext(data_)
+    : FilterElementBaseContext(data_, parent.primitiveLengthFactory())
     , ElementWithInputContext<svgpp::tag::attribute::in>(data_.input1_)
     , ElementWithInputContext<svgpp::tag::attribute::in2>(data_.input2_)
     , parent_(parent)
@@ -322,7 +501,7 @@ class feComponentTransferContext:
 {
 public:
   feComponentTransferContext(FilterContext & parent)
-    : FilterElementBaseContext(data_)
+    : FilterElementBaseContext(data_, parent.primitiveLengthFactory())
     , ElementWithInputContext<svgpp::tag::attribute::in>(data_.input_)
     , parent_(parent)
   {
@@ -358,7 +537,7 @@ class feOffsetContext:
 {
 public:
   feOffsetContext(FilterContext & parent)
-    : FilterElementBaseContext(data_)
+    : FilterElementBaseContext(data_, parent.primitiveLengthFactory())
     , ElementWithInputContext<svgpp::tag::attribute::in>(data_.input_)
     , parent_(parent)
   {
@@ -399,7 +578,7 @@ class feCompositeContext:
 
 public:
   feCompositeContext(FilterContext & parent)
-    : FilterElementBaseContext(data_)
+    : FilterElementBaseContext(data_, parent.primitiveLengthFactory())
     , ElementWithInputContext<svgpp::tag::attribute::in>(data_.input1_)
     , ElementWithInputContext<svgpp::tag::attribute::in2>(data_.input2_)
     , parent_(parent)
@@ -443,7 +622,7 @@ class feMergeContext:
 {
 public:
   feMergeContext(FilterContext & parent)
-    : FilterElementBaseContext(data_)
+    : FilterElementBaseContext(data_, parent.primitiveLengthFactory())
     , parent_(parent)
   {
   }
@@ -484,7 +663,7 @@ class feFloodContext:
 {
 public:
   feFloodContext(FilterContext & parent)
-    : FilterElementBaseContext(data_)
+    : FilterElementBaseContext(data_, parent.primitiveLengthFactory())
     , parent_(parent)
   {
   }
@@ -530,7 +709,7 @@ class feColorMatrixContext:
 
 public:
   feColorMatrixContext(FilterContext & parent)
-    : FilterElementBaseContext(data_)
+    : FilterElementBaseContext(data_, parent.primitiveLengthFactory())
     , ElementWithInputContext<svgpp::tag::attribute::in>(data_.input_)
     , parent_(parent)
   {
@@ -561,6 +740,317 @@ private:
   feColorMatrix data_;
 };
 
+class ElementWithEdgeModeContext
+{
+  typedef mpl::map<
+    mpl::pair< svgpp::tag::value::duplicate, mpl::integral_c<EdgeMode, emDuplicate> >,
+    mpl::pair< svgpp::tag::value::wrap,      mpl::integral_c<EdgeMode, emWrap> >,
+    mpl::pair< svgpp::tag::value::none,      mpl::integral_c<EdgeMode, emNone> >
+  > edge_mode_to_enum;
+
+public:
+  ElementWithEdgeModeContext(EdgeMode & data)
+    : edgeMode_(data)
+  {}
+
+  template<class Mode>
+  void set(svgpp::tag::attribute::edgeMode, Mode)
+  {
+    edgeMode_ = mpl::at<edge_mode_to_enum, Mode>::type::value;
+  }
+
+protected:
+  EdgeMode & edgeMode_;
+};
+
+class feGaussianBlurContext: 
+  public FilterElementBaseContext,
+  public ElementWithInputContext<svgpp::tag::attribute::in>,
+  public ElementWithEdgeModeContext
+{
+public:
+  feGaussianBlurContext(FilterContext & parent)
+    : FilterElementBaseContext(data_, parent.primitiveLengthFactory())
+    , ElementWithInputContext<svgpp::tag::attribute::in>(data_.input_)
+    , ElementWithEdgeModeContext(data_.edgeMode_)
+    , parent_(parent)
+  {
+  }
+
+  void on_exit_element() const 
+  {
+    parent_.addElement(data_);
+  }
+
+  using FilterElementBaseContext::set;
+  using ElementWithInputContext<svgpp::tag::attribute::in>::set;
+  using ElementWithEdgeModeContext::set;
+
+  void set(svgpp::tag::attribute::stdDeviation, double val)
+  { 
+    data_.stdDeviationX_ = val; 
+    data_.stdDeviationY_ = val; 
+  }
+
+  void set(svgpp::tag::attribute::stdDeviation, double x, double y)
+  { 
+    data_.stdDeviationX_ = x; 
+    data_.stdDeviationY_ = y; 
+  }
+
+private:
+  FilterContext & parent_;
+  feGaussianBlur data_;
+};
+
+class feMorphologyContext: 
+  public FilterElementBaseContext,
+  public ElementWithInputContext<svgpp::tag::attribute::in>
+{
+public:
+  feMorphologyContext(FilterContext & parent)
+    : FilterElementBaseContext(data_, parent.primitiveLengthFactory())
+    , ElementWithInputContext<svgpp::tag::attribute::in>(data_.input_)
+    , parent_(parent)
+  {
+  }
+
+  void on_exit_element() const 
+  {
+    parent_.addElement(data_);
+  }
+
+  using FilterElementBaseContext::set;
+  using ElementWithInputContext<svgpp::tag::attribute::in>::set;
+
+  void set(svgpp::tag::attribute::operator_, svgpp::tag::value::erode)
+  { data_.operator_ = feMorphology::opErode; }
+
+  void set(svgpp::tag::attribute::operator_, svgpp::tag::value::dilate)
+  { data_.operator_ = feMorphology::opDilate; }
+
+  void set(svgpp::tag::attribute::radius, double val)
+  { 
+    data_.radiusX_ = val; 
+    data_.radiusY_ = val; 
+  }
+
+  void set(svgpp::tag::attribute::radius, double x, double y)
+  { 
+    data_.radiusX_ = x; 
+    data_.radiusY_ = y; 
+  }
+
+private:
+  FilterContext & parent_;
+  feMorphology data_;
+};
+
+class feConvolveMatrixContext: 
+  public FilterElementBaseContext,
+  public ElementWithInputContext<svgpp::tag::attribute::in>,
+  public ElementWithEdgeModeContext
+{
+public:
+  feConvolveMatrixContext(FilterContext & parent)
+    : FilterElementBaseContext(data_, parent.primitiveLengthFactory())
+    , ElementWithInputContext<svgpp::tag::attribute::in>(data_.input_)
+    , ElementWithEdgeModeContext(data_.edgeMode_)
+    , parent_(parent)
+  {
+  }
+
+  void on_exit_element() const 
+  {
+    parent_.addElement(data_);
+  }
+
+  using FilterElementBaseContext::set;
+  using ElementWithInputContext<svgpp::tag::attribute::in>::set;
+  using ElementWithEdgeModeContext::set;
+
+  void set(svgpp::tag::attribute::order, double val)
+  { 
+    data_.orderX_ = val; 
+    data_.orderY_ = val; 
+  }
+
+  void set(svgpp::tag::attribute::order, double x, double y)
+  { 
+    data_.orderX_ = x; 
+    data_.orderY_ = y; 
+  }
+
+  template<class Values>
+  void set(svgpp::tag::attribute::kernelMatrix, Values const & values)
+  {
+    data_.kernelMatrix_.assign(boost::begin(values), boost::end(values));
+  }
+
+  void set(svgpp::tag::attribute::divisor, double val)
+  { data_.divisor_ = val; }
+
+  void set(svgpp::tag::attribute::bias, double val)
+  { data_.bias_ = val; }
+
+  void set(svgpp::tag::attribute::targetX, int val)
+  { data_.targetX_ = val; }
+
+  void set(svgpp::tag::attribute::targetY, int val)
+  { data_.targetY_ = val; }
+
+  void set(svgpp::tag::attribute::preserveAlpha, svgpp::tag::value::true_)
+  { data_.preserveAlpha_ = true; }
+
+  void set(svgpp::tag::attribute::preserveAlpha, svgpp::tag::value::false_)
+  { data_.preserveAlpha_ = false; }
+
+private:
+  FilterContext & parent_;
+  feConvolveMatrix data_;
+};
+
+class feTurbulenceContext: 
+  public FilterElementBaseContext
+{
+public:
+  feTurbulenceContext(FilterContext & parent)
+    : FilterElementBaseContext(data_, parent.primitiveLengthFactory())
+    , parent_(parent)
+  {
+  }
+
+  void on_exit_element() const 
+  {
+    parent_.addElement(data_);
+  }
+
+  using FilterElementBaseContext::set;
+
+  void set(svgpp::tag::attribute::baseFrequency, double val)
+  { 
+    data_.baseFrequencyX_ = val; 
+    data_.baseFrequencyY_ = val; 
+  }
+
+  void set(svgpp::tag::attribute::baseFrequency, double x, double y)
+  { 
+    data_.baseFrequencyX_ = x; 
+    data_.baseFrequencyY_ = y; 
+  }
+
+  void set(svgpp::tag::attribute::numOctaves, int val)
+  { data_.numOctaves_ = val; }
+
+  void set(svgpp::tag::attribute::seed, double val)
+  { data_.seed_ = val; }
+
+  void set(svgpp::tag::attribute::stitchTiles, svgpp::tag::value::stitch)
+  { data_.stitchTiles_ = true; }
+
+  void set(svgpp::tag::attribute::stitchTiles, svgpp::tag::value::noStitch)
+  { data_.stitchTiles_ = false; }
+
+  void set(svgpp::tag::attribute::type, svgpp::tag::value::fractalNoise)
+  { data_.fractalNoise_ = true; }
+
+  void set(svgpp::tag::attribute::type, svgpp::tag::value::turbulence)
+  { data_.fractalNoise_ = false; }
+
+private:
+  FilterContext & parent_;
+  feTurbulence data_;
+};
+
+template<bool Specular>
+class feLightingContext: 
+  public FilterElementBaseContext,
+  public ElementWithInputContext<svgpp::tag::attribute::in>
+{
+public:
+  feLightingContext(FilterContext & parent)
+    : FilterElementBaseContext(data_, parent.primitiveLengthFactory())
+    , ElementWithInputContext<svgpp::tag::attribute::in>(data_.input_)
+    , parent_(parent)
+  {
+    data_.specular_ = Specular;
+  }
+
+  void on_exit_element() const 
+  {
+    parent_.addElement(data_);
+  }
+
+  LightSource & lightSource() 
+  { 
+    return data_.light_; 
+  }
+
+  using FilterElementBaseContext::set;
+  using ElementWithInputContext<svgpp::tag::attribute::in>::set;
+
+  // Properties of ancestors aren't tracked while filter is compiled, so 'inherit' and 'currentColor' 
+  // keep the initial white. Values from 'style' attribute come here as well
+  void set(svgpp::tag::attribute::lighting_color, svgpp::tag::value::inherit)
+  {}
+
+  void set(svgpp::tag::attribute::lighting_color, svgpp::tag::value::currentColor)
+  {}
+
+  void set(svgpp::tag::attribute::lighting_color, color_t color, svgpp::tag::skip_icc_color = svgpp::tag::skip_icc_color())
+  { data_.lighting_color_ = color; }
+
+  void set(svgpp::tag::attribute::surfaceScale, double val)
+  { data_.surfaceScale_ = val; }
+
+  void set(svgpp::tag::attribute::diffuseConstant, double val)
+  { data_.diffuseConstant_ = val; }
+
+  void set(svgpp::tag::attribute::specularConstant, double val)
+  { data_.specularConstant_ = val; }
+
+  void set(svgpp::tag::attribute::specularExponent, double val)
+  { data_.specularExponent_ = val; }
+
+private:
+  FilterContext & parent_;
+  feLighting data_;
+};
+
+template<LightSource::Type Type>
+class LightSourceContext
+{
+public:
+  template<class LightingContext>
+  LightSourceContext(LightingContext & parent)
+    : target_(parent.lightSource())
+  {
+    data_.type_ = Type;
+  }
+
+  void on_exit_element() const 
+  {
+    // Only the first light source is used
+    if (target_.type_ == LightSource::lsNone)
+      target_ = data_;
+  }
+
+  void set(svgpp::tag::attribute::azimuth, double val)  { data_.azimuth_ = val; }
+  void set(svgpp::tag::attribute::elevation, double val)  { data_.elevation_ = val; }
+  void set(svgpp::tag::attribute::x, double val)  { data_.x_ = val; }
+  void set(svgpp::tag::attribute::y, double val)  { data_.y_ = val; }
+  void set(svgpp::tag::attribute::z, double val)  { data_.z_ = val; }
+  void set(svgpp::tag::attribute::pointsAtX, double val)  { data_.pointsAtX_ = val; }
+  void set(svgpp::tag::attribute::pointsAtY, double val)  { data_.pointsAtY_ = val; }
+  void set(svgpp::tag::attribute::pointsAtZ, double val)  { data_.pointsAtZ_ = val; }
+  void set(svgpp::tag::attribute::specularExponent, double val)  { data_.specularExponent_ = val; }
+  void set(svgpp::tag::attribute::limitingConeAngle, double val)  { data_.limitingConeAngle_ = val; }
+
+private:
+  LightSource & target_;
+  LightSource data_;
+};
+
 struct context_factories
 {
   template<class ParentContext, class ElementTag>
@@ -616,63 +1106,204 @@ struct context_factories::apply<FilterContext, svgpp::tag::element::feColorMatri
 };
 
 template<>
-struct context_factories::apply<feComponentTransferContext, svgpp::tag::element::feFuncA>
+struct context_factories::apply<FilterContext, svgpp::tag::element::feGaussianBlur>
 {
-  typedef svgpp::factory::context::on_stack<feFuncContext<feComponentTransfer::argbA> > type;
+  typedef svgpp::factory::context::on_stack<feGaussianBlurContext> type;
 };
 
 template<>
-struct context_factories::apply<feComponentTransferContext, svgpp::tag::element::feFuncR>
+struct context_factories::apply<FilterContext, svgpp::tag::element::feMorphology>
 {
-  typedef svgpp::factory::context::on_stack<feFuncContext<feComponentTransfer::argbR> > type;
+  typedef svgpp::factory::context::on_stack<feMorphologyContext> type;
 };
 
 template<>
-struct context_factories::apply<feComponentTransferContext, svgpp::tag::element::feFuncG>
+struct context_factories::apply<FilterContext, svgpp::tag::element::feConvolveMatrix>
 {
-  typedef svgpp::factory::context::on_stack<feFuncContext<feComponentTransfer::argbG> > type;
+  typedef svgpp::factory::context::on_stack<feConvolveMatrixContext> type;
 };
 
 template<>
-struct context_factories::apply<feComponentTransferContext, svgpp::tag::element::feFuncB>
+struct context_factories::apply<FilterContext, svgpp::tag::element::feTurbulence>
 {
-  typedef svgpp::factory::context::on_stack<feFuncContext<feComponentTransfer::argbB> > type;
+  typedef svgpp::factory::context::on_stack<feTurbulenceContext> type;
 };
 
-class BlendView: public IFilterView
+template<>
+struct context_factories::apply<FilterContext, svgpp::tag::element::feDiffuseLighting>
 {
-public:
-  BlendView(feBlend const & fe, IFilterViewPtr const & in1, IFilterViewPtr const & in2)
-    : fe_(fe)
-    , in1_(in1)
-    , in2_(in2)
-  {}
+  typedef svgpp::factory::context::on_stack<feLightingContext<false> > type;
+};
 
-  virtual gil::rgba8c_view_t view() 
-  {
-    if (in1_)
-    {
-      image_.recreate(in1_->view().dimensions());
-      switch(fe_.mode_)
-      {
-      case feBlend::mNormal:
-        gil::transform_pixels(in1_->view(), in2_->view(), gil::view(image_), 
-          svgpp::gil_utility::blend_pixel<svgpp::tag::value::normal>());
-        break;
-      case feBlend::mMultiply:
-        gil::transform_pixels(in1_->view(), in2_->view(), gil::view(image_),
-          svgpp::gil_utility::blend_pixel<svgpp::tag::value::multiply>());
-        break;
+template<>
+struct context_factories::apply<FilterContext, svgpp::tag::element::feSpecularLighting>
+{
+  typedef svgpp::factory::context::on_stack<feLightingContext<true> > type;
+};
+
+template<bool Specular>
+struct context_factories::apply<feLightingContext<Specular>, svgpp::tag::element::feDistantLight>
+{
+  typedef svgpp::factory::context::on_stack<LightSourceContext<LightSource::lsDistant> > type;
+};
+
+template<bool Specular>
+struct context_factories::apply<feLightingContext<Specular>, svgpp::tag::element::fePointLight>
+{
+  typedef svgpp::factory::context::on_stack<LightSourceContext<LightSource::lsPoint> > type;
+};
+
+template<bool Specular>
+struct context_factories::apply<feLightingContext<Specular>, svgpp::tag::element::feSpotLight>
+{
+  typedef svgpp::factory::context::on_stack<LightSourceContext<LightSource::lsSpot> > type;
+};
+
+template<>
+struct context_factories::apply<feComponentTransferContext, svgpp::tag::element::feFuncA>
+{
+  typedef svgpp::factory::context::on_stack<feFuncContext<feComponentTransfer::argbA> > type;
+};
+
+template<>
+struct context_factories::apply<feComponentTransferContext, svgpp::tag::element::feFuncR>
+{
+  typedef svgpp::factory::context::on_stack<feFuncContext<feComponentTransfer::argbR> > type;
+};
+
+template<>
+struct context_factories::apply<feComponentTransferContext, svgpp::tag::element::feFuncG>
+{
+  typedef svgpp::factory::context::on_stack<feFuncContext<feComponentTransfer::argbG> > type;
+};
+
+template<>
+struct context_factories::apply<feComponentTransferContext, svgpp::tag::element::feFuncB>
+{
+  typedef svgpp::factory::context::on_stack<feFuncContext<feComponentTransfer::argbB> > type;
+};
+
+// Size of filter region and primitive subregion inside it
+struct PrimitiveRegion
+{
+  gil::rgba8_image_t::point_t size_;
+  Filters::Region subregion_;
+  ThreadPool * threadPool_; // Rows of subregion are split between its threads, NULL to use calling thread only
+};
+
+namespace
+{
+  // Number of rows in the part of work given to a thread, about 16K pixels
+  int rowGrain(int width)
+  {
+    return std::max(1, 16384 / std::max(1, width));
+  }
+
+  // Color matrix functors are processed by whole row SIMD kernels
+  template<class SrcView, class DstView, class F>
+  void transformRowsUnary(SrcView const & src, DstView const & dst, F const & f, int begin, int end)
+  {
+    svgpp::gil_utility::transform_pixels(
+      gil::subimage_view(src, 0, begin, src.width(), end - begin),
+      gil::subimage_view(dst, 0, begin, dst.width(), end - begin), f);
+  }
+
+  // Blend and composite functors are processed by whole row SIMD kernels
+  template<class Src1View, class Src2View, class DstView, class F>
+  void transformRowsBinary(Src1View const & src1, Src2View const & src2, DstView const & dst, F const & f, int begin, int end)
+  {
+    svgpp::gil_utility::transform_pixels(
+      gil::subimage_view(src1, 0, begin, src1.width(), end - begin),
+      gil::subimage_view(src2, 0, begin, src2.width(), end - begin),
+      gil::subimage_view(dst, 0, begin, dst.width(), end - begin), f);
+  }
+}
+
+// Primitive result covers whole filter region, but only pixels inside primitive 
+// subregion are processed, the rest are transparent black
+class PrimitiveView: public IFilterView
+{
+protected:
+  PrimitiveView(PrimitiveRegion const & region)
+    : region_(region)
+  {}
+
+  // Returns subregion of newly created result image
+  gil::rgba8_view_t createImage()
+  {
+    if (region_.subregion_.width_ == region_.size_.x && region_.subregion_.height_ == region_.size_.y)
+      image_.recreate(region_.size_);
+    else
+      image_.recreate(region_.size_, gil::rgba8_pixel_t(0, 0, 0, 0), 0);
+    return subregionView(gil::view(image_));
+  }
+
+  template<class View>
+  View subregionView(View const & v) const
+  {
+    Filters::Region const & sub = region_.subregion_;
+    return gil::subimage_view(v, sub.x_, sub.y_, sub.width_, sub.height_);
+  }
+
+  gil::rgba8c_view_t inputView(IFilterViewPtr const & in) const
+  {
+    return subregionView(in->view());
+  }
+
+  template<class SrcView, class F>
+  void transformPixels(SrcView const & src, gil::rgba8_view_t const & dst, F const & f) const
+  {
+    ParallelFor(region_.threadPool_, dst.height(), rowGrain(dst.width()), 
+      boost::bind(&transformRowsUnary<SrcView, gil::rgba8_view_t, F>, src, dst, f, _1, _2));
+  }
+
+  template<class Src1View, class Src2View, class F>
+  void transformPixels(Src1View const & src1, Src2View const & src2, gil::rgba8_view_t const & dst, F const & f) const
+  {
+    ParallelFor(region_.threadPool_, dst.height(), rowGrain(dst.width()), 
+      boost::bind(&transformRowsBinary<Src1View, Src2View, gil::rgba8_view_t, F>, src1, src2, dst, f, _1, _2));
+  }
+
+  PrimitiveRegion const region_;
+  boost::gil::rgba8_image_t image_;
+};
+
+class BlendView: public PrimitiveView
+{
+public:
+  BlendView(feBlend const & fe, PrimitiveRegion const & region, IFilterViewPtr const & in1, IFilterViewPtr const & in2)
+    : PrimitiveView(region)
+    , fe_(fe)
+    , in1_(in1)
+    , in2_(in2)
+  {}
+
+  virtual gil::rgba8c_view_t view() 
+  {
+    if (in1_)
+    {
+      gil::rgba8_view_t dst = createImage();
+      gil::rgba8c_view_t src1 = inputView(in1_), src2 = inputView(in2_);
+      switch(fe_.mode_)
+      {
+      case feBlend::mNormal:
+        transformPixels(src1, src2, dst, 
+          svgpp::gil_utility::blend_pixel<svgpp::tag::value::normal>());
+        break;
+      case feBlend::mMultiply:
+        transformPixels(src1, src2, dst,
+          svgpp::gil_utility::blend_pixel<svgpp::tag::value::multiply>());
+        break;
       case feBlend::mScreen:
-        gil::transform_pixels(in1_->view(), in2_->view(), gil::view(image_),
+        transformPixels(src1, src2, dst,
           svgpp::gil_utility::blend_pixel<svgpp::tag::value::screen>());
         break;
       case feBlend::mDarken:
-        gil::transform_pixels(in1_->view(), in2_->view(), gil::view(image_),
+        transformPixels(src1, src2, dst,
           svgpp::gil_utility::blend_pixel<svgpp::tag::value::darken>());
         break;
       case feBlend::mLighten:
-        gil::transform_pixels(in1_->view(), in2_->view(), gil::view(image_), 
+        transformPixels(src1, src2, dst, 
           svgpp::gil_utility::blend_pixel<svgpp::tag::value::lighten>());
         break;
       default:
@@ -687,14 +1318,14 @@ public:
 private:
   feBlend const fe_;
   IFilterViewPtr in1_, in2_;
-  boost::gil::rgba8_image_t image_;
 };
 
-class CompositeView: public IFilterView
+class CompositeView: public PrimitiveView
 {
 public:
-  CompositeView(feComposite const & fe, IFilterViewPtr const & in1, IFilterViewPtr const & in2)
-    : fe_(fe)
+  CompositeView(feComposite const & fe, PrimitiveRegion const & region, IFilterViewPtr const & in1, IFilterViewPtr const & in2)
+    : PrimitiveView(region)
+    , fe_(fe)
     , in1_(in1)
     , in2_(in2)
   {}
@@ -703,31 +1334,32 @@ public:
   {
     if (in1_)
     {
-      image_.recreate(in1_->view().dimensions());
+      gil::rgba8_view_t dst = createImage();
+      gil::rgba8c_view_t src1 = inputView(in1_), src2 = inputView(in2_);
       switch(fe_.operator_)
       {
       case feComposite::opOver:
-        gil::transform_pixels(in1_->view(), in2_->view(), gil::view(image_), 
+        transformPixels(src1, src2, dst, 
           svgpp::gil_utility::composite_pixel<svgpp::tag::value::over>());
         break;
       case feComposite::opIn:
-        gil::transform_pixels(in1_->view(), in2_->view(), gil::view(image_), 
+        transformPixels(src1, src2, dst, 
           svgpp::gil_utility::composite_pixel<svgpp::tag::value::in>());
         break;
       case feComposite::opOut:
-        gil::transform_pixels(in1_->view(), in2_->view(), gil::view(image_), 
+        transformPixels(src1, src2, dst, 
           svgpp::gil_utility::composite_pixel<svgpp::tag::value::out>());
         break;
       case feComposite::opAtop:
-        gil::transform_pixels(in1_->view(), in2_->view(), gil::view(image_), 
+        transformPixels(src1, src2, dst, 
           svgpp::gil_utility::composite_pixel<svgpp::tag::value::atop>());
         break;
       case feComposite::opXor:
-        gil::transform_pixels(in1_->view(), in2_->view(), gil::view(image_), 
+        transformPixels(src1, src2, dst, 
           svgpp::gil_utility::composite_pixel<svgpp::tag::value::xor_>());
         break;
       case feComposite::opArithmetic:
-        gil::transform_pixels(in1_->view(), in2_->view(), gil::view(image_), 
+        transformPixels(src1, src2, dst, 
           svgpp::gil_utility::composite_pixel_arithmetic<boost::gil::rgba8c_view_t::value_type>(fe_.k1_, fe_.k2_, fe_.k3_, fe_.k4_));
         break;
       default:
@@ -742,16 +1374,13 @@ public:
 private:
   feComposite const fe_;
   IFilterViewPtr in1_, in2_;
-  boost::gil::rgba8_image_t image_;
 };
 
 typedef boost::array<gil::bits8, 256> ChannelTransferTable;
 
 struct ComponentTransferPixel
 {
-  ComponentTransferPixel(ChannelTransferTable const * tables)
-    : tables_(tables)
-  {}
+  ComponentTransferPixel(feComponentTransfer const & fe);
 
   gil::rgba8_pixel_t operator()(const gil::rgba8_pixel_t & src) const 
   {
@@ -763,14 +1392,105 @@ struct ComponentTransferPixel
   }
 
 private:
-  ChannelTransferTable const * tables_;
+  ChannelTransferTable tables_[4];
 };
 
-class ComponentTransferView: public IFilterView
+ComponentTransferPixel::ComponentTransferPixel(feComponentTransfer const & fe)
+{
+  for(int ch = 0; ch < 4; ++ch)
+  {
+    ChannelTransferTable & table = tables_[ch];
+    feFunc const & func = fe.func_[ch];
+    switch(func.type_)
+    {
+    case feFunc::fTable:
+    case feFunc::fDiscrete: // TODO
+    case feFunc::fIdentity:
+      for(int i=0; i<256; ++i)
+        table[i] = i;
+      break;
+    case feFunc::fLinear:
+      // C' = slope * C + intercept
+      for(int i=0; i<256; ++i)
+        table[i] = svgpp::gil_detail::clamp_channel_bits8(static_cast<int>(func.slope_ * i + func.intercept_ * 255 + 0.49));
+      break;
+    case feFunc::fGamma:
+      for(int i=0; i<256; ++i)
+        // C' = amplitude * pow(C, exponent) + offset
+        table[i] = svgpp::gil_detail::clamp_channel_bits8(static_cast<int>(
+          (func.amplitude_ * std::pow(i / 255.0, func.exponent_) + func.offset_) * 255.0 + 0.49));
+      break;
+    default:
+      BOOST_ASSERT(false);
+    }
+  }
+}
+
+typedef svgpp::gil_utility::color_matrix_transform<gil::rgba8_pixel_t> ColorMatrixPixel;
+typedef svgpp::gil_utility::color_matrix_3x3_transform<gil::rgba8_pixel_t> ColorMatrix3x3Pixel;
+typedef svgpp::gil_utility::luminance_to_alpha_transform<gil::rgba8_pixel_t> LuminanceToAlphaPixel;
+
+// Matrix for all feColorMatrix types except luminanceToAlpha, 3x3 for saturate and hueRotate
+ColorMatrixPixel::matrix_t getColorMatrix(feColorMatrix const & fe)
+{
+  switch(fe.type_)
+  {
+  case feColorMatrix::mMatrix:
+  {
+    if (fe.values_ && fe.values_->size() != 20)
+      throw std::runtime_error("For feColorMatrix type=\"matrix\", 'values' must be a list of 20 values");
+    ColorMatrixPixel::matrix_t m(boost::extents[4][5]);
+    if (fe.values_)
+      m.assign(fe.values_->begin(), fe.values_->end());
+    else
+      for(int i=0; i<4; ++i)
+        m[i][i] = 1;
+    return m;
+  }
+  case feColorMatrix::mSaturate:
+  {
+    if (fe.values_ && fe.values_->size() != 1)
+      throw std::runtime_error("For feColorMatrix type=\"saturate\", 'values' must be single real number");
+    double saturate = fe.values_ ? fe.values_->front() : 1;
+    saturate = std::min(1.0, std::max(0.0, saturate));
+    return svgpp::gil_utility::get_saturate_matrix(saturate);
+  }
+  case feColorMatrix::mHueRotate:
+  {
+    if (fe.values_ && fe.values_->size() != 1)
+      throw std::runtime_error("For feColorMatrix type=\"hueRotate\", 'values' must be single real number");
+    double angle = fe.values_ ? fe.values_->front() : 0;
+    return svgpp::gil_utility::get_hue_rotate_matrix(angle * boost::math::constants::degree<double>());
+  }
+  default:
+    BOOST_ASSERT(false);
+    return ColorMatrixPixel::matrix_t();
+  }
+}
+
+gil::rgba8_pixel_t colorToPixel(color_t const & color, int alpha)
+{
+#if defined(RENDERER_AGG)
+  return gil::rgba8_pixel_t(color.r, color.g, color.b, alpha);
+#elif defined(RENDERER_GDIPLUS)
+  return gil::rgba8_pixel_t(color.GetR(), color.GetG(), color.GetB(), alpha);
+#elif defined(RENDERER_SKIA)
+  return gil::rgba8_pixel_t(SkColorGetR(color), SkColorGetG(color), SkColorGetB(color), alpha);
+#endif
+}
+
+gil::rgba8_pixel_t getFloodPixel(feFlood const & fe)
+{
+  int alpha = static_cast<int>(std::min(1.0, std::max(0.0, fe.flood_opacity_)) * 255 + 0.5);
+  return colorToPixel(fe.flood_color_, alpha);
+}
+
+class ComponentTransferView: public PrimitiveView
 {
 public:
-  ComponentTransferView(feComponentTransfer const & fe, IFilterViewPtr const & in)
-    : fe_(fe)
+  ComponentTransferView(feComponentTransfer const & fe, PrimitiveRegion const & region, IFilterViewPtr const & in)
+    : PrimitiveView(region)
+    , fe_(fe)
     , in_(in)
   {}
 
@@ -778,36 +1498,7 @@ public:
   {
     if (in_)
     {
-      image_.recreate(in_->view().dimensions());
-      ChannelTransferTable tables[4];
-      for(int ch = 0; ch < 4; ++ch)
-      {
-        ChannelTransferTable & table = tables[ch];
-        feFunc const & func = fe_.func_[ch];
-        switch(func.type_)
-        {
-        case feFunc::fTable:
-        case feFunc::fDiscrete: // TODO
-        case feFunc::fIdentity:
-          for(int i=0; i<256; ++i)
-            table[i] = i;
-          break;
-        case feFunc::fLinear:
-          // C' = slope * C + intercept
-          for(int i=0; i<256; ++i)
-            table[i] = svgpp::gil_detail::clamp_channel_bits8(static_cast<int>(func.slope_ * i + func.intercept_ * 255 + 0.49));
-          break;
-        case feFunc::fGamma:
-          for(int i=0; i<256; ++i)
-            // C' = amplitude * pow(C, exponent) + offset
-            table[i] = svgpp::gil_detail::clamp_channel_bits8(static_cast<int>(
-              (func.amplitude_ * std::pow(i / 255.0, func.exponent_) + func.offset_) * 255.0 + 0.49));
-          break;
-        default:
-          BOOST_ASSERT(false);
-        }
-      }
-      gil::transform_pixels(in_->view(), gil::view(image_), ComponentTransferPixel(tables));
+      transformPixels(inputView(in_), createImage(), ComponentTransferPixel(fe_));
       in_.reset();
     }
     return gil::const_view(image_);
@@ -816,32 +1507,35 @@ public:
 private:
   feComponentTransfer const fe_;
   IFilterViewPtr in_;
-  boost::gil::rgba8_image_t image_;
 };
 
-class OffsetView: public IFilterView
+class OffsetView: public PrimitiveView
 {
 public:
-  OffsetView(feOffset const & fe, IFilterViewPtr const & in)
-    : fe_(fe)
+  // dx, dy are in pixels of filter region
+  OffsetView(PrimitiveRegion const & region, int dx, int dy, IFilterViewPtr const & in)
+    : PrimitiveView(region)
+    , dx_(dx)
+    , dy_(dy)
     , in_(in)
   {}
 
   virtual gil::rgba8c_view_t view() 
   {
-    // TODO: use transform
     if (in_)
     {
-      image_.recreate(in_->view().dimensions(), gil::rgba8_pixel_t(0, 0, 0, 0), 0);
-      int w = image_.width() - std::abs(fe_.dx_);
-      int h = image_.height() - std::abs(fe_.dy_);
-      if (w > 0 && h > 0)
+      image_.recreate(region_.size_, gil::rgba8_pixel_t(0, 0, 0, 0), 0);
+      // Part of subregion that is covered by shifted input
+      Filters::Region const & sub = region_.subregion_;
+      int x0 = std::max<int>(sub.x_, dx_);
+      int y0 = std::max<int>(sub.y_, dy_);
+      int x1 = std::min<int>(sub.x_ + sub.width_, region_.size_.x + dx_);
+      int y1 = std::min<int>(sub.y_ + sub.height_, region_.size_.y + dy_);
+      if (x0 < x1 && y0 < y1)
       {
         gil::copy_pixels(
-          gil::subimage_view(in_->view(),  
-            std::max(0.0, -fe_.dx_), std::max(0.0, -fe_.dy_), w, h),
-          gil::subimage_view(gil::view(image_),  
-            std::max(0.0, fe_.dx_), std::max(0.0, fe_.dy_), w, h));
+          gil::subimage_view(in_->view(), x0 - dx_, y0 - dy_, x1 - x0, y1 - y0),
+          gil::subimage_view(gil::view(image_), x0, y0, x1 - x0, y1 - y0));
       }
       in_.reset();
     }
@@ -849,14 +1543,17 @@ public:
   }
 
 private:
-  feOffset const fe_;
+  int const dx_, dy_;
   IFilterViewPtr in_;
-  boost::gil::rgba8_image_t image_;
 };
 
-class MergeView: public IFilterView
+class MergeView: public PrimitiveView
 {
 public:
+  MergeView(PrimitiveRegion const & region)
+    : PrimitiveView(region)
+  {}
+
   void addNode(IFilterViewPtr const & in)
   {
     nodes_.push_back(in);
@@ -864,20 +1561,14 @@ public:
 
   virtual gil::rgba8c_view_t view() 
   {
-    // TODO: what if empty?
-    if (!nodes_.empty())
+    if (image_.width() == 0)
     {
-      image_.recreate(nodes_.front()->view().dimensions());
-      if (nodes_.size() == 1)
-        gil::copy_pixels(nodes_.front()->view(), gil::view(image_));
-      else
-      {
-        gil::transform_pixels(nodes_[0]->view(), nodes_[1]->view(), gil::view(image_), 
-          svgpp::gil_utility::composite_pixel<svgpp::tag::value::over>());
-        for(size_t i = 2; i < nodes_.size(); ++i)
-          gil::transform_pixels(gil::view(image_), nodes_[i]->view(), gil::view(image_), 
-            svgpp::gil_utility::composite_pixel<svgpp::tag::value::over>());
-      }
+      gil::rgba8_view_t dst = createImage();
+      std::vector<gil::rgba8c_view_t> inputs;
+      for(std::vector<IFilterViewPtr>::const_iterator node = nodes_.begin(); node != nodes_.end(); ++node)
+        inputs.push_back(inputView(*node));
+      ParallelFor(region_.threadPool_, dst.height(), rowGrain(dst.width()), 
+        boost::bind(&MergeView::mergeRows, boost::cref(inputs), dst, _1, _2));
       nodes_.clear();
     }
     return gil::const_view(image_);
@@ -885,89 +1576,72 @@ public:
 
 private:
   std::vector<IFilterViewPtr> nodes_;
-  boost::gil::rgba8_image_t image_;
+
+  static void mergeRows(std::vector<gil::rgba8c_view_t> const & inputs, gil::rgba8_view_t const & dstView, int begin, int end)
+  {
+    gil::rgba8_view_t dst = gil::subimage_view(dstView, 0, begin, dstView.width(), end - begin);
+    if (inputs.empty())
+      gil::fill_pixels(dst, gil::rgba8_pixel_t(0, 0, 0, 0));
+    else if (inputs.size() == 1)
+      gil::copy_pixels(gil::subimage_view(inputs[0], 0, begin, dst.width(), dst.height()), dst);
+    else
+    {
+      gil::transform_pixels(
+        gil::subimage_view(inputs[0], 0, begin, dst.width(), dst.height()), 
+        gil::subimage_view(inputs[1], 0, begin, dst.width(), dst.height()), dst, 
+        svgpp::gil_utility::composite_pixel<svgpp::tag::value::over>());
+      for(size_t i = 2; i < inputs.size(); ++i)
+        gil::transform_pixels(dst, gil::subimage_view(inputs[i], 0, begin, dst.width(), dst.height()), dst, 
+          svgpp::gil_utility::composite_pixel<svgpp::tag::value::over>());
+    }
+  }
 };
 
-class FloodView: public IFilterView
+class FloodView: public PrimitiveView
 {
 public:
-  FloodView(feFlood const & fe)
-    : fe_(fe)
+  FloodView(feFlood const & fe, PrimitiveRegion const & region)
+    : PrimitiveView(region)
+    , fe_(fe)
   {}
 
   virtual gil::rgba8c_view_t view() 
   {
     if (image_.width() == 0)
-    {
-      //image_.recreate(in_->view().dimensions(), gil::rgba8_pixel_t(0, 0, 0, 0), 0);
-    }
+      gil::fill_pixels(createImage(), getFloodPixel(fe_));
     return gil::const_view(image_);
   }
 
 private:
   feFlood const fe_;
-  boost::gil::rgba8_image_t image_;
 };
 
-class ColorMatrixView: public IFilterView
+class ColorMatrixView: public PrimitiveView
 {
 public:
-  ColorMatrixView(feColorMatrix const & fe, IFilterViewPtr const & input)
-    : fe_(fe)
+  ColorMatrixView(feColorMatrix const & fe, PrimitiveRegion const & region, IFilterViewPtr const & input)
+    : PrimitiveView(region)
     , in_(input)
+    , fe_(fe)
   {}
 
   virtual gil::rgba8c_view_t view() 
   {
     if (in_)
     {
-      typedef svgpp::gil_utility::color_matrix_transform<boost::gil::rgba8c_view_t::value_type> transform_t;
-      image_.recreate(in_->view().dimensions());
       switch(fe_.type_)
       {
-      case feColorMatrix::mMatrix:
-      {
-        if (fe_.values_ && fe_.values_->size() != 20)
-          throw std::runtime_error("For feColorMatrix type=\"matrix\", 'values' must be a list of 20 values");
-        boost::multi_array<double, 2> m(boost::extents[4][5]);
-        if (fe_.values_)
-          m.assign(fe_.values_->begin(), fe_.values_->end());
-        else
-          for(int i=0; i<4; ++i)
-            m[i][i] = 1;
-        gil::transform_pixels(in_->view(), gil::view(image_), transform_t(m));
-      }
-      break;
-      case feColorMatrix::mSaturate:
-      {
-        if (fe_.values_ && fe_.values_->size() != 1)
-          throw std::runtime_error("For feColorMatrix type=\"saturate\", 'values' must be single real number");
-        double saturate = fe_.values_ ? fe_.values_->front() : 1;
-        saturate = std::min(1.0, std::max(0.0, saturate));
-        gil::transform_pixels(in_->view(), gil::view(image_), 
-          transform_t(svgpp::gil_utility::get_saturate_matrix(saturate)));
-      }
-      break;
-      case feColorMatrix::mHueRotate:
-      {
-        if (fe_.values_ && fe_.values_->size() != 1)
-          throw std::runtime_error("For feColorMatrix type=\"hueRotate\", 'values' must be single real number");
-        double angle = fe_.values_ ? fe_.values_->front() : 0;
-        gil::transform_pixels(in_->view(), gil::view(image_), 
-          transform_t(svgpp::gil_utility::get_hue_rotate_matrix(angle * boost::math::constants::degree<double>())));
-      }
-      break;
       case feColorMatrix::mLuminanceToAlpha:
-      {
-        gil::copy_pixels(
-          gil::color_converted_view<gil::rgba8_pixel_t>(
-            in_->view(),
-            svgpp::gil_utility::rgba_to_mask_color_converter<boost::gil::alpha_t>()
-          ),
-          gil::view(image_));
-      }
-      break;
+        transformPixels(inputView(in_), createImage(), LuminanceToAlphaPixel());
+        break;
+      case feColorMatrix::mMatrix:
+        transformPixels(inputView(in_), createImage(), ColorMatrixPixel(getColorMatrix(fe_)));
+        break;
+      default:
+        transformPixels(inputView(in_), createImage(), ColorMatrix3x3Pixel(getColorMatrix(fe_)));
+        break;
       }
+      in_.reset();
     }
     return gil::const_view(image_);
   }
@@ -975,142 +1649,2214 @@ public:
 private:
   IFilterViewPtr in_;
   feColorMatrix const fe_;
-  boost::gil::rgba8_image_t image_;
 };
 
-class AlphaChannelView: public IFilterView
+namespace
 {
-public:
-  AlphaChannelView(IFilterViewPtr const & in)
-    : in_(in)
-  {}
+  // Premultiplied channel value in 8.8 fixed point, so that rounding errors don't accumulate between passes
+  typedef boost::uint16_t BlurChannel;
 
-  virtual gil::rgba8c_view_t view() 
+  // One-dimensional gaussian blur of lines of premultiplied RGBA pixels. Small deviations use 
+  // exact kernel, larger ones three successive box blurs as described in SVG specification.
+  // Four channels of a pixel are processed as lanes of SSE2 vector if it is available
+  class GaussianBlurLine
   {
-    if (in_)
+  public:
+    explicit GaussianBlurLine(double deviation)
+      : reach_(0)
     {
-      image_.recreate(in_->view().dimensions(), gil::rgba8_pixel_t(0, 0, 0, 0), 0);
-      gil::copy_pixels(
-        gil::kth_channel_view<gil::color_index_type<gil::rgba8_pixel_t, gil::alpha_t>::value>(in_->view()), 
-        gil::kth_channel_view<gil::color_index_type<gil::rgba8_pixel_t, gil::alpha_t>::value>(gil::view(image_)));
-      in_.reset();
+      if (deviation <= 0)
+        return;
+      if (deviation < 2.0)
+      {
+        int const radius = static_cast<int>(std::ceil(deviation * 3));
+        std::vector<double> weights(2 * radius + 1);
+        double sum = 0;
+        for(int i = -radius; i <= radius; ++i)
+          sum += weights[i + radius] = std::exp(-i * i / (2 * deviation * deviation));
+        kernel_.resize(weights.size());
+        boost::uint32_t total = 0;
+        for(size_t i = 0; i < weights.size(); ++i)
+          total += kernel_[i] = static_cast<boost::uint32_t>(weights[i] / sum * KernelOne + 0.5);
+        kernel_[radius] += KernelOne - total; // Keeps brightness after rounding
+        reach_ = radius;
+      }
+      else
+      {
+        int const d = static_cast<int>(std::floor(
+          deviation * 3 * std::sqrt(2 * boost::math::constants::pi<double>()) / 4 + 0.5));
+        if (d % 2)
+        {
+          boxes_.push_back(Box(d, d / 2));
+          boxes_.push_back(Box(d, d / 2));
+          boxes_.push_back(Box(d, d / 2));
+        }
+        else
+        {
+          // Centered between output pixel and the one to the left, then to the right
+          boxes_.push_back(Box(d, d / 2));
+          boxes_.push_back(Box(d, d / 2 - 1));
+          boxes_.push_back(Box(d + 1, d / 2));
+        }
+        for(std::vector<Box>::const_iterator box = boxes_.begin(); box != boxes_.end(); ++box)
+          reach_ += std::max(box->left_, box->size_ - 1 - box->left_);
+      }
     }
-    return gil::const_view(image_);
-  }
 
-private:
-  IFilterViewPtr in_;
-  boost::gil::rgba8_image_t image_;
-};
+    bool identity() const { return reach_ == 0; }
 
-struct FilterElementVisitor:
-  public boost::static_visitor<>,
-  boost::noncopyable
-{
-  FilterElementVisitor(Filters::Input const & input)
-    : input_(input)
-  {}
+    // Number of pixels at each side that affect the result
+    int reach() const { return reach_; }
 
-  void operator()(feBlend const & fe)
-  {
-    boost::shared_ptr<BlendView> feView(new BlendView(fe, findInput(fe.input1_), findInput(fe.input2_)));
-    if (!fe.result_.empty())
-      namedFilters_[fe.result_] = feView;
-    lastFilter_ = feView;
-  }
+    // Blurs 'length' pixels of 'line' using 'buffer' of the same size, 
+    // returns pointer to one of them that contains the result
+    BlurChannel const * apply(BlurChannel * line, BlurChannel * buffer, int length) const
+    {
+      if (!kernel_.empty())
+      {
+        convolve(line, buffer, length);
+        return buffer;
+      }
+      for(std::vector<Box>::const_iterator box = boxes_.begin(); box != boxes_.end(); ++box)
+      {
+        boxBlur(line, buffer, length, box->size_, box->left_);
+        std::swap(line, buffer);
+      }
+      return line;
+    }
+
+  private:
+    static const boost::uint32_t KernelOne = 1 << 16;
+
+    struct Box
+    {
+      Box(int size, int left)
+        : size_(size), left_(left)
+      {}
+
+      int size_, left_; // Window of pixel x is [x - left_, x - left_ + size_)
+    };
+
+    std::vector<boost::uint32_t> kernel_;
+    std::vector<Box> boxes_;
+    int reach_;
+
+    void convolve(BlurChannel const * src, BlurChannel * dst, int length) const
+    {
+      int const radius = reach_;
+      for(int x = 0; x < length; ++x, dst += 4)
+      {
+        int const i0 = std::max(-radius, -x), i1 = std::min(radius, length - 1 - x);
+#if defined(SVGPP_GIL_SSE2)
+        typedef svgpp::gil_detail::sse2_ops ops;
+        // Products and their sum fit 32 bits as unsigned values, as weights sum to KernelOne
+        ops::vec sum = ops::set1_32(KernelOne / 2);
+        for(int i = i0; i <= i1; ++i)
+          sum = ops::add32(sum, ops::mullo32(ops::set1_32(kernel_[i + radius]), ops::load_words32(src + 4 * (x + i))));
+        ops::store_words32(dst, ops::shift_right32(sum, 16));
+#else
+        boost::uint32_t sum[4] = { KernelOne / 2, KernelOne / 2, KernelOne / 2, KernelOne / 2 };
+        for(int i = i0; i <= i1; ++i)
+        {
+          BlurChannel const * p = src + 4 * (x + i);
+          boost::uint32_t const w = kernel_[i + radius];
+          for(int c = 0; c < 4; ++c)
+            sum[c] += w * p[c];
+        }
+        for(int c = 0; c < 4; ++c)
+          dst[c] = static_cast<BlurChannel>(sum[c] >> 16);
+#endif
+      }
+    }
+
+    // Sliding window sum, pixels outside of the line are transparent
+    static void boxBlur(BlurChannel const * src, BlurChannel * dst, int length, int size, int left)
+    {
+      // Fixed point reciprocal of 'size' replaces division
+      boost::uint64_t const scale = ((boost::uint64_t(1) << 32) + size / 2) / size;
+      int const right = size - 1 - left;
+#if defined(SVGPP_GIL_SSE2)
+      // Boxes are at least 4 pixels wide, so the reciprocal fits 32 bits
+      typedef svgpp::gil_detail::sse2_ops ops;
+      ops::vec sum = ops::set1_32(0);
+      for(int i = 0; i <= right && i < length; ++i)
+        sum = ops::add32(sum, ops::load_words32(src + 4 * i));
+      ops::vec const max = ops::set1_32(255 << 8);
+      for(int x = 0; x < length; ++x, dst += 4)
+      {
+        ops::store_words32(dst, ops::min32(ops::mul_fixed32(sum, static_cast<boost::uint32_t>(scale)), max));
+        int const add = x + right + 1, remove = x - left;
+        if (add < length)
+          sum = ops::add32(sum, ops::load_words32(src + 4 * add));
+        if (remove >= 0)
+          sum = ops::sub32(sum, ops::load_words32(src + 4 * remove));
+      }
+#else
+      boost::uint32_t sum[4] = { 0, 0, 0, 0 };
+      for(int i = 0; i <= right && i < length; ++i)
+        for(int c = 0; c < 4; ++c)
+          sum[c] += src[4 * i + c];
+      for(int x = 0; x < length; ++x, dst += 4)
+      {
+        for(int c = 0; c < 4; ++c)
+          dst[c] = static_cast<BlurChannel>(std::min<boost::uint64_t>(255 << 8, 
+            (sum[c] * scale + (boost::uint64_t(1) << 31)) >> 32));
+        int const add = x + right + 1, remove = x - left;
+        if (add < length)
+          for(int c = 0; c < 4; ++c)
+            sum[c] += src[4 * add + c];
+        if (remove >= 0)
+          for(int c = 0; c < 4; ++c)
+            sum[c] -= src[4 * remove + c];
+      }
+#endif
+    }
+  };
 
-  void operator()(feComponentTransfer const & fe)
+  // Index of pixel that replaces pixel 'i' of the line according to 'edgeMode', -1 for transparent one
+  int edgeIndex(int i, int length, EdgeMode edgeMode)
   {
-    boost::shared_ptr<ComponentTransferView> feView(new ComponentTransferView(fe, findInput(fe.input_)));
-    if (!fe.result_.empty())
-      namedFilters_[fe.result_] = feView;
-    lastFilter_ = feView;
+    if (i >= 0 && i < length)
+      return i;
+    switch (edgeMode)
+    {
+    case emDuplicate:
+      return i < 0 ? 0 : length - 1;
+    case emWrap:
+      return (i % length + length) % length;
+    default:
+      return -1;
+    }
   }
 
-  void operator()(feOffset const & fe)
+  // Premultiplies 'length' pixels and 'pad' pixels at each side of them that are obtained according 
+  // to 'edgeMode'
+  template<class Iterator>
+  void gatherLine(Iterator const & line, int length, int pad, EdgeMode edgeMode, BlurChannel * out)
   {
-    boost::shared_ptr<OffsetView> feView(new OffsetView(fe, findInput(fe.input_)));
-    if (!fe.result_.empty())
-      namedFilters_[fe.result_] = feView;
-    lastFilter_ = feView;
+    for(int i = -pad; i < length + pad; ++i, out += 4)
+    {
+      int const j = edgeIndex(i, length, edgeMode);
+      if (j < 0)
+      {
+        std::fill(out, out + 4, 0);
+        continue;
+      }
+      gil::rgba8_pixel_t const p = line[j];
+      int const alpha = gil::at_c<3>(p);
+      out[0] = static_cast<BlurChannel>((gil::at_c<0>(p) * alpha * 256 + 127) / 255);
+      out[1] = static_cast<BlurChannel>((gil::at_c<1>(p) * alpha * 256 + 127) / 255);
+      out[2] = static_cast<BlurChannel>((gil::at_c<2>(p) * alpha * 256 + 127) / 255);
+      out[3] = static_cast<BlurChannel>(alpha << 8);
+    }
   }
 
-  void operator()(feComposite const & fe)
+  // Same for column of already premultiplied pixels that are 'stride' channels apart
+  void gatherColumn(BlurChannel const * column, std::ptrdiff_t stride, int length, int pad, EdgeMode edgeMode, 
+    BlurChannel * out)
   {
-    boost::shared_ptr<CompositeView> feView(new CompositeView(fe, findInput(fe.input1_), findInput(fe.input2_)));
-    if (!fe.result_.empty())
-      namedFilters_[fe.result_] = feView;
-    lastFilter_ = feView;
+    for(int i = -pad; i < length + pad; ++i, out += 4)
+    {
+      int const j = edgeIndex(i, length, edgeMode);
+      if (j < 0)
+        std::fill(out, out + 4, 0);
+      else
+        std::copy(column + stride * j, column + stride * j + 4, out);
+    }
   }
 
-  void operator()(feMerge const & fe)
+  struct PremultiplyPixel
   {
-    boost::shared_ptr<MergeView> feView(new MergeView);
-    for(std::vector<FilterInput>::const_iterator f = fe.inputs_.begin();
-      f != fe.inputs_.end(); ++f)
-      feView->addNode(findInput(*f));
-    if (!fe.result_.empty())
-      namedFilters_[fe.result_] = feView;
-    lastFilter_ = feView;
-  }
+    gil::rgba8_pixel_t operator()(gil::rgba8_pixel_t const & src) const
+    {
+      int const alpha = gil::get_color(src, gil::alpha_t());
+      return gil::rgba8_pixel_t(
+        (gil::at_c<0>(src) * alpha + 127) / 255, 
+        (gil::at_c<1>(src) * alpha + 127) / 255, 
+        (gil::at_c<2>(src) * alpha + 127) / 255, 
+        alpha);
+    }
+  };
 
-  void operator()(feFlood const & fe)
+  gil::rgba8_pixel_t demultiply(BlurChannel const * p)
   {
-    boost::shared_ptr<FloodView> feView(new FloodView(fe));
-    if (!fe.result_.empty())
-      namedFilters_[fe.result_] = feView;
-    lastFilter_ = feView;
+    int const alpha = (p[3] + 128) >> 8;
+    if (alpha == 0)
+      return gil::rgba8_pixel_t(0, 0, 0, 0);
+    // Color channels keep fractional bits
+    return gil::rgba8_pixel_t(
+      std::min(255, (p[0] * 255 + alpha * 128) / (alpha << 8)),
+      std::min(255, (p[1] * 255 + alpha * 128) / (alpha << 8)),
+      std::min(255, (p[2] * 255 + alpha * 128) / (alpha << 8)),
+      alpha);
   }
+}
 
-  void operator()(feColorMatrix const & fe)
+namespace
+{
+  // Minimum or maximum in the window of 2 * radius + 1 pixels by van Herk/Gil-Werman algorithm:
+  // line is split into blocks of window size, then for each pixel the window consists of 
+  // the end of one block and the start of the next one. It takes 3 comparisons per pixel 
+  // regardless of radius
+  class MorphologyLine
   {
-    boost::shared_ptr<ColorMatrixView> feView(new ColorMatrixView(fe, findInput(fe.input_)));
-    if (!fe.result_.empty())
-      namedFilters_[fe.result_] = feView;
-    lastFilter_ = feView;
-  }
+  public:
+    MorphologyLine(int radius, bool dilate)
+      : radius_(std::max(0, radius))
+      , dilate_(dilate)
+    {}
 
-  IFilterViewPtr const & lastFilter() { return lastFilter_; }
+    bool identity() const { return radius_ == 0; }
+    int reach() const { return radius_; }
+
+    // Results are valid for pixels that have 'reach()' pixels at each side
+    BlurChannel const * apply(BlurChannel * line, BlurChannel * buffer, int length) const
+    {
+      if (dilate_)
+        apply(line, buffer, length, MaxChannel());
+      else
+        apply(line, buffer, length, MinChannel());
+      return buffer;
+    }
+
+  private:
+    int const radius_;
+    bool const dilate_;
+
+    struct MinChannel 
+    { 
+      BlurChannel operator()(BlurChannel a, BlurChannel b) const { return a < b ? a : b; } 
+    };
+
+    struct MaxChannel 
+    { 
+      BlurChannel operator()(BlurChannel a, BlurChannel b) const { return a > b ? a : b; } 
+    };
+
+    template<class Op>
+    void apply(BlurChannel * line, BlurChannel * buffer, int length, Op op) const
+    {
+      int const window = 2 * radius_ + 1;
+      // Prefixes of blocks into 'buffer'
+      for(int i = 0; i < length; ++i)
+        for(int c = 0; c < 4; ++c)
+          buffer[4 * i + c] = i % window == 0 ? line[4 * i + c] : op(buffer[4 * (i - 1) + c], line[4 * i + c]);
+      // Suffixes of blocks in place
+      for(int i = length - 2; i >= 0; --i)
+        if ((i + 1) % window != 0)
+          for(int c = 0; c < 4; ++c)
+            line[4 * i + c] = op(line[4 * i + c], line[4 * (i + 1) + c]);
+      // Each result overwrites prefix that is no longer needed
+      for(int x = radius_; x < length - radius_; ++x)
+        for(int c = 0; c < 4; ++c)
+          buffer[4 * x + c] = op(line[4 * (x - radius_) + c], buffer[4 * (x + radius_) + c]);
+    }
+  };
+}
+
+// Applies separable filter in premultiplied colors: rows are filtered into 8.8 fixed point copy 
+// of the input, then columns of the subregion are filtered from it into the result, so that 
+// the result is rounded once. LineFilter is GaussianBlurLine or MorphologyLine
+template<class LineFilter>
+class SeparableView: public PrimitiveView
+{
+public:
+  SeparableView(PrimitiveRegion const & region, LineFilter const & filterX, LineFilter const & filterY, 
+    EdgeMode edgeMode, IFilterViewPtr const & in)
+    : PrimitiveView(region)
+    , filterX_(filterX)
+    , filterY_(filterY)
+    , edgeMode_(edgeMode)
+    , in_(in)
+  {}
+
+  virtual gil::rgba8c_view_t view() 
+  {
+    if (in_)
+    {
+      gil::rgba8_view_t dst = createImage();
+      if (filterX_.identity() && filterY_.identity())
+        gil::copy_pixels(inputView(in_), dst);
+      else
+      {
+        // Pixels outside of subregion affect it, so the whole input is used
+        gil::rgba8c_view_t src = in_->view();
+        // Part of input that affects the subregion, wrapped edges may bring any of its pixels
+        Filters::Region const & sub = region_.subregion_;
+        Filters::Region extent;
+        extent.width_ = src.width();
+        extent.height_ = src.height();
+        if (edgeMode_ != emWrap)
+        {
+          extent.x_ = std::max(0, sub.x_ - filterX_.reach());
+          extent.y_ = std::max(0, sub.y_ - filterY_.reach());
+          extent.width_ = std::min<int>(src.width(), sub.x_ + sub.width_ + filterX_.reach()) - extent.x_;
+          extent.height_ = std::min<int>(src.height(), sub.y_ + sub.height_ + filterY_.reach()) - extent.y_;
+        }
+        // Rows of the extent, filtered horizontally
+        std::vector<BlurChannel> rows(4 * size_t(extent.width_) * extent.height_);
+        ParallelFor(region_.threadPool_, extent.height_, rowGrain(extent.width_), 
+          boost::bind(&SeparableView::filterRows, this, src, &rows[0], extent, _1, _2));
+        ParallelFor(region_.threadPool_, dst.width(), std::max(1, 16384 / std::max(1, extent.height_)), 
+          boost::bind(&SeparableView::filterColumns, this, &rows[0], dst, extent, _1, _2));
+      }
+      in_.reset();
+    }
+    return gil::const_view(image_);
+  }
+
+private:
+  LineFilter const filterX_, filterY_;
+  EdgeMode const edgeMode_;
+  IFilterViewPtr in_;
+
+  // Row y of the extent goes to 'rows' + 4 * width * y
+  void filterRows(gil::rgba8c_view_t const & src, BlurChannel * rows, Filters::Region const & extent, 
+    int begin, int end) const
+  {
+    int const width = extent.width_, pad = filterX_.reach();
+    std::vector<BlurChannel> line(4 * (width + 2 * pad)), buffer(line.size());
+    for(int y = begin; y < end; ++y)
+    {
+      gatherLine(src.row_begin(extent.y_ + y) + extent.x_, width, pad, edgeMode_, &line[0]);
+      BlurChannel const * result = filterX_.identity() 
+        ? &line[0] + 4 * pad
+        : filterX_.apply(&line[0], &buffer[0], int(line.size() / 4)) + 4 * pad;
+      std::copy(result, result + 4 * width, rows + 4 * size_t(width) * y);
+    }
+  }
+
+  void filterColumns(BlurChannel const * rows, gil::rgba8_view_t const & dst, Filters::Region const & extent, 
+    int begin, int end) const
+  {
+    Filters::Region const & sub = region_.subregion_;
+    int const height = extent.height_, pad = filterY_.reach();
+    std::vector<BlurChannel> line(4 * (height + 2 * pad)), buffer(line.size());
+    for(int x = begin; x < end; ++x)
+    {
+      gatherColumn(rows + 4 * (sub.x_ + x - extent.x_), 4 * extent.width_, height, pad, edgeMode_, &line[0]);
+      BlurChannel const * result = filterY_.apply(&line[0], &buffer[0], int(line.size() / 4)) 
+        + 4 * (pad + sub.y_ - extent.y_);
+      for(gil::rgba8_view_t::y_iterator p = dst.col_begin(x); p != dst.col_end(x); ++p, result += 4)
+        *p = demultiply(result);
+    }
+  }
+};
+
+typedef SeparableView<GaussianBlurLine> GaussianBlurView;
+typedef SeparableView<MorphologyLine> MorphologyView;
+
+namespace
+{
+  // feConvolveMatrix kernel prepared for evaluation. Result at (x, y) is 
+  // sum of matrix_[i][j] * SOURCE(x - targetX_ + j, y - targetY_ + i) multiplied by scale_
+  struct ConvolutionKernel
+  {
+    int width_, height_, targetX_, targetY_;
+    std::vector<double> matrix_; // Kernel matrix rotated by 180 degrees, row by row
+    bool separable_;
+    std::vector<double> row_, column_; // matrix_[i][j] == column_[i] * row_[j] if separable_
+    bool integer_; // All coefficients used in evaluation are integers and sums can't overflow int32
+    double scale_, bias_;
+  };
+
+  bool isInteger(double value)
+  {
+    return value == std::floor(value) && std::abs(value) < 65536;
+  }
+
+  double sumOfAbsolute(std::vector<double> const & values)
+  {
+    double sum = 0;
+    for(std::vector<double>::const_iterator value = values.begin(); value != values.end(); ++value)
+      sum += std::abs(*value);
+    return sum;
+  }
+
+  ConvolutionKernel prepareConvolutionKernel(feConvolveMatrix const & fe)
+  {
+    if (fe.orderX_ < 1 || fe.orderY_ < 1 || !isInteger(fe.orderX_) || !isInteger(fe.orderY_))
+      throw std::runtime_error("Invalid feConvolveMatrix order");
+    ConvolutionKernel kernel;
+    kernel.width_ = static_cast<int>(fe.orderX_);
+    kernel.height_ = static_cast<int>(fe.orderY_);
+    if (fe.kernelMatrix_.size() != size_t(kernel.width_ * kernel.height_))
+      throw std::runtime_error("Number of kernelMatrix values doesn't match feConvolveMatrix order");
+    kernel.targetX_ = fe.targetX_.get_value_or(kernel.width_ / 2);
+    kernel.targetY_ = fe.targetY_.get_value_or(kernel.height_ / 2);
+    if (kernel.targetX_ < 0 || kernel.targetX_ >= kernel.width_ 
+      || kernel.targetY_ < 0 || kernel.targetY_ >= kernel.height_)
+      throw std::runtime_error("Invalid feConvolveMatrix target");
+    kernel.matrix_.assign(fe.kernelMatrix_.rbegin(), fe.kernelMatrix_.rend());
+
+    double divisor = std::accumulate(kernel.matrix_.begin(), kernel.matrix_.end(), 0.0);
+    if (fe.divisor_ && *fe.divisor_ != 0)
+      divisor = *fe.divisor_;
+    if (divisor == 0)
+      divisor = 1;
+    kernel.bias_ = fe.bias_;
+
+    // Rank-1 matrix is the product of its row and column that cross at the largest element
+    size_t pivot = 0;
+    for(size_t i = 1; i < kernel.matrix_.size(); ++i)
+      if (std::abs(kernel.matrix_[i]) > std::abs(kernel.matrix_[pivot]))
+        pivot = i;
+    double const pivotValue = kernel.matrix_[pivot];
+    int const pivotRow = int(pivot) / kernel.width_, pivotColumn = int(pivot) % kernel.width_;
+    kernel.separable_ = pivotValue != 0 && kernel.width_ > 1 && kernel.height_ > 1;
+    for(int i = 0; i < kernel.height_ && kernel.separable_; ++i)
+      for(int j = 0; j < kernel.width_ && kernel.separable_; ++j)
+      {
+        double const product = kernel.matrix_[i * kernel.width_ + pivotColumn] 
+          * kernel.matrix_[pivotRow * kernel.width_ + j] / pivotValue;
+        kernel.separable_ = std::abs(product - kernel.matrix_[i * kernel.width_ + j]) <= 1e-6 * std::abs(pivotValue);
+      }
+
+    kernel.integer_ = std::find_if(kernel.matrix_.begin(), kernel.matrix_.end(), 
+      !boost::bind(&isInteger, _1)) == kernel.matrix_.end();
+    kernel.scale_ = 1.0 / divisor;
+    if (kernel.separable_)
+    {
+      // Row and column are taken from integer matrix unscaled, division by pivot is moved to scale_
+      for(int j = 0; j < kernel.width_; ++j)
+        kernel.row_.push_back(kernel.matrix_[pivotRow * kernel.width_ + j]);
+      for(int i = 0; i < kernel.height_; ++i)
+        kernel.column_.push_back(kernel.matrix_[i * kernel.width_ + pivotColumn]);
+      kernel.scale_ /= pivotValue;
+    }
+    if (kernel.integer_)
+    {
+      // Integer accumulators must hold the sum of channels equal to 255 multiplied by absolute weights.
+      // Vertical pass of separable kernel accumulates such sums of the horizontal pass
+      double const worstSum = 255 * (kernel.separable_ 
+        ? sumOfAbsolute(kernel.row_) * sumOfAbsolute(kernel.column_) 
+        : sumOfAbsolute(kernel.matrix_));
+      kernel.integer_ = worstSum <= std::numeric_limits<boost::int32_t>::max();
+    }
+    return kernel;
+  }
+}
+
+// Lattice selector and gradient tables of the turbulence reference implementation in SVG specification.
+// Gradients of four channels are interleaved, so that channels are evaluated together
+struct TurbulenceLattice: boost::noncopyable
+{
+  enum { BSize = 0x100, BM = 0xff, PerlinN = 0x1000 };
+
+  explicit TurbulenceLattice(long seed)
+  {
+    seed = setupSeed(seed);
+    double gradient[4][BSize][2];
+    int i;
+    for(int k = 0; k < 4; ++k)
+      for(i = 0; i < BSize; ++i)
+      {
+        selector_[i] = i;
+        for(int j = 0; j < 2; ++j)
+          gradient[k][i][j] = double(((seed = random(seed)) % (BSize + BSize)) - BSize) / BSize;
+        double const s = std::sqrt(gradient[k][i][0] * gradient[k][i][0] + gradient[k][i][1] * gradient[k][i][1]);
+        gradient[k][i][0] /= s;
+        gradient[k][i][1] /= s;
+      }
+    while (--i)
+    {
+      int const k = selector_[i];
+      int const j = (seed = random(seed)) % BSize;
+      selector_[i] = selector_[j];
+      selector_[j] = k;
+    }
+    for(i = 0; i < BSize + BSize + 2; ++i)
+    {
+      if (i >= BSize)
+        selector_[i] = selector_[i - BSize];
+      for(int k = 0; k < 4; ++k)
+        for(int j = 0; j < 2; ++j)
+          gradient_[i][j][k] = gradient[k][i % BSize][j];
+    }
+  }
+
+  int selector_[BSize + BSize + 2];
+  double gradient_[BSize + BSize + 2][2][4];
+
+private:
+  static long setupSeed(long seed)
+  {
+    if (seed <= 0) 
+      seed = -(seed % (RandM - 1)) + 1;
+    if (seed > RandM - 1) 
+      seed = RandM - 1;
+    return seed;
+  }
+
+  static long random(long seed)
+  {
+    long result = RandA * (seed % RandQ) - RandR * (seed / RandQ);
+    if (result <= 0) 
+      result += RandM;
+    return result;
+  }
+
+  static const long RandM = 2147483647, RandA = 16807, RandQ = 127773, RandR = 2836;
+};
+
+// Affine map from pixels of filter region to user space
+struct PixelToUserSpace
+{
+  double x0_, y0_, xx_, xy_, yx_, yy_;
+
+  void apply(double x, double y, double & ux, double & uy) const
+  {
+    ux = x0_ + x * xx_ + y * xy_;
+    uy = y0_ + x * yx_ + y * yy_;
+  }
+};
+
+// Stitching frequencies and wrap positions are computed once per octave instead of per pixel
+class TurbulenceView: public PrimitiveView
+{
+public:
+  TurbulenceView(feTurbulence const & fe, PrimitiveRegion const & region, PixelToUserSpace const & mapping)
+    : PrimitiveView(region)
+    , fe_(fe)
+    , mapping_(mapping)
+    , baseFrequencyX_(fe.baseFrequencyX_)
+    , baseFrequencyY_(fe.baseFrequencyY_)
+    , done_(false)
+  {
+    if (fe.stitchTiles_)
+      setupStitching();
+  }
+
+  virtual gil::rgba8c_view_t view() 
+  {
+    if (!done_)
+    {
+      gil::rgba8_view_t dst = createImage();
+      ParallelFor(region_.threadPool_, dst.height(), rowGrain(dst.width()), 
+        boost::bind(&TurbulenceView::turbulenceRows, this, dst, _1, _2));
+      done_ = true;
+    }
+    return gil::const_view(image_);
+  }
+
+private:
+  struct StitchInfo
+  {
+    int width_, height_, wrapX_, wrapY_;
+  };
+
+  feTurbulence const fe_;
+  PixelToUserSpace const mapping_;
+  double baseFrequencyX_, baseFrequencyY_;
+  std::vector<StitchInfo> stitch_; // Per octave, empty if not stitching
+  bool done_;
+
+  void setupStitching()
+  {
+    // Tile is the subregion in user space
+    Filters::Region const & sub = region_.subregion_;
+    BoundingBox tile;
+    for(int i = 0; i < 4; ++i)
+    {
+      double x, y;
+      mapping_.apply(sub.x_ + (i & 1 ? sub.width_ : 0), sub.y_ + (i & 2 ? sub.height_ : 0), x, y);
+      tile.add(x, y);
+    }
+    double const tileWidth = tile.maxX_ - tile.minX_, tileHeight = tile.maxY_ - tile.minY_;
+    if (tileWidth <= 0 || tileHeight <= 0)
+      return;
+    // Frequencies are adjusted so that the tile borders are continuous
+    adjustFrequency(baseFrequencyX_, tileWidth);
+    adjustFrequency(baseFrequencyY_, tileHeight);
+    StitchInfo stitch;
+    stitch.width_ = int(tileWidth * baseFrequencyX_ + 0.5);
+    stitch.wrapX_ = int(tile.minX_ * baseFrequencyX_ + TurbulenceLattice::PerlinN + stitch.width_);
+    stitch.height_ = int(tileHeight * baseFrequencyY_ + 0.5);
+    stitch.wrapY_ = int(tile.minY_ * baseFrequencyY_ + TurbulenceLattice::PerlinN + stitch.height_);
+    for(int octave = 0; octave < fe_.numOctaves_; ++octave)
+    {
+      stitch_.push_back(stitch);
+      stitch.width_ *= 2;
+      stitch.wrapX_ = 2 * stitch.wrapX_ - TurbulenceLattice::PerlinN;
+      stitch.height_ *= 2;
+      stitch.wrapY_ = 2 * stitch.wrapY_ - TurbulenceLattice::PerlinN;
+    }
+  }
+
+  static void adjustFrequency(double & frequency, double tileSize)
+  {
+    if (frequency == 0)
+      return;
+    double const lo = std::floor(tileSize * frequency) / tileSize;
+    double const hi = std::ceil(tileSize * frequency) / tileSize;
+    frequency = frequency / lo < hi / frequency ? lo : hi;
+  }
+
+  static double sCurve(double t)
+  {
+    return t * t * (3. - 2. * t);
+  }
+
+  // Perlin noise of four channels at once
+  void noise(double x, double y, StitchInfo const * stitch, double * result) const
+  {
+    TurbulenceLattice const & lattice = *fe_.lattice_;
+    double t = x + TurbulenceLattice::PerlinN;
+    int bx0 = static_cast<int>(t), bx1 = bx0 + 1;
+    double const rx0 = t - static_cast<int>(t), rx1 = rx0 - 1.0;
+    t = y + TurbulenceLattice::PerlinN;
+    int by0 = static_cast<int>(t), by1 = by0 + 1;
+    double const ry0 = t - static_cast<int>(t), ry1 = ry0 - 1.0;
+    if (stitch)
+    {
+      if (bx0 >= stitch->wrapX_)
+        bx0 -= stitch->width_;
+      if (bx1 >= stitch->wrapX_)
+        bx1 -= stitch->width_;
+      if (by0 >= stitch->wrapY_)
+        by0 -= stitch->height_;
+      if (by1 >= stitch->wrapY_)
+        by1 -= stitch->height_;
+    }
+    bx0 &= TurbulenceLattice::BM;
+    bx1 &= TurbulenceLattice::BM;
+    by0 &= TurbulenceLattice::BM;
+    by1 &= TurbulenceLattice::BM;
+    int const i = lattice.selector_[bx0], j = lattice.selector_[bx1];
+    double const (&q00)[2][4] = lattice.gradient_[lattice.selector_[i + by0]];
+    double const (&q10)[2][4] = lattice.gradient_[lattice.selector_[j + by0]];
+    double const (&q01)[2][4] = lattice.gradient_[lattice.selector_[i + by1]];
+    double const (&q11)[2][4] = lattice.gradient_[lattice.selector_[j + by1]];
+    double const sx = sCurve(rx0), sy = sCurve(ry0);
+    for(int c = 0; c < 4; ++c)
+    {
+      double u = rx0 * q00[0][c] + ry0 * q00[1][c];
+      double v = rx1 * q10[0][c] + ry0 * q10[1][c];
+      double const a = u + sx * (v - u);
+      u = rx0 * q01[0][c] + ry1 * q01[1][c];
+      v = rx1 * q11[0][c] + ry1 * q11[1][c];
+      double const b = u + sx * (v - u);
+      result[c] = a + sy * (b - a);
+    }
+  }
+
+  void turbulenceRows(gil::rgba8_view_t const & dst, int begin, int end) const
+  {
+    Filters::Region const & sub = region_.subregion_;
+    for(int y = begin; y < end; ++y)
+    {
+      gil::rgba8_view_t::x_iterator out = dst.row_begin(y);
+      for(int x = 0; x < dst.width(); ++x, ++out)
+      {
+        double vx, vy;
+        mapping_.apply(sub.x_ + x, sub.y_ + y, vx, vy);
+        vx *= baseFrequencyX_;
+        vy *= baseFrequencyY_;
+        double sum[4] = { 0, 0, 0, 0 }, octave[4];
+        double ratio = 1;
+        for(int i = 0; i < fe_.numOctaves_; ++i)
+        {
+          noise(vx, vy, stitch_.empty() ? NULL : &stitch_[i], octave);
+          if (fe_.fractalNoise_)
+            for(int c = 0; c < 4; ++c)
+              sum[c] += octave[c] / ratio;
+          else
+            for(int c = 0; c < 4; ++c)
+              sum[c] += std::abs(octave[c]) / ratio;
+          vx *= 2;
+          vy *= 2;
+          ratio *= 2;
+        }
+        int value[4];
+        for(int c = 0; c < 4; ++c)
+        {
+          double const v = fe_.fractalNoise_ ? (sum[c] * 255 + 255) / 2 : sum[c] * 255;
+          value[c] = std::max(0, std::min(255, static_cast<int>(v + 0.5)));
+        }
+        *out = gil::rgba8_pixel_t(value[0], value[1], value[2], value[3]);
+      }
+    }
+  }
+};
+
+// Approximates pow(x, exponent) on [0, 1] by linear interpolation
+class PowerTable
+{
+public:
+  explicit PowerTable(double exponent)
+    : table_(Size + 2)
+  {
+    for(int i = 0; i <= Size; ++i)
+      table_[i] = static_cast<float>(std::pow(double(i) / Size, exponent));
+    table_[Size + 1] = table_[Size];
+  }
+
+  double operator()(double x) const
+  {
+    if (x <= 0)
+      return 0;
+    double const position = std::min(x, 1.0) * Size;
+    int const i = static_cast<int>(position);
+    return table_[i] + (position - i) * (table_[i + 1] - table_[i]);
+  }
+
+private:
+  enum { Size = 4096 };
+  std::vector<float> table_;
+};
+
+// Light source coordinates are in pixels of filter region, surfaceScale is in pixels too.
+// Surface normals are computed from three alpha rows at a time with Sobel kernels of the 
+// specification, edge pixels use the reduced kernels
+class LightingView: public PrimitiveView
+{
+public:
+  LightingView(feLighting const & fe, PrimitiveRegion const & region, LightSource const & light, 
+    double surfaceScale, IFilterViewPtr const & in)
+    : PrimitiveView(region)
+    , light_(light)
+    , specular_(fe.specular_)
+    , surfaceScale_(surfaceScale)
+    , constant_(fe.specular_ ? fe.specularConstant_ : fe.diffuseConstant_)
+    , specularPower_(std::min(128.0, std::max(1.0, fe.specularExponent_)))
+    , spotPower_(std::min(128.0, std::max(1.0, light.specularExponent_)))
+    , in_(in)
+  {
+    gil::rgba8_pixel_t const color = colorToPixel(fe.lighting_color_, 255);
+    color_[0] = gil::get_color(color, gil::red_t());
+    color_[1] = gil::get_color(color, gil::green_t());
+    color_[2] = gil::get_color(color, gil::blue_t());
+    if (light.type_ == LightSource::lsDistant)
+    {
+      double const azimuth = light.azimuth_ * boost::math::constants::pi<double>() / 180;
+      double const elevation = light.elevation_ * boost::math::constants::pi<double>() / 180;
+      lightVector_[0] = std::cos(azimuth) * std::cos(elevation);
+      lightVector_[1] = std::sin(azimuth) * std::cos(elevation);
+      lightVector_[2] = std::sin(elevation);
+    }
+    else if (light.type_ == LightSource::lsSpot)
+    {
+      double s[3] = { light.pointsAtX_ - light.x_, light.pointsAtY_ - light.y_, light.pointsAtZ_ - light.z_ };
+      normalize(s);
+      std::copy(s, s + 3, spotDirection_);
+      spotCosCone_ = light.limitingConeAngle_ 
+        ? std::cos(std::abs(*light.limitingConeAngle_) * boost::math::constants::pi<double>() / 180) 
+        : -1;
+    }
+  }
+
+  virtual gil::rgba8c_view_t view() 
+  {
+    if (in_)
+    {
+      gil::rgba8_view_t dst = createImage();
+      ParallelFor(region_.threadPool_, dst.height(), rowGrain(dst.width()), 
+        boost::bind(&LightingView::lightRows, this, inputView(in_), dst, _1, _2));
+      in_.reset();
+    }
+    return gil::const_view(image_);
+  }
+
+private:
+  LightSource const light_;
+  bool const specular_;
+  double const surfaceScale_;
+  double const constant_;
+  PowerTable const specularPower_, spotPower_;
+  double color_[3];
+  double lightVector_[3]; // Distant light only
+  double spotDirection_[3], spotCosCone_; // Spot light only
+  IFilterViewPtr in_;
+
+  static double normalize(double * v)
+  {
+    double const length = std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+    if (length > 0)
+      for(int i = 0; i < 3; ++i)
+        v[i] /= length;
+    return length;
+  }
+
+  static int alpha(gil::rgba8c_view_t::x_iterator row, int x)
+  {
+    return gil::get_color(row[x], gil::alpha_t());
+  }
+
+  void lightRows(gil::rgba8c_view_t const & src, gil::rgba8_view_t const & dst, int begin, int end) const
+  {
+    int const width = src.width(), height = src.height();
+    // Vertically weighted alpha and vertical alpha difference per column of current row
+    std::vector<int> columnSum(width), columnDifference(width);
+    for(int y = begin; y < end; ++y)
+    {
+      int const top = std::max(0, y - 1), bottom = std::min(height - 1, y + 1);
+      gil::rgba8c_view_t::x_iterator up = src.row_begin(top), middle = src.row_begin(y), down = src.row_begin(bottom);
+      for(int x = 0; x < width; ++x)
+      {
+        columnSum[x] = (top < y ? alpha(up, x) : 0) + 2 * alpha(middle, x) + (bottom > y ? alpha(down, x) : 0);
+        columnDifference[x] = alpha(down, x) - alpha(up, x);
+      }
+      double const factorX = -surfaceScale_ * 2 / (255 * (2 + (top < y) + (bottom > y)));
+      double const factorY = bottom > top ? -surfaceScale_ * 2 / (255 * (bottom - top)) : 0;
+      gil::rgba8_view_t::x_iterator out = dst.row_begin(y);
+      for(int x = 0; x < width; ++x, ++out)
+      {
+        int const left = std::max(0, x - 1), right = std::min(width - 1, x + 1);
+        double normal[3];
+        normal[0] = right > left ? factorX / (right - left) * (columnSum[right] - columnSum[left]) : 0;
+        normal[1] = factorY / (2 + (left < x) + (right > x)) * ((left < x ? columnDifference[left] : 0) 
+          + 2 * columnDifference[x] + (right > x ? columnDifference[right] : 0));
+        normal[2] = 1;
+        normalize(normal);
+        *out = shade(x, y, normal, surfaceScale_ * alpha(middle, x) / 255);
+      }
+    }
+  }
+
+  gil::rgba8_pixel_t shade(int x, int y, double const * normal, double z) const
+  {
+    double l[3], color[3] = { color_[0], color_[1], color_[2] };
+    if (light_.type_ == LightSource::lsDistant)
+      std::copy(lightVector_, lightVector_ + 3, l);
+    else
+    {
+      l[0] = light_.x_ - (region_.subregion_.x_ + x);
+      l[1] = light_.y_ - (region_.subregion_.y_ + y);
+      l[2] = light_.z_ - z;
+      normalize(l);
+      if (light_.type_ == LightSource::lsSpot)
+      {
+        double const minusLS = -(l[0] * spotDirection_[0] + l[1] * spotDirection_[1] + l[2] * spotDirection_[2]);
+        double const factor = minusLS < spotCosCone_ ? 0 : spotPower_(minusLS);
+        for(int c = 0; c < 3; ++c)
+          color[c] *= factor;
+      }
+    }
+
+    int result[3];
+    if (!specular_)
+    {
+      double const factor = constant_ * (normal[0] * l[0] + normal[1] * l[1] + normal[2] * l[2]);
+      for(int c = 0; c < 3; ++c)
+        result[c] = std::max(0, std::min(255, static_cast<int>(factor * color[c] + 0.5)));
+      return gil::rgba8_pixel_t(result[0], result[1], result[2], 255);
+    }
+
+    // Halfway vector for eye at infinity (0, 0, 1)
+    double h[3] = { l[0], l[1], l[2] + 1 };
+    normalize(h);
+    double const factor = constant_ * specularPower_(normal[0] * h[0] + normal[1] * h[1] + normal[2] * h[2]);
+    for(int c = 0; c < 3; ++c)
+      result[c] = std::max(0, std::min(255, static_cast<int>(factor * color[c] + 0.5)));
+    // Result is premultiplied with alpha being the maximum of color channels
+    int const a = std::max(result[0], std::max(result[1], result[2]));
+    if (a == 0)
+      return gil::rgba8_pixel_t(0, 0, 0, 0);
+    return gil::rgba8_pixel_t((result[0] * 255 + a / 2) / a, (result[1] * 255 + a / 2) / a, (result[2] * 255 + a / 2) / a, a);
+  }
+};
+
+namespace
+{
+  // Adds kernel[j] * src[4 * j + c] for j in [0, count) to sum[c] of four channels
+  template<class T>
+  void multiplyAccumulate(T * sum, T const * src, T const * kernel, int count)
+  {
+    for(int j = 0; j < count; ++j)
+      for(int c = 0; c < 4; ++c)
+        sum[c] += kernel[j] * src[4 * j + c];
+  }
+
+#if defined(SVGPP_GIL_SSE2)
+  // Four channels of integer pixel are lanes of a single vector
+  void multiplyAccumulate(boost::int32_t * sum, boost::int32_t const * src, boost::int32_t const * kernel, int count)
+  {
+    typedef svgpp::gil_detail::sse2_ops ops;
+    ops::vec acc = ops::load(reinterpret_cast<boost::uint8_t const *>(sum));
+    for(int j = 0; j < count; ++j)
+      acc = ops::add32(acc, 
+        ops::mullo32(ops::set1_32(kernel[j]), ops::load(reinterpret_cast<boost::uint8_t const *>(src + 4 * j))));
+    ops::store(reinterpret_cast<boost::uint8_t *>(sum), acc);
+  }
+#endif
+}
+
+// Integer kernels are evaluated with integer multiply-accumulate, others in single precision.
+// Input pixels that kernel covers are first copied into padded buffer with edge mode applied, 
+// so that the inner loops have no bounds checks and compiler may vectorize them
+class ConvolveMatrixView: public PrimitiveView
+{
+public:
+  ConvolveMatrixView(PrimitiveRegion const & region, ConvolutionKernel const & kernel, 
+    EdgeMode edgeMode, bool preserveAlpha, IFilterViewPtr const & in)
+    : PrimitiveView(region)
+    , kernel_(kernel)
+    , edgeMode_(edgeMode)
+    , preserveAlpha_(preserveAlpha)
+    , in_(in)
+  {}
+
+  virtual gil::rgba8c_view_t view() 
+  {
+    if (in_)
+    {
+      if (kernel_.integer_)
+        convolve<boost::int32_t>();
+      else
+        convolve<float>();
+      in_.reset();
+    }
+    return gil::const_view(image_);
+  }
+
+private:
+  ConvolutionKernel const kernel_;
+  EdgeMode const edgeMode_;
+  bool const preserveAlpha_;
+  IFilterViewPtr in_;
+
+  template<class T>
+  struct KernelPass
+  {
+    T const * src_;
+    int srcWidth_;
+    T const * kernel_;
+    int kernelWidth_, kernelHeight_;
+  };
+
+  template<class T>
+  void convolve()
+  {
+    gil::rgba8_view_t dst = createImage();
+    gil::rgba8c_view_t src = in_->view();
+    int const paddedWidth = dst.width() + kernel_.width_ - 1, paddedHeight = dst.height() + kernel_.height_ - 1;
+    std::vector<T> padded(4 * paddedWidth * paddedHeight);
+    ParallelFor(region_.threadPool_, paddedHeight, rowGrain(paddedWidth), 
+      boost::bind(&ConvolveMatrixView::padRows<T>, this, src, &padded[0], paddedWidth, _1, _2));
+    if (kernel_.separable_)
+    {
+      std::vector<T> row(kernel_.row_.begin(), kernel_.row_.end()), column(kernel_.column_.begin(), kernel_.column_.end());
+      std::vector<T> horizontal(4 * dst.width() * paddedHeight);
+      ParallelFor(region_.threadPool_, paddedHeight, rowGrain(dst.width()), 
+        boost::bind(&ConvolveMatrixView::convolveRows<T>, &padded[0], paddedWidth, &row[0], int(row.size()), 
+          &horizontal[0], int(dst.width()), _1, _2));
+      KernelPass<T> const pass = { &horizontal[0], int(dst.width()), &column[0], 1, int(column.size()) };
+      ParallelFor(region_.threadPool_, dst.height(), rowGrain(dst.width()), 
+        boost::bind(&ConvolveMatrixView::storeRows<T>, this, pass, src, dst, _1, _2));
+    }
+    else
+    {
+      std::vector<T> matrix(kernel_.matrix_.begin(), kernel_.matrix_.end());
+      KernelPass<T> const pass = { &padded[0], paddedWidth, &matrix[0], kernel_.width_, kernel_.height_ };
+      ParallelFor(region_.threadPool_, dst.height(), rowGrain(dst.width()), 
+        boost::bind(&ConvolveMatrixView::storeRows<T>, this, pass, src, dst, _1, _2));
+    }
+  }
+
+  // Padded pixel (x, y) is SOURCE(x - targetX, y - targetY) relative to the subregion
+  template<class T>
+  void padRows(gil::rgba8c_view_t const & src, T * padded, int paddedWidth, int begin, int end) const
+  {
+    Filters::Region const & sub = region_.subregion_;
+    for(int y = begin; y < end; ++y)
+    {
+      T * out = padded + 4 * paddedWidth * y;
+      int const sy = edgeIndex(sub.y_ + y - kernel_.targetY_, src.height(), edgeMode_);
+      for(int x = 0; x < paddedWidth; ++x, out += 4)
+      {
+        int const sx = edgeIndex(sub.x_ + x - kernel_.targetX_, src.width(), edgeMode_);
+        if (sx < 0 || sy < 0)
+        {
+          std::fill(out, out + 4, T(0));
+          continue;
+        }
+        gil::rgba8_pixel_t p = src(sx, sy);
+        if (!preserveAlpha_)
+          p = PremultiplyPixel()(p);
+        for(int c = 0; c < 4; ++c)
+          out[c] = T(p[c]);
+      }
+    }
+  }
+
+  // One-dimensional horizontal pass
+  template<class T>
+  static void convolveRows(T const * src, int srcWidth, T const * kernel, int kernelWidth, 
+    T * dst, int dstWidth, int begin, int end)
+  {
+    for(int y = begin; y < end; ++y)
+    {
+      T const * srcRow = src + 4 * srcWidth * y;
+      T * out = dst + 4 * dstWidth * y;
+      for(int x = 0; x < dstWidth; ++x, out += 4)
+      {
+        T sum[4] = { 0, 0, 0, 0 };
+        multiplyAccumulate(sum, srcRow + 4 * x, kernel, kernelWidth);
+        std::copy(sum, sum + 4, out);
+      }
+    }
+  }
+
+  // Two-dimensional pass that creates result pixels, is also used as vertical pass of separable kernel
+  template<class T>
+  void storeRows(KernelPass<T> const & pass, gil::rgba8c_view_t const & source, gil::rgba8_view_t const & dst, 
+    int begin, int end) const
+  {
+    Filters::Region const & sub = region_.subregion_;
+    for(int y = begin; y < end; ++y)
+    {
+      gil::rgba8_view_t::x_iterator out = dst.row_begin(y);
+      for(int x = 0; x < dst.width(); ++x, ++out)
+      {
+        T sum[4] = { 0, 0, 0, 0 };
+        for(int i = 0; i < pass.kernelHeight_; ++i)
+        {
+          T const * srcRow = pass.src_ + 4 * (pass.srcWidth_ * (y + i) + x);
+          multiplyAccumulate(sum, srcRow, pass.kernel_ + i * pass.kernelWidth_, pass.kernelWidth_);
+        }
+        *out = resultPixel(sum, source(sub.x_ + x, sub.y_ + y));
+      }
+    }
+  }
+
+  template<class T>
+  gil::rgba8_pixel_t resultPixel(T const * sum, gil::rgba8_pixel_t const & source) const
+  {
+    int value[4];
+    for(int c = 0; c < 4; ++c)
+      value[c] = std::max(0, std::min(255, 
+        static_cast<int>(std::floor(sum[c] * kernel_.scale_ + kernel_.bias_ * 255 + 0.5))));
+    if (preserveAlpha_)
+      return gil::rgba8_pixel_t(value[0], value[1], value[2], gil::get_color(source, gil::alpha_t()));
+    int const alpha = value[3];
+    if (alpha == 0)
+      return gil::rgba8_pixel_t(0, 0, 0, 0);
+    for(int c = 0; c < 3; ++c)
+      value[c] = (std::min(value[c], alpha) * 255 + alpha / 2) / alpha;
+    return gil::rgba8_pixel_t(value[0], value[1], value[2], alpha);
+  }
+};
+
+class AlphaChannelView: public IFilterView
+{
+public:
+  AlphaChannelView(IFilterViewPtr const & in)
+    : in_(in)
+  {}
+
+  virtual gil::rgba8c_view_t view() 
+  {
+    if (in_)
+    {
+      image_.recreate(in_->view().dimensions(), gil::rgba8_pixel_t(0, 0, 0, 0), 0);
+      gil::copy_pixels(
+        gil::kth_channel_view<gil::color_index_type<gil::rgba8_pixel_t, gil::alpha_t>::value>(in_->view()), 
+        gil::kth_channel_view<gil::color_index_type<gil::rgba8_pixel_t, gil::alpha_t>::value>(gil::view(image_)));
+      in_.reset();
+    }
+    return gil::const_view(image_);
+  }
+
+private:
+  IFilterViewPtr in_;
+  boost::gil::rgba8_image_t image_;
+};
+
+// Part of canvas sized input that is inside the filter region
+class FilterRegionView: public IFilterView
+{
+public:
+  FilterRegionView(IFilterViewPtr const & in, Filters::Region const & region)
+    : in_(in)
+    , region_(region)
+  {}
+
+  virtual gil::rgba8c_view_t view() 
+  {
+    return gil::subimage_view(in_->view(), region_.x_, region_.y_, region_.width_, region_.height_);
+  }
+
+private:
+  IFilterViewPtr in_;
+  Filters::Region const region_;
+};
+
+// Fused evaluation of point-wise primitives. Instead of creating an image per primitive, chain of
+// point-wise primitives is evaluated in one pass: each node produces short runs of pixels on request
+// of its consumer, and feOffset only shifts coordinates of the request. Nodes apply the same
+// per-pixel functions as the views above, so the result is identical
+class PixelSource
+{
+public:
+  enum { MaxRun = 256 }; // Keeps intermediate runs in L1 cache
+
+  virtual ~PixelSource() {}
+
+  // Creates images of not fused inputs, must be called before fetch()
+  virtual void prepare() = 0;
+  // Writes 'count' (up to MaxRun) pixels starting at (x, y) in filter region coordinates
+  virtual void fetch(int x, int y, int count, gil::rgba8_pixel_t * out) = 0;
+};
+
+typedef boost::shared_ptr<PixelSource> PixelSourcePtr;
+
+namespace
+{
+  gil::rgba8_pixel_t const TransparentPixel(0, 0, 0, 0);
+
+  // Clips run [x, x + count) by [begin, end), pixels outside are set to transparent
+  bool clipRun(int x, int count, int begin, int end, gil::rgba8_pixel_t * out, int & x0, int & x1)
+  {
+    x0 = std::min(x + count, std::max(x, begin));
+    x1 = std::max(x0, std::min(x + count, end));
+    std::fill(out, out + (x0 - x), TransparentPixel);
+    std::fill(out + (x1 - x), out + count, TransparentPixel);
+    return x0 < x1;
+  }
+}
+
+// Pixels of the image created by non-fused view, transparent outside of it
+class ViewPixelSource: public PixelSource
+{
+public:
+  ViewPixelSource(IFilterViewPtr const & in)
+    : in_(in)
+  {}
+
+  virtual void prepare()
+  {
+    view_ = in_->view();
+  }
+
+  virtual void fetch(int x, int y, int count, gil::rgba8_pixel_t * out)
+  {
+    int x0, x1;
+    if (y < 0 || y >= view_.height())
+      std::fill(out, out + count, TransparentPixel);
+    else if (clipRun(x, count, 0, view_.width(), out, x0, x1))
+      std::copy(view_.row_begin(y) + x0, view_.row_begin(y) + x1, out + (x0 - x));
+  }
+
+private:
+  IFilterViewPtr in_;
+  gil::rgba8c_view_t view_;
+};
+
+// Pixels outside of primitive subregion are transparent
+class PrimitivePixelSource: public PixelSource
+{
+public:
+  virtual void fetch(int x, int y, int count, gil::rgba8_pixel_t * out)
+  {
+    int x0, x1;
+    if (y < subregion_.y_ || y >= subregion_.y_ + subregion_.height_)
+      std::fill(out, out + count, TransparentPixel);
+    else if (clipRun(x, count, subregion_.x_, subregion_.x_ + subregion_.width_, out, x0, x1))
+      fetchSubregion(x0, y, x1 - x0, out + (x0 - x));
+  }
+
+protected:
+  PrimitivePixelSource(Filters::Region const & subregion)
+    : subregion_(subregion)
+  {}
+
+  virtual void fetchSubregion(int x, int y, int count, gil::rgba8_pixel_t * out) = 0;
+
+private:
+  Filters::Region const subregion_;
+};
+
+template<class PixelFunc>
+class UnaryPixelSource: public PrimitivePixelSource
+{
+public:
+  UnaryPixelSource(Filters::Region const & subregion, PixelFunc const & func, PixelSourcePtr const & in)
+    : PrimitivePixelSource(subregion)
+    , func_(func)
+    , in_(in)
+  {}
+
+  virtual void prepare()
+  {
+    in_->prepare();
+  }
+
+protected:
+  virtual void fetchSubregion(int x, int y, int count, gil::rgba8_pixel_t * out)
+  {
+    in_->fetch(x, y, count, out);
+    gil::rgba8_view_t const run = gil::interleaved_view(count, 1, out, count * sizeof(gil::rgba8_pixel_t));
+    svgpp::gil_utility::transform_pixels(run, run, func_);
+  }
+
+private:
+  PixelFunc const func_;
+  PixelSourcePtr in_;
+};
+
+template<class PixelFunc>
+class BinaryPixelSource: public PrimitivePixelSource
+{
+public:
+  BinaryPixelSource(Filters::Region const & subregion, PixelFunc const & func, 
+      PixelSourcePtr const & in1, PixelSourcePtr const & in2)
+    : PrimitivePixelSource(subregion)
+    , func_(func)
+    , in1_(in1)
+    , in2_(in2)
+  {}
+
+  virtual void prepare()
+  {
+    in1_->prepare();
+    in2_->prepare();
+  }
+
+protected:
+  virtual void fetchSubregion(int x, int y, int count, gil::rgba8_pixel_t * out)
+  {
+    gil::rgba8_pixel_t in2[MaxRun];
+    in1_->fetch(x, y, count, out);
+    in2_->fetch(x, y, count, in2);
+    // Same kernels as of unfused primitives, so that results match exactly
+    std::ptrdiff_t const stride = count * sizeof(gil::rgba8_pixel_t);
+    gil::rgba8_view_t const run = gil::interleaved_view(count, 1, out, stride);
+    svgpp::gil_utility::transform_pixels(run, gil::interleaved_view(count, 1, in2, stride), run, func_);
+  }
+
+private:
+  PixelFunc const func_;
+  PixelSourcePtr in1_, in2_;
+};
+
+template<class PixelFunc>
+PixelSourcePtr createUnaryPixelSource(Filters::Region const & subregion, PixelFunc const & func, PixelSourcePtr const & in)
+{
+  return PixelSourcePtr(new UnaryPixelSource<PixelFunc>(subregion, func, in));
+}
+
+template<class PixelFunc>
+PixelSourcePtr createBinaryPixelSource(Filters::Region const & subregion, PixelFunc const & func, 
+  PixelSourcePtr const & in1, PixelSourcePtr const & in2)
+{
+  return PixelSourcePtr(new BinaryPixelSource<PixelFunc>(subregion, func, in1, in2));
+}
+
+class OffsetPixelSource: public PrimitivePixelSource
+{
+public:
+  OffsetPixelSource(Filters::Region const & subregion, int dx, int dy, PixelSourcePtr const & in)
+    : PrimitivePixelSource(subregion)
+    , dx_(dx)
+    , dy_(dy)
+    , in_(in)
+  {}
+
+  virtual void prepare()
+  {
+    in_->prepare();
+  }
+
+protected:
+  virtual void fetchSubregion(int x, int y, int count, gil::rgba8_pixel_t * out)
+  {
+    in_->fetch(x - dx_, y - dy_, count, out);
+  }
+
+private:
+  int const dx_, dy_;
+  PixelSourcePtr in_;
+};
+
+class FloodPixelSource: public PrimitivePixelSource
+{
+public:
+  FloodPixelSource(Filters::Region const & subregion, gil::rgba8_pixel_t const & color)
+    : PrimitivePixelSource(subregion)
+    , color_(color)
+  {}
+
+  virtual void prepare()
+  {}
+
+protected:
+  virtual void fetchSubregion(int, int, int count, gil::rgba8_pixel_t * out)
+  {
+    std::fill(out, out + count, color_);
+  }
+
+private:
+  gil::rgba8_pixel_t const color_;
+};
+
+// Creates image for the last primitive in fused chain
+class FusedView: public IFilterView
+{
+public:
+  FusedView(gil::rgba8_image_t::point_t const & size, PixelSourcePtr const & root, ThreadPool * threadPool)
+    : size_(size)
+    , root_(root)
+    , threadPool_(threadPool)
+  {}
+
+  virtual gil::rgba8c_view_t view() 
+  {
+    if (root_)
+    {
+      root_->prepare();
+      image_.recreate(size_);
+      gil::rgba8_view_t dst = gil::view(image_);
+      // After prepare() pixel sources are only read, so rows may be fetched concurrently
+      ParallelFor(threadPool_, dst.height(), rowGrain(dst.width()), 
+        boost::bind(&FusedView::fetchRows, this, dst, _1, _2));
+      root_.reset();
+    }
+    return gil::const_view(image_);
+  }
+
+private:
+  gil::rgba8_image_t::point_t const size_;
+  PixelSourcePtr root_;
+  ThreadPool * const threadPool_;
+  boost::gil::rgba8_image_t image_;
+
+  void fetchRows(gil::rgba8_view_t const & dst, int begin, int end) const
+  {
+    for(int y = begin; y < end; ++y)
+      for(int x = 0; x < dst.width(); x += PixelSource::MaxRun)
+        root_->fetch(x, y, std::min<int>(PixelSource::MaxRun, dst.width() - x), dst.row_begin(y) + x);
+  }
+};
+
+struct FilterProgram
+{
+  ElementWithRegion region_;
+  bool filterUnitsUseObjectBoundingBox_;
+  bool primitiveUnitsUseObjectBoundingBox_;
+  std::vector<FilterElement> elements_;
+  std::vector<bool> fused_; // Result is evaluated inside of its only consumer, without creating image
+};
+
+namespace
+{
+  struct FilterElementBaseVisitor: boost::static_visitor<FilterElementBase &>
+  {
+    template<class Element>
+    FilterElementBase & operator()(Element & fe) const
+    {
+      return fe;
+    }
+  };
+
+  // Replaces 'result' references and implicit inputs with indices of primitives
+  class ResolveInputsVisitor: public boost::static_visitor<>
+  {
+  public:
+    ResolveInputsVisitor()
+      : current_(0)
+    {}
+
+    void operator()(feBlend & fe) const { resolve(fe.input1_); resolve(fe.input2_); }
+    void operator()(feComponentTransfer & fe) const { resolve(fe.input_); }
+    void operator()(feOffset & fe) const { resolve(fe.input_); }
+    void operator()(feComposite & fe) const { resolve(fe.input1_); resolve(fe.input2_); }
+    void operator()(feFlood &) const {}
+    void operator()(feColorMatrix & fe) const { resolve(fe.input_); }
+    void operator()(feGaussianBlur & fe) const { resolve(fe.input_); }
+    void operator()(feMorphology & fe) const { resolve(fe.input_); }
+    void operator()(feConvolveMatrix & fe) const { resolve(fe.input_); }
+    void operator()(feTurbulence &) const {}
+    void operator()(feLighting & fe) const { resolve(fe.input_); }
+
+    void operator()(feMerge & fe) const
+    {
+      for(std::vector<FilterInput>::iterator in = fe.inputs_.begin(); in != fe.inputs_.end(); ++in)
+        resolve(*in);
+    }
+
+    void next(svg_string_t const & result)
+    {
+      if (!result.empty())
+        namedResults_[result] = current_;
+      ++current_;
+    }
+
+  private:
+    typedef std::map<svg_string_t, int> NamedResults;
+    NamedResults namedResults_;
+    int current_;
+
+    void resolve(FilterInput & in) const
+    {
+      switch (in.source_)
+      {
+      case FilterInput::fiReference:
+      {
+        NamedResults::const_iterator f = namedResults_.find(in.reference_);
+        if (f == namedResults_.end())
+          throw std::runtime_error("Can't find filter element");
+        in.step_ = f->second;
+        break;
+      }
+      case FilterInput::fiNotSet:
+        if (current_ == 0)
+          in.source_ = FilterInput::fiSourceGraphic;
+        else
+        {
+          in.source_ = FilterInput::fiReference;
+          in.step_ = current_ - 1;
+        }
+        break;
+      default:
+        break;
+      }
+    }
+  };
+
+  struct IsPointwiseVisitor: boost::static_visitor<bool>
+  {
+    bool operator()(feMerge const &) const { return false; }
+    bool operator()(feGaussianBlur const &) const { return false; }
+    bool operator()(feMorphology const &) const { return false; }
+    bool operator()(feConvolveMatrix const &) const { return false; }
+    bool operator()(feTurbulence const &) const { return false; }
+    bool operator()(feLighting const &) const { return false; }
+
+    template<class Element>
+    bool operator()(Element const &) const { return true; }
+  };
+
+  struct CollectInputsVisitor: boost::static_visitor<>
+  {
+    void operator()(feBlend const & fe) { inputs_.push_back(&fe.input1_); inputs_.push_back(&fe.input2_); }
+    void operator()(feComponentTransfer const & fe) { inputs_.push_back(&fe.input_); }
+    void operator()(feOffset const & fe) { inputs_.push_back(&fe.input_); }
+    void operator()(feComposite const & fe) { inputs_.push_back(&fe.input1_); inputs_.push_back(&fe.input2_); }
+    void operator()(feFlood const &) {}
+    void operator()(feColorMatrix const & fe) { inputs_.push_back(&fe.input_); }
+    void operator()(feGaussianBlur const & fe) { inputs_.push_back(&fe.input_); }
+    void operator()(feMorphology const & fe) { inputs_.push_back(&fe.input_); }
+    void operator()(feConvolveMatrix const & fe) { inputs_.push_back(&fe.input_); }
+    void operator()(feTurbulence const &) {}
+    void operator()(feLighting const & fe) { inputs_.push_back(&fe.input_); }
+
+    void operator()(feMerge const & fe)
+    {
+      for(std::vector<FilterInput>::const_iterator in = fe.inputs_.begin(); in != fe.inputs_.end(); ++in)
+        inputs_.push_back(&*in);
+    }
+
+    std::vector<FilterInput const *> inputs_;
+  };
+
+  // Marks point-wise primitives whose result is used once by another point-wise primitive
+  void planFusion(FilterProgram & program)
+  {
+    size_t const count = program.elements_.size();
+    std::vector<int> uses(count, 0);
+    std::vector<bool> pointwiseConsumers(count, true);
+    for(size_t i = 0; i < count; ++i)
+    {
+      bool const pointwise = boost::apply_visitor(IsPointwiseVisitor(), program.elements_[i]);
+      CollectInputsVisitor inputs;
+      boost::apply_visitor(inputs, program.elements_[i]);
+      for(std::vector<FilterInput const *>::const_iterator in = inputs.inputs_.begin(); in != inputs.inputs_.end(); ++in)
+        if ((*in)->source_ == FilterInput::fiReference)
+        {
+          ++uses[(*in)->step_];
+          if (!pointwise)
+            pointwiseConsumers[(*in)->step_] = false;
+        }
+    }
+
+    program.fused_.assign(count, false);
+    for(size_t i = 0; i + 1 < count; ++i)
+      program.fused_[i] = uses[i] == 1 && pointwiseConsumers[i]
+        && boost::apply_visitor(IsPointwiseVisitor(), program.elements_[i]);
+  }
+
+  // Rounds rectangle out to whole pixels and clips it by 'bounds'
+  Filters::Region clipRegion(BoundingBox const & rect, Filters::Region const & bounds)
+  {
+    double const right = bounds.x_ + bounds.width_, bottom = bounds.y_ + bounds.height_;
+    double x0 = std::min(right, std::max<double>(bounds.x_, std::floor(rect.minX_)));
+    double y0 = std::min(bottom, std::max<double>(bounds.y_, std::floor(rect.minY_)));
+    double x1 = std::min(right, std::ceil(rect.maxX_));
+    double y1 = std::min(bottom, std::ceil(rect.maxY_));
+    Filters::Region result;
+    result.x_ = static_cast<int>(x0);
+    result.y_ = static_cast<int>(y0);
+    result.width_ = x1 > x0 ? static_cast<int>(x1 - x0) : 0;
+    result.height_ = y1 > y0 ? static_cast<int>(y1 - y0) : 0;
+    return result;
+  }
+}
+
+// Evaluates independent primitives concurrently. Primitive is started as soon as all 
+// its inputs are evaluated, intermediate images are released after their last use
+class FilterScheduler: boost::noncopyable
+{
+public:
+  FilterScheduler(ThreadPool & pool, std::vector<IFilterViewPtr> & results)
+    : pool_(pool)
+    , results_(results)
+    , nodes_(results.size())
+    , remaining_(0)
+    , queue_(boost::make_shared<ReadyQueue>(this))
+  {}
+
+  void addDependency(size_t consumer, size_t input)
+  {
+    std::vector<size_t> & inputs = nodes_[consumer].inputs_;
+    if (std::find(inputs.begin(), inputs.end(), input) == inputs.end())
+    {
+      inputs.push_back(input);
+      nodes_[input].consumers_.push_back(consumer);
+    }
+  }
+
+  // Evaluates 'target' and everything it depends on
+  void run(size_t target)
+  {
+    target_ = target;
+    std::vector<size_t> ready;
+    std::vector<size_t> stack(1, target);
+    nodes_[target].used_ = true;
+    while (!stack.empty())
+    {
+      Node & node = nodes_[stack.back()];
+      if (node.inputs_.empty())
+        ready.push_back(stack.back());
+      stack.pop_back();
+      ++remaining_;
+      node.pending_ = node.inputs_.size();
+      for(std::vector<size_t>::const_iterator in = node.inputs_.begin(); in != node.inputs_.end(); ++in)
+        if (!nodes_[*in].used_)
+        {
+          nodes_[*in].used_ = true;
+          stack.push_back(*in);
+        }
+    }
+    // Results that aren't used by the target are never evaluated
+    for(size_t i = 0; i < nodes_.size(); ++i)
+      for(std::vector<size_t>::const_iterator c = nodes_[i].consumers_.begin(); c != nodes_[i].consumers_.end(); ++c)
+        if (nodes_[*c].used_)
+          ++nodes_[i].usesLeft_;
+
+    boost::mutex::scoped_lock lock(queue_->mutex_);
+    for(std::vector<size_t>::const_iterator r = ready.begin(); r != ready.end(); ++r)
+      schedule(*r);
+    while (remaining_ > 0)
+    {
+      // Calling thread helps with primitives of this filter only. Other tasks of the pool may be 
+      // unrelated work, e.g. other documents of a batch, that must not run nested in this one
+      if (!queue_->nodes_.empty())
+      {
+        size_t const index = queue_->nodes_.front();
+        queue_->nodes_.pop_front();
+        lock.unlock();
+        runNode(index);
+        lock.lock();
+      }
+      else
+        queue_->finished_.wait(lock);
+    }
+    if (!error_.empty())
+      throw std::runtime_error(error_);
+  }
+
+private:
+  struct Node
+  {
+    Node()
+      : used_(false), pending_(0), usesLeft_(0)
+    {}
+
+    std::vector<size_t> inputs_, consumers_;
+    bool used_;
+    size_t pending_, usesLeft_;
+  };
+
+  // Primitives ready to be evaluated. Shared with tasks posted to the pool, that may run after 
+  // the scheduler is gone if the calling thread has already taken their primitives
+  struct ReadyQueue
+  {
+    explicit ReadyQueue(FilterScheduler * scheduler)
+      : scheduler_(scheduler)
+    {}
+
+    FilterScheduler * const scheduler_;
+    std::deque<size_t> nodes_;
+    boost::mutex mutex_; // Guards state of the scheduler too
+    boost::condition_variable finished_;
+  };
+
+  ThreadPool & pool_;
+  std::vector<IFilterViewPtr> & results_;
+  std::vector<Node> nodes_;
+  size_t target_;
+  size_t remaining_;
+  std::string error_;
+  boost::shared_ptr<ReadyQueue> const queue_;
+
+  // Must be called with the queue locked
+  void schedule(size_t index)
+  {
+    queue_->nodes_.push_back(index);
+    pool_.post(boost::bind(&FilterScheduler::runQueued, queue_));
+  }
+
+  static void runQueued(boost::shared_ptr<ReadyQueue> const & queue)
+  {
+    boost::mutex::scoped_lock lock(queue->mutex_);
+    if (queue->nodes_.empty())
+      return;
+    size_t const index = queue->nodes_.front();
+    queue->nodes_.pop_front();
+    lock.unlock();
+    // Scheduler waits until the taken primitive is finished
+    queue->scheduler_->runNode(index);
+  }
+
+  void runNode(size_t index)
+  {
+    std::string error;
+    {
+      boost::mutex::scoped_lock lock(queue_->mutex_);
+      error = error_;
+    }
+    // After the first error remaining primitives are only marked as finished
+    if (error.empty())
+    {
+      try
+      {
+        results_[index]->view();
+      }
+      catch (std::exception const & e)
+      {
+        error = e.what();
+      }
+    }
+
+    std::vector<IFilterViewPtr> released;
+    boost::mutex::scoped_lock lock(queue_->mutex_);
+    if (!error.empty() && error_.empty())
+      error_ = error;
+    Node const & node = nodes_[index];
+    for(std::vector<size_t>::const_iterator in = node.inputs_.begin(); in != node.inputs_.end(); ++in)
+      if (--nodes_[*in].usesLeft_ == 0 && *in != target_)
+      {
+        released.push_back(IFilterViewPtr());
+        released.back().swap(results_[*in]);
+      }
+    for(std::vector<size_t>::const_iterator c = node.consumers_.begin(); c != node.consumers_.end(); ++c)
+      if (nodes_[*c].used_ && --nodes_[*c].pending_ == 0)
+        schedule(*c);
+    lock.unlock();
+
+    released.clear();
+
+    lock.lock();
+    --remaining_;
+    queue_->finished_.notify_all();
+  }
+};
+
+// Binds compiled filter program to the inputs of particular invocation
+class FilterProgramExecutor:
+  public boost::static_visitor<IFilterViewPtr>,
+  boost::noncopyable
+{
+public:
+  FilterProgramExecutor(Filters::Input const & input, FilterProgram const & program, bool fusion, ThreadPool * threadPool)
+    : input_(input)
+    , program_(program)
+    , fusion_(fusion)
+    , threadPool_(threadPool)
+    , boundingBoxKnown_(input.boundingBox_ && !input.boundingBox_->empty())
+    , current_(0)
+  {}
+
+  // Returns false if filter region is empty and element must not be rendered
+  bool bindRegion(Filters::Region & region)
+  {
+    gil::rgba8c_view_t::point_t const canvasSize = input_.sourceGraphic_->view().dimensions();
+    Filters::Region canvasRegion;
+    canvasRegion.width_ = canvasSize.x;
+    canvasRegion.height_ = canvasSize.y;
+
+    ElementWithRegion const & filterRegion = program_.region_;
+    if (program_.filterUnitsUseObjectBoundingBox_ && !boundingBoxKnown_)
+    {
+      // Bounds aren't tracked for this element, whole canvas is used
+      filterRect_.add(0, 0);
+      filterRect_.add(canvasSize.x, canvasSize.y);
+    }
+    else
+      filterRect_ = toCanvas(program_.filterUnitsUseObjectBoundingBox_, 
+        *filterRegion.x_, *filterRegion.y_, *filterRegion.width_, *filterRegion.height_);
+    region_ = clipRegion(filterRect_, canvasRegion);
+    region = region_;
+    return region_.width_ != 0 && region_.height_ != 0;
+  }
+
+  // Primitives that aren't fused create an image of filter region size each
+  size_t resultImageCount() const
+  {
+    return std::count(program_.fused_.begin(), program_.fused_.end(), false);
+  }
+
+  IFilterViewPtr execute()
+  {
+    sourceGraphic_ = inRegion(input_.sourceGraphic_);
+    backgroundImage_ = inRegion(input_.backgroundImage_);
+    fillPaint_ = inRegion(input_.fillPaint_);
+    strokePaint_ = inRegion(input_.strokePaint_);
+
+    results_.reserve(program_.elements_.size());
+    if (fusion_)
+      sources_.resize(program_.elements_.size());
+    for(current_ = 0; current_ < program_.elements_.size(); ++current_)
+      results_.push_back(boost::apply_visitor(*this, program_.elements_[current_]));
+    IFilterViewPtr result = results_.back();
+    if (threadPool_)
+      evaluateConcurrently();
+    return result;
+  }
+
+  IFilterViewPtr operator()(feBlend const & fe) const
+  {
+    if (fusion_)
+    {
+      Filters::Region const subregion = primitiveRegion(fe).subregion_;
+      PixelSourcePtr in1 = fusedInput(fe.input1_), in2 = fusedInput(fe.input2_);
+      switch(fe.mode_)
+      {
+      case feBlend::mNormal:
+        return fusedResult(createBinaryPixelSource(subregion, 
+          svgpp::gil_utility::blend_pixel<svgpp::tag::value::normal>(), in1, in2));
+      case feBlend::mMultiply:
+        return fusedResult(createBinaryPixelSource(subregion, 
+          svgpp::gil_utility::blend_pixel<svgpp::tag::value::multiply>(), in1, in2));
+      case feBlend::mScreen:
+        return fusedResult(createBinaryPixelSource(subregion, 
+          svgpp::gil_utility::blend_pixel<svgpp::tag::value::screen>(), in1, in2));
+      case feBlend::mDarken:
+        return fusedResult(createBinaryPixelSource(subregion, 
+          svgpp::gil_utility::blend_pixel<svgpp::tag::value::darken>(), in1, in2));
+      case feBlend::mLighten:
+        return fusedResult(createBinaryPixelSource(subregion, 
+          svgpp::gil_utility::blend_pixel<svgpp::tag::value::lighten>(), in1, in2));
+      default:
+        BOOST_ASSERT(false);
+      }
+    }
+    return IFilterViewPtr(new BlendView(fe, primitiveRegion(fe), findInput(fe.input1_), findInput(fe.input2_)));
+  }
+
+  IFilterViewPtr operator()(feComponentTransfer const & fe) const
+  {
+    if (fusion_)
+      return fusedResult(createUnaryPixelSource(primitiveRegion(fe).subregion_, 
+        ComponentTransferPixel(fe), fusedInput(fe.input_)));
+    return IFilterViewPtr(new ComponentTransferView(fe, primitiveRegion(fe), findInput(fe.input_)));
+  }
+
+  IFilterViewPtr operator()(feOffset const & fe) const
+  {
+    int dx, dy;
+    offsetInPixels(fe, dx, dy);
+    if (fusion_)
+      return fusedResult(PixelSourcePtr(new OffsetPixelSource(primitiveRegion(fe).subregion_, 
+        dx, dy, fusedInput(fe.input_))));
+    return IFilterViewPtr(new OffsetView(primitiveRegion(fe), dx, dy, findInput(fe.input_)));
+  }
+
+  IFilterViewPtr operator()(feComposite const & fe) const
+  {
+    if (fusion_)
+    {
+      Filters::Region const subregion = primitiveRegion(fe).subregion_;
+      PixelSourcePtr in1 = fusedInput(fe.input1_), in2 = fusedInput(fe.input2_);
+      switch(fe.operator_)
+      {
+      case feComposite::opOver:
+        return fusedResult(createBinaryPixelSource(subregion, 
+          svgpp::gil_utility::composite_pixel<svgpp::tag::value::over>(), in1, in2));
+      case feComposite::opIn:
+        return fusedResult(createBinaryPixelSource(subregion, 
+          svgpp::gil_utility::composite_pixel<svgpp::tag::value::in>(), in1, in2));
+      case feComposite::opOut:
+        return fusedResult(createBinaryPixelSource(subregion, 
+          svgpp::gil_utility::composite_pixel<svgpp::tag::value::out>(), in1, in2));
+      case feComposite::opAtop:
+        return fusedResult(createBinaryPixelSource(subregion, 
+          svgpp::gil_utility::composite_pixel<svgpp::tag::value::atop>(), in1, in2));
+      case feComposite::opXor:
+        return fusedResult(createBinaryPixelSource(subregion, 
+          svgpp::gil_utility::composite_pixel<svgpp::tag::value::xor_>(), in1, in2));
+      case feComposite::opArithmetic:
+        return fusedResult(createBinaryPixelSource(subregion, 
+          svgpp::gil_utility::composite_pixel_arithmetic<gil::rgba8_pixel_t>(fe.k1_, fe.k2_, fe.k3_, fe.k4_), in1, in2));
+      default:
+        BOOST_ASSERT(false);
+      }
+    }
+    return IFilterViewPtr(new CompositeView(fe, primitiveRegion(fe), findInput(fe.input1_), findInput(fe.input2_)));
+  }
+
+  IFilterViewPtr operator()(feMerge const & fe) const
+  {
+    boost::shared_ptr<MergeView> feView(new MergeView(primitiveRegion(fe)));
+    for(std::vector<FilterInput>::const_iterator f = fe.inputs_.begin();
+      f != fe.inputs_.end(); ++f)
+      feView->addNode(findInput(*f));
+    return feView;
+  }
+
+  IFilterViewPtr operator()(feFlood const & fe) const
+  {
+    if (fusion_)
+      return fusedResult(PixelSourcePtr(new FloodPixelSource(primitiveRegion(fe).subregion_, getFloodPixel(fe))));
+    return IFilterViewPtr(new FloodView(fe, primitiveRegion(fe)));
+  }
+
+  IFilterViewPtr operator()(feColorMatrix const & fe) const
+  {
+    if (fusion_)
+    {
+      Filters::Region const subregion = primitiveRegion(fe).subregion_;
+      switch(fe.type_)
+      {
+      case feColorMatrix::mLuminanceToAlpha:
+        return fusedResult(createUnaryPixelSource(subregion, LuminanceToAlphaPixel(), fusedInput(fe.input_)));
+      case feColorMatrix::mMatrix:
+        return fusedResult(createUnaryPixelSource(subregion, ColorMatrixPixel(getColorMatrix(fe)), fusedInput(fe.input_)));
+      default:
+        return fusedResult(createUnaryPixelSource(subregion, ColorMatrix3x3Pixel(getColorMatrix(fe)), fusedInput(fe.input_)));
+      }
+    }
+    return IFilterViewPtr(new ColorMatrixView(fe, primitiveRegion(fe), findInput(fe.input_)));
+  }
+
+  IFilterViewPtr operator()(feGaussianBlur const & fe) const
+  {
+    number_t deviationX = fe.stdDeviationX_, deviationY = fe.stdDeviationY_;
+    if (deviationX < 0 || deviationY < 0)
+      deviationX = deviationY = 0; // Error that disables the effect
+    lengthsInPixels(deviationX, deviationY);
+    return IFilterViewPtr(new GaussianBlurView(primitiveRegion(fe), 
+      GaussianBlurLine(deviationX), GaussianBlurLine(deviationY), fe.edgeMode_, findInput(fe.input_)));
+  }
+
+  IFilterViewPtr operator()(feConvolveMatrix const & fe) const
+  {
+    // kernelUnitLength isn't supported, kernel is applied to canvas pixels
+    return IFilterViewPtr(new ConvolveMatrixView(primitiveRegion(fe), prepareConvolutionKernel(fe), 
+      fe.edgeMode_, fe.preserveAlpha_, findInput(fe.input_)));
+  }
+
+  IFilterViewPtr operator()(feTurbulence const & fe) const
+  {
+    if (fe.baseFrequencyX_ < 0 || fe.baseFrequencyY_ < 0 || fe.numOctaves_ < 0)
+      throw std::runtime_error("Invalid feTurbulence attributes");
+    return IFilterViewPtr(new TurbulenceView(fe, primitiveRegion(fe), pixelToUserSpace()));
+  }
+
+  IFilterViewPtr operator()(feLighting const & fe) const
+  {
+    // kernelUnitLength isn't supported, normals are computed on canvas pixels
+    LightSource light = fe.light_;
+    if (light.type_ == LightSource::lsNone)
+      throw std::runtime_error("Lighting filter primitive without light source");
+    if (light.type_ != LightSource::lsDistant)
+    {
+      pointInPixels(light.x_, light.y_, light.z_);
+      pointInPixels(light.pointsAtX_, light.pointsAtY_, light.pointsAtZ_);
+    }
+    return IFilterViewPtr(new LightingView(fe, primitiveRegion(fe), light, 
+      fe.surfaceScale_ * zLengthInPixels(), findInput(fe.input_)));
+  }
+
+  IFilterViewPtr operator()(feMorphology const & fe) const
+  {
+    number_t radiusX = fe.radiusX_, radiusY = fe.radiusY_;
+    if (radiusX < 0 || radiusY < 0)
+      radiusX = radiusY = 0; // Error that disables the effect
+    lengthsInPixels(radiusX, radiusY);
+    bool const dilate = fe.operator_ == feMorphology::opDilate;
+    // Outside of filter region input is transparent black
+    return IFilterViewPtr(new MorphologyView(primitiveRegion(fe), 
+      MorphologyLine(static_cast<int>(std::floor(radiusX + 0.5)), dilate), 
+      MorphologyLine(static_cast<int>(std::floor(radiusY + 0.5)), dilate), 
+      emNone, findInput(fe.input_)));
+  }
 
 private:
   Filters::Input const & input_;
-  typedef std::map<svg_string_t, IFilterViewPtr> NamedFilters;
-  NamedFilters namedFilters_;
-  IFilterViewPtr lastFilter_;
+  FilterProgram const & program_;
+  bool const fusion_;
+  ThreadPool * const threadPool_;
+  bool const boundingBoxKnown_;
+  BoundingBox filterRect_; // In canvas pixels, before rounding and clipping
+  Filters::Region region_;
+  IFilterViewPtr sourceGraphic_, backgroundImage_, fillPaint_, strokePaint_;
+  std::vector<IFilterViewPtr> results_;
+  mutable std::vector<PixelSourcePtr> sources_; // Fused primitives waiting for their consumer
+  size_t current_;
   mutable IFilterViewPtr sourceAlphaView_, backgroundAlphaView_;
 
+  // Views are evaluated lazily by default, here the whole graph is evaluated on the pool
+  void evaluateConcurrently()
+  {
+    FilterScheduler scheduler(*threadPool_, results_);
+    for(size_t step = 0; step < results_.size(); ++step)
+      if (results_[step])
+        addDependencies(scheduler, step, step);
+    scheduler.run(results_.size() - 1);
+  }
+
+  // Inputs of fused primitives are inputs of the primitive that evaluates them
+  void addDependencies(FilterScheduler & scheduler, size_t consumer, size_t step) const
+  {
+    CollectInputsVisitor inputs;
+    boost::apply_visitor(inputs, program_.elements_[step]);
+    for(std::vector<FilterInput const *>::const_iterator in = inputs.inputs_.begin(); in != inputs.inputs_.end(); ++in)
+      if ((*in)->source_ != FilterInput::fiReference)
+      {
+        // Shared inputs like SourceAlpha are evaluated beforehand, so that tasks only read them
+        if (IFilterViewPtr shared = findInput(**in))
+          shared->view();
+      }
+      else if (program_.fused_[(*in)->step_])
+        addDependencies(scheduler, consumer, (*in)->step_);
+      else
+        scheduler.addDependency(consumer, (*in)->step_);
+  }
+
+  // Fused primitive is either evaluated inside its consumer or creates an image itself
+  IFilterViewPtr fusedResult(PixelSourcePtr const & source) const
+  {
+    if (program_.fused_[current_])
+    {
+      sources_[current_] = source;
+      return IFilterViewPtr();
+    }
+    return IFilterViewPtr(new FusedView(gil::rgba8_image_t::point_t(region_.width_, region_.height_), source, threadPool_));
+  }
+
+  PixelSourcePtr fusedInput(FilterInput const & in) const
+  {
+    if (in.source_ == FilterInput::fiReference && program_.fused_[in.step_])
+    {
+      BOOST_ASSERT(sources_[in.step_]);
+      PixelSourcePtr source;
+      source.swap(sources_[in.step_]);
+      return source;
+    }
+    return PixelSourcePtr(new ViewPixelSource(findInput(in)));
+  }
+
+  // dx, dy are vector in primitiveUnits, they are rounded to whole pixels
+  void offsetInPixels(feOffset const & fe, int & dxPixels, int & dyPixels) const
+  {
+    number_t dx = fe.dx_, dy = fe.dy_;
+    if (program_.primitiveUnitsUseObjectBoundingBox_)
+    {
+      if (boundingBoxKnown_)
+      {
+        dx *= input_.boundingBox_->maxX_ - input_.boundingBox_->minX_;
+        dy *= input_.boundingBox_->maxY_ - input_.boundingBox_->minY_;
+      }
+    }
+    else if (input_.transform_)
+    {
+      number_t ox = 0, oy = 0;
+      TransformPoint(*input_.transform_, ox, oy);
+      TransformPoint(*input_.transform_, dx, dy);
+      dx -= ox;
+      dy -= oy;
+    }
+    dxPixels = static_cast<int>(std::floor(dx + 0.5));
+    dyPixels = static_cast<int>(std::floor(dy + 0.5));
+  }
+
+  // Lengths along x and y axes of primitiveUnits to canvas pixels
+  void lengthsInPixels(number_t & x, number_t & y) const
+  {
+    if (program_.primitiveUnitsUseObjectBoundingBox_)
+    {
+      if (boundingBoxKnown_)
+      {
+        x *= input_.boundingBox_->maxX_ - input_.boundingBox_->minX_;
+        y *= input_.boundingBox_->maxY_ - input_.boundingBox_->minY_;
+      }
+    }
+    else if (input_.transform_)
+    {
+      number_t ox = 0, oy = 0, xx = x, xy = 0, yx = 0, yy = y;
+      TransformPoint(*input_.transform_, ox, oy);
+      TransformPoint(*input_.transform_, xx, xy);
+      TransformPoint(*input_.transform_, yx, yy);
+      x = std::sqrt((xx - ox) * (xx - ox) + (xy - oy) * (xy - oy));
+      y = std::sqrt((yx - ox) * (yx - ox) + (yy - oy) * (yy - oy));
+    }
+  }
+
+  // Scale of lengths along z axis, that has no direction on canvas
+  number_t zLengthInPixels() const
+  {
+    if (program_.primitiveUnitsUseObjectBoundingBox_)
+    {
+      if (!boundingBoxKnown_)
+        return 1;
+      number_t const width = input_.boundingBox_->maxX_ - input_.boundingBox_->minX_;
+      number_t const height = input_.boundingBox_->maxY_ - input_.boundingBox_->minY_;
+      return std::sqrt((width * width + height * height) / 2);
+    }
+    if (!input_.transform_)
+      return 1;
+    number_t ox = 0, oy = 0, ax = 1, ay = 0, bx = 0, by = 1;
+    TransformPoint(*input_.transform_, ox, oy);
+    TransformPoint(*input_.transform_, ax, ay);
+    TransformPoint(*input_.transform_, bx, by);
+    return std::sqrt(std::abs((ax - ox) * (by - oy) - (bx - ox) * (ay - oy)));
+  }
+
+  // Point in primitiveUnits to pixels of filter region
+  void pointInPixels(number_t & x, number_t & y, number_t & z) const
+  {
+    if (program_.primitiveUnitsUseObjectBoundingBox_)
+    {
+      if (boundingBoxKnown_)
+      {
+        BoundingBox const & bbox = *input_.boundingBox_;
+        x = bbox.minX_ + x * (bbox.maxX_ - bbox.minX_);
+        y = bbox.minY_ + y * (bbox.maxY_ - bbox.minY_);
+      }
+    }
+    else if (input_.transform_)
+      TransformPoint(*input_.transform_, x, y);
+    x -= region_.x_;
+    y -= region_.y_;
+    z *= zLengthInPixels();
+  }
+
+  PixelToUserSpace pixelToUserSpace() const
+  {
+    // Images of origin and unit vectors of user space
+    number_t ox = 0, oy = 0, ax = 1, ay = 0, bx = 0, by = 1;
+    if (input_.transform_)
+    {
+      TransformPoint(*input_.transform_, ox, oy);
+      TransformPoint(*input_.transform_, ax, ay);
+      TransformPoint(*input_.transform_, bx, by);
+    }
+    ax -= ox; ay -= oy;
+    bx -= ox; by -= oy;
+    double const det = ax * by - bx * ay;
+    if (det == 0)
+      throw std::runtime_error("Non-invertible transform");
+    PixelToUserSpace result;
+    result.xx_ = by / det;
+    result.xy_ = -bx / det;
+    result.yx_ = -ay / det;
+    result.yy_ = ax / det;
+    double const cx = region_.x_ - ox, cy = region_.y_ - oy;
+    result.x0_ = result.xx_ * cx + result.xy_ * cy;
+    result.y0_ = result.yx_ * cx + result.yy_ * cy;
+    return result;
+  }
+
+  IFilterViewPtr inRegion(IFilterViewPtr const & in) const
+  {
+    return in ? IFilterViewPtr(new FilterRegionView(in, region_)) : IFilterViewPtr();
+  }
+
+  // Maps rectangle in filterUnits or primitiveUnits to canvas pixels.
+  // Bounding box is only known in canvas pixels, so for rotated or skewed elements 
+  // objectBoundingBox units are relative to its axis-aligned bounds
+  BoundingBox toCanvas(bool useObjectBoundingBox, number_t x, number_t y, number_t width, number_t height) const
+  {
+    BoundingBox result;
+    if (width <= 0 || height <= 0)
+      return result; // Disables the effect
+    if (useObjectBoundingBox)
+    {
+      BoundingBox const & bbox = *input_.boundingBox_;
+      number_t const bboxWidth = bbox.maxX_ - bbox.minX_, bboxHeight = bbox.maxY_ - bbox.minY_;
+      result.add(bbox.minX_ + x * bboxWidth, bbox.minY_ + y * bboxHeight);
+      result.add(bbox.minX_ + (x + width) * bboxWidth, bbox.minY_ + (y + height) * bboxHeight);
+    }
+    else
+    {
+      number_t px[4] = { x, x + width, x + width, x };
+      number_t py[4] = { y, y, y + height, y + height };
+      for(int i = 0; i < 4; ++i)
+      {
+        if (input_.transform_)
+          TransformPoint(*input_.transform_, px[i], py[i]);
+        result.add(px[i], py[i]);
+      }
+    }
+    return result;
+  }
+
+  PrimitiveRegion primitiveRegion(FilterElementBase const & fe) const
+  {
+    BoundingBox rect = filterRect_;
+    bool const useObjectBoundingBox = program_.primitiveUnitsUseObjectBoundingBox_;
+    if ((fe.x_ || fe.y_ || fe.width_ || fe.height_)
+      && (boundingBoxKnown_ || !useObjectBoundingBox))
+    {
+      // Subregion attributes that are not set default to the filter region
+      double const width = fe.width_.get_value_or(1), height = fe.height_.get_value_or(1);
+      BoundingBox const origin = toCanvas(useObjectBoundingBox, 
+        fe.x_.get_value_or(0), fe.y_.get_value_or(0), 1, 1);
+      BoundingBox const size = toCanvas(useObjectBoundingBox, 
+        0, 0, width > 0 ? width : 1, height > 0 ? height : 1);
+      if (fe.x_)
+        rect.minX_ = origin.minX_;
+      if (fe.y_)
+        rect.minY_ = origin.minY_;
+      if (fe.width_)
+        rect.maxX_ = width > 0 ? rect.minX_ + (size.maxX_ - size.minX_) : rect.minX_;
+      if (fe.height_)
+        rect.maxY_ = height > 0 ? rect.minY_ + (size.maxY_ - size.minY_) : rect.minY_;
+    }
+
+    PrimitiveRegion result;
+    result.size_ = gil::rgba8_image_t::point_t(region_.width_, region_.height_);
+    result.subregion_ = clipRegion(rect, region_);
+    result.subregion_.x_ -= region_.x_;
+    result.subregion_.y_ -= region_.y_;
+    result.threadPool_ = threadPool_;
+    return result;
+  }
+
   IFilterViewPtr findInput(FilterInput const & in) const
   {
     switch (in.source_)
     {
     case FilterInput::fiReference:
-    {
-      NamedFilters::const_iterator f = namedFilters_.find(in.reference_);
-      if (f == namedFilters_.end())
-        throw std::runtime_error("Can't find filter element");
-      return f->second;
-    }
-    case FilterInput::fiNotSet:
-      if (lastFilter_)
-        return lastFilter_;
-      else
-        return input_.sourceGraphic_;
+      BOOST_ASSERT(in.step_ >= 0 && in.step_ < int(results_.size()));
+      return results_[in.step_];
     case FilterInput::fiSourceGraphic:
-      return input_.sourceGraphic_;
+      return sourceGraphic_;
     case FilterInput::fiSourceAlpha:
       if (!sourceAlphaView_)
-        sourceAlphaView_.reset(new AlphaChannelView(input_.sourceGraphic_));
+        sourceAlphaView_.reset(new AlphaChannelView(sourceGraphic_));
       return sourceAlphaView_;
     case FilterInput::fiBackgroundImage:
-      return input_.backgroundImage_;
+      return backgroundImage_;
     case FilterInput::fiBackgroundAlpha:
       if (!backgroundAlphaView_)
-        backgroundAlphaView_.reset(new AlphaChannelView(input_.backgroundImage_));
+        backgroundAlphaView_.reset(new AlphaChannelView(backgroundImage_));
       return backgroundAlphaView_;
     case FilterInput::fiFillPaint:
-      return input_.fillPaint_;
+      return fillPaint_;
     case FilterInput::fiStrokePaint:
-      return input_.strokePaint_;
+      return strokePaint_;
     default:
       BOOST_ASSERT(false);
     }
@@ -1120,111 +3866,227 @@ private:
 
 namespace
 {
-  length_factory_t length_factory_instance;
-
-  struct length_policy_t
+  struct filter_attribute_traversal: svgpp::policy::attribute_traversal::default_policy
   {
-    typedef length_factory_t const length_factory_type;
-
-    static length_factory_type & length_factory(ElementWithRegionContext const &)
-    {
-      return length_factory_instance;
-    }
+    typedef boost::mpl::if_<
+      boost::is_same<svgpp::tag::element::filter, boost::mpl::_1>,
+      boost::mpl::vector<
+        svgpp::tag::attribute::filterUnits,
+        svgpp::tag::attribute::primitiveUnits,
+        svgpp::notify_context<afterFilterUnitsTag>
+      >,
+      boost::mpl::empty_sequence
+    > get_priority_attributes_by_element;
   };
+
+  // Attributes are split into several sets because of BOOST_MPL_LIMIT_SET_SIZE
+  typedef boost::mpl::fold<
+    boost::mpl::set<
+      // feConvolveMatrix
+      boost::mpl::pair<svgpp::tag::element::feConvolveMatrix, svgpp::tag::attribute::order>,
+      boost::mpl::pair<svgpp::tag::element::feConvolveMatrix, svgpp::tag::attribute::kernelMatrix>,
+      boost::mpl::pair<svgpp::tag::element::feConvolveMatrix, svgpp::tag::attribute::divisor>,
+      boost::mpl::pair<svgpp::tag::element::feConvolveMatrix, svgpp::tag::attribute::bias>,
+      boost::mpl::pair<svgpp::tag::element::feConvolveMatrix, svgpp::tag::attribute::targetX>,
+      boost::mpl::pair<svgpp::tag::element::feConvolveMatrix, svgpp::tag::attribute::targetY>,
+      boost::mpl::pair<svgpp::tag::element::feConvolveMatrix, svgpp::tag::attribute::edgeMode>,
+      boost::mpl::pair<svgpp::tag::element::feConvolveMatrix, svgpp::tag::attribute::preserveAlpha>,
+
+      // feTurbulence
+      boost::mpl::pair<svgpp::tag::element::feTurbulence, svgpp::tag::attribute::baseFrequency>,
+      boost::mpl::pair<svgpp::tag::element::feTurbulence, svgpp::tag::attribute::numOctaves>,
+      boost::mpl::pair<svgpp::tag::element::feTurbulence, svgpp::tag::attribute::seed>,
+      boost::mpl::pair<svgpp::tag::element::feTurbulence, svgpp::tag::attribute::stitchTiles>,
+      boost::mpl::pair<svgpp::tag::element::feTurbulence, svgpp::tag::attribute::type>,
+
+      // lighting filter primitives and light sources, x and y are processed for all elements
+      boost::mpl::pair<svgpp::tag::element::feDiffuseLighting, svgpp::tag::attribute::lighting_color>,
+      boost::mpl::pair<svgpp::tag::element::feDiffuseLighting, svgpp::tag::attribute::surfaceScale>,
+      boost::mpl::pair<svgpp::tag::element::feDiffuseLighting, svgpp::tag::attribute::diffuseConstant>,
+      boost::mpl::pair<svgpp::tag::element::feSpecularLighting, svgpp::tag::attribute::lighting_color>,
+      boost::mpl::pair<svgpp::tag::element::feSpecularLighting, svgpp::tag::attribute::surfaceScale>,
+      boost::mpl::pair<svgpp::tag::element::feSpecularLighting, svgpp::tag::attribute::specularConstant>,
+      boost::mpl::pair<svgpp::tag::element::feSpecularLighting, svgpp::tag::attribute::specularExponent>,
+      boost::mpl::pair<svgpp::tag::element::feDistantLight, svgpp::tag::attribute::azimuth>,
+      boost::mpl::pair<svgpp::tag::element::feDistantLight, svgpp::tag::attribute::elevation>,
+      boost::mpl::pair<svgpp::tag::element::fePointLight, svgpp::tag::attribute::z>,
+      boost::mpl::pair<svgpp::tag::element::feSpotLight, svgpp::tag::attribute::z>,
+      boost::mpl::pair<svgpp::tag::element::feSpotLight, svgpp::tag::attribute::pointsAtX>,
+      boost::mpl::pair<svgpp::tag::element::feSpotLight, svgpp::tag::attribute::pointsAtY>,
+      boost::mpl::pair<svgpp::tag::element::feSpotLight, svgpp::tag::attribute::pointsAtZ>,
+      boost::mpl::pair<svgpp::tag::element::feSpotLight, svgpp::tag::attribute::specularExponent>,
+      boost::mpl::pair<svgpp::tag::element::feSpotLight, svgpp::tag::attribute::limitingConeAngle>
+    >::type,
+    boost::mpl::set<
+      // filter region and primitive subregions
+      svgpp::tag::attribute::x,
+      svgpp::tag::attribute::y,
+      svgpp::tag::attribute::width,
+      svgpp::tag::attribute::height,
+      boost::mpl::pair<svgpp::tag::element::filter, svgpp::tag::attribute::filterUnits>,
+      boost::mpl::pair<svgpp::tag::element::filter, svgpp::tag::attribute::primitiveUnits>,
+
+      svgpp::tag::attribute::result,
+      svgpp::tag::attribute::in,
+      svgpp::tag::attribute::in2,
+      boost::mpl::pair<svgpp::tag::element::feBlend, svgpp::tag::attribute::mode>,
+      boost::mpl::pair<svgpp::tag::element::feColorMatrix, svgpp::tag::attribute::type>,
+      boost::mpl::pair<svgpp::tag::element::feColorMatrix, svgpp::tag::attribute::values>,
+      boost::mpl::pair<svgpp::tag::element::feOffset, svgpp::tag::attribute::dx>,
+      boost::mpl::pair<svgpp::tag::element::feOffset, svgpp::tag::attribute::dy>,
+      boost::mpl::pair<svgpp::tag::element::feComposite, svgpp::tag::attribute::operator_>,
+      boost::mpl::pair<svgpp::tag::element::feComposite, svgpp::tag::attribute::k1>,
+      boost::mpl::pair<svgpp::tag::element::feComposite, svgpp::tag::attribute::k2>,
+      boost::mpl::pair<svgpp::tag::element::feComposite, svgpp::tag::attribute::k3>,
+      boost::mpl::pair<svgpp::tag::element::feComposite, svgpp::tag::attribute::k4>,
+      boost::mpl::pair<svgpp::tag::element::feFlood, svgpp::tag::attribute::flood_color>,
+      boost::mpl::pair<svgpp::tag::element::feFlood, svgpp::tag::attribute::flood_opacity>,
+      boost::mpl::pair<svgpp::tag::element::feGaussianBlur, svgpp::tag::attribute::stdDeviation>,
+      boost::mpl::pair<svgpp::tag::element::feGaussianBlur, svgpp::tag::attribute::edgeMode>,
+      boost::mpl::pair<svgpp::tag::element::feMorphology, svgpp::tag::attribute::operator_>,
+      boost::mpl::pair<svgpp::tag::element::feMorphology, svgpp::tag::attribute::radius>,
+
+      // transfer function element attributes
+      boost::mpl::pair<svgpp::tag::element::feFuncA, svgpp::tag::attribute::type>,
+      boost::mpl::pair<svgpp::tag::element::feFuncR, svgpp::tag::attribute::type>,
+      boost::mpl::pair<svgpp::tag::element::feFuncG, svgpp::tag::attribute::type>,
+      boost::mpl::pair<svgpp::tag::element::feFuncB, svgpp::tag::attribute::type>,
+      svgpp::tag::attribute::tableValues,
+      svgpp::tag::attribute::slope, 
+      svgpp::tag::attribute::intercept, 
+      svgpp::tag::attribute::amplitude, 
+      svgpp::tag::attribute::exponent, 
+      svgpp::tag::attribute::offset
+    >::type,
+    boost::mpl::insert<boost::mpl::_1, boost::mpl::_2>
+  >::type processed_attributes;
 }
 
-IFilterViewPtr Filters::get(svg_string_t const & id, length_factory_t const &, Input const & input)
+IFilterViewPtr Filters::get(svg_string_t const & id, length_factory_t const & length_factory, 
+  Input const & input, Region & region)
 {
-  try
+  gil::rgba8c_view_t::point_t const canvasSize = input.sourceGraphic_->view().dimensions();
+  region = Region();
+  region.width_ = canvasSize.x;
+  region.height_ = canvasSize.y;
+  Region const canvasRegion = region;
+
+  program_key_t key(id,
+    length_factory.create_length(100, svgpp::tag::length_units::percent(), svgpp::tag::length_dimension::width()),
+    length_factory.create_length(100, svgpp::tag::length_units::percent(), svgpp::tag::length_dimension::height()));
+  programs_t::iterator program = programs_.find(key);
+  if (program == programs_.end())
   {
-    if (XMLElement node = xml_document_.findElementById(id))
-    {
-      FilterContext filterContext;
-      svgpp::document_traversal<
-        svgpp::context_factories<context_factories>,
-        svgpp::color_factory<color_factory_t>,
-        svgpp::length_policy<length_policy_t>,
-        svgpp::processed_elements<
-          boost::mpl::set<
-            svgpp::tag::element::filter,
-            svgpp::tag::element::feBlend,
-            svgpp::tag::element::feMerge,
-            svgpp::tag::element::feMergeNode,
-            svgpp::tag::element::feDistantLight,
-            svgpp::tag::element::fePointLight,
-            svgpp::tag::element::feSpotLight,
-            svgpp::tag::element::feColorMatrix,
-            svgpp::tag::element::feComponentTransfer,
-            svgpp::tag::element::feComposite,
-            svgpp::tag::element::feFlood,
-            svgpp::tag::element::feFuncA,
-            svgpp::tag::element::feFuncB,
-            svgpp::tag::element::feFuncG,
-            svgpp::tag::element::feFuncR,
-            svgpp::tag::element::feOffset
-          >::type
-        >,
-        svgpp::processed_attributes<
-          boost::mpl::set<
-            boost::mpl::pair<svgpp::tag::element::filter, svgpp::tag::attribute::x>,
-            boost::mpl::pair<svgpp::tag::element::filter, svgpp::tag::attribute::y>,
-            boost::mpl::pair<svgpp::tag::element::filter, svgpp::tag::attribute::width>,
-            boost::mpl::pair<svgpp::tag::element::filter, svgpp::tag::attribute::height>,
-            boost::mpl::pair<svgpp::tag::element::filter, svgpp::tag::attribute::filterUnits>,
-            //boost::mpl::pair<svgpp::tag::element::filter, svgpp::tag::attribute::primitiveUnits>,
-
-            svgpp::tag::attribute::result,
-            svgpp::tag::attribute::in,
-            svgpp::tag::attribute::in2,
-            boost::mpl::pair<svgpp::tag::element::feBlend, svgpp::tag::attribute::x>,
-            boost::mpl::pair<svgpp::tag::element::feBlend, svgpp::tag::attribute::y>,
-            boost::mpl::pair<svgpp::tag::element::feBlend, svgpp::tag::attribute::width>,
-            boost::mpl::pair<svgpp::tag::element::feBlend, svgpp::tag::attribute::height>,
-            boost::mpl::pair<svgpp::tag::element::feBlend, svgpp::tag::attribute::mode>,
-            boost::mpl::pair<svgpp::tag::element::feColorMatrix, svgpp::tag::attribute::type>,
-            boost::mpl::pair<svgpp::tag::element::feColorMatrix, svgpp::tag::attribute::values>,
-            boost::mpl::pair<svgpp::tag::element::feOffset, svgpp::tag::attribute::dx>,
-            boost::mpl::pair<svgpp::tag::element::feOffset, svgpp::tag::attribute::dy>,
-            boost::mpl::pair<svgpp::tag::element::feComposite, svgpp::tag::attribute::operator_>,
-            boost::mpl::pair<svgpp::tag::element::feComposite, svgpp::tag::attribute::k1>,
-            boost::mpl::pair<svgpp::tag::element::feComposite, svgpp::tag::attribute::k2>,
-            boost::mpl::pair<svgpp::tag::element::feComposite, svgpp::tag::attribute::k3>,
-            boost::mpl::pair<svgpp::tag::element::feComposite, svgpp::tag::attribute::k4>,
-            boost::mpl::pair<svgpp::tag::element::feFlood, svgpp::tag::attribute::flood_color>,
-            boost::mpl::pair<svgpp::tag::element::feFlood, svgpp::tag::attribute::flood_opacity>,
-
-            // transfer function element attributes
-            boost::mpl::pair<svgpp::tag::element::feFuncA, svgpp::tag::attribute::type>,
-            boost::mpl::pair<svgpp::tag::element::feFuncR, svgpp::tag::attribute::type>,
-            boost::mpl::pair<svgpp::tag::element::feFuncG, svgpp::tag::attribute::type>,
-            boost::mpl::pair<svgpp::tag::element::feFuncB, svgpp::tag::attribute::type>,
-            svgpp::tag::attribute::tableValues,
-            svgpp::tag::attribute::slope, 
-            svgpp::tag::attribute::intercept, 
-            svgpp::tag::attribute::amplitude, 
-            svgpp::tag::attribute::exponent, 
-            svgpp::tag::attribute::offset
-          >::type
-        >
-      >::load_expected_element(node, filterContext, svgpp::tag::element::filter());
-
-      FilterElementVisitor v(input);
-      for(std::vector<FilterElement>::const_iterator fe = filterContext.elements_.begin();
-        fe != filterContext.elements_.end(); ++fe)
-      {
-        boost::apply_visitor(v, *fe);
-      }
-      if (!v.lastFilter())
-        throw std::runtime_error("No filter elements in filter definition");
-      return v.lastFilter();
+    FilterProgramPtr compiled;
+    try
+    {
+      compiled = compile(id, length_factory);
     }
-    else
-      throw std::runtime_error("Filter not found");
+    catch (std::exception const & e)
+    {
+      // Not all filters implemented yet, we will skip such cases
+      std::cerr << e.what() << "\n";
+    }
+    program = programs_.insert(programs_t::value_type(key, compiled)).first;
+  }
+
+  if (!program->second)
+    return input.sourceGraphic_;
+
+  FilterProgramExecutor executor(input, *program->second, fusion_, threadPool_);
+  try
+  {
+    if (!executor.bindRegion(region))
+      return IFilterViewPtr();
   }
   catch (std::exception const & e)
   {
-    // Not all filters implemented yet, we will skip such cases
     std::cerr << e.what() << "\n";
+    region = canvasRegion;
     return input.sourceGraphic_;
   }
-}
\ No newline at end of file
+  if (input.reserveImage_)
+    for(size_t i = executor.resultImageCount(); i > 0; --i)
+      input.reserveImage_(region.width_, region.height_);
+  try
+  {
+    return executor.execute();
+  }
+  catch (std::exception const & e)
+  {
+    std::cerr << e.what() << "\n";
+    region = canvasRegion;
+    return input.sourceGraphic_;
+  }
+}
+
+Filters::FilterProgramPtr Filters::compile(svg_string_t const & id, length_factory_t const & length_factory)
+{
+  XMLElement node = xml_document_.findElementById(id);
+  if (!node)
+    throw std::runtime_error("Filter not found");
+
+  FilterContext filterContext(length_factory);
+  svgpp::document_traversal<
+    svgpp::context_factories<context_factories>,
+    svgpp::color_factory<color_factory_t>,
+    svgpp::length_policy<svgpp::policy::length::forward_to_method<ElementWithRegionContext, const length_factory_t> >,
+    svgpp::attribute_traversal_policy<filter_attribute_traversal>,
+    svgpp::processed_elements<
+      boost::mpl::set<
+        svgpp::tag::element::filter,
+        svgpp::tag::element::feBlend,
+        svgpp::tag::element::feMerge,
+        svgpp::tag::element::feMergeNode,
+        svgpp::tag::element::feDistantLight,
+        svgpp::tag::element::fePointLight,
+        svgpp::tag::element::feSpotLight,
+        svgpp::tag::element::feColorMatrix,
+        svgpp::tag::element::feComponentTransfer,
+        svgpp::tag::element::feComposite,
+        svgpp::tag::element::feConvolveMatrix,
+        svgpp::tag::element::feDiffuseLighting,
+        svgpp::tag::element::feFlood,
+        svgpp::tag::element::feFuncA,
+        svgpp::tag::element::feFuncB,
+        svgpp::tag::element::feFuncG,
+        svgpp::tag::element::feFuncR,
+        svgpp::tag::element::feGaussianBlur,
+        svgpp::tag::element::feMorphology,
+        svgpp::tag::element::feOffset,
+        svgpp::tag::element::feSpecularLighting,
+        svgpp::tag::element::feTurbulence
+      >::type
+    >,
+    svgpp::processed_attributes<processed_attributes>
+  >::load_expected_element(node, filterContext, svgpp::tag::element::filter());
+
+  if (filterContext.elements_.empty())
+    throw std::runtime_error("No filter elements in filter definition");
+
+  boost::shared_ptr<FilterProgram> program(new FilterProgram);
+  program->region_ = filterContext.region_;
+  program->filterUnitsUseObjectBoundingBox_ = filterContext.filterUnitsUseObjectBoundingBox_;
+  program->primitiveUnitsUseObjectBoundingBox_ = filterContext.primitiveUnitsUseObjectBoundingBox_;
+  program->elements_.swap(filterContext.elements_);
+
+  ResolveInputsVisitor resolve;
+  for(std::vector<FilterElement>::iterator fe = program->elements_.begin();
+    fe != program->elements_.end(); ++fe)
+  {
+    boost::apply_visitor(resolve, *fe);
+    resolve.next(boost::apply_visitor(FilterElementBaseVisitor(), *fe).result_);
+    if (feTurbulence * turbulence = boost::get<feTurbulence>(&*fe))
+    {
+      // Seed is truncated to integer
+      long const seed = static_cast<long>(turbulence->seed_);
+      lattices_t::iterator lattice = lattices_.find(seed);
+      if (lattice == lattices_.end())
+        lattice = lattices_.insert(lattices_t::value_type(seed, 
+          boost::make_shared<TurbulenceLattice>(seed))).first;
+      turbulence->lattice_ = lattice->second;
+    }
+  }
+  planFusion(*program);
+  return program;
+}
@@ -1,8 +1,12 @@
 #pragma once
 
 #include "common.hpp"
+#include <boost/function.hpp>
 #include <boost/gil/typedefs.hpp>
+#include <boost/optional.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/tuple/tuple_comparison.hpp>
+#include <map>
 
 class IFilterView
 {
@@ -14,26 +18,73 @@ public:
 
 typedef boost::shared_ptr<IFilterView> IFilterViewPtr;
 
+struct FilterProgram;
+struct TurbulenceLattice;
+class ThreadPool;
+
 class Filters
 {
 public:
   Filters(XMLDocument & xml_document)
     : xml_document_(xml_document)
+    , fusion_(true)
+    , threadPool_(NULL)
   {}
 
+  // Point-wise primitives are evaluated in a single pass without intermediate images.
+  // Disabling it creates image per primitive, which is useful for checking the results
+  void setFusion(bool enable) { fusion_ = enable; }
+  // Independent primitives and rows of each primitive are processed on the pool. NULL disables threading
+  void setThreadPool(ThreadPool * pool) { threadPool_ = pool; }
+
   struct Input
   {
+    Input()
+      : transform_(NULL)
+    {}
+
     IFilterViewPtr sourceGraphic_;
     IFilterViewPtr backgroundImage_;
     IFilterViewPtr fillPaint_;
     IFilterViewPtr strokePaint_;
+    transform_t const * transform_; // User space of filtered element to canvas pixels, NULL for identity
+    boost::optional<BoundingBox> boundingBox_; // Bounds of filtered element geometry in canvas pixels
+    // Called with filter region size for each image of primitive results before they are evaluated,
+    // results live as long as the returned view. Exceptions thrown by it are passed to the caller
+    boost::function<void(int, int)> reserveImage_;
+  };
+
+  // Rectangle in canvas pixels
+  struct Region
+  {
+    Region()
+      : x_(0), y_(0), width_(0), height_(0)
+    {}
+
+    int x_, y_, width_, height_;
   };
 
+  // Filter definition is parsed once per document, each call only binds it to the input.
+  // Result covers only the filter region, its position on canvas is returned in 'region'
   IFilterViewPtr get(
     svg_string_t const & id, 
     length_factory_t const &,
-    Input const & input);
+    Input const & input,
+    Region & region);
 
 private:
+  typedef boost::shared_ptr<FilterProgram const> FilterProgramPtr;
+  // Filter id and viewport size that percentage lengths were resolved against
+  typedef boost::tuple<svg_string_t, number_t, number_t> program_key_t;
+  typedef std::map<program_key_t, FilterProgramPtr> programs_t;
+
+  typedef std::map<long, boost::shared_ptr<TurbulenceLattice const> > lattices_t;
+
   XMLDocument & xml_document_;
+  programs_t programs_; // NULL for filters that failed to load
+  lattices_t lattices_; // Noise tables of feTurbulence by seed
+  bool fusion_;
+  ThreadPool * threadPool_;
+
+  FilterProgramPtr compile(svg_string_t const & id, length_factory_t const &);
 };
\ No newline at end of file
@@ -243,6 +243,21 @@ private:
   bool fx_set_, fy_set_;
 };
 
+struct GradientIdVisitor: boost::static_visitor<>
+{
+  GradientIdVisitor(svg_string_t const & id)
+    : id_(id)
+  {}
+
+  void operator()(GradientBase & g) const
+  {
+    g.id_ = id_;
+  }
+
+private:
+  svg_string_t const & id_;
+};
+
 struct gradient_context_factories
 {
   template<class ParentContext, class ElementTag>
@@ -281,10 +296,24 @@ struct attribute_traversal: svgpp::policy::attribute_traversal::default_policy
   > get_priority_attributes_by_element;
 };
 
-boost::optional<Gradient> Gradients::get(
+boost::optional<Gradient> const & Gradients::get(
     svg_string_t const & id, 
     length_factory_t const & length_factory/*, 
     get_bounding_box_func_t const & get_bounding_box*/)
+{
+  // Percentage lengths in userSpaceOnUse gradients depend on viewport size
+  cache_key_t key(id, 
+    length_factory.create_length(100, svgpp::tag::length_units::percent(), svgpp::tag::length_dimension::width()),
+    length_factory.create_length(100, svgpp::tag::length_units::percent(), svgpp::tag::length_dimension::height()));
+  cache_t::iterator it = cache_.find(key);
+  if (it == cache_.end())
+    it = cache_.insert(cache_t::value_type(key, load(id, length_factory))).first;
+  return it->second;
+}
+
+boost::optional<Gradient> Gradients::load(
+    svg_string_t const & id, 
+    length_factory_t const & length_factory)
 {
   // TODO: inheritance via xlink::href
   if (XMLElement node = xml_document_.findElementById(id))
@@ -328,6 +357,11 @@ boost::optional<Gradient> Gradients::get(
       >::load_referenced_element<
         svgpp::expected_elements<svgpp::traits::gradient_elements>
       >::load(node, gradient_context);
+      if (gradient_context.gradient_)
+      {
+        GradientIdVisitor set_id(id);
+        boost::apply_visitor(set_id, *gradient_context.gradient_);
+      }
       return gradient_context.gradient_;
     } catch (std::exception const & e)
     {
@@ -337,3 +371,51 @@ boost::optional<Gradient> Gradients::get(
 
   return boost::optional<Gradient>();
 }
+
+#if defined(RENDERER_AGG)
+ColorFunctionProfile::ColorFunctionProfile(GradientStops const & stops, number_t opacity, unsigned size)
+  : colors_(size)
+{
+  assert(stops.size() >= 2);
+
+  number_t const offset_step = 1.0 / size;
+  number_t offset = 0;
+  GradientStops::const_iterator stop1 = stops.begin(), stop2 = stops.begin();
+  agg::rgba8 color1 = stopColor(*stop1, opacity), color2 = color1;
+  for(unsigned i = 0; i < size; ++i, offset += offset_step)
+  {
+    while(stop2 != stops.end() && offset > stop2->offset_)
+    {
+      stop1 = stop2;
+      color1 = color2;
+      ++stop2;
+      if (stop2 != stops.end())
+        color2 = stopColor(*stop2, opacity);
+    }
+    if (stop2 == stops.begin() || stop2 == stops.end())
+      colors_[i] = color1;
+    else
+      colors_[i] = color1.gradient(color2, (offset - stop1->offset_) / (stop2->offset_ - stop1->offset_));
+  }
+}
+
+agg::rgba8 ColorFunctionProfile::stopColor(GradientStop const & stop, number_t opacity)
+{
+  if (opacity < 0.999)
+  {
+    agg::rgba8 color = stop.color_;
+    return color.opacity(opacity * color.opacity());
+  }
+  return stop.color_;
+}
+
+ColorFunctionProfile const & Gradients::colorRamp(GradientBase const & gradient, number_t opacity)
+{
+  color_ramp_key_t key(gradient.id_, opacity, color_ramp_size_);
+  color_ramps_t::iterator it = color_ramps_.find(key);
+  if (it == color_ramps_.end())
+    it = color_ramps_.insert(color_ramps_t::value_type(key, 
+      ColorFunctionProfile(gradient.stops_, opacity, color_ramp_size_))).first;
+  return it->second;
+}
+#endif
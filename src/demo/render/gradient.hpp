@@ -3,6 +3,7 @@
 #include <boost/array.hpp>
 #include <boost/variant.hpp>
 #include <boost/optional.hpp>
+#include <boost/tuple/tuple_comparison.hpp>
 #include <map>
 #include <vector>
 #include "common.hpp"
@@ -47,6 +48,7 @@ struct GradientBase
 #endif
   GradientStops stops_;
   bool useObjectBoundingBox_;
+  svg_string_t id_;
 };
 
 struct LinearGradient: GradientBase
@@ -67,18 +69,63 @@ struct RadialGradient: GradientBase
 
 typedef boost::variant<LinearGradient, RadialGradient> Gradient;
 
+#if defined(RENDERER_AGG)
+// Precomputed colors for agg::span_gradient
+class ColorFunctionProfile
+{
+public:
+  ColorFunctionProfile(GradientStops const & stops, number_t opacity, unsigned size);
+
+  unsigned size() const { return colors_.size(); }
+  const agg::rgba8 & operator[] (unsigned v) const
+  {
+    return colors_[v];
+  }
+
+private:
+  std::vector<agg::rgba8> colors_;
+
+  static agg::rgba8 stopColor(GradientStop const & stop, number_t opacity);
+};
+#endif
+
 class Gradients
 {
 public:
   Gradients(XMLDocument & xml_document)
     : xml_document_(xml_document)
+#if defined(RENDERER_AGG)
+    , color_ramp_size_(256)
+#endif
   {}
 
-  boost::optional<Gradient> get(
+  // Gradients are loaded once per id and viewport size and then kept for the lifetime of the document
+  boost::optional<Gradient> const & get(
     svg_string_t const & id, 
     length_factory_t const &/*, 
     get_bounding_box_func_t const & get_bounding_box*/);
 
+#if defined(RENDERER_AGG)
+  // Color ramps are shared by all uses of gradient with the same opacity and ramp size
+  ColorFunctionProfile const & colorRamp(GradientBase const & gradient, number_t opacity);
+
+  // 256 is enough for most cases, wide and smooth gradients may need 1024
+  void setColorRampSize(unsigned size) { color_ramp_size_ = size; }
+#endif
+
 private:
   XMLDocument & xml_document_;
+  typedef boost::tuple<svg_string_t, number_t, number_t> cache_key_t;
+  typedef std::map<cache_key_t, boost::optional<Gradient> > cache_t;
+  cache_t cache_;
+#if defined(RENDERER_AGG)
+  typedef boost::tuple<svg_string_t, number_t, unsigned> color_ramp_key_t;
+  typedef std::map<color_ramp_key_t, ColorFunctionProfile> color_ramps_t;
+  color_ramps_t color_ramps_;
+  unsigned color_ramp_size_;
+#endif
+
+  boost::optional<Gradient> load(
+    svg_string_t const & id, 
+    length_factory_t const &);
 };
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <boost/gil/gil_all.hpp>
+#include <boost/noncopyable.hpp>
+#include <memory>
+#include <vector>
+
+#if defined(RENDERER_AGG)
+#include <agg_pixfmt_rgba.h>
+#include <agg_renderer_base.h>
+#include <agg_rendering_buffer.h>
+#elif defined(RENDERER_SKIA)
+#include <SkBitmap.h>
+#endif
+
+#if defined(RENDERER_AGG)
+typedef agg::pixfmt_rgba32 pixfmt_t;
+typedef agg::renderer_base<pixfmt_t> renderer_base_t;
+#endif
+
+// 32 bits per pixel image, either owned or attached to memory of the caller
+class ImageBuffer: boost::noncopyable
+{
+public:
+  ImageBuffer()
+#if defined(RENDERER_GDIPLUS)
+    : pixels_(NULL)
+    , stride_(0)
+#endif
+  {}
+
+  ImageBuffer(int width, int height)
+  {
+    setSize(width, height, TransparentBlackColor());
+  }
+
+#if defined(RENDERER_AGG)
+  int width() const { return pixfmt_.width(); }
+  int height() const { return pixfmt_.height(); }
+  pixfmt_t & pixfmt() { return pixfmt_; }
+#elif defined(RENDERER_GDIPLUS)
+  int width() const { return bitmap_->GetWidth(); }
+  int height() const { return bitmap_->GetHeight(); }
+  Gdiplus::Bitmap & bitmap() { return *bitmap_; }
+#elif defined(RENDERER_SKIA)
+  int width() const { return bitmap_.width(); }
+  int height() const { return bitmap_.height(); }
+  SkBitmap & bitmap() { return bitmap_; }
+#endif
+
+#if defined(RENDERER_AGG)
+  bool isSizeSet() const { return rbuf_.buf() != NULL; }
+#elif defined(RENDERER_GDIPLUS)
+  bool isSizeSet() const { return bitmap_.get() != NULL; }
+#elif defined(RENDERER_SKIA)
+  bool isSizeSet() const { return !bitmap_.empty(); }
+#endif
+
+  void setSize(int width, int height, color_t const & fill_color)
+  {
+#if defined(RENDERER_AGG)
+    BOOST_ASSERT(!isSizeSet());
+    buffer_.resize(width * height * pixfmt_t::pix_width);
+    rbuf_.attach(&buffer_[0], width, height, width * pixfmt_t::pix_width);
+    pixfmt_.attach(rbuf_);
+    agg::renderer_base<pixfmt_t> renderer_base(pixfmt_);
+    renderer_base.clear(fill_color);
+#elif defined(RENDERER_GDIPLUS)
+    BOOST_ASSERT(!isSizeSet());
+    buffer_.resize(width * height * 4);
+    pixels_ = &buffer_[0];
+    stride_ = width * 4;
+    bitmap_.reset(new Gdiplus::Bitmap(width, height, stride_, PixelFormat32bppARGB, pixels_));
+#elif defined(RENDERER_SKIA)
+    bitmap_.allocN32Pixels(width, height);
+    bitmap_.eraseColor(fill_color);
+#endif
+  }
+
+  // Renders directly to 'pixels' owned by the caller. Content of the memory is kept,
+  // pixels are in native layout of the renderer
+  void attach(unsigned char * pixels, int width, int height, int stride)
+  {
+#if defined(RENDERER_AGG)
+    BOOST_ASSERT(!isSizeSet());
+    rbuf_.attach(pixels, width, height, stride);
+    pixfmt_.attach(rbuf_);
+#elif defined(RENDERER_GDIPLUS)
+    BOOST_ASSERT(!isSizeSet());
+    pixels_ = pixels;
+    stride_ = stride;
+    bitmap_.reset(new Gdiplus::Bitmap(width, height, stride, PixelFormat32bppARGB, pixels));
+#elif defined(RENDERER_SKIA)
+    bitmap_.installPixels(SkImageInfo::MakeN32Premul(width, height), pixels, stride);
+#endif
+  }
+
+  boost::gil::rgba8_view_t gilView()
+  {
+#if defined(RENDERER_AGG)
+    return boost::gil::interleaved_view(pixfmt_.width(), pixfmt_.height(),
+      reinterpret_cast<boost::gil::rgba8_pixel_t*>(pixfmt_.row_ptr(0)), pixfmt_.stride());
+#elif defined(RENDERER_GDIPLUS)
+    return boost::gil::interleaved_view(bitmap_->GetWidth(), bitmap_->GetHeight(),
+      reinterpret_cast<boost::gil::rgba8_pixel_t*>(pixels_), stride_);
+#elif defined(RENDERER_SKIA)
+    return boost::gil::interleaved_view(bitmap_.width(), bitmap_.height(),
+      reinterpret_cast<boost::gil::rgba8_pixel_t*>(bitmap_.getPixels()), bitmap_.rowBytes());
+#endif
+  }
+
+private:
+#if defined(RENDERER_AGG)
+  std::vector<unsigned char> buffer_;
+  agg::rendering_buffer rbuf_;
+  pixfmt_t pixfmt_;
+#elif defined(RENDERER_GDIPLUS)
+  std::vector<BYTE> buffer_;
+  BYTE * pixels_;
+  int stride_;
+  std::unique_ptr<Gdiplus::Bitmap> bitmap_;
+#elif defined(RENDERER_SKIA)
+  SkBitmap bitmap_;
+#endif
+};
@@ -0,0 +1,558 @@
+#include "image_encoder.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+
+#if defined(SVGPP_RENDER_ZLIB)
+#include <zlib.h>
+#else
+// Defined in stb.cpp, but not declared in the header
+unsigned char * stbi_zlib_compress(unsigned char * data, int data_len, int * out_len, int quality);
+#endif
+
+namespace
+{
+  typedef boost::uint32_t uint32;
+
+  // PNG rows are filtered and compressed in independent blocks of about this size
+  size_t const png_block_bytes = 256 * 1024;
+  size_t const deflate_window_bytes = 32768;
+  size_t const max_stored_block_bytes = 65535;
+  uint32 const adler_base = 65521;
+
+  class Crc32Table
+  {
+  public:
+    Crc32Table()
+    {
+      for(uint32 n = 0; n < 256; ++n)
+      {
+        uint32 c = n;
+        for(int k = 0; k < 8; ++k)
+          c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        table_[n] = c;
+      }
+    }
+
+    uint32 update(uint32 crc, unsigned char const * data, size_t size) const
+    {
+      crc = ~crc;
+      for(size_t i = 0; i < size; ++i)
+        crc = table_[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+      return ~crc;
+    }
+
+  private:
+    uint32 table_[256];
+  };
+
+  Crc32Table const crc32_table;
+
+  uint32 adler32(unsigned char const * data, size_t size)
+  {
+    uint32 a = 1, b = 0;
+    while (size > 0)
+    {
+      // Sums of 5552 bytes can't overflow 32 bits
+      size_t const n = std::min<size_t>(size, 5552);
+      for(size_t i = 0; i < n; ++i)
+      {
+        a += data[i];
+        b += a;
+      }
+      a %= adler_base;
+      b %= adler_base;
+      data += n;
+      size -= n;
+    }
+    return a | (b << 16);
+  }
+
+  // Checksum of concatenation of two parts, as adler32_combine() in zlib
+  uint32 adler32Combine(uint32 adler1, uint32 adler2, size_t size2)
+  {
+    uint32 const remainder = uint32(size2 % adler_base);
+    uint32 sum1 = adler1 & 0xffff;
+    uint32 sum2 = (remainder * sum1) % adler_base;
+    sum1 += (adler2 & 0xffff) + adler_base - 1;
+    sum2 += (adler1 >> 16) + (adler2 >> 16) + adler_base - remainder;
+    if (sum1 >= adler_base) sum1 -= adler_base;
+    if (sum1 >= adler_base) sum1 -= adler_base;
+    if (sum2 >= 2 * adler_base) sum2 -= 2 * adler_base;
+    if (sum2 >= adler_base) sum2 -= adler_base;
+    return sum1 | (sum2 << 16);
+  }
+
+  void putUint32(std::vector<unsigned char> & out, uint32 value)
+  {
+    out.push_back((value >> 24) & 0xff);
+    out.push_back((value >> 16) & 0xff);
+    out.push_back((value >> 8) & 0xff);
+    out.push_back(value & 0xff);
+  }
+
+  // Writes row 'y' as RGBA or RGB with straight alpha
+  void convertRow(EncoderInput const & input, int y, unsigned char * out, bool alpha)
+  {
+    unsigned char const * src = input.pixels_ + std::ptrdiff_t(y) * input.stride_;
+    if (alpha && !input.bgra_ && !input.premultiplied_)
+    {
+      std::memcpy(out, src, size_t(input.width_) * 4);
+      return;
+    }
+    int const red_offset = input.bgra_ ? 2 : 0, blue_offset = input.bgra_ ? 0 : 2;
+    for(int x = 0; x < input.width_; ++x, src += 4)
+    {
+      unsigned red = src[red_offset], green = src[1], blue = src[blue_offset];
+      unsigned const a = src[3];
+      if (input.premultiplied_ && a != 255)
+      {
+        if (a == 0)
+          red = green = blue = 0;
+        else
+        {
+          red = std::min(255u, (red * 255 + a / 2) / a);
+          green = std::min(255u, (green * 255 + a / 2) / a);
+          blue = std::min(255u, (blue * 255 + a / 2) / a);
+        }
+      }
+      *out++ = red;
+      *out++ = green;
+      *out++ = blue;
+      if (alpha)
+        *out++ = a;
+    }
+  }
+
+  int paethPredictor(int a, int b, int c)
+  {
+    int const p = a + b - c;
+    int const pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc)
+      return a;
+    return pb <= pc ? b : c;
+  }
+
+  // PNG filter of RGBA row, 'prev' is unfiltered previous row
+  void filterRow(int type, unsigned char const * row, unsigned char const * prev, size_t size, unsigned char * out)
+  {
+    size_t const bpp = 4;
+    switch (type)
+    {
+    case 0:
+      std::memcpy(out, row, size);
+      break;
+    case 1:
+      std::memcpy(out, row, bpp);
+      for(size_t i = bpp; i < size; ++i)
+        out[i] = row[i] - row[i - bpp];
+      break;
+    case 2:
+      for(size_t i = 0; i < size; ++i)
+        out[i] = row[i] - prev[i];
+      break;
+    case 3:
+      for(size_t i = 0; i < bpp; ++i)
+        out[i] = row[i] - prev[i] / 2;
+      for(size_t i = bpp; i < size; ++i)
+        out[i] = row[i] - (row[i - bpp] + prev[i]) / 2;
+      break;
+    case 4:
+      for(size_t i = 0; i < bpp; ++i)
+        out[i] = row[i] - prev[i];
+      for(size_t i = bpp; i < size; ++i)
+        out[i] = row[i] - paethPredictor(row[i - bpp], prev[i], prev[i - bpp]);
+      break;
+    }
+  }
+
+  // Sum of absolute values of filtered bytes taken as signed, the usual filter selection heuristic
+  unsigned long filterScore(unsigned char const * data, size_t size)
+  {
+    unsigned long score = 0;
+    for(size_t i = 0; i < size; ++i)
+      score += data[i] < 128 ? data[i] : 256 - data[i];
+    return score;
+  }
+
+  void writeChunk(std::ostream & out, char const * type, std::vector<unsigned char> const & data, uint32 crc)
+  {
+    std::vector<unsigned char> header;
+    putUint32(header, uint32(data.size()));
+    header.insert(header.end(), type, type + 4);
+    out.write(reinterpret_cast<char const *>(&header[0]), header.size());
+    if (!data.empty())
+      out.write(reinterpret_cast<char const *>(&data[0]), data.size());
+    std::vector<unsigned char> trailer;
+    putUint32(trailer, crc);
+    out.write(reinterpret_cast<char const *>(&trailer[0]), trailer.size());
+  }
+
+  uint32 chunkTypeCrc(char const * type)
+  {
+    return crc32_table.update(0, reinterpret_cast<unsigned char const *>(type), 4);
+  }
+
+  void writeNetpbmHeader(int width, int height, EncoderOptions::format_t format, std::ostream & out)
+  {
+    if (format == EncoderOptions::pam)
+      out << "P7\nWIDTH " << width << "\nHEIGHT " << height
+        << "\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n";
+    else if (format == EncoderOptions::ppm)
+      out << "P6\n" << width << " " << height << "\n255\n";
+  }
+
+  void writeRawRows(EncoderInput const & input, EncoderOptions::format_t format, std::ostream & out)
+  {
+    bool const alpha = format != EncoderOptions::ppm;
+    std::vector<unsigned char> row(size_t(input.width_) * (alpha ? 4 : 3));
+    for(int y = 0; y < input.height_ && out; ++y)
+    {
+      convertRow(input, y, &row[0], alpha);
+      out.write(reinterpret_cast<char const *>(&row[0]), row.size());
+    }
+  }
+}
+
+bool parseImageFormat(std::string const & name, EncoderOptions::format_t & format)
+{
+  if (name == "png")
+    format = EncoderOptions::png;
+  else if (name == "rgba")
+    format = EncoderOptions::rgba;
+  else if (name == "pam")
+    format = EncoderOptions::pam;
+  else if (name == "ppm")
+    format = EncoderOptions::ppm;
+  else
+    return false;
+  return true;
+}
+
+bool parseCompressionLevel(std::string const & name, int & level)
+{
+  if (name == "none")
+    level = 0;
+  else if (name == "fast")
+    level = 1;
+  else if (name == "best")
+    level = 9;
+  else if (name.size() == 1 && name[0] >= '0' && name[0] <= '9')
+    level = name[0] - '0';
+  else
+    return false;
+  return true;
+}
+
+char const * imageFileExtension(EncoderOptions::format_t format)
+{
+  switch (format)
+  {
+  case EncoderOptions::rgba: return ".rgba";
+  case EncoderOptions::pam: return ".pam";
+  case EncoderOptions::ppm: return ".ppm";
+  default: return ".png";
+  }
+}
+
+// Encodes PNG in blocks of rows that are filtered and deflated independently. Blocks end with
+// sync flush and use the tail of previous block as dictionary, as in pigz, so output is a single
+// zlib stream that compresses nearly as well as sequential one. State that spans blocks is kept
+// between parts of rows, so parts are compressed as if the image were encoded at once
+class ImageWriter::PngEncoder
+{
+public:
+  PngEncoder(int width, int height, int level, std::ostream & out)
+    : level_(std::max(0, std::min(9, level)))
+    , height_(height)
+    , row_bytes_(size_t(width) * 4 + 1)
+    , rows_per_block_(int(std::max<size_t>(1, png_block_bytes / row_bytes_)))
+    , rows_encoded_(0)
+    , input_(NULL)
+    , prev_row_(row_bytes_ - 1, 0)
+    , adler_(1)
+  {
+    static unsigned char const signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    out.write(reinterpret_cast<char const *>(signature), sizeof(signature));
+    std::vector<unsigned char> header;
+    putUint32(header, width);
+    putUint32(header, height);
+    unsigned char const header_tail[5] = { 8, 6, 0, 0, 0 }; // 8 bit RGBA, no interlace
+    header.insert(header.end(), header_tail, header_tail + 5);
+    writeChunk(out, "IHDR", header, crc32_table.update(chunkTypeCrc("IHDR"), &header[0], header.size()));
+  }
+
+  void encode(EncoderInput const & input, ThreadPool * pool, std::ostream & out)
+  {
+    input_ = &input;
+    int const block_count = (input.height_ + rows_per_block_ - 1) / rows_per_block_;
+    bool const first = rows_encoded_ == 0;
+    bool const last = rows_encoded_ + input.height_ == height_;
+    filtered_.resize(row_bytes_ * input.height_);
+    blocks_.assign(block_count, std::vector<unsigned char>());
+    adlers_.resize(block_count);
+    crcs_.resize(block_count);
+    ParallelFor(pool, block_count, 1, boost::bind(&PngEncoder::filterBlocks, this, _1, _2));
+    convertRow(input, input.height_ - 1, &prev_row_[0], true);
+    rows_encoded_ += input.height_;
+#if !defined(SVGPP_RENDER_ZLIB)
+    if (level_ > 0)
+    {
+      // stb compresses complete zlib stream only, so data is written at the end
+      pending_.insert(pending_.end(), filtered_.begin(), filtered_.end());
+      if (last)
+        compressWithStb();
+      else
+        blocks_.clear();
+    }
+    else
+#endif
+    {
+      ParallelFor(pool, block_count, 1, boost::bind(&PngEncoder::compressBlocks, this, _1, _2, last));
+      // zlib header and trailer
+      if (first)
+      {
+        static unsigned char const level_flags[10] = { 0x01, 0x01, 0x5e, 0x5e, 0x5e, 0x5e, 0x9c, 0xda, 0xda, 0xda };
+        unsigned char const header[2] = { 0x78, level_flags[level_] };
+        blocks_.front().insert(blocks_.front().begin(), header, header + 2);
+      }
+      for(int i = 0; i < block_count; ++i)
+        adler_ = adler32Combine(adler_, adlers_[i], blockSize(i));
+      if (last)
+        putUint32(blocks_.back(), adler_);
+      updateWindow();
+    }
+    ParallelFor(pool, int(blocks_.size()), 1, boost::bind(&PngEncoder::computeCrcs, this, _1, _2));
+
+    // Each block is a separate IDAT chunk, so that CRCs are computed in parallel
+    for(size_t i = 0; i < blocks_.size(); ++i)
+      writeChunk(out, "IDAT", blocks_[i], crcs_[i]);
+    if (last)
+      writeChunk(out, "IEND", std::vector<unsigned char>(), chunkTypeCrc("IEND"));
+    input_ = NULL;
+  }
+
+private:
+  int const level_, height_;
+  size_t const row_bytes_;
+  int const rows_per_block_;
+  int rows_encoded_;
+  EncoderInput const * input_;
+  std::vector<unsigned char> prev_row_; // Unfiltered last row of previous part
+  std::vector<unsigned char> window_; // Tail of filtered data of previous parts, dictionary of the first block
+  uint32 adler_;
+  std::vector<unsigned char> filtered_;
+  std::vector<std::vector<unsigned char> > blocks_;
+  std::vector<uint32> adlers_, crcs_;
+#if !defined(SVGPP_RENDER_ZLIB)
+  std::vector<unsigned char> pending_;
+#endif
+
+  size_t blockOffset(int block) const { return size_t(block) * rows_per_block_ * row_bytes_; }
+  size_t blockSize(int block) const { return std::min(filtered_.size(), blockOffset(block + 1)) - blockOffset(block); }
+
+  void filterBlocks(int begin, int end)
+  {
+    size_t const size = row_bytes_ - 1;
+    std::vector<unsigned char> prev(size), row(size), candidate(size);
+    for(int block = begin; block < end; ++block)
+    {
+      int const first_row = block * rows_per_block_;
+      int const last_row = std::min(input_->height_, first_row + rows_per_block_);
+      if (first_row > 0)
+        convertRow(*input_, first_row - 1, &prev[0], true);
+      else
+        prev = prev_row_;
+      for(int y = first_row; y < last_row; ++y)
+      {
+        convertRow(*input_, y, &row[0], true);
+        unsigned char * out = &filtered_[y * row_bytes_];
+        if (level_ == 0)
+        {
+          out[0] = 0;
+          std::memcpy(out + 1, &row[0], size);
+        }
+        else if (level_ <= 2)
+        {
+          out[0] = 1;
+          filterRow(1, &row[0], &prev[0], size, out + 1);
+        }
+        else
+        {
+          unsigned long best_score = 0;
+          for(int type = 0; type < 5; ++type)
+          {
+            filterRow(type, &row[0], &prev[0], size, &candidate[0]);
+            unsigned long const score = filterScore(&candidate[0], size);
+            if (type == 0 || score < best_score)
+            {
+              best_score = score;
+              out[0] = type;
+              std::memcpy(out + 1, &candidate[0], size);
+            }
+          }
+        }
+        prev.swap(row);
+      }
+    }
+  }
+
+  void compressBlocks(int begin, int end, bool last_part)
+  {
+    for(int block = begin; block < end; ++block)
+    {
+      unsigned char const * data = &filtered_[blockOffset(block)];
+      size_t const size = blockSize(block);
+      bool const last = last_part && block == int(blocks_.size()) - 1;
+      adlers_[block] = adler32(data, size);
+      if (level_ == 0)
+        storeBlock(data, size, last, blocks_[block]);
+#if defined(SVGPP_RENDER_ZLIB)
+      else if (block == 0)
+        deflateBlock(data, size, window_.empty() ? NULL : &window_[0], window_.size(), last, blocks_[block]);
+      else
+      {
+        size_t const dictionary_size = std::min(blockOffset(block), deflate_window_bytes);
+        deflateBlock(data, size, data - dictionary_size, dictionary_size, last, blocks_[block]);
+      }
+#endif
+    }
+  }
+
+  void updateWindow()
+  {
+    if (filtered_.size() >= deflate_window_bytes)
+      window_.assign(filtered_.end() - deflate_window_bytes, filtered_.end());
+    else
+    {
+      window_.insert(window_.end(), filtered_.begin(), filtered_.end());
+      if (window_.size() > deflate_window_bytes)
+        window_.erase(window_.begin(), window_.end() - deflate_window_bytes);
+    }
+  }
+
+  static void storeBlock(unsigned char const * data, size_t size, bool last, std::vector<unsigned char> & out)
+  {
+    out.reserve(size + (size / max_stored_block_bytes + 1) * 5);
+    do
+    {
+      size_t const length = std::min(size, max_stored_block_bytes);
+      out.push_back(last && length == size ? 1 : 0); // BFINAL, BTYPE = 00
+      out.push_back(length & 0xff);
+      out.push_back((length >> 8) & 0xff);
+      out.push_back(~length & 0xff);
+      out.push_back((~length >> 8) & 0xff);
+      out.insert(out.end(), data, data + length);
+      data += length;
+      size -= length;
+    } while (size > 0);
+  }
+
+#if defined(SVGPP_RENDER_ZLIB)
+  void deflateBlock(unsigned char const * data, size_t size, 
+    unsigned char const * dictionary, size_t dictionary_size, bool last,
+    std::vector<unsigned char> & out) const
+  {
+    z_stream stream;
+    std::memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, level_, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+      throw std::runtime_error("Error initializing deflate");
+    if (dictionary_size)
+      deflateSetDictionary(&stream, dictionary, uInt(dictionary_size));
+    out.resize(deflateBound(&stream, uLong(size)) + 16);
+    stream.next_in = const_cast<Bytef *>(data);
+    stream.avail_in = uInt(size);
+    stream.next_out = &out[0];
+    stream.avail_out = uInt(out.size());
+    int const flush = last ? Z_FINISH : Z_SYNC_FLUSH;
+    for(;;)
+    {
+      int const result = deflate(&stream, flush);
+      if (result == Z_STREAM_ERROR)
+      {
+        deflateEnd(&stream);
+        throw std::runtime_error("Deflate error");
+      }
+      if (last ? result == Z_STREAM_END : stream.avail_out > 0)
+        break;
+      size_t const used = out.size() - stream.avail_out;
+      out.resize(out.size() * 2);
+      stream.next_out = &out[used];
+      stream.avail_out = uInt(out.size() - used);
+    }
+    out.resize(out.size() - stream.avail_out);
+    deflateEnd(&stream);
+  }
+#else
+  // Single threaded fallback that produces complete zlib stream
+  void compressWithStb()
+  {
+    int length = 0;
+    unsigned char * data = stbi_zlib_compress(&pending_[0], int(pending_.size()), &length, 8);
+    if (!data)
+      throw std::runtime_error("Deflate error");
+    blocks_.resize(1);
+    blocks_[0].assign(data, data + length);
+    free(data);
+    crcs_.resize(1);
+    std::vector<unsigned char>().swap(pending_);
+  }
+#endif
+
+  void computeCrcs(int begin, int end)
+  {
+    for(int i = begin; i < end; ++i)
+      crcs_[i] = crc32_table.update(chunkTypeCrc("IDAT"),
+        blocks_[i].empty() ? NULL : &blocks_[i][0], blocks_[i].size());
+  }
+};
+
+ImageWriter::ImageWriter(std::ostream & out, int width, int height, EncoderOptions const & options)
+  : out_(out)
+  , options_(options)
+  , width_(width)
+  , height_(height)
+  , rows_written_(0)
+{
+  if (options.format_ == EncoderOptions::png)
+  {
+    if (width <= 0 || height <= 0)
+      throw std::runtime_error("Empty image can't be saved as PNG");
+    png_.reset(new PngEncoder(width, height, options.compression_level_, out));
+  }
+  else
+    writeNetpbmHeader(width, height, options.format_, out);
+}
+
+ImageWriter::~ImageWriter()
+{}
+
+void ImageWriter::writeRows(EncoderInput const & rows)
+{
+  if (rows.width_ != width_ || rows.height_ > height_ - rows_written_)
+    throw std::runtime_error("Rows don't fit the image");
+  if (rows.height_ > 0)
+  {
+    if (png_)
+      png_->encode(rows, options_.thread_pool_, out_);
+    else
+      writeRawRows(rows, options_.format_, out_);
+    rows_written_ += rows.height_;
+  }
+  if (isComplete())
+    out_.flush();
+  if (!out_)
+    throw std::runtime_error("Error writing image");
+}
+
+void encodeImage(EncoderInput const & input, EncoderOptions const & options, std::ostream & out)
+{
+  ImageWriter writer(out, input.width_, input.height_, options);
+  writer.writeRows(input);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <ostream>
+#include <string>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+
+class ThreadPool;
+
+// Source pixels of encoders, 4 bytes per pixel
+struct EncoderInput
+{
+  EncoderInput(unsigned char const * pixels, int width, int height, int stride)
+    : pixels_(pixels)
+    , width_(width)
+    , height_(height)
+    , stride_(stride)
+    , bgra_(false)
+    , premultiplied_(false)
+  {}
+
+  unsigned char const * pixels_;
+  int width_, height_, stride_;
+  bool bgra_; // Channel order in memory, RGBA if false
+  bool premultiplied_;
+};
+
+struct EncoderOptions
+{
+  // 'rgba' is raw pixel data without header, 'pam' and 'ppm' are Netpbm formats,
+  // 'ppm' drops alpha channel. All formats except 'png' are written row by row
+  enum format_t { png, rgba, pam, ppm };
+
+  EncoderOptions()
+    : format_(png)
+    , compression_level_(6)
+    , thread_pool_(NULL)
+  {}
+
+  format_t format_;
+  int compression_level_; // PNG deflate level 0-9, 0 stores data uncompressed
+  ThreadPool * thread_pool_; // Not owned, PNG row blocks are compressed in parallel if set
+};
+
+// Return false if 'name' isn't recognized
+bool parseImageFormat(std::string const & name, EncoderOptions::format_t & format);
+// Accepts 0-9, 'none', 'fast' and 'best'
+bool parseCompressionLevel(std::string const & name, int & level);
+char const * imageFileExtension(EncoderOptions::format_t format);
+
+// Throws std::runtime_error if 'out' fails
+void encodeImage(EncoderInput const & input, EncoderOptions const & options, std::ostream & out);
+
+// Streaming encoder that gets image in consecutive parts of rows, so the whole image 
+// never has to be in memory. Each part is written as soon as it is encoded
+class ImageWriter: boost::noncopyable
+{
+public:
+  ImageWriter(std::ostream & out, int width, int height, EncoderOptions const & options);
+  ~ImageWriter();
+
+  // Width of 'rows' must match the image, the last part completes the file.
+  // Throws std::runtime_error if 'out' fails
+  void writeRows(EncoderInput const & rows);
+  bool isComplete() const { return rows_written_ == height_; }
+
+private:
+  class PngEncoder;
+
+  std::ostream & out_;
+  EncoderOptions const options_;
+  int const width_, height_;
+  int rows_written_;
+  boost::scoped_ptr<PngEncoder> png_;
+};
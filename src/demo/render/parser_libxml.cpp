@@ -2,6 +2,7 @@
 #include <map>
 #include <stdexcept>
 #include <libxml/parser.h>
+#include <boost/thread/mutex.hpp>
 
 namespace
 {
@@ -33,6 +34,14 @@ public:
       throw std::runtime_error("Could not parse file");
   }
 
+  Impl(const char * data, size_t size)
+  {
+    LIBXML_TEST_VERSION
+
+    if ((doc_ = xmlReadMemory(data, int(size), NULL, NULL, 0)) == NULL)
+      throw std::runtime_error("Could not parse document");
+  }
+
   ~Impl()
   {
     if (doc_)
@@ -47,6 +56,8 @@ public:
 
   XMLElement findElementById(svg_string_t const & id)
   {
+    // Same document may be rendered by several threads
+    boost::mutex::scoped_lock lock(element_by_id_mutex_);
     std::pair<element_by_id_t::iterator, bool> ins = element_by_id_.insert(element_by_id_t::value_type(id, XMLElement()));
     if (ins.second)
       ins.first->second = FindChildElementById(getRoot(), id);
@@ -57,6 +68,7 @@ private:
   xmlDoc * doc_;
   typedef std::map<svg_string_t, XMLElement> element_by_id_t;
   element_by_id_t element_by_id_;
+  boost::mutex element_by_id_mutex_;
 };
 
 XMLDocument::XMLDocument()
@@ -70,6 +82,11 @@ void XMLDocument::load(const char * fileName)
   impl_.reset(new Impl(fileName));
 }
 
+void XMLDocument::loadFromMemory(const char * data, size_t size)
+{
+  impl_.reset(new Impl(data, size));
+}
+
 XMLElement XMLDocument::getRoot()
 {
   return impl_->getRoot();
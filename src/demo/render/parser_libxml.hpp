@@ -15,6 +15,7 @@ public:
   ~XMLDocument();
 
   void load(const char * fileName);
+  void loadFromMemory(const char * data, size_t size);
   XMLElement getRoot();
 
   XMLElement findElementById(svg_string_t const & id);
@@ -21,51 +21,80 @@ XMLDocument::~XMLDocument()
   CoUninitialize();
 }
 
-void XMLDocument::load(const char * fileName)
+namespace
 {
-  //init
-  HRESULT hr;
+  typedef _com_ptr_t<_com_IIID<IXMLDOMDocument, &IID_IXMLDOMDocument> > DocumentPtr;
 
-  _com_ptr_t<_com_IIID<IXMLDOMDocument, &IID_IXMLDOMDocument> > docPtr;
-  if (FAILED(hr = docPtr.CreateInstance(L"Msxml2.DOMDocument.3.0")))
+  DocumentPtr CreateDocument()
   {
-    std::ostringstream ostr;
-    ostr << "Error creating DOMDocument 0x" << std::hex << hr << "\n" << std::dec;
-    throw std::runtime_error(ostr.str());
+    HRESULT hr;
+    DocumentPtr docPtr;
+    if (FAILED(hr = docPtr.CreateInstance(L"Msxml2.DOMDocument.3.0")))
+    {
+      std::ostringstream ostr;
+      ostr << "Error creating DOMDocument 0x" << std::hex << hr << "\n" << std::dec;
+      throw std::runtime_error(ostr.str());
+    }
+
+    docPtr->put_async(VARIANT_FALSE);
+    docPtr->put_resolveExternals(VARIANT_FALSE);
+    docPtr->put_validateOnParse(VARIANT_FALSE);
+    return docPtr;
   }
 
-  // Load a document.
-  docPtr->put_async(VARIANT_FALSE);
-  docPtr->put_resolveExternals(VARIANT_FALSE);
-  docPtr->put_validateOnParse(VARIANT_FALSE);
-  VARIANT_BOOL load_result;
-  if (S_OK != (hr = docPtr->load(_variant_t(fileName), &load_result)))
+  // Checks result of load() or loadXML() and returns document element
+  XMLElement GetDocumentElement(DocumentPtr const & docPtr, HRESULT hr)
   {
-    _com_ptr_t<_com_IIID<IXMLDOMParseError, &IID_IXMLDOMParseError> > parseError;
-    if (SUCCEEDED(docPtr->get_parseError(&parseError)))
+    if (S_OK != hr)
     {
-      _bstr_t reason;
-      if (S_OK == parseError->get_reason(reason.GetAddress()))
+      _com_ptr_t<_com_IIID<IXMLDOMParseError, &IID_IXMLDOMParseError> > parseError;
+      if (SUCCEEDED(docPtr->get_parseError(&parseError)))
       {
-        std::ostringstream ostr;
-        ostr << "Parse error: " << std::string(reason.GetBSTR(), reason.GetBSTR() + reason.length()) << "\n";
-        throw std::runtime_error(ostr.str());
+        _bstr_t reason;
+        if (S_OK == parseError->get_reason(reason.GetAddress()))
+        {
+          std::ostringstream ostr;
+          ostr << "Parse error: " << std::string(reason.GetBSTR(), reason.GetBSTR() + reason.length()) << "\n";
+          throw std::runtime_error(ostr.str());
+        }
       }
+      std::ostringstream ostr;
+      ostr << "Error loading XML document 0x" << std::hex << hr << "\n" << std::dec;
+      throw std::runtime_error(ostr.str());
     }
-    std::ostringstream ostr;
-    ostr << "Error loading XML document 0x" << std::hex << hr << "\n" << std::dec;
-    throw std::runtime_error(ostr.str());
+
+    _com_ptr_t<_com_IIID<IXMLDOMElement, &IID_IXMLDOMElement> > root;
+    if (FAILED(hr = docPtr->get_documentElement(&root)))
+    {
+      std::ostringstream ostr;
+      ostr << "Error getting documentElement 0x" << std::hex << hr << "\n" << std::dec;
+      throw std::runtime_error(ostr.str());
+    }
+    return XMLElement(root.GetInterfacePtr());
   }
+}
+
+void XMLDocument::load(const char * fileName)
+{
+  DocumentPtr docPtr = CreateDocument();
+  VARIANT_BOOL load_result;
+  root_ = GetDocumentElement(docPtr, docPtr->load(_variant_t(fileName), &load_result));
+}
 
-  _com_ptr_t<_com_IIID<IXMLDOMElement, &IID_IXMLDOMElement> > root;
-  if (FAILED(hr = docPtr->get_documentElement(&root)))
+void XMLDocument::loadFromMemory(const char * data, size_t size)
+{
+  // loadXML() expects UTF-16 text
+  std::wstring text;
+  if (size > 0)
   {
-    std::ostringstream ostr;
-    ostr << "Error getting documentElement 0x" << std::hex << hr << "\n" << std::dec;
-    throw std::runtime_error(ostr.str());
+    int const length = MultiByteToWideChar(CP_UTF8, 0, data, int(size), NULL, 0);
+    text.resize(length);
+    if (length > 0)
+      MultiByteToWideChar(CP_UTF8, 0, data, int(size), &text[0], length);
   }
-
-  root_ = root.GetInterfacePtr();
+  DocumentPtr docPtr = CreateDocument();
+  VARIANT_BOOL load_result;
+  root_ = GetDocumentElement(docPtr, docPtr->loadXML(_bstr_t(text.c_str()), &load_result));
 }
 
 XMLElement XMLDocument::findElementById(svg_string_t const & id)
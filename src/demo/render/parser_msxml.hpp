@@ -19,6 +19,7 @@ public:
   ~XMLDocument();
 
   void load(const char * fileName);
+  void loadFromMemory(const char * data, size_t size);
   XMLElement const & getRoot() { return root_; }
 
   XMLElement findElementById(svg_string_t const & id);
@@ -1,6 +1,9 @@
 #include "parser_rapidxml_ns.hpp"
 #include <rapidxml_ns/rapidxml_ns_utils.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 #include <map>
+#include <vector>
 
 namespace
 {
@@ -22,9 +25,16 @@ class XMLDocument::Impl
 {
 public:
   Impl(const char * fileName)
-    : xml_file_(fileName)
+    : xml_file_(new rapidxml_ns::file<>(fileName))
   {
-    doc_.parse<rapidxml_ns::parse_no_string_terminators>(xml_file_.data());  
+    doc_.parse<rapidxml_ns::parse_no_string_terminators>(xml_file_->data());  
+  }
+
+  Impl(const char * data, size_t size)
+    : text_(data, data + size)
+  {
+    text_.push_back(0); // rapidxml parses zero terminated string in place
+    doc_.parse<rapidxml_ns::parse_no_string_terminators>(&text_[0]);  
   }
 
   XMLElement getRoot()
@@ -34,6 +44,8 @@ public:
 
   XMLElement findElementById(svg_string_t const & id)
   {
+    // Same document may be rendered by several threads
+    boost::mutex::scoped_lock lock(element_by_id_mutex_);
     std::pair<element_by_id_t::iterator, bool> ins = element_by_id_.insert(element_by_id_t::value_type(id, XMLElement()));
     if (ins.second)
       ins.first->second = FindChildElementById(getRoot(), id);
@@ -41,10 +53,12 @@ public:
   }
 
 private:
-  rapidxml_ns::file<> xml_file_;
+  boost::scoped_ptr<rapidxml_ns::file<> > xml_file_;
+  std::vector<char> text_;
   rapidxml_ns::xml_document<> doc_;
   typedef std::map<svg_string_t, XMLElement> element_by_id_t;
   element_by_id_t element_by_id_;
+  boost::mutex element_by_id_mutex_;
 };
 
 XMLDocument::XMLDocument()
@@ -58,6 +72,11 @@ void XMLDocument::load(const char * fileName)
   impl_.reset(new Impl(fileName));
 }
 
+void XMLDocument::loadFromMemory(const char * data, size_t size)
+{
+  impl_.reset(new Impl(data, size));
+}
+
 XMLElement XMLDocument::getRoot()
 {
   return impl_->getRoot();
@@ -2,8 +2,10 @@
 
 #include <xercesc/util/PlatformUtils.hpp>
 #include <xercesc/parsers/XercesDOMParser.hpp>
+#include <xercesc/framework/MemBufInputSource.hpp>
 #include <sstream>
 #include <map>
+#include <boost/thread/mutex.hpp>
 
 using namespace xercesc;
 
@@ -32,8 +34,12 @@ class XMLDocument::Impl
 public:
   std::auto_ptr<XercesDOMParser> parser_;
 
+  template<class Source>
+  void parse(Source const & source);
+
   typedef std::map<svg_string_t, XMLElement> element_by_id_t;
   element_by_id_t element_by_id_;
+  boost::mutex element_by_id_mutex_;
 };
 
 XMLDocument::XMLDocument()
@@ -57,15 +63,16 @@ XMLDocument::~XMLDocument()
 {
 }
 
-void XMLDocument::load(const char * fileName)
+template<class Source>
+void XMLDocument::Impl::parse(Source const & source)
 {
-  impl_->parser_.reset(new XercesDOMParser);
-  impl_->parser_->setValidationScheme(XercesDOMParser::Val_Always);
-  impl_->parser_->setDoNamespaces(true);    // optional
+  parser_.reset(new XercesDOMParser);
+  parser_->setValidationScheme(XercesDOMParser::Val_Always);
+  parser_->setDoNamespaces(true);    // optional
 
   try 
   {
-    impl_->parser_->parse(fileName);
+    parser_->parse(source);
   }
   catch (const XMLException& toCatch) 
   {
@@ -91,6 +98,16 @@ void XMLDocument::load(const char * fileName)
   }
 }
 
+void XMLDocument::load(const char * fileName)
+{
+  impl_->parse(fileName);
+}
+
+void XMLDocument::loadFromMemory(const char * data, size_t size)
+{
+  impl_->parse(MemBufInputSource(reinterpret_cast<XMLByte const *>(data), size, "svg", false));
+}
+
 XMLElement XMLDocument::getRoot() const
 {
   return impl_->parser_->getDocument()->getDocumentElement();
@@ -98,6 +115,8 @@ XMLElement XMLDocument::getRoot() const
 
 XMLElement XMLDocument::findElementById(svg_string_t const & id)
 {
+  // Same document may be rendered by several threads
+  boost::mutex::scoped_lock lock(impl_->element_by_id_mutex_);
   std::pair<Impl::element_by_id_t::iterator, bool> ins = 
     impl_->element_by_id_.insert(Impl::element_by_id_t::value_type(id, XMLElement()));
   if (ins.second)
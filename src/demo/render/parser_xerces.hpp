@@ -14,6 +14,7 @@ public:
   ~XMLDocument();
 
   void load(const char * fileName);
+  void loadFromMemory(const char * data, size_t size);
   XMLElement getRoot() const;
 
   XMLElement findElementById(svg_string_t const & id);
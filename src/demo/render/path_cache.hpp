@@ -0,0 +1,79 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <map>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <svgpp/policy/marker_events.hpp>
+
+struct MarkerPos
+{
+  svgpp::marker_vertex v;
+  number_t x, y, directionality;
+};
+
+#if defined(RENDERER_AGG)
+#include <agg_path_storage.h>
+
+// Path with marker positions as built from path data, in user space. Subpath orientations are
+// arranged, so that the geometry is rasterized as is
+struct PathGeometry
+{
+  agg::path_storage path_storage_;
+  std::vector<MarkerPos> markers_;
+};
+
+// Iterates vertices of path storage without modifying it, so the same geometry may be rasterized
+// by several threads and by several instances of the element
+class ConstPathSource
+{
+public:
+  explicit ConstPathSource(agg::path_storage const & path)
+    : path_(path)
+    , index_(0)
+  {}
+
+  void rewind(unsigned)
+  {
+    index_ = 0;
+  }
+
+  unsigned vertex(double * x, double * y)
+  {
+    if (index_ >= path_.total_vertices())
+      return agg::path_cmd_stop;
+    return path_.vertex(index_++, x, y);
+  }
+
+private:
+  agg::path_storage const & path_;
+  unsigned index_;
+};
+
+// Geometry of 'd' attributes of referenced elements, so that instances of elements used many times
+// by 'use', 'marker' and 'clipPath' share it instead of parsing path data again. Keyed by element
+class PathCache: boost::noncopyable
+{
+public:
+  typedef boost::shared_ptr<PathGeometry const> geometry_ptr_t;
+
+  geometry_ptr_t find(XMLElement const & element) const
+  {
+    cache_t::const_iterator it = cache_.find(element);
+    return it == cache_.end() ? geometry_ptr_t() : it->second;
+  }
+
+  void insert(XMLElement const & element, geometry_ptr_t const & geometry)
+  {
+    cache_[element] = geometry;
+  }
+
+private:
+  typedef std::map<XMLElement, geometry_ptr_t> cache_t;
+  cache_t cache_;
+};
+#else
+class PathCache;
+#endif
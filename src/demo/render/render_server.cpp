@@ -0,0 +1,505 @@
+#include "render_server.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <sstream>
+#include <stdexcept>
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/ref.hpp>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <csignal>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+namespace
+{
+  size_t const max_header_length = 256;
+  // Upper bounds of render time histogram buckets in seconds, +Inf bucket is implied
+  double const render_time_bounds[] = { 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5, 10 };
+  size_t const render_time_bucket_count = sizeof(render_time_bounds) / sizeof(render_time_bounds[0]);
+
+  RenderServer::Limits resolveLimits(RenderServer::Limits limits)
+  {
+    limits.workers_ = std::max(1u, limits.workers_);
+    if (limits.queue_size_ == 0)
+      limits.queue_size_ = 2 * limits.workers_;
+    return limits;
+  }
+
+  int readSome(int fd, char * data, size_t size)
+  {
+#if defined(_WIN32)
+    return _read(fd, data, unsigned(size));
+#else
+    ssize_t result;
+    do
+      result = ::read(fd, data, size);
+    while (result < 0 && errno == EINTR);
+    return int(result);
+#endif
+  }
+
+  int writeSome(int fd, char const * data, size_t size)
+  {
+#if defined(_WIN32)
+    return _write(fd, data, unsigned(size));
+#else
+    ssize_t result;
+    do
+      result = ::write(fd, data, size);
+    while (result < 0 && errno == EINTR);
+    return int(result);
+#endif
+  }
+}
+
+// Buffered reading and writing of file descriptors
+class RenderServer::Connection: boost::noncopyable
+{
+public:
+  Connection(int in_fd, int out_fd)
+    : in_fd_(in_fd)
+    , out_fd_(out_fd)
+    , begin_(0)
+    , end_(0)
+  {}
+
+  // Returns false on end of input or if the line is longer than 'max_length'
+  bool readLine(std::string & line, size_t max_length)
+  {
+    line.clear();
+    for(;;)
+    {
+      if (begin_ == end_ && !fill())
+        return false;
+      char const * const data = buffer_ + begin_;
+      char const * const eol = static_cast<char const *>(std::memchr(data, '\n', end_ - begin_));
+      size_t const length = eol ? eol - data : end_ - begin_;
+      if (line.size() + length > max_length)
+        return false;
+      line.append(data, length);
+      if (eol)
+      {
+        begin_ += length + 1;
+        if (!line.empty() && line[line.size() - 1] == '\r')
+          line.resize(line.size() - 1);
+        return true;
+      }
+      begin_ = end_;
+    }
+  }
+
+  // Reads exactly 'size' bytes to 'out' or discards them if 'out' is NULL
+  bool readBytes(std::string * out, size_t size)
+  {
+    if (out)
+      out->clear();
+    while (size > 0)
+    {
+      if (begin_ == end_ && !fill())
+        return false;
+      size_t const length = std::min(size, end_ - begin_);
+      if (out)
+        out->append(buffer_ + begin_, length);
+      begin_ += length;
+      size -= length;
+    }
+    return true;
+  }
+
+  bool write(std::string const & data)
+  {
+    for(size_t offset = 0; offset < data.size(); )
+    {
+      int const written = writeSome(out_fd_, data.data() + offset, data.size() - offset);
+      if (written <= 0)
+        return false;
+      offset += written;
+    }
+    return true;
+  }
+
+private:
+  int const in_fd_, out_fd_;
+  char buffer_[65536];
+  size_t begin_, end_;
+
+  bool fill()
+  {
+    int const received = readSome(in_fd_, buffer_, sizeof(buffer_));
+    if (received <= 0)
+      return false;
+    begin_ = 0;
+    end_ = received;
+    return true;
+  }
+};
+
+struct RenderServer::Job
+{
+  Job()
+    : done_(false)
+  {}
+
+  RenderRequest request_;
+  RenderResponse response_;
+  bool done_;
+};
+
+// Jobs of pipelined stream in order of requests
+struct RenderServer::Pipeline
+{
+  Pipeline()
+    : finished_(false)
+  {}
+
+  std::deque<boost::shared_ptr<Job> > jobs_;
+  bool finished_;
+  boost::mutex mutex_;
+  boost::condition_variable changed_;
+};
+
+RenderServer::Limits::Limits()
+  : workers_(std::max(1u, boost::thread::hardware_concurrency()))
+  , queue_size_(0)
+  , max_connections_(64)
+  , max_request_bytes_(16 << 20)
+{}
+
+RenderServer::RenderServer(render_func_t const & render, Limits const & limits)
+  : render_(render)
+  , limits_(resolveLimits(limits))
+  , pool_(new ThreadPool(limits_.workers_ + 1)) // Calling thread doesn't render
+  , queued_(0)
+  , connections_(0)
+  , requests_ok_(0)
+  , requests_failed_(0)
+  , requests_timed_out_(0)
+  , requests_rejected_(0)
+  , render_time_buckets_(render_time_bucket_count + 1, 0)
+  , render_seconds_sum_(0)
+  , bytes_in_(0)
+  , bytes_out_(0)
+{}
+
+RenderServer::~RenderServer()
+{}
+
+RenderServer::ReadResult RenderServer::readRequest(Connection & connection, Job & job, bool & in_sync)
+{
+  std::string line;
+  if (!connection.readLine(line, max_header_length))
+    return readStop;
+
+  std::istringstream header(line);
+  std::string command;
+  header >> command;
+  if (command == "QUIT")
+    return readStop;
+  if (command == "STATS")
+  {
+    job.response_.format_ = "text";
+    job.response_.body_ = stats();
+    return readAnswered;
+  }
+
+  size_t length = 0;
+  if (command != "RENDER"
+    || !(header >> job.request_.width_ >> job.request_.height_ >> job.request_.format_ >> length))
+  {
+    job.response_.code_ = 400;
+    job.response_.body_ = "Invalid request header";
+    in_sync = false;
+    return readAnswered;
+  }
+  if (length > limits_.max_request_bytes_)
+  {
+    job.response_.code_ = 413;
+    job.response_.body_ = "Request is too large";
+    in_sync = connection.readBytes(NULL, length);
+    boost::mutex::scoped_lock lock(mutex_);
+    ++requests_rejected_;
+    return readAnswered;
+  }
+  if (!connection.readBytes(&job.request_.svg_, length))
+    return readStop;
+  boost::mutex::scoped_lock lock(mutex_);
+  bytes_in_ += length;
+  return readRender;
+}
+
+bool RenderServer::submit(boost::shared_ptr<Job> const & job, bool wait_for_room)
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (queued_ >= limits_.queue_size_)
+    {
+      if (!wait_for_room)
+      {
+        ++requests_rejected_;
+        return false;
+      }
+      while (queued_ >= limits_.queue_size_)
+        changed_.wait(lock);
+    }
+    ++queued_;
+  }
+  pool_->post(boost::bind(&RenderServer::runJob, this, job));
+  return true;
+}
+
+void RenderServer::wait(Job const & job)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  while (!job.done_)
+    changed_.wait(lock);
+}
+
+void RenderServer::runJob(boost::shared_ptr<Job> const & job)
+{
+  boost::posix_time::ptime const start = boost::posix_time::microsec_clock::universal_time();
+  try
+  {
+    render_(job->request_, job->response_);
+  }
+  catch (std::exception const & e)
+  {
+    job->response_.code_ = 500;
+    job->response_.body_ = e.what();
+  }
+  catch (...)
+  {
+    job->response_.code_ = 500;
+    job->response_.body_ = "Unknown error";
+  }
+  double const seconds = (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds() / 1e6;
+
+  boost::mutex::scoped_lock lock(mutex_);
+  if (job->response_.code_ == 200)
+    ++requests_ok_;
+  else if (job->response_.code_ == 504)
+    ++requests_timed_out_;
+  else
+    ++requests_failed_;
+  ++render_time_buckets_[
+    std::lower_bound(render_time_bounds, render_time_bounds + render_time_bucket_count, seconds) - render_time_bounds];
+  render_seconds_sum_ += seconds;
+  --queued_;
+  job->done_ = true;
+  changed_.notify_all();
+}
+
+bool RenderServer::writeResponse(Connection & connection, RenderResponse const & response)
+{
+  std::ostringstream header;
+  if (response.code_ == 200)
+    header << "OK " << response.format_ << " " << response.body_.size() << "\n";
+  else
+    header << "ERROR " << response.code_ << " " << response.body_.size() << "\n";
+  if (!connection.write(header.str()) || !connection.write(response.body_))
+    return false;
+  boost::mutex::scoped_lock lock(mutex_);
+  bytes_out_ += response.body_.size();
+  return true;
+}
+
+void RenderServer::readPipelined(Connection & connection, boost::shared_ptr<Pipeline> const & pipeline)
+{
+  for(bool in_sync = true; in_sync; )
+  {
+    boost::shared_ptr<Job> job = boost::make_shared<Job>();
+    ReadResult const result = readRequest(connection, *job, in_sync);
+    if (result == readStop)
+      break;
+    {
+      // Finished jobs keep their responses until they are written, so reading waits for the writer
+      boost::mutex::scoped_lock lock(pipeline->mutex_);
+      while (pipeline->jobs_.size() >= limits_.queue_size_)
+        pipeline->changed_.wait(lock);
+    }
+    if (result == readRender)
+      submit(job, true);
+    else
+      job->done_ = true;
+    boost::mutex::scoped_lock lock(pipeline->mutex_);
+    pipeline->jobs_.push_back(job);
+    pipeline->changed_.notify_all();
+  }
+  boost::mutex::scoped_lock lock(pipeline->mutex_);
+  pipeline->finished_ = true;
+  pipeline->changed_.notify_all();
+}
+
+void RenderServer::serveStream(int in_fd, int out_fd)
+{
+  Connection connection(in_fd, out_fd);
+  boost::shared_ptr<Pipeline> pipeline = boost::make_shared<Pipeline>();
+  // Reader blocks in submit() while the queue is full and while too many responses wait to be written,
+  // so the number of pending jobs stays bounded
+  boost::thread reader(boost::bind(&RenderServer::readPipelined, this, boost::ref(connection), pipeline));
+  bool output_ok = true;
+  for(;;)
+  {
+    boost::shared_ptr<Job> job;
+    {
+      boost::mutex::scoped_lock lock(pipeline->mutex_);
+      while (pipeline->jobs_.empty() && !pipeline->finished_)
+        pipeline->changed_.wait(lock);
+      if (pipeline->jobs_.empty())
+        break;
+      job = pipeline->jobs_.front();
+      pipeline->jobs_.pop_front();
+      pipeline->changed_.notify_all();
+    }
+    wait(*job);
+    // After output is closed the rest of jobs is drained, so that the reader isn't blocked
+    if (output_ok)
+      output_ok = writeResponse(connection, job->response_);
+  }
+  reader.join();
+}
+
+void RenderServer::serveSocketConnection(int fd)
+{
+#if !defined(_WIN32)
+  try
+  {
+    Connection connection(fd, fd);
+    for(bool in_sync = true; in_sync; )
+    {
+      boost::shared_ptr<Job> job = boost::make_shared<Job>();
+      ReadResult const result = readRequest(connection, *job, in_sync);
+      if (result == readStop)
+        break;
+      if (result == readRender)
+      {
+        if (submit(job, false))
+          wait(*job);
+        else
+        {
+          job->response_.code_ = 503;
+          job->response_.body_ = "Render queue is full";
+        }
+      }
+      if (!writeResponse(connection, job->response_))
+        break;
+    }
+  }
+  catch (std::exception const &)
+  {}
+  ::close(fd);
+  boost::mutex::scoped_lock lock(mutex_);
+  --connections_;
+#endif
+}
+
+void RenderServer::serveUnixSocket(std::string const & path)
+{
+#if defined(_WIN32)
+  throw std::runtime_error("Unix domain sockets aren't supported on this platform");
+#else
+  // Client disconnects are reported by write() errors
+  std::signal(SIGPIPE, SIG_IGN);
+
+  sockaddr_un address;
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path))
+    throw std::runtime_error("Socket path is too long: " + path);
+  std::strcpy(address.sun_path, path.c_str());
+
+  int const listen_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd < 0)
+    throw std::runtime_error("Can't create socket");
+  ::unlink(path.c_str());
+  if (::bind(listen_fd, reinterpret_cast<sockaddr const *>(&address), sizeof(address)) != 0
+    || ::listen(listen_fd, SOMAXCONN) != 0)
+  {
+    ::close(listen_fd);
+    throw std::runtime_error("Can't listen on socket " + path + ": " + std::strerror(errno));
+  }
+
+  for(;;)
+  {
+    int const fd = ::accept(listen_fd, NULL, NULL);
+    if (fd < 0)
+    {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      int const error = errno;
+      ::close(listen_fd);
+      throw std::runtime_error(std::string("Error accepting connection: ") + std::strerror(error));
+    }
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      if (connections_ < limits_.max_connections_)
+      {
+        ++connections_;
+        lock.unlock();
+        boost::thread(boost::bind(&RenderServer::serveSocketConnection, this, fd)).detach();
+        continue;
+      }
+      ++requests_rejected_;
+    }
+    Connection connection(fd, fd);
+    RenderResponse response;
+    response.code_ = 503;
+    response.body_ = "Too many connections";
+    writeResponse(connection, response);
+    ::close(fd);
+  }
+#endif
+}
+
+std::string RenderServer::stats()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  std::ostringstream out;
+  out << "# HELP svgpp_requests_total Render requests by result.\n"
+    << "# TYPE svgpp_requests_total counter\n"
+    << "svgpp_requests_total{result=\"ok\"} " << requests_ok_ << "\n"
+    << "svgpp_requests_total{result=\"error\"} " << requests_failed_ << "\n"
+    << "svgpp_requests_total{result=\"timeout\"} " << requests_timed_out_ << "\n"
+    << "svgpp_requests_total{result=\"rejected\"} " << requests_rejected_ << "\n"
+    << "# HELP svgpp_render_duration_seconds Time spent rendering and encoding an image.\n"
+    << "# TYPE svgpp_render_duration_seconds histogram\n";
+  unsigned long cumulative = 0;
+  for(size_t i = 0; i < render_time_bucket_count; ++i)
+  {
+    cumulative += render_time_buckets_[i];
+    out << "svgpp_render_duration_seconds_bucket{le=\"" << render_time_bounds[i] << "\"} " << cumulative << "\n";
+  }
+  cumulative += render_time_buckets_[render_time_bucket_count];
+  out << "svgpp_render_duration_seconds_bucket{le=\"+Inf\"} " << cumulative << "\n"
+    << "svgpp_render_duration_seconds_sum " << render_seconds_sum_ << "\n"
+    << "svgpp_render_duration_seconds_count " << cumulative << "\n"
+    << "# HELP svgpp_queue_depth Requests waiting for a worker or being rendered.\n"
+    << "# TYPE svgpp_queue_depth gauge\n"
+    << "svgpp_queue_depth " << queued_ << "\n"
+    << "# HELP svgpp_queue_capacity Maximum queue depth.\n"
+    << "# TYPE svgpp_queue_capacity gauge\n"
+    << "svgpp_queue_capacity " << limits_.queue_size_ << "\n"
+    << "# HELP svgpp_workers Render worker threads.\n"
+    << "# TYPE svgpp_workers gauge\n"
+    << "svgpp_workers " << pool_->size() - 1 << "\n"
+    << "# HELP svgpp_connections Open socket connections.\n"
+    << "# TYPE svgpp_connections gauge\n"
+    << "svgpp_connections " << connections_ << "\n"
+    << "# HELP svgpp_received_bytes_total Bytes of SVG documents received.\n"
+    << "# TYPE svgpp_received_bytes_total counter\n"
+    << "svgpp_received_bytes_total " << bytes_in_ << "\n"
+    << "# HELP svgpp_sent_bytes_total Bytes of response bodies sent.\n"
+    << "# TYPE svgpp_sent_bytes_total counter\n"
+    << "svgpp_sent_bytes_total " << bytes_out_ << "\n";
+  return out.str();
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+
+class ThreadPool;
+
+// Requests and responses are framed by a text header line followed by a binary body:
+//   RENDER <width> <height> <format> <body length>\n<SVG bytes>
+//   STATS\n
+//   QUIT\n
+// Responses:
+//   OK <format> <body length>\n<encoded image or stats text>
+//   ERROR <code> <body length>\n<message>
+// Zero width and height mean the size set in the document.
+// Error codes follow HTTP: 400 bad request, 413 too large, 500 render error, 503 queue is full,
+// 504 time limit exceeded
+struct RenderRequest
+{
+  RenderRequest()
+    : width_(0)
+    , height_(0)
+  {}
+
+  unsigned width_, height_;
+  std::string format_;
+  std::string svg_;
+};
+
+struct RenderResponse
+{
+  RenderResponse()
+    : code_(200)
+  {}
+
+  int code_; // 200 on success
+  std::string format_;
+  std::string body_; // Encoded image or error message
+};
+
+class RenderServer: boost::noncopyable
+{
+public:
+  typedef boost::function<void(RenderRequest const &, RenderResponse &)> render_func_t;
+
+  struct Limits
+  {
+    Limits();
+
+    unsigned workers_;
+    // Requests waiting for a worker or being rendered, also responses of a stream waiting to be
+    // written. Zero means twice the number of workers
+    unsigned queue_size_;
+    unsigned max_connections_;
+    size_t max_request_bytes_;
+  };
+
+  RenderServer(render_func_t const & render, Limits const & limits);
+  ~RenderServer();
+
+  // Reads requests from 'in_fd' and writes responses in the same order to 'out_fd' until
+  // end of input or QUIT. Requests are rendered in parallel, reading stops while the queue is full
+  // or 'queue_size_' responses aren't written yet
+  void serveStream(int in_fd, int out_fd);
+  // Accepts connections on Unix domain socket 'path', returns on error only. Requests of one
+  // connection are processed in turn, requests that don't fit the queue get 503 response
+  void serveUnixSocket(std::string const & path);
+
+  // Prometheus text exposition format
+  std::string stats();
+
+private:
+  struct Job;
+  struct Pipeline;
+  class Connection;
+
+  render_func_t const render_;
+  Limits const limits_;
+  boost::scoped_ptr<ThreadPool> pool_;
+  boost::mutex mutex_;
+  boost::condition_variable changed_;
+  unsigned queued_, connections_;
+
+  // Statistics
+  unsigned long requests_ok_, requests_failed_, requests_timed_out_, requests_rejected_;
+  std::vector<unsigned long> render_time_buckets_;
+  double render_seconds_sum_;
+  unsigned long bytes_in_, bytes_out_;
+
+  enum ReadResult { readRender, readAnswered, readStop };
+
+  // Reads next request. Requests that don't need rendering are answered in 'job' response.
+  // 'in_sync' is reset if the rest of input can't be parsed
+  ReadResult readRequest(Connection & connection, Job & job, bool & in_sync);
+  // Returns false if the queue is full and 'wait_for_room' is false
+  bool submit(boost::shared_ptr<Job> const & job, bool wait_for_room);
+  void wait(Job const & job);
+  void runJob(boost::shared_ptr<Job> const & job);
+  bool writeResponse(Connection & connection, RenderResponse const & response);
+  void readPipelined(Connection & connection, boost::shared_ptr<Pipeline> const & pipeline);
+  void serveSocketConnection(int fd);
+};
@@ -6,12 +6,17 @@
 #include <svgpp/document_traversal.hpp>
 #include <svgpp/utility/gil/mask.hpp>
 
+#include <boost/array.hpp>
 #include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <boost/gil/gil_all.hpp>
+#include <boost/make_shared.hpp>
 #include <boost/mpl/set.hpp>
 #include <boost/mpl/transform_view.hpp>
 #include <boost/optional.hpp>
 #include <boost/scope_exit.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 
 #if defined(RENDERER_AGG)
 #include <agg_bounding_rect.h>
@@ -31,26 +36,28 @@
 #include <agg_span_allocator.h>
 #include <agg_span_gradient.h>
 #include <agg_span_interpolator_linear.h>
-#include <stb/stb_image_write.h>
 #elif defined(RENDERER_SKIA)
 #include <SkBitmap.h>
 #include <SkCanvas.h>
-#include <SkImageEncoder.h>
 #include <SkPath.h>
 #include <effects/SkDashPathEffect.h>
 #include <effects/SkGradientShader.h>
-#include <images/SkForceLinking.h>
 #endif
 
+#include <limits>
 #include <map>
 #include <set>
-#include <fstream>
 #include <numeric>
 
 #include "stylable.hpp"
 #include "gradient.hpp"
 #include "clip_buffer.hpp"
 #include "filter.hpp"
+#include "display_list.hpp"
+#include "path_cache.hpp"
+#include "thread_pool.hpp"
+#include "image_buffer.hpp"
+#include "svgpp_render.hpp"
 
 namespace boost {
   namespace mpl {
@@ -72,21 +79,242 @@ class ReferencedSymbolOrSvg;
 class Mask;
 class Marker;
 
+#if defined(RENDERER_AGG)
+// Rasterizer, scanline and span storage shared by all fills and strokes of a document, so that it is
+// allocated once instead of for every path. Document is used by a single thread
+class RasterResources: boost::noncopyable
+{
+public:
+  // Scanline and span allocator grow their arrays to the widest span met. They are passed to AGG 
+  // algorithms by exact type, so methods hiding the base ones count the growth
+  class Scanline: public agg::scanline_p8
+  {
+  public:
+    explicit Scanline(unsigned long & allocations)
+      : allocations_(allocations)
+      , capacity_(0)
+    {}
+
+    void reset(int min_x, int max_x)
+    {
+      unsigned const length = max_x - min_x + 3; // As computed by agg::scanline_p8
+      if (length > capacity_)
+      {
+        capacity_ = length;
+        ++allocations_;
+      }
+      agg::scanline_p8::reset(min_x, max_x);
+    }
+
+  private:
+    unsigned long & allocations_;
+    unsigned capacity_;
+  };
+
+  class SpanAllocator: public agg::span_allocator<agg::rgba8>
+  {
+  public:
+    explicit SpanAllocator(unsigned long & allocations)
+      : allocations_(allocations)
+    {}
+
+    agg::rgba8 * allocate(unsigned span_length)
+    {
+      unsigned const capacity = max_span_len();
+      agg::rgba8 * span = agg::span_allocator<agg::rgba8>::allocate(span_length);
+      if (max_span_len() != capacity)
+        ++allocations_;
+      return span;
+    }
+
+  private:
+    unsigned long & allocations_;
+  };
+
+  RasterResources()
+    : passes_(0)
+    , allocations_(0)
+    , scanline_(allocations_)
+    , span_allocator_(allocations_)
+  {}
+
+  // Resets rasterizer for the next path, its cell blocks are kept
+  agg::rasterizer_scanline_aa<> & beginPass(ImageBuffer & buffer, agg::filling_rule_e filling_rule)
+  {
+    ++passes_;
+    rasterizer_.reset();
+    // Parts outside of the buffer (e.g. other bands of the canvas) are cut before cells are generated
+    rasterizer_.clip_box(0, 0, buffer.width(), buffer.height());
+    rasterizer_.filling_rule(filling_rule);
+    return rasterizer_;
+  }
+
+  agg::rasterizer_scanline_aa<> & rasterizer() { return rasterizer_; }
+  Scanline & scanline() { return scanline_; }
+  SpanAllocator & spanAllocator() { return span_allocator_; }
+  unsigned long passes() const { return passes_; }
+  // Reallocations of scanline and span arrays. Cell blocks are kept inside of the AGG rasterizer 
+  // and aren't visible here
+  unsigned long allocations() const { return allocations_; }
+
+private:
+  unsigned long passes_, allocations_; // Counters are bound by scanline and span allocator
+  agg::rasterizer_scanline_aa<> rasterizer_;
+  Scanline scanline_;
+  SpanAllocator span_allocator_;
+};
+
+// Content of a marker drawn once at the origin of the referencing path user space with zero orientation,
+// vertices get copies of it transformed to them
+struct CompiledMarker
+{
+  bool instanced_; // Not set if marker isn't found or has layers, it is traversed for each vertex then
+  bool auto_orient_;
+  std::vector<DisplayList::DrawPath> content_; // Transforms and bounds are relative to the path user space
+};
+#endif
+
 struct Document
 {
   class FollowRef;
 
-  Document(XMLDocument & xmlDocument)
+  Document(XMLDocument & xmlDocument, RenderOptions const & options = RenderOptions())
     : xml_document_(xmlDocument)
+    , options_(options)
     , gradients_(xml_document_)
     , filters_(xml_document_)
-  {}
+    , canvas_width_(0)
+    , canvas_height_(0)
+#if defined(RENDERER_AGG)
+    , display_list_(NULL)
+    , subtree_path_(NULL)
+#endif
+    , image_bytes_(0)
+    , image_peak_bytes_(0)
+  {
+#if defined(RENDERER_AGG)
+    gradients_.setColorRampSize(options.gradient_ramp_size_);
+#endif
+    filters_.setFusion(options.filter_fusion_);
+    filters_.setThreadPool(options.thread_pool_);
+  }
+
+  ~Document()
+  {
+#if defined(RENDERER_AGG)
+    statistics_.raster_passes_ += raster_resources_.passes();
+    statistics_.raster_allocations_ += raster_resources_.allocations();
+#endif
+    statistics_.document_peak_bytes_ = std::max(statistics_.document_peak_bytes_, image_peak_bytes_);
+    if (options_.statistics_)
+      *options_.statistics_ += statistics_;
+  }
+
+  void checkDeadline() const
+  {
+    if (!options_.deadline_.is_not_a_date_time() 
+      && boost::posix_time::microsec_clock::universal_time() > options_.deadline_)
+      throw RenderLimitExceeded(RenderLimitExceeded::time_limit, "Render time limit exceeded");
+  }
+
+  // RGBA images by default, clip buffers have a single byte per pixel
+  void reserveImageMemory(int width, int height, int pixel_bytes = 4)
+  {
+    image_bytes_ += size_t(width) * height * pixel_bytes;
+    image_peak_bytes_ = std::max(image_peak_bytes_, image_bytes_);
+    if (options_.max_image_bytes_ && image_bytes_ > options_.max_image_bytes_)
+      throw RenderLimitExceeded(RenderLimitExceeded::memory_limit, "Render memory limit exceeded");
+  }
+
+  void releaseImageMemory(int width, int height, int pixel_bytes = 4)
+  {
+    image_bytes_ -= size_t(width) * height * pixel_bytes;
+  }
+
+  // Memory of clip buffers is reserved while they exist
+  boost::shared_ptr<ClipBuffer> createClipBuffer(int width, int height)
+  {
+    reserveImageMemory(width, height, 1);
+    return boost::shared_ptr<ClipBuffer>(new ClipBuffer(width, height), ClipBufferDeleter(*this));
+  }
+
+  boost::shared_ptr<ClipBuffer> copyClipBuffer(ClipBuffer const & src)
+  {
+    boost::gil::gray8c_view_t const view = src.gilView();
+    reserveImageMemory(view.width(), view.height(), 1);
+    return boost::shared_ptr<ClipBuffer>(new ClipBuffer(src), ClipBufferDeleter(*this));
+  }
 
   XMLDocument & xml_document_;
+  RenderOptions const options_;
   Gradients gradients_;
   Filters filters_;
   typedef std::set<XMLElement> followed_refs_t;
   followed_refs_t followed_refs_;
+  int canvas_width_, canvas_height_; // Set by topmost 'svg' element, may be larger than the image buffer
+  BoundingBox buffer_bounds_; // Pixels of the image buffer, layers have the same size
+  RenderStatistics statistics_;
+#if defined(RENDERER_AGG)
+  // Separate, as clip path traversal doesn't compute markers
+  PathCache path_cache_, clip_path_cache_;
+  // Bounds of clip paths by id and transform to pixels, as many elements are usually clipped by the same one
+  typedef std::pair<svg_string_t, boost::array<number_t, 6> > clip_path_key_t;
+  typedef std::map<clip_path_key_t, BoundingBox> clip_path_bounds_t;
+  clip_path_bounds_t clip_path_bounds_;
+  // By marker id, stroke width and viewport size that percentage lengths refer to
+  typedef std::pair<svg_string_t, boost::array<number_t, 3> > marker_key_t;
+  typedef std::map<marker_key_t, boost::shared_ptr<CompiledMarker const> > compiled_markers_t;
+  compiled_markers_t compiled_markers_;
+  RasterResources raster_resources_;
+#endif
+
+  // Passed to ClipBuffer, NULL if renderer doesn't support it
+  PathCache * clipPathCache()
+  {
+#if defined(RENDERER_AGG)
+    return &clip_path_cache_;
+#else
+    return NULL;
+#endif
+  }
+  BoundingBox clipPathBounds(svg_string_t const & id, transform_t const & transform)
+  {
+#if defined(RENDERER_AGG)
+    clip_path_key_t key(id, boost::array<number_t, 6>());
+    transform.store_to(key.second.data());
+    clip_path_bounds_t::const_iterator it = clip_path_bounds_.find(key);
+    if (it == clip_path_bounds_.end())
+      it = clip_path_bounds_.insert(clip_path_bounds_t::value_type(key, 
+        ::clipPathBounds(xml_document_, id, transform, &clip_path_cache_))).first;
+    return it->second;
+#else
+    return ::clipPathBounds(xml_document_, id, transform, clipPathCache());
+#endif
+  }
+
+#if defined(RENDERER_AGG)
+  DisplayList * display_list_; // Drawing is recorded to it instead of rasterizing if set
+  std::vector<unsigned> const * subtree_path_; // If set, only this subtree of the document is recorded
+#endif
+
+private:
+  size_t image_bytes_, image_peak_bytes_;
+
+  struct ClipBufferDeleter
+  {
+    explicit ClipBufferDeleter(Document & document)
+      : document_(&document)
+    {}
+
+    void operator()(ClipBuffer * buffer) const
+    {
+      boost::gil::gray8c_view_t const view = buffer->gilView();
+      document_->releaseImageMemory(view.width(), view.height(), 1);
+      delete buffer;
+    }
+
+    Document * document_;
+  };
 };
 
 class Document::FollowRef
@@ -175,7 +403,7 @@ struct child_context_factories::apply<Canvas, svgpp::tag::element::use_, void>
 template<class ElementTag>
 struct child_context_factories::apply<Canvas, ElementTag, typename boost::enable_if<boost::mpl::has_key<svgpp::traits::shape_elements, ElementTag> >::type>
 {
-  typedef svgpp::factory::context::on_stack<Path> type;
+  typedef svgpp::factory::context::on_stack_with_xml_element<Path> type;
 };
 
 // Elements referenced by 'use' element
@@ -227,7 +455,7 @@ struct processed_elements
 {};
 
 struct processed_attributes
-  : boost::mpl::set58<
+  : boost::mpl::set59<
     // svgpp::traits::shapes_attributes_by_element
     boost::mpl::pair<svgpp::tag::element::path, svgpp::tag::attribute::d>,
     boost::mpl::pair<svgpp::tag::element::rect, svgpp::tag::attribute::x>,
@@ -288,92 +516,11 @@ struct processed_attributes
     svgpp::tag::attribute::opacity,
     svgpp::tag::attribute::orient,
     svgpp::tag::attribute::overflow,
+    svgpp::tag::attribute::id,
     boost::mpl::pair<svgpp::tag::element::use_, svgpp::tag::attribute::xlink::href>
   >
 {};
 
-#if defined(RENDERER_AGG)
-typedef agg::pixfmt_rgba32 pixfmt_t;
-typedef agg::renderer_base<pixfmt_t> renderer_base_t;
-#endif
-
-class ImageBuffer: boost::noncopyable
-{
-public:
-  ImageBuffer()
-  {}
-
-  ImageBuffer(int width, int height)
-  {
-    setSize(width, height, TransparentBlackColor());
-  }
-
-#if defined(RENDERER_AGG)
-  int width() const { return pixfmt_.width(); }
-  int height() const { return pixfmt_.height(); }
-  pixfmt_t & pixfmt() { return pixfmt_; }
-#elif defined(RENDERER_GDIPLUS)
-  int width() const { return bitmap_->GetWidth(); }
-  int height() const { return bitmap_->GetHeight(); }
-  Gdiplus::Bitmap & bitmap() { return *bitmap_; }
-#elif defined(RENDERER_SKIA)
-  int width() const { return bitmap_.width(); }
-  int height() const { return bitmap_.height(); }
-  SkBitmap & bitmap() { return bitmap_; }
-#endif
-
-#if defined(RENDERER_SKIA)
-  bool isSizeSet() const { return !bitmap_.empty(); }
-#else
-  bool isSizeSet() const { return !buffer_.empty(); }
-#endif
-
-  void setSize(int width, int height, color_t const & fill_color)
-  {
-#if defined(RENDERER_AGG)
-    BOOST_ASSERT(buffer_.empty());
-    buffer_.resize(width * height * pixfmt_t::pix_width);
-    rbuf_.attach(&buffer_[0], width, height, width * pixfmt_t::pix_width);
-    pixfmt_.attach(rbuf_);
-    agg::renderer_base<pixfmt_t> renderer_base(pixfmt_);
-    renderer_base.clear(fill_color);
-#elif defined(RENDERER_GDIPLUS)
-    BOOST_ASSERT(buffer_.empty());
-    buffer_.resize(width * height * 4);
-    bitmap_.reset(new Gdiplus::Bitmap(width, height, width * 4, PixelFormat32bppARGB, &buffer_[0]));
-#elif defined(RENDERER_SKIA)
-    bitmap_.allocN32Pixels(width, height);
-    bitmap_.eraseColor(fill_color); 
-#endif
-  }
-
-  boost::gil::rgba8_view_t gilView()
-  {
-#if defined(RENDERER_AGG)
-    return boost::gil::interleaved_view(pixfmt_.width(), pixfmt_.height(), 
-      reinterpret_cast<boost::gil::rgba8_pixel_t*>(pixfmt_.row_ptr(0)), pixfmt_.stride());
-#elif defined(RENDERER_GDIPLUS)
-    return boost::gil::interleaved_view(bitmap_->GetWidth(), bitmap_->GetHeight(), 
-      reinterpret_cast<boost::gil::rgba8_pixel_t*>(&buffer_[0]), bitmap_->GetWidth() * 4);
-#elif defined(RENDERER_SKIA)
-    return boost::gil::interleaved_view(bitmap_.width(), bitmap_.height(), 
-      reinterpret_cast<boost::gil::rgba8_pixel_t*>(bitmap_.getPixels()), bitmap_.rowBytesAsPixels());
-#endif
-  }
-
-private:
-#if defined(RENDERER_AGG)
-  std::vector<unsigned char> buffer_;
-  agg::rendering_buffer rbuf_;
-  pixfmt_t pixfmt_;
-#elif defined(RENDERER_GDIPLUS)
-  std::vector<BYTE> buffer_;
-  std::unique_ptr<Gdiplus::Bitmap> bitmap_;
-#elif defined(RENDERER_SKIA)
-  SkBitmap bitmap_;
-#endif
-};
-
 class Transformable
 {
 public:
@@ -463,24 +610,24 @@ private:
 
 typedef boost::function<ImageBuffer&()> lazy_buffer_t;
 
-namespace
+// Effects applied to layer of an element when it is composed into the layer below
+struct LayerEffects
 {
-  template<class GrayMask>
-  void blend_image_with_mask(boost::gil::rgba8_view_t const & rgbaView, GrayMask const & maskView)
-  {
-    boost::gil::rgba8_view_t::iterator o = rgbaView.begin();
-    for(typename GrayMask::iterator m = maskView.begin(); m != maskView.end(); ++m, ++o)
-    {
-      using namespace boost::gil;
-      get_color(*o, alpha_t()) = 
-        channel_multiply(
-          get_color(*o, alpha_t()),
-          get_color(*m, gray_color_t())
-        );
-    }
-    BOOST_ASSERT(o == rgbaView.end());
-  }
-}
+  LayerEffects(transform_t const & transform, length_factory_t const & length_factory)
+    : transform_(transform)
+    , length_factory_(length_factory)
+    , opacity_(1)
+  {}
+
+  transform_t const & transform_;
+  length_factory_t const & length_factory_;
+  number_t opacity_;
+  boost::optional<svg_string_t> mask_fragment_, filter_;
+  BoundingBox bounding_box_;
+};
+
+void compositeLayer(Document & document, LayerEffects const & effects, ImageBuffer & layer, ImageBuffer & parent,
+  ClipBuffer const * clip);
 
 class Canvas: 
   public Stylable,
@@ -488,97 +635,104 @@ class Canvas:
 {
 public:
   struct dontInheritStyle {};
+#if defined(RENDERER_AGG)
+  // When a subtree is recorded again, only its content and elements on the path to it are traversed
+  enum RecordState { recordAll, recordAncestor, recordNone };
+#endif
 
   Canvas(Document & document, ImageBuffer & image_buffer)
     : document_(document)
-    , parent_buffer_(boost::bind(&Canvas::getPassedImageBuffer, this))
     , image_buffer_(&image_buffer)
+    , parent_buffer_(boost::bind(&Canvas::getPassedImageBuffer, this))
+    , parent_canvas_(NULL)
+    , visible_bounds_(BoundingBox::unbounded())
+    , visible_bounds_resolved_(false)
     , rendering_disabled_(false)
+#if defined(RENDERER_AGG)
+    , index_(0)
+    , depth_(0)
+    , child_count_(0)
+    , record_state_(document.subtree_path_ && !document.subtree_path_->empty() ? recordAncestor : recordAll)
+#endif
   {
     if (image_buffer.isSizeSet())
-      clip_buffer_.reset(new ClipBuffer(image_buffer_->width(), image_buffer_->height()));
+      clip_buffer_ = document_.createClipBuffer(image_buffer_->width(), image_buffer_->height());
   }
 
   Canvas(Canvas & parent)
-    : Transformable(parent)
-    , Stylable(parent)
+    : Stylable(parent)
+    , Transformable(parent)
     , document_(parent.document_)
     , image_buffer_(NULL)
     , parent_buffer_(boost::bind(&Canvas::getImageBuffer, &parent))
-    , length_factory_(parent.length_factory_)
+    , parent_canvas_(&parent)
     , clip_buffer_(parent.clip_buffer_)
+#if defined(RENDERER_AGG)
+    , clip_chain_(parent.clip_chain_)
+#endif
+    , visible_bounds_(parent.visibleBounds())
+    , visible_bounds_resolved_(false)
+    , length_factory_(parent.length_factory_)
     , rendering_disabled_(false)
-  {}
+#if defined(RENDERER_AGG)
+    , index_(parent.child_count_++)
+    , depth_(parent.depth_ + 1)
+    , child_count_(0)
+    , record_state_(parent.childRecordState(index_))
+#endif
+  {
+    document_.checkDeadline();
+#if defined(RENDERER_AGG)
+    if (record_state_ == recordNone)
+      disable_rendering();
+#endif
+  }
 
+  // Geometry of canvases that don't inherit style (markers) isn't included in parent's bounding box
   Canvas(Canvas & parent, dontInheritStyle)
     : Transformable(parent)
     , document_(parent.document_)
     , image_buffer_(NULL)
     , parent_buffer_(boost::bind(&Canvas::getImageBuffer, &parent))
-    , length_factory_(parent.length_factory_)
+    , parent_canvas_(NULL)
     , clip_buffer_(parent.clip_buffer_)
+#if defined(RENDERER_AGG)
+    , clip_chain_(parent.clip_chain_)
+#endif
+    , visible_bounds_(parent.visibleBounds())
+    , visible_bounds_resolved_(false)
+    , length_factory_(parent.length_factory_)
     , rendering_disabled_(false)
+#if defined(RENDERER_AGG)
+    , index_(0)
+    , depth_(0)
+    , child_count_(0)
+    , record_state_(parent.record_state_ == recordNone ? recordNone : recordAll)
+#endif
   {}
 
   void on_exit_element()
   {
-    if (!own_buffer_.get())
+    if (skipped())
       return;
-    applyFilter();
-
-    if (style().clip_path_fragment_)
-    {
-      if (!clip_buffer_.unique())
-        clip_buffer_.reset(new ClipBuffer(*clip_buffer_));
-      clip_buffer_->intersectClipPath(document().xml_document_, *style().clip_path_fragment_, transform());
-    }
+    composeLayer();
+#if defined(RENDERER_AGG)
+    addSubtree();
+#endif
+  }
 
-    if (clip_buffer_)
-      blend_image_with_mask(own_buffer_->gilView(), clip_buffer_->gilView());
+  using Stylable::set;
 
-    if (style().mask_fragment_)
-    {
-      ImageBuffer & parent_buffer = parent_buffer_();
-      ImageBuffer mask_buffer(parent_buffer.width(), parent_buffer.height());
-      loadMask(mask_buffer);
-      typedef boost::gil::color_converted_view_type<
-        boost::gil::rgba8_view_t, 
-        boost::gil::gray8_pixel_t, 
-        svgpp::gil_utility::rgba_to_mask_color_converter<> 
-      >::type mask_view_t;
-      mask_view_t mask_view = boost::gil::color_converted_view<boost::gil::gray8_pixel_t>(
-        mask_buffer.gilView(), svgpp::gil_utility::rgba_to_mask_color_converter<>());
-
-      blend_image_with_mask(own_buffer_->gilView(), mask_view);
-    }
+  template<class StringRange>
+  void set(svgpp::tag::attribute::id, StringRange const & id)
+  {
 #if defined(RENDERER_AGG)
-    agg::renderer_base<pixfmt_t> renderer_base(parent_buffer_().pixfmt());
-    renderer_base.blend_from(own_buffer_->pixfmt(), NULL, 0, 0, unsigned(style().opacity_ * 255));
-#elif defined(RENDERER_GDIPLUS)
-    {
-      Gdiplus::ColorMatrix color_matrix[] = { 
-        1.0f, 0.0f, 0.0f, 0.0f, 0.0f,
-        0.0f, 1.0f, 0.0f, 0.0f, 0.0f,
-        0.0f, 0.0f, 1.0f, 0.0f, 0.0f,
-        0.0f, 0.0f, 0.0f, style().opacity_, 0.0f,
-        0.0f, 0.0f, 0.0f, 0.0f, 1.0f };
-      Gdiplus::ImageAttributes ImgAttr;
-      ImgAttr.SetColorMatrix(color_matrix, Gdiplus::ColorMatrixFlagsDefault, Gdiplus::ColorAdjustTypeBitmap);
-      Gdiplus::Graphics graphics(&parent_buffer_().bitmap());
-      graphics.DrawImage(
-        &own_buffer_->bitmap(), 
-        Gdiplus::Rect(0, 0, own_buffer_->width(), own_buffer_->height()), 
-        0, 0, own_buffer_->width(), own_buffer_->height(),
-        Gdiplus::UnitPixel, &ImgAttr);
-    }
-#elif defined(RENDERER_SKIA)
-    {
-      SkCanvas canvas(parent_buffer_().bitmap());
-      SkPaint paint;
-      paint.setStyle(SkPaint::kFill_Style);
-      paint.setAlpha(style().opacity_ * 255);
-      canvas.drawBitmap(own_buffer_->bitmap(), 0, 0, &paint);
-    }
+    if (!document_.display_list_ || record_state_ == recordNone)
+      return;
+    // Layers of ancestors are pushed before the subtree, so that its commands may be replaced alone
+    parent_buffer_();
+    id_.assign(boost::begin(id), boost::end(id));
+    subtree_begin_ = document_.display_list_->commands_.size();
 #endif
   }
 
@@ -586,16 +740,85 @@ public:
   {
     if (image_buffer_) // If topmost SVG element
     {
-      image_buffer_->setSize(viewport_width + 1.0, viewport_height + 1.0, TransparentWhiteColor());
-      clip_buffer_.reset(new ClipBuffer(image_buffer_->width(), image_buffer_->height()));
+      RenderOptions const & options = document_.options_;
+      if (image_buffer_->isSizeSet())
+        ; // Memory of the caller, transform to it is already set
+      else
+      {
+        bool const scaled = options.output_width_ && options.output_height_;
+        int const width = scaled ? int(options.output_width_) : int(viewport_width + 1.0);
+        int const height = scaled ? int(options.output_height_) : int(viewport_height + 1.0);
+        document_.canvas_width_ = width;
+        document_.canvas_height_ = height;
+        int buffer_width = width, buffer_height = height;
+#if defined(RENDERER_AGG)
+        if (DisplayList * display_list = document_.display_list_)
+        {
+          // Only drawing commands are recorded, layers still get placeholder buffers
+          display_list->width_ = width;
+          display_list->height_ = height;
+          buffer_width = buffer_height = 1;
+        }
+        else
+#endif
+        if (options.band_height_ > 0)
+        {
+          // Only rows of the band get to the buffer, translation is the outermost transform
+          buffer_height = std::max(1, std::min(options.band_height_, height - options.band_y_));
+          boost::array<number_t, 6> const translate = {{ 1, 0, 0, 1, 0, -number_t(options.band_y_) }};
+          transform_matrix(translate);
+        }
+        document_.reserveImageMemory(buffer_width, buffer_height);
+        image_buffer_->setSize(buffer_width, buffer_height, TransparentWhiteColor());
+#if defined(RENDERER_AGG)
+        if (document_.display_list_)
+          // Nothing is culled while recording, it is done when the list is rasterized
+          document_.buffer_bounds_ = BoundingBox::unbounded();
+#endif
+        if (scaled)
+        {
+          // Document viewport is scaled to requested output size
+          boost::array<number_t, 6> const scale = {{
+            number_t(options.output_width_ / viewport_width), 0, 0, number_t(options.output_height_ / viewport_height), 0, 0 }};
+          transform_matrix(scale);
+        }
+      }
+      clip_buffer_ = document_.createClipBuffer(image_buffer_->width(), image_buffer_->height());
+      if (document_.buffer_bounds_.empty())
+      {
+        document_.buffer_bounds_.add(0, 0);
+        document_.buffer_bounds_.add(image_buffer_->width(), image_buffer_->height());
+      }
+      visible_bounds_ = document_.buffer_bounds_;
     }
     else
     {
       if (style().overflow_clip_)
       {
+        // Content of viewport that is clipped out completely isn't traversed
+        BoundingBox viewport;
+        viewport.add(viewport_x, viewport_y);
+        viewport.add(viewport_x + viewport_width, viewport_y + viewport_height);
+        viewport = TransformBox(transform(), viewport);
+        viewport.add(viewport.minX_ - 1, viewport.minY_ - 1);
+        viewport.add(viewport.maxX_ + 1, viewport.maxY_ + 1);
+        visible_bounds_.intersect(viewport);
+        if (visible_bounds_.empty())
+        {
+          ++document_.statistics_.culled_viewports_;
+          disable_rendering();
+        }
+
         if (!clip_buffer_.unique())
-          clip_buffer_.reset(new ClipBuffer(*clip_buffer_));
+          clip_buffer_ = document_.copyClipBuffer(*clip_buffer_);
         clip_buffer_->intersectClipRect(transform(), viewport_x, viewport_y, viewport_width, viewport_height);
+#if defined(RENDERER_AGG)
+        if (document_.display_list_)
+        {
+          DisplayList::Clip clip = { clip_chain_, transform(), boost::none, viewport_x, viewport_y, viewport_width, viewport_height };
+          clip_chain_.reset(new DisplayList::Clip(clip));
+        }
+#endif
       }
     }
     length_factory_.set_viewport_size(viewport_width, viewport_height);
@@ -623,15 +846,104 @@ private:
   Document & document_;
   ImageBuffer * const image_buffer_; // Non-NULL only for topmost SVG element
   lazy_buffer_t parent_buffer_;
+  Canvas * const parent_canvas_; // NULL if bounding box isn't passed to parent
+  BoundingBox bounding_box_; // Geometry bounds in canvas pixels, only tracked inside filtered elements
   std::auto_ptr<ImageBuffer> own_buffer_;
   boost::shared_ptr<ClipBuffer> clip_buffer_;
+#if defined(RENDERER_AGG)
+  DisplayList::clip_ptr_t clip_chain_; // Clip state for recorded layers
+#endif
+  BoundingBox visible_bounds_; // See visibleBounds(), clip path isn't applied until resolved
+  bool visible_bounds_resolved_;
   length_factory_t length_factory_;
   bool rendering_disabled_;
+#if defined(RENDERER_AGG)
+  unsigned const index_, depth_; // Position of the element among ones created by the parent
+  unsigned child_count_;
+  RecordState const record_state_;
+  svg_string_t id_; // Set if element is recorded to the display list
+  size_t subtree_begin_;
+#endif
 
-  void loadMask(ImageBuffer &) const;
-  void applyFilter();
   ImageBuffer & getPassedImageBuffer() { return *image_buffer_; }
 
+  void composeLayer()
+  {
+    if (parent_canvas_)
+      parent_canvas_->bounding_box_.add(bounding_box_);
+    if (style().filter_ && style().display_)
+      // Filter may produce output (e.g. feFlood) even if all content is culled
+      getImageBuffer();
+    if (!own_buffer_.get())
+      return;
+
+    if (style().clip_path_fragment_)
+    {
+      if (!clip_buffer_.unique())
+        clip_buffer_ = document_.copyClipBuffer(*clip_buffer_);
+      clip_buffer_->intersectClipPath(document().xml_document_, *style().clip_path_fragment_, transform(), 
+        document_.clipPathCache());
+#if defined(RENDERER_AGG)
+      if (document_.display_list_)
+      {
+        DisplayList::Clip clip = { clip_chain_, transform(), style().clip_path_fragment_, 0, 0, 0, 0 };
+        clip_chain_.reset(new DisplayList::Clip(clip));
+      }
+#endif
+    }
+
+    LayerEffects effects(transform(), length_factory_);
+    effects.opacity_ = style().opacity_;
+    effects.mask_fragment_ = style().mask_fragment_;
+    effects.filter_ = style().filter_;
+    effects.bounding_box_ = bounding_box_;
+#if defined(RENDERER_AGG)
+    if (DisplayList * display_list = document_.display_list_)
+    {
+      DisplayList::PopLayer layer = { effects.opacity_, clip_chain_, effects.mask_fragment_, effects.filter_, 
+        transform(), length_factory_, bounding_box_ };
+      display_list->commands_.push_back(layer);
+    }
+    else
+#endif
+      compositeLayer(document_, effects, *own_buffer_, parent_buffer_(), clip_buffer_.get());
+    document_.releaseImageMemory(own_buffer_->width(), own_buffer_->height());
+    own_buffer_.reset();
+  }
+
+#if defined(RENDERER_AGG)
+  RecordState childRecordState(unsigned index) const
+  {
+    if (record_state_ != recordAncestor)
+      return record_state_;
+    std::vector<unsigned> const & path = *document_.subtree_path_;
+    if (path[depth_] != index)
+      return recordNone;
+    return depth_ + 1 == path.size() ? recordAll : recordAncestor;
+  }
+
+  void addSubtree()
+  {
+    DisplayList * const display_list = document_.display_list_;
+    if (id_.empty() || !display_list)
+      return;
+    std::vector<unsigned> path;
+    Canvas const * canvas = this;
+    for(; canvas->parent_canvas_; canvas = canvas->parent_canvas_)
+      path.push_back(canvas->index_);
+    if (!canvas->image_buffer_)
+      return; // Marker content is recorded separately
+    std::reverse(path.begin(), path.end());
+    // Layer bounds of filtered ancestors depend on the subtree
+    DisplayList::Subtree const subtree = { subtree_begin_, display_list->commands_.size(), path, 
+      !parent_canvas_ || !parent_canvas_->needsBoundingBox() };
+    std::pair<DisplayList::subtrees_t::iterator, bool> const inserted = 
+      display_list->subtrees_.insert(std::make_pair(id_, subtree));
+    if (!inserted.second)
+      inserted.first->second.refreshable_ = false;
+  }
+#endif
+
 protected:
   ImageBuffer & getImageBuffer()
   {
@@ -643,7 +955,14 @@ protected:
       || style().filter_)
     {
       if (!own_buffer_.get())
+      {
+        document_.reserveImageMemory(parent_buffer.width(), parent_buffer.height());
         own_buffer_.reset(new ImageBuffer(parent_buffer.width(), parent_buffer.height()));
+#if defined(RENDERER_AGG)
+        if (DisplayList * display_list = document_.display_list_)
+          display_list->commands_.push_back(DisplayList::PushLayer());
+#endif
+      }
       return *own_buffer_;
     }
     return parent_buffer;
@@ -651,6 +970,49 @@ protected:
 
   Document & document() const { return document_; }
   ClipBuffer const & clipBuffer() const { return *clip_buffer_; }
+
+  // Element is outside of the subtree that is recorded again
+  bool skipped() const
+  {
+#if defined(RENDERER_AGG)
+    return record_state_ == recordNone;
+#else
+    return false;
+#endif
+  }
+
+  // Area in buffer pixels outside of which drawing of the element and its content isn't visible.
+  // Must be called after element attributes are processed
+  BoundingBox const & visibleBounds()
+  {
+    if (!visible_bounds_resolved_)
+    {
+      visible_bounds_resolved_ = true;
+      if (style().filter_)
+        // Filter effects may move pixels across the layer
+        visible_bounds_ = document_.buffer_bounds_;
+      else if (style().clip_path_fragment_)
+        visible_bounds_.intersect(document_.clipPathBounds(*style().clip_path_fragment_, transform()));
+    }
+    return visible_bounds_;
+  }
+
+  // Filter regions in objectBoundingBox units need bounds of the filtered element geometry
+  bool needsBoundingBox() const
+  {
+    for(Canvas const * canvas = this; canvas; canvas = canvas->parent_canvas_)
+      if (canvas->style().filter_)
+        return true;
+    return false;
+  }
+
+  void addBoundingBox(BoundingBox const & box) { bounding_box_.add(box); }
+
+  // Small features may be enlarged by filters, so they aren't culled inside of filtered elements
+  number_t minFeatureSize() const
+  { return needsBoundingBox() ? 0 : document_.options_.min_feature_size_; }
+  // For content that is drawn at several places later and is culled for each of them
+  void resetVisibleBounds() { visible_bounds_ = BoundingBox::unbounded(); }
   virtual bool isSwitchElement() const { return false; }
 };
 
@@ -666,43 +1028,90 @@ private:
   boost::gil::rgba8c_view_t view_;
 };
 
-void Canvas::applyFilter()
-{
-  if (!style().filter_)
-    return;
-
-  Filters::Input in;
-  in.sourceGraphic_ = IFilterViewPtr(new SimpleFilterView(own_buffer_->gilView()));
-  in.backgroundImage_ = IFilterViewPtr(new SimpleFilterView(parent_buffer_().gilView()));
-  IFilterViewPtr out = document_.filters_.get(*style().filter_, length_factory_, in);
-  if (out)
-    boost::gil::copy_pixels(out->view(), own_buffer_->gilView());
-}
-
-class Switch: public Canvas
+// Images of filter primitive results are counted in document image memory until the filter is applied
+class FilterImageMemory: boost::noncopyable
 {
 public:
-  Switch(Canvas & parent)
-    : Canvas(parent)
+  explicit FilterImageMemory(Document & document)
+    : document_(document)
   {}
 
-  virtual bool isSwitchElement() const { return true; }
-};
+  ~FilterImageMemory()
+  {
+    for(std::vector<std::pair<int, int> >::const_iterator size = sizes_.begin(); size != sizes_.end(); ++size)
+      document_.releaseImageMemory(size->first, size->second);
+  }
 
-class Path: 
+  void reserve(int width, int height)
+  {
+    // Recorded first, as the failed reservation is still counted
+    sizes_.push_back(std::make_pair(width, height));
+    document_.reserveImageMemory(width, height);
+  }
+
+private:
+  Document & document_;
+  std::vector<std::pair<int, int> > sizes_;
+};
+
+void applyFilter(Document & document, LayerEffects const & effects, ImageBuffer & layer, ImageBuffer & background)
+{
+  if (!effects.filter_)
+    return;
+
+  FilterImageMemory memory(document);
+  Filters::Input in;
+  in.reserveImage_ = boost::bind(&FilterImageMemory::reserve, &memory, _1, _2);
+  in.sourceGraphic_ = IFilterViewPtr(new SimpleFilterView(layer.gilView()));
+  in.backgroundImage_ = IFilterViewPtr(new SimpleFilterView(background.gilView()));
+  in.transform_ = &effects.transform_;
+  if (!effects.bounding_box_.empty())
+    in.boundingBox_ = effects.bounding_box_;
+  Filters::Region region;
+  IFilterViewPtr out = document.filters_.get(*effects.filter_, effects.length_factory_, in, region);
+  if (out && region.width_ == layer.width() && region.height_ == layer.height())
+  {
+    boost::gil::copy_pixels(out->view(), layer.gilView());
+    return;
+  }
+
+  // Result must be calculated before source graphic is cleared
+  boost::gil::rgba8c_view_t result;
+  if (out)
+    result = out->view();
+  boost::gil::fill_pixels(layer.gilView(), boost::gil::rgba8_pixel_t(0, 0, 0, 0));
+  if (out)
+    boost::gil::copy_pixels(result, 
+      boost::gil::subimage_view(layer.gilView(), region.x_, region.y_, region.width_, region.height_));
+}
+
+class Switch: public Canvas
+{
+public:
+  Switch(Canvas & parent)
+    : Canvas(parent)
+  {}
+
+  virtual bool isSwitchElement() const { return true; }
+};
+
+class Path: 
   public Canvas
 #if defined(RENDERER_GDIPLUS)
 , public PathStorage
 #endif
 {
 public:
-  Path(Canvas & parent)
+  Path(Canvas & parent, XMLElement const & element)
     : Canvas(parent)
+#if defined(RENDERER_AGG)
+    , element_(element)
+#endif
   {}
 
   void on_exit_element()
   {
-    if (style().display_)
+    if (style().display_ && !skipped())
     {
       drawPath();
       drawMarkers();
@@ -745,6 +1154,11 @@ public:
 
   void path_exit()
   {}
+
+  using Canvas::set;
+
+  template<class Range>
+  void set(svgpp::tag::attribute::d, Range const & path_data);
 #elif defined(RENDERER_SKIA)
   void path_move_to(SkScalar x, SkScalar y, svgpp::tag::coordinate::absolute const &)
   { 
@@ -822,17 +1236,14 @@ public:
 
 private:
 #if defined(RENDERER_AGG)
+  XMLElement const element_;
   agg::path_storage path_storage_;
+  // Set for instances of referenced elements, then it is used instead of path_storage_ and markers_
+  boost::shared_ptr<PathGeometry const> geometry_;
 #elif defined(RENDERER_SKIA)
   SkPath path_;
 #endif
 
-  struct MarkerPos
-  {
-    svgpp::marker_vertex v;
-    number_t x, y, directionality;
-  };
-
   typedef std::vector<MarkerPos> Markers; 
   Markers markers_;
 
@@ -852,16 +1263,27 @@ private:
   }
 
   typedef boost::variant<svgpp::tag::value::none, color_t, Gradient> EffectivePaint;
-#if defined(RENDERER_AGG)
-  template<class VertexSource>
-  void paintScanlines(EffectivePaint const & paint, number_t opacity, agg::rasterizer_scanline_aa<> & rasterizer,
-    VertexSource & curved);
-  template<class VertexSourceStroked, class VertexSourceCurved>
-  void strokePath(EffectivePaint const & stroke, VertexSourceStroked & curved_stroked, VertexSourceCurved & curved);
-#endif
   void drawPath();
   void drawMarkers();
+  template<class Iterator>
+  void drawMarkers(Iterator begin, Iterator end);
   void drawMarker(svg_string_t const & id, number_t x, number_t y, number_t dir);
+#if defined(RENDERER_AGG)
+  agg::path_storage const & geometry() const
+  { return geometry_ ? geometry_->path_storage_ : path_storage_; }
+
+  // Orientations of shared geometry are arranged once when it is cached
+  agg::path_storage const & arrangedGeometry()
+  {
+    if (geometry_)
+      return geometry_->path_storage_;
+    path_storage_.arrange_orientations_all_paths(agg::path_flags_ccw);
+    return path_storage_;
+  }
+
+  boost::shared_ptr<CompiledMarker const> compileMarker(svg_string_t const & id);
+  void drawMarkerInstance(CompiledMarker const & marker, number_t x, number_t y, number_t dir);
+#endif
   EffectivePaint getEffectivePaint(Paint const &) const;
 };
 
@@ -914,9 +1336,48 @@ typedef
     svgpp::error_policy<svgpp::policy::error::default_policy<Stylable> >, // Type of context isn't used
     svgpp::markers_policy<svgpp::policy::markers::calculate_always>,
     svgpp::attribute_traversal_policy<attribute_traversal>,
+#if defined(RENDERER_AGG)
+    svgpp::passthrough_attributes<boost::mpl::set1<svgpp::tag::attribute::d> >, // Loaded by Path, see path_data_loader
+#endif
     svgpp::viewport_policy<svgpp::policy::viewport::as_transform>
   > document_traversal_main;
 
+#if defined(RENDERER_AGG)
+// Loads path data the same way as document_traversal_main would
+typedef svgpp::attribute_dispatcher<
+    svgpp::tag::element::path,
+    Path,
+    svgpp::processed_attributes<boost::mpl::set1<svgpp::tag::attribute::d> >,
+    svgpp::length_policy<svgpp::policy::length::forward_to_method<Canvas, const length_factory_t> >,
+    svgpp::path_policy<path_policy>,
+    svgpp::path_events_policy<svgpp::policy::path_events::forward_to_method<Path> >,
+    svgpp::error_policy<svgpp::policy::error::default_policy<Stylable> >,
+    svgpp::markers_policy<svgpp::policy::markers::calculate_always>
+  > path_data_loader;
+
+template<class Range>
+void Path::set(svgpp::tag::attribute::d, Range const & path_data)
+{
+  // Only elements instanced by reference are cached, others are parsed once anyway
+  PathCache * const cache = document().followed_refs_.empty() ? NULL : &document().path_cache_;
+  if (cache)
+    if ((geometry_ = cache->find(element_)))
+      return;
+  if (path_data_loader(*this).load_attribute_value(svgpp::tag::attribute::d(), path_data, svgpp::tag::source::attribute())
+    && cache)
+  {
+    boost::shared_ptr<PathGeometry> geometry = boost::make_shared<PathGeometry>();
+    geometry->path_storage_ = path_storage_; // Copied once per element, not per instance
+    geometry->path_storage_.arrange_orientations_all_paths(agg::path_flags_ccw);
+    path_storage_.remove_all();
+    geometry->markers_.assign(markers_.begin(), markers_.end());
+    markers_.clear();
+    cache->insert(element_, geometry);
+    geometry_ = geometry;
+  }
+}
+#endif
+
 class Use: public Canvas
 {
 public:
@@ -928,8 +1389,11 @@ public:
 
   void on_exit_element()
   {
-    if (!style().display_)
+    if (!style().display_ || skipped())
+    {
+      Canvas::on_exit_element();
       return;
+    }
     if (XMLElement element = document().xml_document_.findElementById(fragment_id_))
     {
       Document::FollowRef lock(document(), element);
@@ -1009,15 +1473,15 @@ private:
 class Mask: public Canvas
 {
 public:
-  Mask(Document & document, ImageBuffer & image_buffer, Transformable const & referenced)
+  Mask(Document & document, ImageBuffer & image_buffer, transform_t const & referenced_transform)
     : Canvas(document, image_buffer)
     , maskUseObjectBoundingBox_(true)
     , maskContentUseObjectBoundingBox_(false)
   {
 #if defined(RENDERER_AGG) || defined(RENDERER_SKIA)
-    transform() = referenced.transform();
+    transform() = referenced_transform;
 #elif defined(RENDERER_GDIPLUS)
-    AssignMatrix(transform(), referenced.transform());
+    AssignMatrix(transform(), referenced_transform);
 #endif
   }
 
@@ -1058,19 +1522,67 @@ private:
   number_t x_, y_, width_, height_; // TODO: defaults
 };
 
-void Canvas::loadMask(ImageBuffer & mask_buffer) const
+void loadMask(Document & document, svg_string_t const & id, transform_t const & transform, ImageBuffer & mask_buffer)
 {
-  if (XMLElement element = document().xml_document_.findElementById(*style().mask_fragment_))
+  if (XMLElement element = document.xml_document_.findElementById(id))
   {
-    Document::FollowRef lock(document(), element);
+    Document::FollowRef lock(document, element);
 
-    Mask mask(document_, mask_buffer, *this);
+    Mask mask(document, mask_buffer, transform);
     document_traversal_main::load_expected_element(element, mask, svgpp::tag::element::mask());
   }
   else
     throw std::runtime_error("Element referenced by 'mask' not found");
 }
 
+void compositeLayer(Document & document, LayerEffects const & effects, ImageBuffer & layer, ImageBuffer & parent,
+  ClipBuffer const * clip)
+{
+  applyFilter(document, effects, layer, parent);
+
+  if (clip)
+    svgpp::gil_utility::apply_alpha_mask(layer.gilView(), clip->gilView());
+
+  if (effects.mask_fragment_)
+  {
+    document.reserveImageMemory(parent.width(), parent.height());
+    ImageBuffer mask_buffer(parent.width(), parent.height());
+    loadMask(document, *effects.mask_fragment_, effects.transform_, mask_buffer);
+    // Luminance of mask is computed and multiplied into the layer in one pass
+    svgpp::gil_utility::apply_luminance_mask(layer.gilView(), mask_buffer.gilView());
+    document.releaseImageMemory(parent.width(), parent.height());
+  }
+#if defined(RENDERER_AGG)
+  agg::renderer_base<pixfmt_t> renderer_base(parent.pixfmt());
+  renderer_base.blend_from(layer.pixfmt(), NULL, 0, 0, unsigned(effects.opacity_ * 255));
+#elif defined(RENDERER_GDIPLUS)
+  {
+    Gdiplus::ColorMatrix color_matrix[] = { 
+      1.0f, 0.0f, 0.0f, 0.0f, 0.0f,
+      0.0f, 1.0f, 0.0f, 0.0f, 0.0f,
+      0.0f, 0.0f, 1.0f, 0.0f, 0.0f,
+      0.0f, 0.0f, 0.0f, effects.opacity_, 0.0f,
+      0.0f, 0.0f, 0.0f, 0.0f, 1.0f };
+    Gdiplus::ImageAttributes ImgAttr;
+    ImgAttr.SetColorMatrix(color_matrix, Gdiplus::ColorMatrixFlagsDefault, Gdiplus::ColorAdjustTypeBitmap);
+    Gdiplus::Graphics graphics(&parent.bitmap());
+    graphics.DrawImage(
+      &layer.bitmap(), 
+      Gdiplus::Rect(0, 0, layer.width(), layer.height()), 
+      0, 0, layer.width(), layer.height(),
+      Gdiplus::UnitPixel, &ImgAttr);
+  }
+#elif defined(RENDERER_SKIA)
+  {
+    SkCanvas canvas(parent.bitmap());
+    SkPaint paint;
+    paint.setStyle(SkPaint::kFill_Style);
+    paint.setAlpha(effects.opacity_ * 255);
+    canvas.drawBitmap(layer.bitmap(), 0, 0, &paint);
+  }
+#endif
+}
+
 struct GradientBase_visitor: boost::static_visitor<>
 {
   void operator()(GradientBase const & g) 
@@ -1129,63 +1641,14 @@ private:
 };
 
 
-struct ColorFunctionProfile
-{
-  static const unsigned size_ = 256;
-
-  ColorFunctionProfile(GradientStops const & stops, number_t opacity) 
-  {
-    assert(stops.size() >= 2);
-
-    static const number_t offset_step = 1.0 / size_;
-    number_t offset = 0;
-    GradientStops::const_iterator stop1 = stops.begin(), stop2 = stops.begin();
-    agg::rgba8 color1 = stopColor(*stop1, opacity), color2 = color1;
-    for(int i = 0; i < size_; ++i, offset += offset_step)
-    {
-      while(stop2 != stops.end() && offset > stop2->offset_)
-      {
-        stop1 = stop2;
-        color1 = color2;
-        ++stop2;
-        if (stop2 != stops.end())
-          color2 = stopColor(*stop2, opacity);
-      }
-      if (stop2 == stops.begin() || stop2 == stops.end())
-        colors_[i] = color1;
-      else
-        colors_[i] = color1.gradient(color2, (offset - stop1->offset_) / (stop2->offset_ - stop1->offset_));
-    }
-  }
-
-  static unsigned size() { return size_; }
-  const agg::rgba8 & operator[] (unsigned v) const
-  {
-    return colors_[v];
-  }
-
-private:
-  static agg::rgba8 stopColor(GradientStop const & stop, number_t opacity)
-  {
-    if (opacity < 0.999)
-    {
-      agg::rgba8 color = stop.color_;
-      return color.opacity(opacity * color.opacity());
-    }
-    return stop.color_;
-  }
-
-  agg::rgba8 colors_[size_];
-};
-
 static const number_t GradientScale = 100.0;
 
 template<class GradientFunc, class VertexSource>
 void RenderScanlinesGradient(renderer_base_t & renderer, 
-  agg::rasterizer_scanline_aa<> & rasterizer,
+  RasterResources & resources,
   GradientFunc const & gradient_func, GradientBase const & gradient_base, 
   transform_t const & user_transform, transform_t const & gradient_geometry_transform,
-  number_t opacity,
+  ColorFunctionProfile const & color_function,
   VertexSource & curved)
 {
   typedef agg::span_interpolator_linear<> span_interpolator_t;
@@ -1195,7 +1658,6 @@ void RenderScanlinesGradient(renderer_base_t & renderer,
     span_interpolator_t,
     gradient_t,
     ColorFunctionProfile > span_gradient_t;
-  typedef agg::span_allocator<typename span_gradient_t::color_type> span_allocator_t;
 
   transform_t tr = agg::trans_affine_scaling(1.0/GradientScale) * gradient_geometry_transform;
 
@@ -1215,19 +1677,17 @@ void RenderScanlinesGradient(renderer_base_t & renderer,
   tr *= user_transform;
   tr.invert();
   span_interpolator_t span_interpolator(tr);
-  ColorFunctionProfile color_function(gradient_base.stops_, opacity);
   gradient_t gradient_repeated(gradient_func, gradient_base.spreadMethod_);
   span_gradient_t span_gradient(span_interpolator, gradient_repeated, color_function, 0, GradientScale);
-  span_allocator_t span_allocator;
-  agg::scanline_p8 scanline;
-  agg::render_scanlines_aa(rasterizer, scanline, renderer, span_allocator, span_gradient);
+  agg::render_scanlines_aa(resources.rasterizer(), resources.scanline(), renderer, resources.spanAllocator(), 
+    span_gradient);
 }
 
 template<class VertexSource>
-void Path::paintScanlines(EffectivePaint const & paint, number_t opacity, agg::rasterizer_scanline_aa<> & rasterizer,
-  VertexSource & curved) 
+void paintScanlines(ImageBuffer & buffer, Gradients & gradients, RasterResources & resources, 
+  transform_t const & transform, EffectivePaint const & paint, number_t opacity, VertexSource & curved) 
 {
-  renderer_base_t renderer_base(getImageBuffer().pixfmt());
+  renderer_base_t renderer_base(buffer.pixfmt());
   // TODO: pass bounding box function instead of curved
   if (agg::rgba8 const * paintColor = boost::get<agg::rgba8>(&paint))
   {
@@ -1236,8 +1696,7 @@ void Path::paintScanlines(EffectivePaint const & paint, number_t opacity, agg::r
     typedef agg::renderer_scanline_aa_solid<renderer_base_t> renderer_solid_t;
     renderer_solid_t renderer_solid(renderer_base);
     renderer_solid.color(color);
-    agg::scanline_p8 scanline;
-    agg::render_scanlines(rasterizer, scanline, renderer_solid);
+    agg::render_scanlines(resources.rasterizer(), resources.scanline(), renderer_solid);
   }
   else
   {
@@ -1251,8 +1710,9 @@ void Path::paintScanlines(EffectivePaint const & paint, number_t opacity, agg::r
         agg::trans_affine_scaling(std::sqrt(dx * dx + dy * dy))
         * agg::trans_affine_rotation(std::atan2(dy, dx))
         * agg::trans_affine_translation(linearGradient->x1_, linearGradient->y1_);
-      RenderScanlinesGradient(renderer_base, rasterizer,
-        gradient_func, *linearGradient, transform(), gradient_geometry_transform, opacity, curved);
+      RenderScanlinesGradient(renderer_base, resources,
+        gradient_func, *linearGradient, transform, gradient_geometry_transform, 
+        gradients.colorRamp(*linearGradient, opacity), curved);
     }
     else
     {
@@ -1263,38 +1723,119 @@ void Path::paintScanlines(EffectivePaint const & paint, number_t opacity, agg::r
       transform_t gradient_geometry_transform = 
         agg::trans_affine_scaling(radialGradient.r_)
         * agg::trans_affine_translation(radialGradient.cx_, radialGradient.cy_);
-      RenderScanlinesGradient(renderer_base, rasterizer,
-        gradient_func, radialGradient, transform(), gradient_geometry_transform, opacity, curved);
+      RenderScanlinesGradient(renderer_base, resources,
+        gradient_func, radialGradient, transform, gradient_geometry_transform, 
+        gradients.colorRamp(radialGradient, opacity), curved);
     }
   }
 }
 
 template<class VertexSourceStroked, class VertexSourceCurved>
-void Path::strokePath(EffectivePaint const & stroke, 
-  VertexSourceStroked & curved_stroked, VertexSourceCurved & curved) 
+void strokePath(ImageBuffer & buffer, Gradients & gradients, RasterResources & resources, 
+  transform_t const & transform, PathPaint const & paint, VertexSourceStroked & curved_stroked, VertexSourceCurved & curved) 
 {
-  curved_stroked.width(style().stroke_width_);
-  curved_stroked.line_join(style().line_join_);
-  curved_stroked.line_cap(style().line_cap_);
-  curved_stroked.miter_limit(style().miterlimit_);
+  curved_stroked.width(paint.stroke_width_);
+  curved_stroked.line_join(paint.line_join_);
+  curved_stroked.line_cap(paint.line_cap_);
+  curved_stroked.miter_limit(paint.miterlimit_);
   curved_stroked.inner_join(agg::inner_round);
-  curved_stroked.approximation_scale(transform().scale());
+  curved_stroked.approximation_scale(transform.scale());
 
   // If the *visual* line width is considerable we 
   // turn on processing of curve cusps.
   //---------------------
-  if(style().stroke_width_ * transform().scale() > 1.0)
+  if(paint.stroke_width_ * transform.scale() > 1.0)
   {
       curved.angle_tolerance(0.2);
   }
 
   typedef agg::conv_transform<VertexSourceStroked> transformed_t;
-  transformed_t curved_stroked_transformed(curved_stroked, transform());
-  agg::rasterizer_scanline_aa<> rasterizer;
-  rasterizer.filling_rule(agg::fill_non_zero);
-  rasterizer.add_path(curved_stroked_transformed);
-  paintScanlines(stroke, style().stroke_opacity_, rasterizer, curved);
+  transformed_t curved_stroked_transformed(curved_stroked, transform);
+  resources.beginPass(buffer, agg::fill_non_zero).add_path(curved_stroked_transformed);
+  paintScanlines(buffer, gradients, resources, transform, paint.stroke_, paint.stroke_opacity_, curved);
 }
+
+// Bounds of geometry mapped by 'transform', empty if path has no vertices
+BoundingBox pathBounds(agg::path_storage const & geometry, transform_t const & transform)
+{
+  ConstPathSource source(geometry);
+  agg::conv_curve<ConstPathSource> curved(source);
+  agg::conv_transform<agg::conv_curve<ConstPathSource> > curved_transformed(curved, transform);
+  BoundingBox bounds;
+  number_t min_x, min_y, max_x, max_y;
+  if (agg::bounding_rect_single(curved_transformed, 0, &min_x, &min_y, &max_x, &max_y))
+  {
+    bounds.add(min_x, min_y);
+    bounds.add(max_x, max_y);
+  }
+  return bounds;
+}
+
+// Geometry of path is in user space and is mapped to buffer pixels by 'transform'
+void rasterizePath(ImageBuffer & buffer, Gradients & gradients, RasterResources & resources, 
+  transform_t const & transform, agg::path_storage const & geometry, PathPaint const & paint)
+{
+  typedef agg::conv_curve<ConstPathSource> curved_t;
+  typedef agg::conv_transform<curved_t> curved_transformed_t;
+
+  ConstPathSource source(geometry);
+  curved_t curved(source);
+
+  if (boost::get<svgpp::tag::value::none>(&paint.fill_) == NULL)
+  {
+    curved_transformed_t curved_transformed(curved, transform);
+    resources.beginPass(buffer, paint.nonzero_fill_rule_ ? agg::fill_non_zero : agg::fill_even_odd)
+      .add_path(curved_transformed);
+    paintScanlines(buffer, gradients, resources, transform, paint.fill_, paint.fill_opacity_, curved);
+  }
+
+  if (boost::get<svgpp::tag::value::none>(&paint.stroke_) == NULL)
+  {
+    if (std::accumulate(paint.stroke_dasharray_.begin(), paint.stroke_dasharray_.end(), 0.0) <= 0.0)
+    {
+      typedef agg::conv_stroke<curved_t> curved_stroked_t;
+      curved_stroked_t curved_stroked(curved);
+      strokePath(buffer, gradients, resources, transform, paint, curved_stroked, curved);
+    }
+    else
+    {
+      typedef agg::conv_dash<curved_t> curved_dashed_t;
+      curved_dashed_t curved_dashed(curved);
+
+      std::vector<number_t> const & dasharray = paint.stroke_dasharray_;
+      int num_dash_values = 
+        dasharray.size() % 2 == 0
+          ? dasharray.size() 
+          : 2 * dasharray.size();
+      for(int i=0; i<num_dash_values; i+=2)
+        curved_dashed.add_dash(dasharray[i % dasharray.size()], dasharray[(i+1) % dasharray.size()]);
+
+      curved_dashed.dash_start(paint.stroke_dashoffset_);
+
+      typedef agg::conv_stroke<curved_dashed_t> curved_stroked_t;
+      curved_stroked_t curved_stroked(curved_dashed);
+      strokePath(buffer, gradients, resources, transform, paint, curved_stroked, curved);
+    }
+  }
+}
+
+// True if geometry with 'bounds' in buffer pixels doesn't reach the visible area or is too small to render
+bool isPathCulled(BoundingBox const & bounds, PathPaint const & paint, transform_t const & transform, 
+  BoundingBox const & visible_bounds, number_t min_feature_size)
+{
+  // Stroke extends geometry by half of its width, miters and square caps may reach further
+  number_t const stroke_extent = boost::get<svgpp::tag::value::none>(&paint.stroke_) == NULL
+    ? paint.stroke_width_ * transform.scale() : 0;
+  number_t const margin = stroke_extent * 0.5 * std::max<number_t>(std::sqrt(2.0), paint.miterlimit_) + 1;
+  BoundingBox extent = bounds;
+  extent.add(bounds.minX_ - margin, bounds.minY_ - margin);
+  extent.add(bounds.maxX_ + margin, bounds.maxY_ + margin);
+  if (!extent.intersects(visible_bounds))
+    return true;
+  return min_feature_size > 0 
+    && std::max(bounds.maxX_ - bounds.minX_, bounds.maxY_ - bounds.minY_) + stroke_extent < min_feature_size;
+}
+
 #elif defined(RENDERER_SKIA)
 void AssignGradientPaint(SkPaint & paint, SkPath const & path, Gradient const & gradient, SkMatrix transform)
 {
@@ -1368,64 +1909,51 @@ void AssignGradientPaint(SkPaint & paint, SkPath const & path, Gradient const &
 void Path::drawPath()
 {
 #if defined(RENDERER_AGG)
-  if (path_storage_.total_vertices() == 0)
+  if (geometry().total_vertices() == 0)
     return;
-  typedef agg::conv_curve<agg::path_storage> curved_t;
-  typedef agg::conv_transform<curved_t> curved_transformed_t;
-  typedef agg::conv_contour<curved_transformed_t> curved_transformed_contour_t;
 
-  curved_t curved(path_storage_);
-
-  path_storage_.arrange_orientations_all_paths(agg::path_flags_ccw); // TODO: move out
-  
-  EffectivePaint fill = getEffectivePaint(style().fill_paint_);
-  if (boost::get<svgpp::tag::value::none>(&fill) == NULL)
+  // Geometry bounds in buffer pixels
+  BoundingBox const bounds = pathBounds(geometry(), transform());
+  if (bounds.empty())
+    return;
+  if (needsBoundingBox())
+    addBoundingBox(bounds);
+
+  PathPaint paint;
+  paint.fill_ = getEffectivePaint(style().fill_paint_);
+  paint.stroke_ = getEffectivePaint(style().stroke_paint_);
+  paint.fill_opacity_ = style().fill_opacity_;
+  paint.stroke_opacity_ = style().stroke_opacity_;
+  paint.nonzero_fill_rule_ = style().nonzero_fill_rule_;
+  paint.stroke_width_ = style().stroke_width_;
+  paint.line_cap_ = style().line_cap_;
+  paint.line_join_ = style().line_join_;
+  paint.miterlimit_ = style().miterlimit_;
+  paint.stroke_dasharray_ = style().stroke_dasharray_;
+  paint.stroke_dashoffset_ = style().stroke_dashoffset_;
+
+  if (DisplayList * display_list = document().display_list_)
   {
-    curved_transformed_t curved_transformed(curved, transform());
-    agg::rasterizer_scanline_aa<> rasterizer;
-    rasterizer.filling_rule(style().nonzero_fill_rule_ ? agg::fill_non_zero : agg::fill_even_odd);
-    //if(fabs(m_curved_trans_contour.width()) < 0.0001)
-    {
-        rasterizer.add_path(curved_transformed);
-    }
-    /*else
-    {
-        m_curved_trans_contour.miter_limit(attr.miter_limit);
-        ras.add_path(m_curved_trans_contour, attr.index);
-    }*/
-
-    paintScanlines(fill, style().fill_opacity_, rasterizer, curved);
+    // Culling is done when the list is rasterized
+    getImageBuffer(); // Records layer of the element if it needs one
+    boost::shared_ptr<agg::path_storage const> const geometry = geometry_ 
+      ? boost::shared_ptr<agg::path_storage const>(geometry_, &geometry_->path_storage_) // Shared by instances
+      : boost::make_shared<agg::path_storage>(arrangedGeometry());
+    DisplayList::DrawPath command = { geometry, transform(), paint, bounds, visibleBounds(), needsBoundingBox() };
+    display_list->commands_.push_back(command);
+    return;
   }
 
-  EffectivePaint stroke = getEffectivePaint(style().stroke_paint_);
-  if (boost::get<svgpp::tag::value::none>(&stroke) == NULL)
+  // Layer of the element isn't allocated until something is drawn to it
+  if (isPathCulled(bounds, paint, transform(), visibleBounds(), minFeatureSize()))
   {
-    if (std::accumulate(style().stroke_dasharray_.begin(), style().stroke_dasharray_.end(), 0.0) <= 0.0)
-    {
-      typedef agg::conv_stroke<curved_t> curved_stroked_t;
-      curved_stroked_t curved_stroked(curved);
-      strokePath(stroke, curved_stroked, curved);
-    }
-    else
-    {
-      typedef agg::conv_dash<curved_t> curved_dashed_t;
-      curved_dashed_t curved_dashed(curved);
-
-      std::vector<number_t> const & dasharray = style().stroke_dasharray_;
-      int num_dash_values = 
-        dasharray.size() % 2 == 0
-          ? dasharray.size() 
-          : 2 * dasharray.size();
-      for(int i=0; i<num_dash_values; i+=2)
-        curved_dashed.add_dash(dasharray[i % dasharray.size()], dasharray[(i+1) % dasharray.size()]);
-
-      curved_dashed.dash_start(style().stroke_dashoffset_);
-
-      typedef agg::conv_stroke<curved_dashed_t> curved_stroked_t;
-      curved_stroked_t curved_stroked(curved_dashed);
-      strokePath(stroke, curved_stroked, curved);
-    }
+    ++document().statistics_.culled_shapes_;
+    return;
   }
+  ++document().statistics_.drawn_shapes_;
+
+  rasterizePath(getImageBuffer(), document().gradients_, document().raster_resources_, transform(), arrangedGeometry(), 
+    paint);
 #elif defined(RENDERER_GDIPLUS)
   if (path_points_.empty())
     return;
@@ -1525,10 +2053,11 @@ class Marker:
 public:
   Marker(Path & parent, number_t strokeWidth, number_t x, number_t y, number_t autoOrient)
     : Canvas(parent, dontInheritStyle())
-    , autoOrient_(autoOrient)
     , strokeWidth_(strokeWidth)
-    , orient_(0.0)
+    , autoOrient_(autoOrient)
     , strokeWidthUnits_(true)
+    , orient_(0.0)
+    , autoOriented_(false)
   {
 #if defined(RENDERER_AGG)
     transform().premultiply(agg::trans_affine_translation(x, y));
@@ -1539,6 +2068,18 @@ public:
 #endif
   }
 
+  // Placed at origin with zero orientation, to be transformed to vertices later
+  Marker(Path & parent, number_t strokeWidth)
+    : Canvas(parent, dontInheritStyle())
+    , strokeWidth_(strokeWidth)
+    , autoOrient_(0.0)
+    , strokeWidthUnits_(true)
+    , orient_(0.0)
+    , autoOriented_(false)
+  {
+    resetVisibleBounds();
+  }
+
   void on_enter_element(svgpp::tag::element::marker) {}
   void on_exit_element() {}
 
@@ -1577,28 +2118,150 @@ public:
   { orient_ = val * boost::math::constants::degree<number_t>(); }
 
   void set(svgpp::tag::attribute::orient, svgpp::tag::value::auto_)
-  { orient_ = autoOrient_; }
+  { 
+    orient_ = autoOrient_; 
+    autoOriented_ = true;
+  }
+
+  bool autoOriented() const { return autoOriented_; }
 
 private:
   number_t const strokeWidth_;
   number_t const autoOrient_;
   bool strokeWidthUnits_;
   number_t orient_;
+  bool autoOriented_;
 };
 
 void Path::drawMarkers()
 {
   if (!style().marker_start_ && !style().marker_mid_ && !style().marker_end_)
     return;
-  for(Markers::const_iterator pos = markers_.begin(); pos != markers_.end(); ++pos)
+#if defined(RENDERER_AGG)
+  if (geometry_)
+  {
+    drawMarkers(geometry_->markers_.begin(), geometry_->markers_.end());
+    return;
+  }
+#endif
+  drawMarkers(markers_.begin(), markers_.end());
+}
+
+template<class Iterator>
+void Path::drawMarkers(Iterator begin, Iterator end)
+{
+  for(Iterator pos = begin; pos != end; ++pos)
   {
     if (boost::optional<svg_string_t> & m = getMarkerReference(pos->v))
     {
+#if defined(RENDERER_AGG)
+      boost::shared_ptr<CompiledMarker const> const compiled = compileMarker(*m);
+      if (compiled->instanced_)
+      {
+        drawMarkerInstance(*compiled, pos->x, pos->y, pos->directionality);
+        continue;
+      }
+#endif
       drawMarker(*m, pos->x, pos->y, pos->directionality);
     }
   }
 }
 
+#if defined(RENDERER_AGG)
+boost::shared_ptr<CompiledMarker const> Path::compileMarker(svg_string_t const & id)
+{
+  Document::marker_key_t key;
+  key.first = id;
+  key.second[0] = style().stroke_width_;
+  key.second[1] = length_factory().create_length(100, svgpp::tag::length_units::percent(), 
+    svgpp::tag::length_dimension::width());
+  key.second[2] = length_factory().create_length(100, svgpp::tag::length_units::percent(), 
+    svgpp::tag::length_dimension::height());
+  Document::compiled_markers_t::const_iterator found = document().compiled_markers_.find(key);
+  if (found != document().compiled_markers_.end())
+    return found->second;
+
+  boost::shared_ptr<CompiledMarker> compiled = boost::make_shared<CompiledMarker>();
+  compiled->instanced_ = false;
+  compiled->auto_orient_ = false;
+  transform_t to_user_space = transform();
+  if (std::abs(to_user_space.determinant()) > agg::affine_epsilon)
+    if (XMLElement element = document().xml_document_.findElementById(id))
+    {
+      to_user_space.invert();
+      DisplayList content;
+      {
+        Document::FollowRef lock(document(), element);
+        // Marker content is recorded instead of drawn
+        Document & document_ref = document();
+        DisplayList * const display_list = document_ref.display_list_;
+        document_ref.display_list_ = &content;
+        BOOST_SCOPE_EXIT((&document_ref)(display_list))
+        {
+          document_ref.display_list_ = display_list;
+        } BOOST_SCOPE_EXIT_END
+
+        Marker markerContext(*this, style().stroke_width_);
+        document_traversal_main::load_expected_element(element, markerContext, svgpp::tag::element::marker());
+        compiled->auto_orient_ = markerContext.autoOriented();
+      }
+      compiled->instanced_ = true;
+      for(std::vector<DisplayList::command_t>::const_iterator command = content.commands_.begin();
+        command != content.commands_.end(); ++command)
+      {
+        DisplayList::DrawPath const * draw = boost::get<DisplayList::DrawPath>(&*command);
+        if (!draw)
+        {
+          // Layers are composed with the content below them, that differs for each vertex
+          compiled->instanced_ = false;
+          compiled->content_.clear();
+          break;
+        }
+        compiled->content_.push_back(*draw);
+        DisplayList::DrawPath & local = compiled->content_.back();
+        local.transform_ *= to_user_space;
+        local.bounds_ = pathBounds(*local.geometry_, local.transform_);
+        local.visible_bounds_ = TransformBox(to_user_space, local.visible_bounds_);
+      }
+    }
+  document().compiled_markers_[key] = compiled;
+  return compiled;
+}
+
+void Path::drawMarkerInstance(CompiledMarker const & marker, number_t x, number_t y, number_t dir)
+{
+  document().checkDeadline();
+  // Same as transforms set by Marker, uniform scale of 'markerUnits' and rotation commute
+  transform_t placement = agg::trans_affine_rotation(marker.auto_orient_ ? dir : 0);
+  placement *= agg::trans_affine_translation(x, y);
+  placement *= transform();
+  for(std::vector<DisplayList::DrawPath>::const_iterator content = marker.content_.begin();
+    content != marker.content_.end(); ++content)
+  {
+    transform_t instance_transform = content->transform_;
+    instance_transform *= placement;
+    BoundingBox const bounds = TransformBox(placement, content->bounds_);
+    BoundingBox visible_bounds = TransformBox(placement, content->visible_bounds_);
+    visible_bounds.intersect(visibleBounds());
+    if (DisplayList * display_list = document().display_list_)
+    {
+      getImageBuffer();
+      DisplayList::DrawPath command = { content->geometry_, instance_transform, content->paint_, bounds, visible_bounds,
+        needsBoundingBox() };
+      display_list->commands_.push_back(command);
+    }
+    else if (isPathCulled(bounds, content->paint_, instance_transform, visible_bounds, minFeatureSize()))
+      ++document().statistics_.culled_shapes_;
+    else
+    {
+      ++document().statistics_.drawn_shapes_;
+      rasterizePath(getImageBuffer(), document().gradients_, document().raster_resources_, instance_transform, 
+        *content->geometry_, content->paint_);
+    }
+  }
+}
+#endif
+
 void Path::drawMarker(svg_string_t const & id, number_t x, number_t y, number_t dir)
 {
   if (XMLElement element = document().xml_document_.findElementById(id))
@@ -1621,7 +2284,8 @@ Path::EffectivePaint Path::getEffectivePaint(Paint const & paint) const
   SolidPaint const * solidPaint = NULL;
   if (IRIPaint const * iri = boost::get<IRIPaint>(&paint))
   {
-    if (boost::optional<Gradient> const gradient = document().gradients_.get(iri->fragment_, length_factory()))
+    boost::optional<Gradient> const & gradient = document().gradients_.get(iri->fragment_, length_factory());
+    if (gradient)
     {
       GradientBase_visitor gradientBase;
       boost::apply_visitor(gradientBase, *gradient);
@@ -1651,79 +2315,471 @@ Path::EffectivePaint Path::getEffectivePaint(Paint const & paint) const
   return boost::get<color_t>(*solidPaint);
 }
 
-void renderDocument(XMLDocument & xmlDocument, ImageBuffer & buffer)
+void renderDocument(XMLDocument & xmlDocument, ImageBuffer & buffer, RenderOptions const & options)
 {
-  Document document(xmlDocument);
+  Document document(xmlDocument, options);
   Canvas canvas(document, buffer);
   document_traversal_main::load_document(xmlDocument.getRoot(), canvas);
 }
 
-int main(int argc, char * argv[])
+// Converts between RGBA and BGRA channel orders
+struct SwapRedBlue
 {
-  if (argc < 2)
+  void operator()(boost::gil::rgba8_pixel_t & pixel) const
   {
-    std::cout << "Usage: " << argv[0] << " <svg file name> [<output BMP file name>]\n";
-    return 1;
+    std::swap(pixel[0], pixel[2]);
   }
+};
 
-#if defined(RENDERER_GDIPLUS)
-  Gdiplus::GdiplusStartupInput gdiplusStartupInput;
-  ULONG_PTR gdiplusToken;
-  Gdiplus::GdiplusStartup(&gdiplusToken, &gdiplusStartupInput, NULL);
+void renderDocumentInBands(XMLDocument & xmlDocument, RenderOptions const & options, int band_height, int overlap,
+  canvas_size_func_t const & canvas_size_func, band_func_t const & band_func)
+{
+  band_height = std::max(1, band_height);
+  overlap = std::max(0, overlap);
+  RenderOptions band_options = options;
+  int canvas_height = -1; // Unknown until the first band is rendered
+  for(int y = 0; canvas_height < 0 || y < canvas_height; y += band_height)
+  {
+    int const top = std::max(0, y - overlap);
+    band_options.band_y_ = top;
+    band_options.band_height_ = y - top + band_height + overlap;
+    ImageBuffer buffer;
+    {
+      Document document(xmlDocument, band_options);
+      Canvas canvas(document, buffer);
+      document_traversal_main::load_document(xmlDocument.getRoot(), canvas);
+      if (canvas_height < 0)
+      {
+        if (!buffer.isSizeSet())
+          throw std::runtime_error("Document has no size");
+        canvas_height = document.canvas_height_;
+        canvas_size_func(document.canvas_width_, canvas_height);
+      }
+    }
+    band_func(buffer, y - top, y, std::min(band_height, canvas_height - y));
+  }
+}
+
+RenderTarget::pixel_format_t RenderTarget::nativeFormat()
+{
+#if defined(RENDERER_AGG)
+  return rgba8;
+#elif defined(RENDERER_GDIPLUS)
+  return bgra8;
+#elif defined(RENDERER_SKIA)
+  return kN32_SkColorType == kBGRA_8888_SkColorType ? bgra8 : rgba8;
 #endif
+}
 
+void renderDocument(XMLDocument & xmlDocument, RenderTarget const & target, RenderOptions const & options)
+{
+  ImageBuffer buffer;
+  buffer.attach(target.pixels_, target.width_, target.height_, target.stride_);
+  boost::gil::rgba8_view_t const view = buffer.gilView();
+  // Existing content is drawn over, so it is converted both ways
+  bool const swap_channels = target.format_ != RenderTarget::nativeFormat();
+  if (swap_channels)
+    boost::gil::for_each_pixel(view, SwapRedBlue());
+  try
   {
-    ImageBuffer buffer;
-  
-    XMLDocument xmlDoc;
-    try
+    Document document(xmlDocument, options);
+    Canvas canvas(document, buffer);
+    boost::array<number_t, 6> const transform = {{ 
+      number_t(target.scale_), 0, 0, number_t(target.scale_), number_t(target.translate_x_), number_t(target.translate_y_) }};
+    canvas.transform_matrix(transform);
+    document_traversal_main::load_document(xmlDocument.getRoot(), canvas);
+  }
+  catch(...)
+  {
+    if (swap_channels)
+      boost::gil::for_each_pixel(view, SwapRedBlue());
+    throw;
+  }
+  if (swap_channels)
+    boost::gil::for_each_pixel(view, SwapRedBlue());
+}
+
+void documentCanvasSize(XMLDocument & xmlDocument, RenderOptions const & options, int & width, int & height)
+{
+  // Single row far below the canvas is rendered, so all shapes are culled
+  RenderOptions size_options = options;
+  size_options.band_y_ = std::numeric_limits<int>::max() / 2;
+  size_options.band_height_ = 1;
+  ImageBuffer buffer;
+  Document document(xmlDocument, size_options);
+  Canvas canvas(document, buffer);
+  document_traversal_main::load_document(xmlDocument.getRoot(), canvas);
+  if (!buffer.isSizeSet())
+    throw std::runtime_error("Document has no size");
+  width = document.canvas_width_;
+  height = document.canvas_height_;
+}
+
+#if defined(RENDERER_AGG)
+namespace
+{
+  // Rasterizes recorded commands to the buffer, 'outer' maps canvas pixels to buffer pixels
+  class DisplayListExecutor: public boost::static_visitor<>, boost::noncopyable
+  {
+  public:
+    DisplayListExecutor(Document & document, ImageBuffer & buffer, transform_t const & outer)
+      : document_(document)
+      , buffer_(buffer)
+      , outer_(outer)
+    {}
+
+    void operator()(DisplayList::DrawPath const & command)
     {
-      xmlDoc.load(argv[1]);
-      renderDocument(xmlDoc, buffer);
+      transform_t const transform = toTarget(command.transform_);
+      BoundingBox visible_bounds = TransformBox(outer_, command.visible_bounds_);
+      visible_bounds.intersect(document_.buffer_bounds_);
+      if (isPathCulled(TransformBox(outer_, command.bounds_), command.paint_, transform, visible_bounds, 
+        command.filtered_ ? 0 : document_.options_.min_feature_size_))
+      {
+        ++document_.statistics_.culled_shapes_;
+        return;
+      }
+      ++document_.statistics_.drawn_shapes_;
+      rasterizePath(currentBuffer(), document_.gradients_, document_.raster_resources_, transform, *command.geometry_, 
+        command.paint_);
     }
-    catch(svgpp::exception_base const & e)
+
+    void operator()(DisplayList::PushLayer const &)
     {
-      typedef boost::error_info<svgpp::tag::error_info::xml_element, XMLElement> element_error_info;
-      std::cerr << "Error reading file " << argv[1];
-#if defined(SVG_PARSER_RAPIDXML_NS)
-      if (XMLElement const * element = boost::get_error_info<element_error_info>(e))
-        std::cerr << " in element \"" << std::string((*element)->name(), (*element)->name() + (*element)->name_size())
-          << "\"";
-#endif
-      std::cerr << ": " << e.what() << "\n";
+      document_.checkDeadline();
+      document_.reserveImageMemory(buffer_.width(), buffer_.height());
+      layers_.push_back(boost::make_shared<ImageBuffer>(buffer_.width(), buffer_.height()));
     }
-    catch(std::exception const & e)
+
+    void operator()(DisplayList::PopLayer const & command)
     {
-      std::cerr << "Error reading file " << argv[1] << ": " << e.what() << "\n";
-      return 1;
+      boost::shared_ptr<ImageBuffer> const layer = layers_.back();
+      layers_.pop_back();
+      transform_t const transform = toTarget(command.transform_);
+      LayerEffects effects(transform, command.length_factory_);
+      effects.opacity_ = command.opacity_;
+      effects.mask_fragment_ = command.mask_fragment_;
+      effects.filter_ = command.filter_;
+      effects.bounding_box_ = TransformBox(outer_, command.bounding_box_);
+      compositeLayer(document_, effects, *layer, currentBuffer(), clipBuffer(command.clip_).get());
+      document_.releaseImageMemory(layer->width(), layer->height());
     }
 
-    // Saving output
-    const char * out_file_name = argc > 2 ? argv[2] : "svgpp.png";
-#if defined(RENDERER_AGG)
-    if (1 != stbi_write_png(out_file_name, buffer.pixfmt().width(), buffer.pixfmt().height(), 
-      4, // RGBA
-      reinterpret_cast<const char *>(buffer.pixfmt().row_ptr(0)), 
-      buffer.pixfmt().stride()))
+  private:
+    Document & document_;
+    ImageBuffer & buffer_;
+    transform_t const outer_;
+    std::vector<boost::shared_ptr<ImageBuffer> > layers_;
+    // Clip nodes are shared by many layers, so their buffers are computed once
+    typedef std::map<DisplayList::Clip const *, boost::shared_ptr<ClipBuffer> > clip_buffers_t;
+    clip_buffers_t clip_buffers_;
+
+    transform_t toTarget(transform_t const & transform) const
     {
-      std::cerr << "Error writing to PNG file\n";
-      return 1;
+      transform_t result = transform;
+      result *= outer_;
+      return result;
     }
-#elif defined(RENDERER_GDIPLUS)
-    // {C2510B29-9212-4866-A354-6EA79710636C}
-    static const GUID PNGEncoderCLSID = 
-      { 0x557cf406, 0x1a04, 0x11d3, { 0x9a, 0x73, 0x00, 0x00, 0xf8, 0x1e, 0xf3, 0x2e } };
-    buffer.bitmap().Save(std::wstring(out_file_name, out_file_name + strlen(out_file_name)).c_str(), 
-      &PNGEncoderCLSID, NULL);
-#elif defined(RENDERER_SKIA)
-    __SK_FORCE_IMAGE_DECODER_LINKING;
-    if (!SkImageEncoder::EncodeFile(out_file_name, buffer.bitmap(), SkImageEncoder::kPNG_Type, 100))
-      std::cerr << "Failed to write " << out_file_name << "\n";
+
+    ImageBuffer & currentBuffer()
+    {
+      return layers_.empty() ? buffer_ : *layers_.back();
+    }
+
+    boost::shared_ptr<ClipBuffer> clipBuffer(DisplayList::clip_ptr_t const & clip)
+    {
+      if (!clip)
+        return boost::shared_ptr<ClipBuffer>();
+      boost::shared_ptr<ClipBuffer> & result = clip_buffers_[clip.get()];
+      if (!result)
+      {
+        boost::shared_ptr<ClipBuffer> const parent = clipBuffer(clip->parent_);
+        boost::shared_ptr<ClipBuffer> buffer = parent 
+          ? document_.copyClipBuffer(*parent)
+          : document_.createClipBuffer(buffer_.width(), buffer_.height());
+        transform_t const transform = toTarget(clip->transform_);
+        if (clip->clip_path_fragment_)
+          buffer->intersectClipPath(document_.xml_document_, *clip->clip_path_fragment_, transform, 
+            document_.clipPathCache());
+        else
+          buffer->intersectClipRect(transform, clip->x_, clip->y_, clip->width_, clip->height_);
+        result = buffer;
+      }
+      return result;
+    }
+  };
+
+  // Maps canvas pixels of the recorded list to target pixels. Recorded transforms already include
+  // half pixel offset, that is removed before scaling
+  transform_t displayListTransform(double scale, double translate_x, double translate_y)
+  {
+    transform_t transform = agg::trans_affine_translation(-0.5, -0.5);
+    transform *= agg::trans_affine_scaling(scale);
+    transform *= agg::trans_affine_translation(translate_x + 0.5, translate_y + 0.5);
+    return transform;
+  }
+
+  void executeDisplayList(DisplayList const & display_list, XMLDocument & xmlDocument, ImageBuffer & buffer, 
+    RenderOptions const & options, transform_t const & outer)
+  {
+    Document document(xmlDocument, options);
+    document.buffer_bounds_.add(0, 0);
+    document.buffer_bounds_.add(buffer.width(), buffer.height());
+    DisplayListExecutor executor(document, buffer, outer);
+    for(std::vector<DisplayList::command_t>::const_iterator command = display_list.commands_.begin();
+      command != display_list.commands_.end(); ++command)
+      boost::apply_visitor(executor, *command);
+  }
+}
+
+boost::shared_ptr<DisplayList> recordDisplayList(XMLDocument & xmlDocument, RenderOptions const & options)
+{
+  boost::shared_ptr<DisplayList> display_list = boost::make_shared<DisplayList>();
+  RenderOptions record_options = options;
+  record_options.band_height_ = 0;
+  ImageBuffer buffer;
+  Document document(xmlDocument, record_options);
+  document.display_list_ = display_list.get();
+  Canvas canvas(document, buffer);
+  document_traversal_main::load_document(xmlDocument.getRoot(), canvas);
+  if (!buffer.isSizeSet())
+    throw std::runtime_error("Document has no size");
+  return display_list;
+}
+
+namespace
+{
+  bool isInSubtree(std::vector<unsigned> const & path, std::vector<unsigned> const & subtree_path)
+  {
+    return path.size() >= subtree_path.size() && std::equal(subtree_path.begin(), subtree_path.end(), path.begin());
+  }
+}
+
+bool updateDisplayListSubtree(DisplayList & display_list, XMLDocument & xmlDocument, svg_string_t const & id, 
+  RenderOptions const & options)
+{
+  DisplayList::subtrees_t::iterator const subtree = display_list.subtrees_.find(id);
+  if (subtree == display_list.subtrees_.end() || !subtree->second.refreshable_)
+    return false;
+  DisplayList::Subtree const old = subtree->second;
+
+  DisplayList recorded;
+  {
+    RenderOptions record_options = options;
+    record_options.band_height_ = 0;
+    ImageBuffer buffer;
+    Document document(xmlDocument, record_options);
+    document.display_list_ = &recorded;
+    document.subtree_path_ = &old.path_;
+    Canvas canvas(document, buffer);
+    document_traversal_main::load_document(xmlDocument.getRoot(), canvas);
+  }
+  // Element at the same position must have the same id, otherwise document was changed above the subtree
+  DisplayList::subtrees_t::const_iterator const updated = recorded.subtrees_.find(id);
+  if (updated == recorded.subtrees_.end() || updated->second.path_ != old.path_ || !updated->second.refreshable_
+    || recorded.width_ != display_list.width_ || recorded.height_ != display_list.height_)
+    return false;
+
+  size_t const old_size = old.end_ - old.begin_;
+  size_t const new_size = updated->second.end_ - updated->second.begin_;
+  std::vector<DisplayList::command_t> commands;
+  commands.reserve(display_list.commands_.size() - old_size + new_size);
+  commands.insert(commands.end(), display_list.commands_.begin(), display_list.commands_.begin() + old.begin_);
+  commands.insert(commands.end(), recorded.commands_.begin() + updated->second.begin_, 
+    recorded.commands_.begin() + updated->second.end_);
+  commands.insert(commands.end(), display_list.commands_.begin() + old.end_, display_list.commands_.end());
+
+  // Ranges of ancestors and following elements are moved, ranges of the subtree content are replaced.
+  // Ones that aren't refreshable aren't used
+  DisplayList::subtrees_t subtrees;
+  for(DisplayList::subtrees_t::const_iterator it = display_list.subtrees_.begin(); it != display_list.subtrees_.end(); ++it)
+  {
+    DisplayList::Subtree entry = it->second;
+    if (entry.refreshable_)
+    {
+      if (isInSubtree(entry.path_, old.path_))
+        continue; // Replaced by the recorded one
+      if (isInSubtree(old.path_, entry.path_))
+        entry.end_ = entry.end_ - old_size + new_size;
+      else if (old.path_ < entry.path_)
+      {
+        entry.begin_ = entry.begin_ - old_size + new_size;
+        entry.end_ = entry.end_ - old_size + new_size;
+      }
+    }
+    subtrees.insert(subtrees.end(), std::make_pair(it->first, entry));
+  }
+  for(DisplayList::subtrees_t::const_iterator it = recorded.subtrees_.begin(); it != recorded.subtrees_.end(); ++it)
+  {
+    if (!isInSubtree(it->second.path_, old.path_))
+      continue; // Ancestors aren't recorded completely
+    DisplayList::Subtree entry = it->second;
+    entry.begin_ = entry.begin_ - updated->second.begin_ + old.begin_;
+    entry.end_ = entry.end_ - updated->second.begin_ + old.begin_;
+    std::pair<DisplayList::subtrees_t::iterator, bool> const inserted = subtrees.insert(std::make_pair(it->first, entry));
+    if (!inserted.second)
+      inserted.first->second.refreshable_ = false;
+  }
+
+  display_list.commands_.swap(commands);
+  display_list.subtrees_.swap(subtrees);
+  return true;
+}
+
+void displayListSize(DisplayList const & display_list, int & width, int & height)
+{
+  width = display_list.width_;
+  height = display_list.height_;
+}
+
+void renderDisplayList(DisplayList const & display_list, XMLDocument & xmlDocument, ImageBuffer & buffer, 
+  RenderOptions const & options)
+{
+  if (!buffer.isSizeSet())
+    buffer.setSize(display_list.width_, display_list.height_, TransparentWhiteColor());
+  executeDisplayList(display_list, xmlDocument, buffer, options, transform_t());
+}
+
+void renderDisplayList(DisplayList const & display_list, XMLDocument & xmlDocument, RenderTarget const & target, 
+  RenderOptions const & options)
+{
+  ImageBuffer buffer;
+  buffer.attach(target.pixels_, target.width_, target.height_, target.stride_);
+  boost::gil::rgba8_view_t const view = buffer.gilView();
+  bool const swap_channels = target.format_ != RenderTarget::nativeFormat();
+  if (swap_channels)
+    boost::gil::for_each_pixel(view, SwapRedBlue());
+  try
+  {
+    executeDisplayList(display_list, xmlDocument, buffer, options, 
+      displayListTransform(target.scale_, target.translate_x_, target.translate_y_));
+  }
+  catch(...)
+  {
+    if (swap_channels)
+      boost::gil::for_each_pixel(view, SwapRedBlue());
+    throw;
+  }
+  if (swap_channels)
+    boost::gil::for_each_pixel(view, SwapRedBlue());
+}
 #endif
+
+namespace
+{
+  struct PyramidTile
+  {
+    int zoom_, x_, y_;
+  };
+
+  // Renders ranges of tiles from several threads
+  class PyramidRenderer: boost::noncopyable
+  {
+  public:
+    PyramidRenderer(XMLDocument & xml_document, DisplayList const * display_list, RenderOptions const & options, 
+      int tile_size, int margin, double canvas_side, std::vector<PyramidTile> const & tiles, tile_func_t const & tile_func)
+      : xml_document_(xml_document)
+      , display_list_(display_list)
+      , options_(options)
+      , tile_size_(tile_size)
+      , margin_(margin)
+      , canvas_side_(canvas_side)
+      , tiles_(tiles)
+      , tile_func_(tile_func)
+    {}
+
+    void render(int begin, int end)
+    {
+      // Counters of concurrent tiles are collected separately and merged once
+      RenderStatistics statistics;
+      RenderOptions options = options_;
+      if (options_.statistics_)
+        options.statistics_ = &statistics;
+      int const side = tile_size_ + 2 * margin_;
+      std::vector<unsigned char> pixels(size_t(side) * side * 4);
+      for(int i = begin; i < end; ++i)
+      {
+        PyramidTile const & tile = tiles_[i];
+        std::fill(pixels.begin(), pixels.end(), 0);
+        RenderTarget target(&pixels[0], side * 4, side, side, RenderTarget::nativeFormat());
+        target.scale_ = std::ldexp(double(tile_size_), tile.zoom_) / canvas_side_;
+        target.translate_x_ = margin_ - double(tile.x_) * tile_size_;
+        target.translate_y_ = margin_ - double(tile.y_) * tile_size_;
+#if defined(RENDERER_AGG)
+        renderDisplayList(*display_list_, xml_document_, target, options);
+#else
+        renderDocument(xml_document_, target, options);
+#endif
+        RenderTarget cropped(&pixels[(size_t(margin_) * side + margin_) * 4], side * 4, tile_size_, tile_size_, 
+          target.format_);
+        tile_func_(tile.zoom_, tile.x_, tile.y_, cropped);
+      }
+      if (options_.statistics_)
+      {
+        boost::mutex::scoped_lock lock(statistics_mutex_);
+        *options_.statistics_ += statistics;
+      }
+    }
+
+  private:
+    XMLDocument & xml_document_;
+    DisplayList const * const display_list_;
+    RenderOptions const & options_;
+    int const tile_size_, margin_;
+    double const canvas_side_;
+    std::vector<PyramidTile> const & tiles_;
+    tile_func_t const & tile_func_;
+    boost::mutex statistics_mutex_;
+  };
 }
-#if defined(RENDERER_GDIPLUS)
-  Gdiplus::GdiplusShutdown(gdiplusToken);
+
+void renderTilePyramid(XMLDocument & xmlDocument, RenderOptions const & options, int tile_size, int margin,
+  int min_zoom, int max_zoom, tile_func_t const & tile_func)
+{
+  margin = std::max(0, margin);
+  if (tile_size <= 0 || tile_size > 65536 - 2 * margin)
+    throw std::runtime_error("Invalid tile size");
+  int canvas_width, canvas_height;
+  boost::shared_ptr<DisplayList const> display_list;
+#if defined(RENDERER_AGG)
+  // Document is traversed once, tiles replay recorded commands
+  display_list = recordDisplayList(xmlDocument, options);
+  displayListSize(*display_list, canvas_width, canvas_height);
+#else
+  documentCanvasSize(xmlDocument, options, canvas_width, canvas_height);
 #endif
+  double const canvas_side = std::max(canvas_width, canvas_height);
+  std::vector<PyramidTile> tiles;
+  for(int zoom = min_zoom; zoom <= max_zoom; ++zoom)
+  {
+    // Tiles that are completely outside of the canvas are skipped
+    double const scale = std::ldexp(double(tile_size), zoom) / canvas_side;
+    double const level_columns = std::ceil(canvas_width * scale / tile_size);
+    double const level_rows = std::ceil(canvas_height * scale / tile_size);
+    if (tiles.size() + level_columns * level_rows > std::numeric_limits<int>::max())
+      throw std::runtime_error("Too many tiles in the pyramid");
+    int const columns = int(level_columns), rows = int(level_rows);
+    for(int y = 0; y < rows; ++y)
+      for(int x = 0; x < columns; ++x)
+      {
+        PyramidTile const tile = { zoom, x, y };
+        tiles.push_back(tile);
+      }
+  }
+  // Work is split by tiles, filters inside of a tile run in its thread
+  RenderOptions tile_options = options;
+  tile_options.thread_pool_ = NULL;
+  PyramidRenderer renderer(xmlDocument, display_list.get(), tile_options, tile_size, margin, canvas_side, tiles, tile_func);
+  ParallelFor(options.thread_pool_, int(tiles.size()), 1, boost::bind(&PyramidRenderer::render, &renderer, _1, _2));
+}
 
-  return 0;
-}
\ No newline at end of file
+std::string errorDescription(svgpp::exception_base const & e)
+{
+  typedef boost::error_info<svgpp::tag::error_info::xml_element, XMLElement> element_error_info;
+  std::string result;
+#if defined(SVG_PARSER_RAPIDXML_NS)
+  if (XMLElement const * element = boost::get_error_info<element_error_info>(e))
+    result = "in element \"" + std::string((*element)->name(), (*element)->name() + (*element)->name_size()) + "\": ";
+#endif
+  return result + e.what();
+}
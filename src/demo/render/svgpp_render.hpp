@@ -0,0 +1,169 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <svgpp/policy/error.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+class ImageBuffer;
+class ThreadPool;
+struct DisplayList;
+
+// Thrown when one of the RenderOptions limits is exceeded
+struct RenderLimitExceeded: std::runtime_error
+{
+  enum limit_t { time_limit, memory_limit };
+
+  RenderLimitExceeded(limit_t limit, const char * message)
+    : std::runtime_error(message)
+    , limit_(limit)
+  {}
+
+  limit_t limit_;
+};
+
+// Counters of a render, culled elements are the ones that were skipped being outside of the visible area
+struct RenderStatistics
+{
+  RenderStatistics()
+    : drawn_shapes_(0)
+    , culled_shapes_(0)
+    , culled_viewports_(0)
+    , raster_passes_(0)
+    , raster_allocations_(0)
+    , document_peak_bytes_(0)
+  {}
+
+  RenderStatistics & operator+=(RenderStatistics const & other)
+  {
+    drawn_shapes_ += other.drawn_shapes_;
+    culled_shapes_ += other.culled_shapes_;
+    culled_viewports_ += other.culled_viewports_;
+    raster_passes_ += other.raster_passes_;
+    raster_allocations_ += other.raster_allocations_;
+    document_peak_bytes_ = std::max(document_peak_bytes_, other.document_peak_bytes_);
+    return *this;
+  }
+
+  unsigned long drawn_shapes_, culled_shapes_;
+  unsigned long culled_viewports_; // Nested 'svg', 'symbol' and 'marker' instances which content wasn't traversed
+  unsigned long raster_passes_; // Fills and strokes rasterized
+  unsigned long raster_allocations_; // Reallocations of scanline and span arrays shared by passes of a render
+  size_t document_peak_bytes_; // Largest of documents' peak of image and clip buffer bytes
+};
+
+struct RenderOptions
+{
+  RenderOptions()
+    : gradient_ramp_size_(256)
+    , filter_fusion_(true)
+    , thread_pool_(NULL)
+    , output_width_(0)
+    , output_height_(0)
+    , max_image_bytes_(0)
+    , band_y_(0)
+    , band_height_(0)
+    , min_feature_size_(0)
+    , statistics_(NULL)
+  {}
+
+  unsigned gradient_ramp_size_;
+  bool filter_fusion_;
+  ThreadPool * thread_pool_; // Not owned, NULL for single-threaded rendering
+  // Document is scaled to this size if both are set
+  unsigned output_width_, output_height_;
+  // Limits used by server mode, zero and not_a_date_time mean no limit
+  size_t max_image_bytes_; // Sum of sizes of image buffers that exist at the same time
+  boost::posix_time::ptime deadline_;
+  // Only canvas rows [band_y_, band_y_ + band_height_) are rendered to the buffer if band height is set
+  int band_y_, band_height_;
+  // Shapes which bounds are smaller than this number of pixels in both dimensions are skipped
+  double min_feature_size_;
+  // Not owned, counters of the render are added to it if set. Renders running at the same time
+  // must not share it
+  RenderStatistics * statistics_;
+};
+
+// Memory owned by the caller that document is rendered to
+struct RenderTarget
+{
+  enum pixel_format_t { rgba8, bgra8 };
+
+  RenderTarget(unsigned char * pixels, int stride, int width, int height, pixel_format_t format)
+    : pixels_(pixels)
+    , stride_(stride)
+    , width_(width)
+    , height_(height)
+    , format_(format)
+    , scale_(1)
+    , translate_x_(0)
+    , translate_y_(0)
+  {}
+
+  // Channel order the renderer draws in, other formats cost a pass that swaps channels in place
+  static pixel_format_t nativeFormat();
+
+  unsigned char * pixels_;
+  int stride_, width_, height_;
+  pixel_format_t format_;
+  // Maps document user space to target pixels: x * scale + translate
+  double scale_, translate_x_, translate_y_;
+};
+
+// Renders to 'buffer', the size of the buffer is set from the document if it isn't set yet
+void renderDocument(XMLDocument & xmlDocument, ImageBuffer & buffer, RenderOptions const & options);
+// Draws document over the current content of target memory without intermediate
+// full size buffer. Alpha is premultiplied for Skia and straight for AGG and GDI+ renderers
+void renderDocument(XMLDocument & xmlDocument, RenderTarget const & target, RenderOptions const & options = RenderOptions());
+
+typedef boost::function<void(int width, int height)> canvas_size_func_t;
+// Receives 'rows' rows of the canvas starting from 'canvas_row' that are in 'band' starting from 'band_row'
+typedef boost::function<void(ImageBuffer & band, int band_row, int canvas_row, int rows)> band_func_t;
+
+// Renders canvas in horizontal bands of 'band_height' rows, so that memory used by image buffers 
+// is bounded by band size rather than canvas size. Document is traversed once per band. 
+// Bands are rendered with 'overlap' extra rows above and below, so that filter effects 
+// reaching no further than that are seamless
+void renderDocumentInBands(XMLDocument & xmlDocument, RenderOptions const & options, int band_height, int overlap,
+  canvas_size_func_t const & canvas_size_func, band_func_t const & band_func);
+
+// Size of the image buffer that renderDocument() would create for the document
+void documentCanvasSize(XMLDocument & xmlDocument, RenderOptions const & options, int & width, int & height);
+
+#if defined(RENDERER_AGG)
+// Traverses the document once and records drawing commands that may be rasterized many times
+// at different scale and crop. Masks, clip paths and filters are resolved from 'xmlDocument'
+// when the list is rasterized, so the document must outlive the list
+boost::shared_ptr<DisplayList> recordDisplayList(XMLDocument & xmlDocument, RenderOptions const & options);
+// Records again the element with 'id' attribute after it or its content was changed in 'xmlDocument' and
+// replaces its commands in the list. Only elements on the path to it are traversed. Returns false if the list
+// must be recorded anew instead: the id isn't found or isn't unique, the element is inside of a filtered
+// element, or elements above it were changed. Must not be called while the list is rasterized
+bool updateDisplayListSubtree(DisplayList & displayList, XMLDocument & xmlDocument, svg_string_t const & id, 
+  RenderOptions const & options);
+// Canvas size at scale 1
+void displayListSize(DisplayList const & displayList, int & width, int & height);
+// Same as renderDocument() but from the recorded list. May be called from several threads for the same list
+void renderDisplayList(DisplayList const & displayList, XMLDocument & xmlDocument, ImageBuffer & buffer, 
+  RenderOptions const & options);
+void renderDisplayList(DisplayList const & displayList, XMLDocument & xmlDocument, RenderTarget const & target, 
+  RenderOptions const & options = RenderOptions());
+#endif
+
+// Receives tile in RenderTarget::nativeFormat(), memory is valid only during the call
+typedef boost::function<void(int zoom, int x, int y, RenderTarget const & tile)> tile_func_t;
+
+// Renders zoom levels [min_zoom, max_zoom] of square tiles from a document parsed once. At level Z 
+// the larger side of the canvas spans tile_size * 2^Z pixels, tiles outside of the canvas are skipped.
+// Tiles are rendered with 'margin' extra pixels on each side and cropped, so that filter effects
+// reaching no further than that are seamless.
+// Tiles are rendered in parallel on options.thread_pool_ and 'tile_func' is called from its threads
+void renderTilePyramid(XMLDocument & xmlDocument, RenderOptions const & options, int tile_size, int margin,
+  int min_zoom, int max_zoom, tile_func_t const & tile_func);
+
+std::string errorDescription(svgpp::exception_base const & e);
@@ -0,0 +1,770 @@
+#include "svgpp_render.hpp"
+#include "image_buffer.hpp"
+#include "image_encoder.hpp"
+#include "render_server.hpp"
+#include "thread_pool.hpp"
+#include "tile_writer.hpp"
+
+#include <boost/bind.hpp>
+#include <boost/ref.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#if defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+EncoderInput encoderInput(ImageBuffer & buffer)
+{
+  boost::gil::rgba8_view_t const view = buffer.gilView();
+  EncoderInput input(reinterpret_cast<unsigned char const *>(&view(0, 0)), 
+    view.width(), view.height(), int(view.pixels().row_size()));
+  input.bgra_ = RenderTarget::nativeFormat() == RenderTarget::bgra8;
+#if defined(RENDERER_SKIA)
+  input.premultiplied_ = true;
+#endif
+  return input;
+}
+
+// "-" means standard output
+bool saveImage(ImageBuffer & buffer, std::string const & out_file_name, EncoderOptions const & encoder_options)
+{
+  try
+  {
+    if (out_file_name == "-")
+    {
+#if defined(_WIN32)
+      _setmode(_fileno(stdout), _O_BINARY);
+#endif
+      encodeImage(encoderInput(buffer), encoder_options, std::cout);
+    }
+    else
+    {
+      std::ofstream out(out_file_name.c_str(), std::ios::binary);
+      encodeImage(encoderInput(buffer), encoder_options, out);
+    }
+    return true;
+  }
+  catch(std::exception const &)
+  {
+    return false;
+  }
+}
+
+// Encodes bands of the canvas as soon as they are rendered, see renderDocumentInBands
+class BandWriter
+{
+public:
+  BandWriter(std::ostream & out, EncoderOptions const & encoder_options)
+    : out_(out)
+    , encoder_options_(encoder_options)
+  {}
+
+  void start(int width, int height)
+  {
+    writer_.reset(new ImageWriter(out_, width, height, encoder_options_));
+  }
+
+  void write(ImageBuffer & band, int band_row, int /*canvas_row*/, int rows)
+  {
+    EncoderInput input = encoderInput(band);
+    input.pixels_ += std::ptrdiff_t(band_row) * input.stride_;
+    input.height_ = rows;
+    writer_->writeRows(input);
+  }
+
+private:
+  std::ostream & out_;
+  EncoderOptions const encoder_options_;
+  boost::scoped_ptr<ImageWriter> writer_;
+};
+
+double millisecondsSince(boost::posix_time::ptime const & start)
+{
+  return (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds() / 1000.0;
+}
+
+// Batch mode renders many files in one process. Main thread reads and parses documents 
+// ahead of rendering, while pool threads rasterize and save already loaded ones
+struct BatchItem
+{
+  BatchItem()
+    : file_bytes_(0)
+    , width_(0)
+    , height_(0)
+    , load_ms_(0)
+    , render_ms_(0)
+    , write_ms_(0)
+    , status_("pending")
+  {}
+
+  std::string svg_file_, out_file_;
+  boost::shared_ptr<XMLDocument> xml_document_; // Set while document is loaded but not rendered yet
+  long file_bytes_;
+  int width_, height_;
+  double load_ms_, render_ms_, write_ms_;
+  RenderStatistics statistics_;
+  std::string status_, error_;
+};
+
+class BatchRenderer: boost::noncopyable
+{
+public:
+  BatchRenderer(RenderOptions const & options, EncoderOptions const & encoder_options, ThreadPool & pool, 
+    unsigned prefetch)
+    : options_(options)
+    , encoder_options_(encoder_options)
+    , pool_(pool)
+    , prefetch_(std::max(1u, prefetch))
+    , in_flight_(0)
+  {
+    options_.thread_pool_ = &pool_;
+    encoder_options_.thread_pool_ = &pool_;
+  }
+
+  void run(std::vector<BatchItem> & items)
+  {
+    for(std::vector<BatchItem>::iterator item = items.begin(); item != items.end(); ++item)
+    {
+      waitInFlightBelow(prefetch_);
+      if (load(*item))
+      {
+        {
+          boost::mutex::scoped_lock lock(mutex_);
+          ++in_flight_;
+        }
+        pool_.post(boost::bind(&BatchRenderer::render, this, boost::ref(*item)));
+      }
+    }
+    waitInFlightBelow(1);
+  }
+
+private:
+  RenderOptions options_;
+  EncoderOptions encoder_options_;
+  ThreadPool & pool_;
+  unsigned const prefetch_;
+  unsigned in_flight_; // Loaded documents that aren't rendered yet
+  boost::mutex mutex_;
+  boost::condition_variable rendered_;
+
+  bool load(BatchItem & item)
+  {
+    boost::posix_time::ptime const start = boost::posix_time::microsec_clock::universal_time();
+    try
+    {
+      std::ifstream file(item.svg_file_.c_str(), std::ios::binary | std::ios::ate);
+      if (!file)
+        throw std::runtime_error("Can't open file");
+      item.file_bytes_ = static_cast<long>(file.tellg());
+      file.close();
+      item.xml_document_.reset(new XMLDocument);
+      item.xml_document_->load(item.svg_file_.c_str());
+    }
+    catch(std::exception const & e)
+    {
+      item.xml_document_.reset();
+      item.status_ = "load_error";
+      item.error_ = e.what();
+    }
+    item.load_ms_ = millisecondsSince(start);
+    return item.xml_document_.get() != NULL;
+  }
+
+  void render(BatchItem & item)
+  {
+    try
+    {
+      ImageBuffer buffer;
+      boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+      item.status_ = "ok";
+      try
+      {
+        RenderOptions options = options_;
+        options.statistics_ = &item.statistics_;
+        renderDocument(*item.xml_document_, buffer, options);
+      }
+      catch(svgpp::exception_base const & e)
+      {
+        // Same as in single file mode, partially rendered image is saved
+        item.status_ = "render_error";
+        item.error_ = errorDescription(e);
+      }
+      item.render_ms_ = millisecondsSince(start);
+      item.xml_document_.reset();
+      if (buffer.isSizeSet())
+      {
+        item.width_ = buffer.width();
+        item.height_ = buffer.height();
+        start = boost::posix_time::microsec_clock::universal_time();
+        if (!saveImage(buffer, item.out_file_, encoder_options_))
+        {
+          item.status_ = "write_error";
+          item.error_ = "Error writing to image file";
+        }
+        item.write_ms_ = millisecondsSince(start);
+      }
+    }
+    catch(std::exception const & e)
+    {
+      item.status_ = "render_error";
+      item.error_ = e.what();
+    }
+    item.xml_document_.reset();
+
+    boost::mutex::scoped_lock lock(mutex_);
+    --in_flight_;
+    rendered_.notify_all();
+  }
+
+  // Calling thread helps with pending tasks while waiting
+  void waitInFlightBelow(unsigned limit)
+  {
+    for(;;)
+    {
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        if (in_flight_ < limit)
+          return;
+      }
+      if (!pool_.runPendingTask())
+      {
+        // All pending documents are being rendered by other threads
+        boost::mutex::scoped_lock lock(mutex_);
+        while (in_flight_ >= limit)
+          rendered_.wait(lock);
+        return;
+      }
+    }
+  }
+};
+
+std::string fileNameWithoutPath(std::string const & path)
+{
+  std::string::size_type const pos = path.find_last_of("/\\");
+  return pos == std::string::npos ? path : path.substr(pos + 1);
+}
+
+// Manifest lines are "<svg file>" or "<svg file><TAB><output file>", empty lines and
+// lines starting with '#' are ignored
+void readManifest(const char * manifest_file, std::string const & output_dir, const char * extension, 
+  std::vector<BatchItem> & items)
+{
+  std::ifstream manifest(manifest_file);
+  if (!manifest)
+    throw std::runtime_error(std::string("Can't open manifest ") + manifest_file);
+  std::string line;
+  while (std::getline(manifest, line))
+  {
+    if (!line.empty() && line[line.size() - 1] == '\r')
+      line.erase(line.size() - 1);
+    if (line.empty() || line[0] == '#')
+      continue;
+    BatchItem item;
+    std::string::size_type const tab = line.find('\t');
+    item.svg_file_ = line.substr(0, tab);
+    item.out_file_ = tab == std::string::npos 
+      ? output_dir + "/" + fileNameWithoutPath(item.svg_file_) + extension
+      : line.substr(tab + 1);
+    items.push_back(item);
+  }
+}
+
+std::string jsonString(std::string const & str)
+{
+  std::string result = "\"";
+  for(std::string::const_iterator c = str.begin(); c != str.end(); ++c)
+  {
+    if (*c == '"' || *c == '\\')
+      result += '\\';
+    if (static_cast<unsigned char>(*c) < 0x20)
+      result += ' ';
+    else
+      result += *c;
+  }
+  return result + "\"";
+}
+
+std::string csvString(std::string const & str)
+{
+  std::string result = "\"";
+  for(std::string::const_iterator c = str.begin(); c != str.end(); ++c)
+  {
+    if (*c == '"')
+      result += '"';
+    result += *c == '\n' || *c == '\r' ? ' ' : *c;
+  }
+  return result + "\"";
+}
+
+// Summary is written as JSON if file name ends with ".json" and as CSV otherwise
+void writeBatchSummary(std::ostream & out, std::vector<BatchItem> const & items, bool json)
+{
+  if (json)
+    out << "[\n";
+  else
+    out << "file,output,status,file_bytes,width,height,load_ms,render_ms,write_ms,image_bytes,document_peak_kb,"
+      "drawn_shapes,culled_shapes,culled_viewports,error\n";
+  for(std::vector<BatchItem>::const_iterator item = items.begin(); item != items.end(); ++item)
+  {
+    long const image_bytes = long(item->width_) * item->height_ * 4;
+    // Memory of the render itself, unlike the peak of the process that is shared by concurrent items
+    size_t const document_peak_kb = (item->statistics_.document_peak_bytes_ + 1023) / 1024;
+    if (json)
+      out << "  {\"file\": " << jsonString(item->svg_file_) 
+        << ", \"output\": " << jsonString(item->out_file_)
+        << ", \"status\": " << jsonString(item->status_)
+        << ", \"file_bytes\": " << item->file_bytes_
+        << ", \"width\": " << item->width_
+        << ", \"height\": " << item->height_
+        << ", \"load_ms\": " << item->load_ms_
+        << ", \"render_ms\": " << item->render_ms_
+        << ", \"write_ms\": " << item->write_ms_
+        << ", \"image_bytes\": " << image_bytes
+        << ", \"document_peak_kb\": " << document_peak_kb
+        << ", \"drawn_shapes\": " << item->statistics_.drawn_shapes_
+        << ", \"culled_shapes\": " << item->statistics_.culled_shapes_
+        << ", \"culled_viewports\": " << item->statistics_.culled_viewports_
+        << ", \"error\": " << jsonString(item->error_)
+        << (item + 1 == items.end() ? "}\n" : "},\n");
+    else
+      out << csvString(item->svg_file_) << ',' << csvString(item->out_file_) << ',' << item->status_ << ','
+        << item->file_bytes_ << ',' << item->width_ << ',' << item->height_ << ','
+        << item->load_ms_ << ',' << item->render_ms_ << ',' << item->write_ms_ << ','
+        << image_bytes << ',' << document_peak_kb << ',' 
+        << item->statistics_.drawn_shapes_ << ',' << item->statistics_.culled_shapes_ << ',' 
+        << item->statistics_.culled_viewports_ << ',' << csvString(item->error_) << '\n';
+  }
+  if (json)
+    out << "]\n";
+}
+
+int runBatch(RenderOptions const & options, EncoderOptions const & encoder_options, unsigned threads, 
+  unsigned prefetch, std::vector<BatchItem> & items, std::string const & summary_file)
+{
+  {
+    ThreadPool thread_pool(threads);
+    BatchRenderer renderer(options, encoder_options, thread_pool, prefetch ? prefetch : 2 * thread_pool.size());
+    renderer.run(items);
+  }
+
+  bool const json = summary_file.size() >= 5 && summary_file.compare(summary_file.size() - 5, 5, ".json") == 0;
+  if (summary_file.empty())
+    writeBatchSummary(std::cout, items, false);
+  else
+  {
+    std::ofstream out(summary_file.c_str());
+    writeBatchSummary(out, items, json);
+    if (!out)
+    {
+      std::cerr << "Error writing summary to " << summary_file << "\n";
+      return 1;
+    }
+  }
+
+  int failed = 0;
+  for(std::vector<BatchItem>::const_iterator item = items.begin(); item != items.end(); ++item)
+    if (item->status_ != "ok")
+    {
+      ++failed;
+      std::cerr << "Error processing file " << item->svg_file_ << ": " << item->error_ << "\n";
+    }
+  return failed == 0 ? 0 : 1;
+}
+
+// Renders requests of server mode. Each request is rendered in single thread, 
+// requests are parallelized by the server
+class ServerRenderer
+{
+public:
+  ServerRenderer(RenderOptions const & options, EncoderOptions const & encoder_options, unsigned timeout_ms)
+    : options_(options)
+    , encoder_options_(encoder_options)
+    , timeout_ms_(timeout_ms)
+  {
+    options_.thread_pool_ = NULL;
+    encoder_options_.thread_pool_ = NULL;
+  }
+
+  void operator()(RenderRequest const & request, RenderResponse & response) const
+  {
+    EncoderOptions encoder_options = encoder_options_;
+    if (!parseImageFormat(request.format_, encoder_options.format_))
+    {
+      response.code_ = 400;
+      response.body_ = "Unsupported format " + request.format_ + ", expected png, rgba, pam or ppm";
+      return;
+    }
+    RenderOptions options = options_;
+    options.output_width_ = request.width_;
+    options.output_height_ = request.height_;
+    if (timeout_ms_)
+      options.deadline_ = boost::posix_time::microsec_clock::universal_time() 
+        + boost::posix_time::milliseconds(timeout_ms_);
+    try
+    {
+      XMLDocument xmlDoc;
+      xmlDoc.loadFromMemory(request.svg_.data(), request.svg_.size());
+      ImageBuffer buffer;
+      renderDocument(xmlDoc, buffer, options);
+      if (!buffer.isSizeSet())
+        throw std::runtime_error("Document has no size");
+      std::ostringstream out;
+      encodeImage(encoderInput(buffer), encoder_options, out);
+      response.body_ = out.str();
+      response.format_ = request.format_;
+      if (encoder_options.format_ == EncoderOptions::rgba)
+      {
+        // Size isn't known to the client if it wasn't set in request
+        std::ostringstream format;
+        format << "rgba:" << buffer.width() << "x" << buffer.height();
+        response.format_ = format.str();
+      }
+    }
+    catch(RenderLimitExceeded const & e)
+    {
+      response.code_ = e.limit_ == RenderLimitExceeded::time_limit ? 504 : 413;
+      response.body_ = e.what();
+    }
+    catch(svgpp::exception_base const & e)
+    {
+      response.code_ = 500;
+      response.body_ = errorDescription(e);
+    }
+    catch(std::exception const & e)
+    {
+      response.code_ = 500;
+      response.body_ = e.what();
+    }
+  }
+
+private:
+  RenderOptions options_;
+  EncoderOptions encoder_options_;
+  unsigned const timeout_ms_;
+};
+
+void writePyramidTile(TileWriter & writer, EncoderOptions const & encoder_options, 
+  int zoom, int x, int y, RenderTarget const & tile)
+{
+  EncoderInput input(tile.pixels_, tile.width_, tile.height_, tile.stride_);
+  input.bgra_ = tile.format_ == RenderTarget::bgra8;
+#if defined(RENDERER_SKIA)
+  input.premultiplied_ = true;
+#endif
+  std::ostringstream out;
+  encodeImage(input, encoder_options, out);
+  writer.write(zoom, x, y, out.str());
+}
+
+// Document is parsed once and all tiles of all levels are rendered from it
+int renderPyramid(char const * svg_file_name, TileWriter & writer, RenderOptions const & options, 
+  EncoderOptions const & encoder_options, int tile_size, int tile_margin, int min_zoom, int max_zoom)
+{
+  // Tiles are encoded in threads that render them
+  EncoderOptions tile_encoder_options = encoder_options;
+  tile_encoder_options.thread_pool_ = NULL;
+  XMLDocument xmlDoc;
+  try
+  {
+    xmlDoc.load(svg_file_name);
+    renderTilePyramid(xmlDoc, options, tile_size, tile_margin, min_zoom, max_zoom,
+      boost::bind(&writePyramidTile, boost::ref(writer), boost::cref(tile_encoder_options), _1, _2, _3, _4));
+    writer.finish();
+  }
+  catch(svgpp::exception_base const & e)
+  {
+    std::cerr << "Error reading file " << svg_file_name << ": " << errorDescription(e) << "\n";
+    return 1;
+  }
+  catch(std::exception const & e)
+  {
+    std::cerr << "Error rendering tiles of " << svg_file_name << ": " << e.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
+
+// Canvas is rendered and written band by band, so it may be larger than available memory
+int renderInBands(char const * svg_file_name, std::string const & out_file_name, RenderOptions const & options, 
+  EncoderOptions const & encoder_options, int band_height, int band_overlap)
+{
+  std::ofstream out_file;
+  if (out_file_name == "-")
+  {
+#if defined(_WIN32)
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+  }
+  else
+    out_file.open(out_file_name.c_str(), std::ios::binary);
+  BandWriter writer(out_file_name == "-" ? std::cout : out_file, encoder_options);
+  XMLDocument xmlDoc;
+  try
+  {
+    xmlDoc.load(svg_file_name);
+    renderDocumentInBands(xmlDoc, options, band_height, band_overlap,
+      boost::bind(&BandWriter::start, &writer, _1, _2),
+      boost::bind(&BandWriter::write, &writer, _1, _2, _3, _4));
+  }
+  catch(svgpp::exception_base const & e)
+  {
+    std::cerr << "Error reading file " << svg_file_name << ": " << errorDescription(e) << "\n";
+    return 1;
+  }
+  catch(std::exception const & e)
+  {
+    std::cerr << "Error rendering file " << svg_file_name << " to " << out_file_name << ": " << e.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char * argv[])
+{
+  RenderOptions options;
+  EncoderOptions encoder_options;
+  int threads = 1;
+  bool batch = false;
+  unsigned prefetch = 0;
+  std::string manifest_file, output_dir = ".", summary_file;
+  std::vector<const char *> file_args;
+  bool serve_stdio = false;
+  std::string serve_socket;
+  RenderServer::Limits server_limits;
+  unsigned request_timeout_ms = 10000;
+  size_t max_image_bytes = size_t(512) << 20;
+  int band_height = 0, band_overlap = 32;
+  std::string pyramid_dir, pyramid_pack;
+  int tile_size = 256, tile_margin = 32, min_zoom = 0, max_zoom = 8;
+  double min_feature_size = -1;
+  bool print_statistics = false;
+  for(int i = 1; i < argc; ++i)
+  {
+    std::string arg(argv[i]);
+    if (arg.compare(0, 21, "--gradient-ramp-size=") == 0)
+      options.gradient_ramp_size_ = std::max(2, atoi(arg.c_str() + 21));
+    else if (arg == "--no-filter-fusion")
+      options.filter_fusion_ = false;
+    else if (arg.compare(0, 10, "--threads=") == 0)
+      threads = std::max(1, atoi(arg.c_str() + 10));
+    else if (arg.compare(0, 9, "--format=") == 0)
+    {
+      if (!parseImageFormat(arg.substr(9), encoder_options.format_))
+      {
+        std::cerr << "Unknown output format " << arg.substr(9) << "\n";
+        return 1;
+      }
+    }
+    else if (arg.compare(0, 14, "--compression=") == 0)
+    {
+      if (!parseCompressionLevel(arg.substr(14), encoder_options.compression_level_))
+      {
+        std::cerr << "Invalid compression level " << arg.substr(14) << "\n";
+        return 1;
+      }
+    }
+    else if (arg == "--batch")
+      batch = true;
+    else if (arg.compare(0, 11, "--manifest=") == 0)
+    {
+      batch = true;
+      manifest_file = arg.substr(11);
+    }
+    else if (arg.compare(0, 13, "--output-dir=") == 0)
+      output_dir = arg.substr(13);
+    else if (arg.compare(0, 10, "--summary=") == 0)
+      summary_file = arg.substr(10);
+    else if (arg.compare(0, 11, "--prefetch=") == 0)
+      prefetch = std::max(1, atoi(arg.c_str() + 11));
+    else if (arg == "--serve-stdio")
+      serve_stdio = true;
+    else if (arg.compare(0, 15, "--serve-socket=") == 0)
+      serve_socket = arg.substr(15);
+    else if (arg.compare(0, 10, "--workers=") == 0)
+      server_limits.workers_ = std::max(1, atoi(arg.c_str() + 10));
+    else if (arg.compare(0, 13, "--queue-size=") == 0)
+      server_limits.queue_size_ = std::max(1, atoi(arg.c_str() + 13));
+    else if (arg.compare(0, 20, "--max-request-bytes=") == 0)
+      server_limits.max_request_bytes_ = strtoul(arg.c_str() + 20, NULL, 10);
+    else if (arg.compare(0, 21, "--request-timeout-ms=") == 0)
+      request_timeout_ms = strtoul(arg.c_str() + 21, NULL, 10);
+    else if (arg.compare(0, 18, "--max-image-bytes=") == 0)
+      max_image_bytes = strtoul(arg.c_str() + 18, NULL, 10);
+    else if (arg.compare(0, 14, "--band-height=") == 0)
+      band_height = std::max(0, atoi(arg.c_str() + 14));
+    else if (arg.compare(0, 15, "--band-overlap=") == 0)
+      band_overlap = std::max(0, atoi(arg.c_str() + 15));
+    else if (arg.compare(0, 10, "--pyramid=") == 0)
+      pyramid_dir = arg.substr(10);
+    else if (arg.compare(0, 15, "--pyramid-pack=") == 0)
+      pyramid_pack = arg.substr(15);
+    else if (arg.compare(0, 12, "--tile-size=") == 0)
+      tile_size = std::max(1, std::min(16384, atoi(arg.c_str() + 12)));
+    else if (arg.compare(0, 14, "--tile-margin=") == 0)
+      tile_margin = std::max(0, std::min(1024, atoi(arg.c_str() + 14)));
+    else if (arg.compare(0, 11, "--min-zoom=") == 0)
+      min_zoom = std::max(0, std::min(20, atoi(arg.c_str() + 11)));
+    else if (arg.compare(0, 11, "--max-zoom=") == 0)
+      max_zoom = std::max(0, std::min(20, atoi(arg.c_str() + 11)));
+    else if (arg.compare(0, 19, "--min-feature-size=") == 0)
+      min_feature_size = std::max(0.0, atof(arg.c_str() + 19));
+    else if (arg == "--statistics")
+      print_statistics = true;
+    else
+      file_args.push_back(argv[i]);
+  }
+
+  bool const serve = serve_stdio || !serve_socket.empty();
+  bool const pyramid = !pyramid_dir.empty() || !pyramid_pack.empty();
+  if (min_feature_size >= 0)
+    options.min_feature_size_ = min_feature_size;
+  else if (pyramid)
+    options.min_feature_size_ = 1; // Details smaller than a pixel of the level are skipped
+  if (file_args.empty() && manifest_file.empty() && !serve)
+  {
+    std::cout << "Usage: " << argv[0] << " [--gradient-ramp-size=<256|1024>] [--no-filter-fusion] [--threads=<N>] <svg file name> [<output file name or - for stdout>]\n"
+      << "         [--band-height=<rows> [--band-overlap=<rows>]] [--min-feature-size=<pixels>] [--statistics]\n"
+      << "       " << argv[0] << " --pyramid=<dir>|--pyramid-pack=<file> [--tile-size=<256>] [--tile-margin=<32>] [--min-zoom=<0>] [--max-zoom=<8>]\n"
+      << "         [--min-feature-size=<1>] [--threads=<N>] [--statistics] <svg file name>\n"
+      << "       " << argv[0] << " --batch|--manifest=<file> [--output-dir=<dir>] [--summary=<CSV or JSON file>] [--prefetch=<N>] [--threads=<N>] [<svg file name>...]\n"
+      << "       " << argv[0] << " --serve-stdio|--serve-socket=<path> [--workers=<N>] [--queue-size=<N>] [--max-request-bytes=<N>]\n"
+      << "         [--request-timeout-ms=<N>] [--max-image-bytes=<N>]\n"
+      << "Output: [--format=<png|rgba|pam|ppm>] [--compression=<0-9|none|fast|best>]\n";
+    return 1;
+  }
+
+#if defined(RENDERER_GDIPLUS)
+  Gdiplus::GdiplusStartupInput gdiplusStartupInput;
+  ULONG_PTR gdiplusToken;
+  Gdiplus::GdiplusStartup(&gdiplusToken, &gdiplusStartupInput, NULL);
+#endif
+
+  int result = 0;
+  if (serve)
+  {
+    options.max_image_bytes_ = max_image_bytes;
+    RenderServer server(ServerRenderer(options, encoder_options, request_timeout_ms), server_limits);
+    try
+    {
+      if (serve_stdio)
+      {
+#if defined(_WIN32)
+        _setmode(_fileno(stdin), _O_BINARY);
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        server.serveStream(0, 1);
+      }
+      else
+        server.serveUnixSocket(serve_socket);
+    }
+    catch(std::exception const & e)
+    {
+      std::cerr << e.what() << "\n";
+      result = 1;
+    }
+  }
+  else if (batch)
+  {
+    std::vector<BatchItem> items;
+    try
+    {
+      if (!manifest_file.empty())
+        readManifest(manifest_file.c_str(), output_dir, imageFileExtension(encoder_options.format_), items);
+    }
+    catch(std::exception const & e)
+    {
+      std::cerr << e.what() << "\n";
+      return 1;
+    }
+    for(std::vector<const char *>::const_iterator file = file_args.begin(); file != file_args.end(); ++file)
+    {
+      BatchItem item;
+      item.svg_file_ = *file;
+      item.out_file_ = output_dir + "/" + fileNameWithoutPath(item.svg_file_) + imageFileExtension(encoder_options.format_);
+      items.push_back(item);
+    }
+    result = runBatch(options, encoder_options, threads, prefetch, items, summary_file);
+  }
+  else
+  {
+    boost::scoped_ptr<ThreadPool> thread_pool;
+    if (threads > 1)
+    {
+      thread_pool.reset(new ThreadPool(threads));
+      options.thread_pool_ = thread_pool.get();
+      encoder_options.thread_pool_ = thread_pool.get();
+    }
+    RenderStatistics statistics;
+    if (print_statistics)
+      options.statistics_ = &statistics;
+    std::string const out_file_name = file_args.size() > 1 
+      ? std::string(file_args[1]) : std::string("svgpp") + imageFileExtension(encoder_options.format_);
+    if (pyramid)
+    {
+      try
+      {
+        boost::scoped_ptr<TileWriter> writer;
+        if (!pyramid_pack.empty())
+          writer.reset(new TilePackWriter(pyramid_pack));
+        else
+          writer.reset(new TileDirectoryWriter(pyramid_dir, imageFileExtension(encoder_options.format_)));
+        result = renderPyramid(file_args[0], *writer, options, encoder_options, tile_size, tile_margin, min_zoom, max_zoom);
+      }
+      catch(std::exception const & e)
+      {
+        std::cerr << e.what() << "\n";
+        return 1;
+      }
+    }
+    else if (band_height > 0)
+      result = renderInBands(file_args[0], out_file_name, options, encoder_options, band_height, band_overlap);
+    else
+    {
+      ImageBuffer buffer;
+    
+      XMLDocument xmlDoc;
+      try
+      {
+        xmlDoc.load(file_args[0]);
+        renderDocument(xmlDoc, buffer, options);
+      }
+      catch(svgpp::exception_base const & e)
+      {
+        std::cerr << "Error reading file " << file_args[0] << ": " << errorDescription(e) << "\n";
+      }
+      catch(std::exception const & e)
+      {
+        std::cerr << "Error reading file " << file_args[0] << ": " << e.what() << "\n";
+        return 1;
+      }
+
+      // Saving output
+      if (!saveImage(buffer, out_file_name, encoder_options))
+      {
+        std::cerr << "Error writing to image file " << out_file_name << "\n";
+        result = 1;
+      }
+    }
+    if (print_statistics)
+      std::cerr << "Shapes drawn: " << statistics.drawn_shapes_ << ", culled: " << statistics.culled_shapes_ 
+        << ", viewports culled: " << statistics.culled_viewports_ << "\n"
+        << "Raster passes: " << statistics.raster_passes_ << ", scanline allocations: " 
+        << statistics.raster_allocations_ << "\n"
+        << "Document peak bytes (images): " << statistics.document_peak_bytes_ << "\n";
+  }
+#if defined(RENDERER_GDIPLUS)
+  Gdiplus::GdiplusShutdown(gdiplusToken);
+#endif
+
+  return result;
+}
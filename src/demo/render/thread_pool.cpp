@@ -0,0 +1,143 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+
+struct ThreadPool::ParallelForState
+{
+  ParallelForState(int count, int grain, range_func_t const & func)
+    : func_(func)
+    , count_(count)
+    , grain_(std::max(1, grain))
+    , next_(0)
+    , running_(0)
+  {}
+
+  // Claims and processes next part of the range, returns false if all parts are already claimed
+  bool runPart()
+  {
+    int begin;
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      if (next_ >= count_)
+        return false;
+      begin = next_;
+      next_ += grain_;
+      ++running_;
+    }
+    std::string error;
+    try
+    {
+      func_(begin, std::min(count_, begin + grain_));
+    }
+    catch (std::exception const & e)
+    {
+      error = e.what();
+    }
+    catch (...)
+    {
+      error = "Unknown error in parallel task";
+    }
+    boost::mutex::scoped_lock lock(mutex_);
+    if (!error.empty() && error_.empty())
+      error_ = error;
+    if (--running_ == 0 && next_ >= count_)
+      finished_.notify_all();
+    return true;
+  }
+
+  void wait()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    // Parts that are still running are processed by other threads right now, so waiting can't deadlock
+    while (running_ > 0)
+      finished_.wait(lock);
+    if (!error_.empty())
+      throw std::runtime_error(error_);
+  }
+
+  range_func_t const func_;
+  int const count_, grain_;
+  int next_, running_;
+  std::string error_;
+  boost::mutex mutex_;
+  boost::condition_variable finished_;
+};
+
+ThreadPool::ThreadPool(unsigned threads)
+  : stopping_(false)
+{
+  for(unsigned i = 1; i < threads; ++i)
+    threads_.push_back(boost::make_shared<boost::thread>(boost::bind(&ThreadPool::workerLoop, this)));
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    stopping_ = true;
+  }
+  condition_.notify_all();
+  for(size_t i = 0; i < threads_.size(); ++i)
+    threads_[i]->join();
+}
+
+void ThreadPool::post(task_t const & task)
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    tasks_.push_back(task);
+  }
+  condition_.notify_one();
+}
+
+bool ThreadPool::runPendingTask()
+{
+  task_t task;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (tasks_.empty())
+      return false;
+    task.swap(tasks_.front());
+    tasks_.pop_front();
+  }
+  task();
+  return true;
+}
+
+void ThreadPool::workerLoop()
+{
+  for(;;)
+  {
+    task_t task;
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      while (tasks_.empty() && !stopping_)
+        condition_.wait(lock);
+      if (tasks_.empty())
+        return;
+      task.swap(tasks_.front());
+      tasks_.pop_front();
+    }
+    task();
+  }
+}
+
+void ThreadPool::helpParallelFor(boost::shared_ptr<ParallelForState> const & state)
+{
+  while (state->runPart())
+  {}
+}
+
+void ThreadPool::parallelFor(int count, int grain, range_func_t const & func)
+{
+  boost::shared_ptr<ParallelForState> state = boost::make_shared<ParallelForState>(count, grain, func);
+  int const parts = (count + state->grain_ - 1) / state->grain_;
+  // Helpers that start after all parts are claimed return immediately
+  for(int i = 1; i < std::min<int>(parts, size()); ++i)
+    post(boost::bind(&ThreadPool::helpParallelFor, state));
+  helpParallelFor(state);
+  state->wait();
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+// Fixed set of worker threads. Threads that wait for the posted work help to execute
+// pending tasks, so the pool may be safely used from inside of its own tasks
+class ThreadPool: boost::noncopyable
+{
+public:
+  typedef boost::function<void()> task_t;
+  typedef boost::function<void(int, int)> range_func_t;
+
+  // Creates 'threads' - 1 workers, calling thread is expected to do the rest of work
+  explicit ThreadPool(unsigned threads = boost::thread::hardware_concurrency());
+  ~ThreadPool();
+
+  // Number of threads that process tasks including the calling one
+  unsigned size() const { return threads_.size() + 1; }
+
+  void post(task_t const & task);
+  // Runs one of pending tasks in calling thread, returns false if there are none
+  bool runPendingTask();
+
+  // Calls func(begin, end) for consecutive parts of [0, count) no longer than 'grain' and returns
+  // when all of them are processed. Exception thrown by func is rethrown as std::runtime_error
+  void parallelFor(int count, int grain, range_func_t const & func);
+
+private:
+  struct ParallelForState;
+
+  std::vector<boost::shared_ptr<boost::thread> > threads_;
+  boost::mutex mutex_;
+  boost::condition_variable condition_;
+  std::deque<task_t> tasks_;
+  bool stopping_;
+
+  void workerLoop();
+  static void helpParallelFor(boost::shared_ptr<ParallelForState> const & state);
+};
+
+// Runs func(begin, end) on 'pool' or in calling thread if 'pool' is NULL
+inline void ParallelFor(ThreadPool * pool, int count, int grain, ThreadPool::range_func_t const & func)
+{
+  if (pool && count > grain)
+    pool->parallelFor(count, grain, func);
+  else if (count > 0)
+    func(0, count);
+}
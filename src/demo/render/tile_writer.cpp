@@ -0,0 +1,101 @@
+#include "tile_writer.hpp"
+
+#include <cerrno>
+#include <sstream>
+#include <stdexcept>
+
+#if defined(_WIN32)
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+namespace
+{
+  void makeDirectory(std::string const & path)
+  {
+#if defined(_WIN32)
+    int const result = _mkdir(path.c_str());
+#else
+    int const result = mkdir(path.c_str(), 0777);
+#endif
+    if (result != 0 && errno != EEXIST)
+      throw std::runtime_error("Can't create directory " + path);
+  }
+
+  std::string toString(int value)
+  {
+    std::ostringstream str;
+    str << value;
+    return str.str();
+  }
+
+  void putLittleEndian(std::string & out, boost::uint64_t value, int bytes)
+  {
+    for(int i = 0; i < bytes; ++i, value >>= 8)
+      out.push_back(char(value & 0xff));
+  }
+}
+
+TileDirectoryWriter::TileDirectoryWriter(std::string const & directory, std::string const & extension)
+  : directory_(directory)
+  , extension_(extension)
+{
+  makeDirectory(directory_);
+}
+
+void TileDirectoryWriter::write(int zoom, int x, int y, std::string const & data)
+{
+  std::string const column_directory = directory_ + "/" + toString(zoom) + "/" + toString(x);
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    makeDirectory(directory_ + "/" + toString(zoom));
+    makeDirectory(column_directory);
+  }
+  std::string const file_name = column_directory + "/" + toString(y) + extension_;
+  std::ofstream out(file_name.c_str(), std::ios::binary);
+  out.write(data.data(), data.size());
+  if (!out)
+    throw std::runtime_error("Error writing tile " + file_name);
+}
+
+TilePackWriter::TilePackWriter(std::string const & file_name)
+  : out_(file_name.c_str(), std::ios::binary)
+  , offset_(8)
+{
+  out_.write("SVGPPTIL", 8);
+  if (!out_)
+    throw std::runtime_error("Can't create " + file_name);
+}
+
+void TilePackWriter::write(int zoom, int x, int y, std::string const & data)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  Entry const entry = { zoom, x, y, boost::uint32_t(data.size()), offset_ };
+  out_.write(data.data(), data.size());
+  if (!out_)
+    throw std::runtime_error("Error writing tile");
+  index_.push_back(entry);
+  offset_ += data.size();
+}
+
+void TilePackWriter::finish()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  std::string index;
+  for(std::vector<Entry>::const_iterator entry = index_.begin(); entry != index_.end(); ++entry)
+  {
+    putLittleEndian(index, entry->zoom_, 4);
+    putLittleEndian(index, entry->x_, 4);
+    putLittleEndian(index, entry->y_, 4);
+    putLittleEndian(index, entry->size_, 4);
+    putLittleEndian(index, entry->offset_, 8);
+  }
+  putLittleEndian(index, offset_, 8);
+  putLittleEndian(index, index_.size(), 4);
+  index += "SVGPPIDX";
+  out_.write(index.data(), index.size());
+  out_.flush();
+  if (!out_)
+    throw std::runtime_error("Error writing tile index");
+}
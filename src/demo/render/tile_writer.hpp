@@ -0,0 +1,58 @@
+#pragma once
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+// Destination of encoded pyramid tiles, 'write' may be called from several threads at once
+class TileWriter: boost::noncopyable
+{
+public:
+  virtual ~TileWriter() {}
+
+  virtual void write(int zoom, int x, int y, std::string const & data) = 0;
+  // Called once after all tiles are written
+  virtual void finish() {}
+};
+
+// Writes tiles as <directory>/<zoom>/<x>/<y><extension>, Y axis goes down as in XYZ tile scheme
+class TileDirectoryWriter: public TileWriter
+{
+public:
+  TileDirectoryWriter(std::string const & directory, std::string const & extension);
+
+  virtual void write(int zoom, int x, int y, std::string const & data);
+
+private:
+  std::string const directory_, extension_;
+  boost::mutex mutex_; // Guards directory creation
+};
+
+// Writes all tiles to a single file: "SVGPPTIL" signature, tile data in order of completion,
+// index entries of little endian uint32 zoom, x, y, size and uint64 offset, then uint64 offset
+// of the index, uint32 number of entries and "SVGPPIDX" signature. tiles_to_mbtiles.py
+// converts it to MBTiles
+class TilePackWriter: public TileWriter
+{
+public:
+  explicit TilePackWriter(std::string const & file_name);
+
+  virtual void write(int zoom, int x, int y, std::string const & data);
+  virtual void finish();
+
+private:
+  struct Entry
+  {
+    int zoom_, x_, y_;
+    boost::uint32_t size_;
+    boost::uint64_t offset_;
+  };
+
+  std::ofstream out_;
+  boost::uint64_t offset_;
+  std::vector<Entry> index_;
+  boost::mutex mutex_;
+};
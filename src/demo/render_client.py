@@ -0,0 +1,101 @@
+import argparse
+import os
+import socket
+import subprocess
+import sys
+
+parser = argparse.ArgumentParser(description='Render SVG files with svgpp_render server and save results.')
+parser.add_argument('--socket', dest='socket',
+                   help='Unix domain socket of running "svgpp_render --serve-socket=<path>" server')
+parser.add_argument('--executable', dest='executable',
+                   help='path to demo app executable, started with --serve-stdio if --socket is not set')
+parser.add_argument('--width', dest='width', type=int, default=0,
+                   help='output width, document size is used if zero')
+parser.add_argument('--height', dest='height', type=int, default=0,
+                   help='output height, document size is used if zero')
+parser.add_argument('--format', dest='format', default='png',
+                   help='png, rgba, pam or ppm')
+parser.add_argument('--output-dir', dest='output_dir', default='.',
+                   help='directory for rendered images')
+parser.add_argument('--stats', dest='stats', action='store_true',
+                   help='print server statistics after rendering')
+parser.add_argument('files', nargs='*', help='SVG files')
+
+class RenderClient:
+  def __init__(self, reader, writer):
+    self.reader = reader
+    self.writer = writer
+
+  def send_render(self, svg, width, height, format):
+    self.writer.write(b'RENDER %d %d %s %d\n' % (width, height, format.encode(), len(svg)) + svg)
+    self.writer.flush()
+
+  def send_stats(self):
+    self.writer.write(b'STATS\n')
+    self.writer.flush()
+
+  # Returns (True, format, body) or (False, error code, message)
+  def receive(self):
+    header = self.reader.readline().decode().split()
+    if len(header) != 3:
+      raise RuntimeError('connection closed')
+    body = self.reader.read(int(header[2]))
+    if header[0] == 'OK':
+      return True, header[1], body
+    return False, int(header[1]), body.decode()
+
+  def quit(self):
+    self.writer.write(b'QUIT\n')
+    self.writer.flush()
+
+args = parser.parse_args()
+if args.socket:
+  sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+  sock.connect(args.socket)
+  stream = sock.makefile('rwb')
+  client = RenderClient(stream, stream)
+  pipelined = False
+elif args.executable:
+  process = subprocess.Popen([args.executable, '--serve-stdio'], stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+  client = RenderClient(process.stdout, process.stdin)
+  pipelined = True
+else:
+  parser.error('either --socket or --executable must be set')
+
+def save_response(svg_file, response):
+  ok, format, body = response
+  if not ok:
+    print('%s: error %d %s' % (svg_file, format, body))
+    return False
+  out_file = os.path.join(args.output_dir,
+    os.path.splitext(os.path.basename(svg_file))[0] + '.' + format.split(':')[0])
+  with open(out_file, 'wb') as f:
+    f.write(body)
+  print('%s: %s %d bytes' % (out_file, format, len(body)))
+  return True
+
+failed = 0
+if pipelined:
+  # Stream mode answers in order of requests, so all of them are sent ahead
+  for svg_file in args.files:
+    with open(svg_file, 'rb') as f:
+      client.send_render(f.read(), args.width, args.height, args.format)
+  if args.stats:
+    client.send_stats()
+  client.quit()
+  for svg_file in args.files:
+    if not save_response(svg_file, client.receive()):
+      failed += 1
+else:
+  for svg_file in args.files:
+    with open(svg_file, 'rb') as f:
+      client.send_render(f.read(), args.width, args.height, args.format)
+    if not save_response(svg_file, client.receive()):
+      failed += 1
+  if args.stats:
+    client.send_stats()
+if args.stats:
+  sys.stdout.write(client.receive()[2].decode())
+if not pipelined:
+  client.quit()
+sys.exit(1 if failed else 0)
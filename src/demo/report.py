@@ -1,6 +1,8 @@
 import argparse
+import csv
 import errno
 import glob
+import multiprocessing
 import subprocess
 import os
 from string import Template
@@ -12,6 +14,8 @@ parser.add_argument('--executable', dest='executable', required=True,
                    help='path to demo app executable')
 parser.add_argument('--report_dir', dest='report_dir', default='report',
                    help='path to report output folder')
+parser.add_argument('--threads', dest='threads', type=int, default=0,
+                   help='number of threads for batch rendering, all cores by default')
 
 args = parser.parse_args()
 
@@ -28,12 +32,24 @@ except OSError as e:
   else:
       raise
   
+# All files are rendered by single batch process, that writes per-file summary
+manifest_name = os.path.join(args.report_dir, 'manifest.txt')
+summary_name = os.path.join(args.report_dir, 'summary.csv')
+with open(manifest_name, 'w') as manifest:
+  for glob_arg in args.files:
+    for file in glob.iglob(glob_arg):
+      manifest.write(file + '\t' + os.path.join(args.report_dir, os.path.basename(file) + '.png') + '\n')
+
+threads = args.threads if args.threads > 0 else multiprocessing.cpu_count()
+subprocess.call([args.executable, '--manifest=' + manifest_name, '--summary=' + summary_name, 
+  '--threads=%d' % threads])
+
 report_records = ''
-for glob_arg in args.files:
-  for file in glob.iglob(glob_arg):
-    out_image_name = os.path.join(args.report_dir, os.path.basename(file) + '.png')
-    if subprocess.call([args.executable, file, out_image_name]) == 0:
-      report_records += record_template.substitute(header=file, raster_file=out_image_name, svg_file=file)
+with open(summary_name, 'r') as summary_file:
+  for row in csv.DictReader(summary_file):
+    if row['status'] in ('ok', 'render_error'):
+      header = '%s (%.1f ms, %s KB peak)' % (row['file'], float(row['render_ms']), row['document_peak_kb'])
+      report_records += record_template.substitute(header=header, raster_file=row['output'], svg_file=row['file'])
 
 with open(os.path.join(template_dir, "report.tmpl"), "r") as tmpl_file:
   with open("report.html", "w") as report_file:
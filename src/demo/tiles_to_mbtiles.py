@@ -0,0 +1,37 @@
+import argparse
+import sqlite3
+import struct
+
+parser = argparse.ArgumentParser(description='Convert tile pack written by "svgpp_render --pyramid-pack=<file>" to MBTiles.')
+parser.add_argument('--name', dest='name', default='svgpp', help='tileset name in metadata')
+parser.add_argument('--format', dest='format', default='png', help='tile format in metadata')
+parser.add_argument('pack', help='tile pack file')
+parser.add_argument('mbtiles', help='output MBTiles file')
+args = parser.parse_args()
+
+with open(args.pack, 'rb') as f:
+  data = f.read()
+if data[:8] != b'SVGPPTIL' or data[-8:] != b'SVGPPIDX':
+  raise SystemExit('%s is not a tile pack' % args.pack)
+index_offset, count = struct.unpack('<QI', data[-20:-8])
+
+db = sqlite3.connect(args.mbtiles)
+db.execute('CREATE TABLE IF NOT EXISTS metadata (name text, value text)')
+db.execute('CREATE TABLE IF NOT EXISTS tiles (zoom_level integer, tile_column integer, tile_row integer, tile_data blob)')
+db.execute('CREATE UNIQUE INDEX IF NOT EXISTS tile_index ON tiles (zoom_level, tile_column, tile_row)')
+zooms = set()
+for i in range(count):
+  zoom, x, y, size, offset = struct.unpack_from('<IIIIQ', data, index_offset + i * 24)
+  zooms.add(zoom)
+  # MBTiles rows are counted from the bottom as in TMS scheme
+  db.execute('INSERT OR REPLACE INTO tiles VALUES (?, ?, ?, ?)',
+    (zoom, x, (1 << zoom) - 1 - y, sqlite3.Binary(data[offset:offset + size])))
+metadata = {'name': args.name, 'format': args.format, 'type': 'baselayer'}
+if zooms:
+  metadata['minzoom'] = str(min(zooms))
+  metadata['maxzoom'] = str(max(zooms))
+db.execute('DELETE FROM metadata')
+db.executemany('INSERT INTO metadata VALUES (?, ?)', metadata.items())
+db.commit()
+db.close()
+print('%d tiles written to %s' % (count, args.mbtiles))
@@ -0,0 +1,162 @@
+#include <svgpp/utility/gil/blend.hpp>
+#include <svgpp/utility/gil/composite.hpp>
+
+#include <gtest/gtest.h>
+#include <boost/gil/image.hpp>
+#include <boost/gil/typedefs.hpp>
+#include <algorithm>
+#include <cstdlib>
+
+namespace gil = boost::gil;
+
+namespace
+{
+  // Odd width, so that SIMD and scalar parts of rows are both used
+  int const width = 37, height = 5;
+
+  // Random premultiplied pixels, including fully transparent and opaque ones
+  template<class Image>
+  void fill_random(Image & image, unsigned seed)
+  {
+    std::srand(seed);
+    typename Image::view_t v = gil::view(image);
+    for(typename Image::view_t::iterator it = v.begin(); it != v.end(); ++it)
+    {
+      int const alpha = std::rand() % 4 == 0 ? (std::rand() % 2) * 255 : std::rand() % 256;
+      gil::get_color(*it, gil::alpha_t()) = alpha;
+      gil::get_color(*it, gil::red_t()) = std::rand() % (alpha + 1);
+      gil::get_color(*it, gil::green_t()) = std::rand() % (alpha + 1);
+      gil::get_color(*it, gil::blue_t()) = std::rand() % (alpha + 1);
+    }
+  }
+
+  template<class View>
+  int max_difference(View const & a, View const & b)
+  {
+    int result = 0;
+    for(int y = 0; y < a.height(); ++y)
+      for(int x = 0; x < a.width(); ++x)
+        for(int c = 0; c < 4; ++c)
+          result = std::max(result, std::abs(int(a(x, y)[c]) - int(b(x, y)[c])));
+    return result;
+  }
+
+  // Whole row kernels round products, while the per-pixel functors truncate them,
+  // so the results differ by at most one per product term
+  template<class Image, class PixelFunction>
+  void check_against_reference(PixelFunction const & fn, int tolerance)
+  {
+    Image a(width, height), b(width, height), reference(width, height), result(width, height);
+    fill_random(a, 1);
+    fill_random(b, 2);
+    gil::transform_pixels(gil::const_view(a), gil::const_view(b), gil::view(reference), fn);
+    svgpp::gil_utility::transform_pixels(gil::const_view(a), gil::const_view(b), gil::view(result), fn);
+    EXPECT_LE(max_difference(gil::const_view(reference), gil::const_view(result)), tolerance);
+
+    // Pixel by pixel goes through scalar code, that must match SIMD exactly
+    Image scalar(width, height);
+    typedef typename Image::view_t::value_type pixel_t;
+    for(int y = 0; y < height; ++y)
+      for(int x = 0; x < width; ++x)
+      {
+        pixel_t const pa = gil::const_view(a)(x, y), pb = gil::const_view(b)(x, y);
+        pixel_t p;
+        svgpp::gil_utility::transform_pixels(
+          gil::interleaved_view(1, 1, &pa, sizeof(pixel_t)),
+          gil::interleaved_view(1, 1, &pb, sizeof(pixel_t)),
+          gil::interleaved_view(1, 1, &p, sizeof(pixel_t)), fn);
+        gil::view(scalar)(x, y) = p;
+      }
+    EXPECT_EQ(0, max_difference(gil::const_view(scalar), gil::const_view(result)));
+  }
+
+  template<class PixelFunction>
+  void check_layouts(PixelFunction const & fn, int tolerance)
+  {
+    check_against_reference<gil::rgba8_image_t>(fn, tolerance);
+    check_against_reference<gil::bgra8_image_t>(fn, tolerance);
+    check_against_reference<gil::argb8_image_t>(fn, tolerance);
+  }
+
+  // Fused filter primitives process short runs of pixels in place of the first input, result must be
+  // the same as of whole rows written to a separate image by unfused primitives
+  template<class PixelFunction>
+  void check_runs_in_place(PixelFunction const & fn)
+  {
+    gil::rgba8_image_t a(width, height), b(width, height), rows(width, height);
+    fill_random(a, 3);
+    fill_random(b, 4);
+    svgpp::gil_utility::transform_pixels(gil::const_view(a), gil::const_view(b), gil::view(rows), fn);
+
+    gil::rgba8_image_t runs(a);
+    int const run_lengths[] = { 1, 5, 3, 8, 2, 16 };
+    for(int y = 0; y < height; ++y)
+      for(int x = 0, i = 0; x < width; ++i)
+      {
+        int const count = std::min(run_lengths[i % 6], width - x);
+        gil::rgba8_pixel_t * run = &gil::view(runs)(x, y);
+        gil::rgba8_pixel_t const * in2 = &gil::const_view(b)(x, y);
+        svgpp::gil_utility::transform_pixels(
+          gil::interleaved_view(count, 1, run, count * sizeof(gil::rgba8_pixel_t)),
+          gil::interleaved_view(count, 1, in2, count * sizeof(gil::rgba8_pixel_t)),
+          gil::interleaved_view(count, 1, run, count * sizeof(gil::rgba8_pixel_t)), fn);
+        x += count;
+      }
+    EXPECT_EQ(0, max_difference(gil::const_view(rows), gil::const_view(runs)));
+  }
+}
+
+TEST(GilBlend, matches_reference)
+{
+  check_layouts(svgpp::gil_utility::blend_pixel<svgpp::tag::value::normal>(), 1);
+  check_layouts(svgpp::gil_utility::blend_pixel<svgpp::tag::value::multiply>(), 2);
+  check_layouts(svgpp::gil_utility::blend_pixel<svgpp::tag::value::screen>(), 1);
+  check_layouts(svgpp::gil_utility::blend_pixel<svgpp::tag::value::darken>(), 1);
+  check_layouts(svgpp::gil_utility::blend_pixel<svgpp::tag::value::lighten>(), 1);
+}
+
+TEST(GilComposite, matches_reference)
+{
+  check_layouts(svgpp::gil_utility::composite_pixel<svgpp::tag::value::over>(), 1);
+  check_layouts(svgpp::gil_utility::composite_pixel<svgpp::tag::value::in>(), 1);
+  check_layouts(svgpp::gil_utility::composite_pixel<svgpp::tag::value::out>(), 1);
+  check_layouts(svgpp::gil_utility::composite_pixel<svgpp::tag::value::atop>(), 1);
+  check_layouts(svgpp::gil_utility::composite_pixel<svgpp::tag::value::xor_>(), 2);
+}
+
+TEST(GilComposite, arithmetic_matches_reference)
+{
+  // Reference truncates each of three terms
+  check_layouts(svgpp::gil_utility::composite_pixel_arithmetic<gil::rgba8_pixel_t>(0.2, 0.6, -0.4, 0.2), 3);
+  check_layouts(svgpp::gil_utility::composite_pixel_arithmetic<gil::rgba8_pixel_t>(1., 0., 0., 0.), 3);
+  check_layouts(svgpp::gil_utility::composite_pixel_arithmetic<gil::rgba8_pixel_t>(0., 1., 1., -1.), 3);
+}
+
+TEST(GilBlend, runs_in_place_match_whole_rows)
+{
+  check_runs_in_place(svgpp::gil_utility::blend_pixel<svgpp::tag::value::normal>());
+  check_runs_in_place(svgpp::gil_utility::blend_pixel<svgpp::tag::value::multiply>());
+  check_runs_in_place(svgpp::gil_utility::blend_pixel<svgpp::tag::value::screen>());
+  check_runs_in_place(svgpp::gil_utility::blend_pixel<svgpp::tag::value::darken>());
+  check_runs_in_place(svgpp::gil_utility::blend_pixel<svgpp::tag::value::lighten>());
+}
+
+TEST(GilComposite, runs_in_place_match_whole_rows)
+{
+  check_runs_in_place(svgpp::gil_utility::composite_pixel<svgpp::tag::value::over>());
+  check_runs_in_place(svgpp::gil_utility::composite_pixel<svgpp::tag::value::in>());
+  check_runs_in_place(svgpp::gil_utility::composite_pixel<svgpp::tag::value::out>());
+  check_runs_in_place(svgpp::gil_utility::composite_pixel<svgpp::tag::value::atop>());
+  check_runs_in_place(svgpp::gil_utility::composite_pixel<svgpp::tag::value::xor_>());
+  check_runs_in_place(svgpp::gil_utility::composite_pixel_arithmetic<gil::rgba8_pixel_t>(0.2, 0.6, -0.4, 0.2));
+}
+
+TEST(GilComposite, exact_values)
+{
+  gil::rgba8_pixel_t const a(128, 0, 0, 128), b(0, 0, 255, 255);
+  gil::rgba8_pixel_t r;
+  svgpp::gil_utility::transform_pixels(
+    gil::interleaved_view(1, 1, &a, 4), gil::interleaved_view(1, 1, &b, 4), gil::interleaved_view(1, 1, &r, 4),
+    svgpp::gil_utility::composite_pixel<svgpp::tag::value::over>());
+  EXPECT_EQ(gil::rgba8_pixel_t(128, 0, 127, 255), r);
+}
@@ -0,0 +1,137 @@
+#include <svgpp/utility/gil/color_matrix.hpp>
+
+#include <gtest/gtest.h>
+#include <boost/gil/image.hpp>
+#include <boost/gil/typedefs.hpp>
+#include <cmath>
+#include <cstdlib>
+
+namespace gil = boost::gil;
+
+namespace
+{
+  int const width = 37, height = 5;
+
+  template<class Image>
+  void fill_random(Image & image)
+  {
+    std::srand(3);
+    typename Image::view_t v = gil::view(image);
+    for(typename Image::view_t::iterator it = v.begin(); it != v.end(); ++it)
+      for(int c = 0; c < 4; ++c)
+        (*it)[c] = std::rand() % 256;
+  }
+
+  typedef boost::multi_array<double, 2> matrix_t;
+
+  // Straightforward evaluation of the matrix on 0..1 values
+  gil::rgba8_pixel_t reference_transform(matrix_t const & m, gil::rgba8_pixel_t const & p)
+  {
+    double const in[5] = { p[0] / 255., p[1] / 255., p[2] / 255., p[3] / 255., 1. };
+    gil::rgba8_pixel_t result;
+    for(int i = 0; i < 4; ++i)
+    {
+      double v = 0;
+      for(int j = 0; j < 5; ++j)
+        v += m[i][j] * in[j];
+      result[i] = static_cast<gil::bits8>(std::floor(std::min(1., std::max(0., v)) * 255 + 0.5));
+    }
+    return result;
+  }
+
+  template<class Image, class Transform>
+  void check_layout(matrix_t const & m, Transform const & fn, int tolerance)
+  {
+    Image src(width, height), result(width, height), scalar(width, height);
+    fill_random(src);
+    svgpp::gil_utility::transform_pixels(gil::const_view(src), gil::view(result), fn);
+    // Per pixel functor must give exactly the same result as whole row code
+    gil::transform_pixels(gil::const_view(src), gil::view(scalar), fn);
+    for(int y = 0; y < height; ++y)
+      for(int x = 0; x < width; ++x)
+      {
+        gil::rgba8_pixel_t s, r, expected;
+        gil::color_convert(gil::const_view(src)(x, y), s);
+        gil::color_convert(gil::const_view(result)(x, y), r);
+        expected = reference_transform(m, s);
+        for(int c = 0; c < 4; ++c)
+          EXPECT_LE(std::abs(int(expected[c]) - int(r[c])), tolerance);
+        EXPECT_TRUE(gil::const_view(scalar)(x, y) == gil::const_view(result)(x, y));
+      }
+  }
+
+  template<template<class, class> class Transform>
+  void check_layouts(matrix_t const & reference_matrix, matrix_t const & matrix, int tolerance = 1)
+  {
+    check_layout<gil::rgba8_image_t>(reference_matrix, Transform<gil::rgba8_pixel_t, double>(matrix), tolerance);
+    check_layout<gil::bgra8_image_t>(reference_matrix, Transform<gil::bgra8_pixel_t, double>(matrix), tolerance);
+    check_layout<gil::argb8_image_t>(reference_matrix, Transform<gil::argb8_pixel_t, double>(matrix), tolerance);
+  }
+
+  matrix_t to_4x5(matrix_t const & m3x3)
+  {
+    matrix_t m(boost::extents[4][5]);
+    for(int i = 0; i < 3; ++i)
+      for(int j = 0; j < 3; ++j)
+        m[i][j] = m3x3[i][j];
+    m[3][3] = 1;
+    return m;
+  }
+}
+
+TEST(GilColorMatrix, matrix_4x5)
+{
+  double const values[20] = {
+    0.5, 0.3, 0.2, 0, 0.1,
+    -0.4, 1.2, 0, 0.3, 0,
+    0, 0, 0, 0, 0.75,
+    0.3, 0.3, 0.3, 0.5, -0.2 };
+  matrix_t m(boost::extents[4][5]);
+  m.assign(values, values + 20);
+  check_layouts<svgpp::gil_utility::color_matrix_transform>(m, m);
+}
+
+TEST(GilColorMatrix, large_coefficients)
+{
+  // Out of fixed point range, double precision code is used
+  double const values[20] = {
+    100, -100, 0, 0, 0.5,
+    0, 1, 0, 0, 0,
+    0, 0, 1, 0, 0,
+    0, 0, 0, 1, 0 };
+  matrix_t m(boost::extents[4][5]);
+  m.assign(values, values + 20);
+  EXPECT_FALSE(svgpp::gil_utility::color_matrix_transform<gil::rgba8_pixel_t>(m).fixed_point());
+  check_layouts<svgpp::gil_utility::color_matrix_transform>(m, m);
+}
+
+TEST(GilColorMatrix, matrix_3x3)
+{
+  matrix_t const saturate = svgpp::gil_utility::get_saturate_matrix(0.3);
+  check_layouts<svgpp::gil_utility::color_matrix_3x3_transform>(to_4x5(saturate), saturate);
+  check_layouts<svgpp::gil_utility::color_matrix_transform>(to_4x5(saturate), saturate);
+  matrix_t const hue_rotate = svgpp::gil_utility::get_hue_rotate_matrix(2.0);
+  check_layouts<svgpp::gil_utility::color_matrix_3x3_transform>(to_4x5(hue_rotate), hue_rotate);
+}
+
+TEST(GilColorMatrix, luminance_to_alpha)
+{
+  matrix_t m(boost::extents[4][5]);
+  m[3][0] = 0.2125; m[3][1] = 0.7154; m[3][2] = 0.0721;
+  check_layout<gil::rgba8_image_t>(m, svgpp::gil_utility::luminance_to_alpha_transform<gil::rgba8_pixel_t>(), 1);
+  check_layout<gil::bgra8_image_t>(m, svgpp::gil_utility::luminance_to_alpha_transform<gil::bgra8_pixel_t>(), 1);
+  check_layout<gil::argb8_image_t>(m, svgpp::gil_utility::luminance_to_alpha_transform<gil::argb8_pixel_t>(), 1);
+}
+
+TEST(GilColorMatrix, exact_values)
+{
+  matrix_t m(boost::extents[4][5]);
+  m[0][4] = 1; m[1][1] = 0.5; m[2][2] = 2; m[3][3] = 1;
+  gil::rgba8_pixel_t const src(10, 101, 200, 77);
+  gil::rgba8_pixel_t const expected(255, 51, 255, 77);
+  EXPECT_TRUE(expected == svgpp::gil_utility::color_matrix_transform<gil::rgba8_pixel_t>(m)(src));
+  gil::rgba8_pixel_t r;
+  svgpp::gil_utility::transform_pixels(gil::interleaved_view(1, 1, &src, 4), gil::interleaved_view(1, 1, &r, 4),
+    svgpp::gil_utility::color_matrix_transform<gil::rgba8_pixel_t>(m));
+  EXPECT_TRUE(expected == r);
+}
@@ -0,0 +1,86 @@
+#include <svgpp/utility/gil/mask.hpp>
+
+#include <gtest/gtest.h>
+#include <boost/gil/image.hpp>
+#include <boost/gil/image_view_factory.hpp>
+#include <boost/gil/planar_pixel_iterator.hpp>
+#include <boost/gil/planar_pixel_reference.hpp>
+#include <boost/gil/typedefs.hpp>
+#include <cstdlib>
+
+namespace gil = boost::gil;
+
+namespace
+{
+  int const width = 37, height = 5;
+
+  template<class Image>
+  void fill_random(Image & image, unsigned seed)
+  {
+    std::srand(seed);
+    typename Image::view_t v = gil::view(image);
+    for(typename Image::view_t::iterator it = v.begin(); it != v.end(); ++it)
+      for(int c = 0; c < int(gil::num_channels<Image>::value); ++c)
+        (*it)[c] = std::rand() % 4 == 0 ? (std::rand() % 2) * 255 : std::rand() % 256;
+  }
+
+  // Same as the demo did before: mask is pulled through color_converted_view pixel by pixel
+  template<class View, class GrayMask>
+  void reference_blend(View const & view, GrayMask const & mask)
+  {
+    typename GrayMask::iterator m = mask.begin();
+    for(typename View::iterator o = view.begin(); o != view.end(); ++o, ++m)
+      gil::get_color(*o, gil::alpha_t()) = 
+        gil::channel_multiply(gil::get_color(*o, gil::alpha_t()), gil::get_color(*m, gil::gray_color_t()));
+  }
+
+  template<class Image, class MaskImage>
+  void check_luminance_mask()
+  {
+    Image reference(width, height), result(width, height);
+    MaskImage mask(width, height);
+    fill_random(reference, 1);
+    fill_random(mask, 2);
+    gil::copy_pixels(gil::const_view(reference), gil::view(result));
+    reference_blend(gil::view(reference), gil::color_converted_view<gil::gray8_pixel_t>(
+      gil::const_view(mask), svgpp::gil_utility::rgba_to_mask_color_converter<>()));
+    svgpp::gil_utility::apply_luminance_mask(gil::view(result), gil::const_view(mask));
+    EXPECT_TRUE(gil::equal_pixels(gil::const_view(reference), gil::const_view(result)));
+  }
+
+  template<class Image>
+  void check_alpha_mask()
+  {
+    Image reference(width, height), result(width, height), result_rgba(width, height);
+    gil::gray8_image_t mask(width, height);
+    fill_random(reference, 3);
+    fill_random(mask, 4);
+    gil::copy_pixels(gil::const_view(reference), gil::view(result));
+    gil::copy_pixels(gil::const_view(reference), gil::view(result_rgba));
+    reference_blend(gil::view(reference), gil::const_view(mask));
+    svgpp::gil_utility::apply_alpha_mask(gil::view(result), gil::const_view(mask));
+    EXPECT_TRUE(gil::equal_pixels(gil::const_view(reference), gil::const_view(result)));
+
+    // Alpha of RGBA mask gives the same result
+    gil::rgba8_image_t rgba_mask(width, height);
+    fill_random(rgba_mask, 5);
+    gil::copy_pixels(gil::const_view(mask), gil::nth_channel_view(gil::view(rgba_mask), 3));
+    svgpp::gil_utility::apply_alpha_mask(gil::view(result_rgba), gil::const_view(rgba_mask));
+    EXPECT_TRUE(gil::equal_pixels(gil::const_view(reference), gil::const_view(result_rgba)));
+  }
+}
+
+TEST(GilMask, luminance_mask_matches_converter)
+{
+  check_luminance_mask<gil::rgba8_image_t, gil::rgba8_image_t>();
+  check_luminance_mask<gil::bgra8_image_t, gil::rgba8_image_t>();
+  check_luminance_mask<gil::rgba8_image_t, gil::argb8_image_t>();
+  // Generic code
+  check_luminance_mask<gil::rgba8_image_t, gil::rgba8_planar_image_t>();
+}
+
+TEST(GilMask, alpha_mask)
+{
+  check_alpha_mask<gil::rgba8_image_t>();
+  check_alpha_mask<gil::argb8_image_t>();
+}